@@ -0,0 +1,41 @@
+#ifndef tp_math_utils_ConeProximity_h
+#define tp_math_utils_ConeProximity_h
+
+#include "tp_math_utils/Globals.h"
+
+#include <vector>
+
+namespace tp_math_utils
+{
+struct DCone;
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT ConeProximityPair
+{
+  size_t first{0};    //!< Index of the first cone, always less than second.
+  size_t second{0};   //!< Index of the second cone.
+  double distance{0}; //!< The result of distanceBetweenCones(), negative if the cones intersect.
+};
+
+//##################################################################################################
+//! Find all pairs of cones that are within a distance of each other.
+/*!
+Each cone is bounded by a box around a sphere at each end with the larger of the two radii. The
+boxes are expanded by the threshold, sorted along the axis where the cones are most spread out and
+swept to find the pairs that overlap. distanceBetweenCones() is then called for these candidates in
+parallel and those with a distance <= threshold are returned.
+
+\note distanceBetweenCones() measures between the infinite center lines of cones that do not
+intersect, so it can return a small distance for cones that are far apart. Those pairs are never
+candidates, so this can return fewer pairs than testing every pair.
+
+\param cones The cones to test against each other.
+\param threshold The max distance between the surfaces of a pair of cones.
+\return Pairs sorted by first then second.
+*/
+std::vector<ConeProximityPair> TP_MATH_UTILS_EXPORT conesWithinDistance(const std::vector<DCone>& cones,
+                                                                        double threshold);
+
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef tp_math_utils_DerivedDataCache_h
+#define tp_math_utils_DerivedDataCache_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+#include "tp_utils/MutexUtils.h"
+
+#include <list>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! Identifies the result of running an operation on some input.
+struct TP_MATH_UTILS_EXPORT DerivedDataKey
+{
+  uint64_t inputDigest{0}; //!< See digestGeometry3D.
+  std::string operation;   //!< The name and version of the operation, change this if it changes.
+  std::string parameters;  //!< Typically the dumped JSON of the parameters.
+
+  //################################################################################################
+  uint64_t hash() const;
+
+  //################################################################################################
+  //! The hash as a 16 character hex string, used as the file name on disk.
+  std::string toString() const;
+
+  //################################################################################################
+  bool operator==(const DerivedDataKey& other) const
+  {
+    return
+        inputDigest == other.inputDigest &&
+        operation == other.operation &&
+        parameters == other.parameters;
+  }
+};
+
+//##################################################################################################
+//! Caches the output of expensive operations on geometry, such as normals, tangents or UVs.
+/*!
+Results are stored as binary blobs keyed by the digest of the input, the operation and its
+parameters. The most recently used results are kept in memory up to a budget, if a directory is
+given results are also written there so that they survive between sessions. Files are written
+under a temporary name and renamed into place so that readers never see a partly written file.
+
+This is thread safe, the compute functions are called without holding a lock so two threads that
+miss on the same key at the same time will both compute it.
+*/
+class TP_MATH_UTILS_EXPORT DerivedDataCache
+{
+  TP_NONCOPYABLE(DerivedDataCache);
+public:
+  //################################################################################################
+  /*!
+  \param memoryBudget The max number of bytes of results to keep in memory.
+  \param directory An existing directory to store results in, or empty to only cache in memory.
+  */
+  DerivedDataCache(size_t memoryBudget=256*1024*1024, const std::string& directory=std::string());
+
+  //################################################################################################
+  size_t memoryBudget() const;
+
+  //################################################################################################
+  void setMemoryBudget(size_t memoryBudget);
+
+  //################################################################################################
+  size_t memoryUsage() const;
+
+  //################################################################################################
+  const std::string& directory() const;
+
+  //################################################################################################
+  //! Look for a result in memory and then on disk.
+  bool find(const DerivedDataKey& key, std::string& data);
+
+  //################################################################################################
+  //! Add a result to memory and write it to disk.
+  void insert(const DerivedDataKey& key, const std::string& data);
+
+  //################################################################################################
+  //! Drop everything that is held in memory, this does not remove anything from disk.
+  void clearMemory();
+
+  //################################################################################################
+  //! Return the cached result of an operation on geometry or compute and cache it.
+  Geometry3DList geometry(const Geometry3DList& input,
+                          const std::string& operation,
+                          const nlohmann::json& parameters,
+                          const std::function<Geometry3DList(const Geometry3DList&)>& compute);
+
+  //################################################################################################
+  //! Return the cached per vertex result of an operation on a mesh, for example tangents.
+  std::vector<glm::vec3> vectors(const Geometry3D& input,
+                                 const std::string& operation,
+                                 const nlohmann::json& parameters,
+                                 const std::function<std::vector<glm::vec3>(const Geometry3D&)>& compute);
+
+private:
+  //################################################################################################
+  void trim();
+
+  //################################################################################################
+  std::string filePath(const DerivedDataKey& key) const;
+
+  struct Entry_lt
+  {
+    DerivedDataKey key;
+    std::string data;
+  };
+
+  size_t m_memoryBudget;
+  std::string m_directory;
+
+  mutable TPMutex m_mutex{TPM};
+  size_t m_memoryUsage{0};
+  std::list<Entry_lt> m_entries; //!< Most recently used first.
+  std::unordered_map<uint64_t, std::list<Entry_lt>::iterator> m_lookup;
+};
+
+//##################################################################################################
+//! Write geometry to a compact binary format, including comments, materials and parts.
+void TP_MATH_UTILS_EXPORT serializeGeometry3DList(const Geometry3DList& geometry, std::string& data);
+
+//##################################################################################################
+//! Read geometry written by serializeGeometry3DList, returns false if the data is not valid.
+bool TP_MATH_UTILS_EXPORT deserializeGeometry3DList(const std::string& data, Geometry3DList& geometry);
+
+}
+
+#endif
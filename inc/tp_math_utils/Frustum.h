@@ -1,6 +1,8 @@
 #ifndef tp_math_utils_Frustum_h
 #define tp_math_utils_Frustum_h
 
+#include "tp_math_utils/Globals.h"
+
 #include "glm/matrix.hpp"
 
 namespace tp_math_utils
@@ -9,7 +11,7 @@ namespace tp_math_utils
 //##################################################################################################
 // Taken from:
 // https://gist.github.com/podgorskiy/e698d18879588ada9014768e3e82a644
-class Frustum
+class TP_MATH_UTILS_EXPORT Frustum
 {
 public:
   //################################################################################################
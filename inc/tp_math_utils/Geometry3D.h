@@ -4,6 +4,7 @@
 #include "tp_math_utils/Material.h"
 
 #include <unordered_map>
+#include <memory_resource>
 
 namespace tp_math_utils
 {
@@ -59,6 +60,57 @@ struct TP_MATH_UTILS_EXPORT Vertex3D
 
 typedef std::vector<int> Vertex3DIndexList;
 
+//##################################################################################################
+//! Bounds checked access if Checked is true, used to select between safe and validated kernels.
+template<bool Checked, typename Container>
+auto& checkedAt(Container& container, size_t i)
+{
+  if constexpr(Checked)
+    return container.at(i);
+  else
+    return container[i];
+}
+
+//##################################################################################################
+//! Loop for each triangle in a part passing the vertex indexes.
+/*!
+This is shared by the different index layouts. If FlipStrips is true odd strip triangles are
+flipped so that they all have the same winding. The indexes are not range checked.
+*/
+template<bool FlipStrips, typename Closure>
+void forEachPartTriangle(int type,
+                         const int* ii,
+                         size_t count,
+                         int triangleFan,
+                         int triangleStrip,
+                         int triangles,
+                         Closure&& closure)
+{
+  if(count<3)
+    return;
+
+  if(type == triangleFan)
+  {
+    for(size_t v=1; v+1<count; v++)
+      closure(ii[0], ii[v], ii[v+1]);
+  }
+  else if(type == triangleStrip)
+  {
+    for(size_t v=0; v+2<count; v++)
+    {
+      if(FlipStrips && (v&1))
+        closure(ii[v], ii[v+2], ii[v+1]);
+      else
+        closure(ii[v], ii[v+1], ii[v+2]);
+    }
+  }
+  else if(type == triangles)
+  {
+    for(size_t v=0; v+2<count; v+=3)
+      closure(ii[v], ii[v+1], ii[v+2]);
+  }
+}
+
 //##################################################################################################
 struct TP_MATH_UTILS_EXPORT Indexes3D
 {
@@ -79,6 +131,19 @@ typedef std::vector<Vertex3D> Vertex3DList;
 typedef std::vector<Indexes3D> Indexes3DList;
 
 //##################################################################################################
+//! The unit tangent of a triangle from its texture coordinates, false if it can't be calculated.
+bool TP_MATH_UTILS_EXPORT triangleTangent(const Vertex3D& v1, const Vertex3D& v2, const Vertex3D& v3, glm::vec3& tangent);
+
+//##################################################################################################
+//! Normalize tangents summed from triangleTangent(), replacing those parallel to the vert normal.
+void TP_MATH_UTILS_EXPORT normalizeTangents(const Vertex3DList& verts, std::vector<glm::vec3>& tangent);
+
+//##################################################################################################
+//! Triangle meshes made of verts and parts that index them.
+/*!
+Functions that take a scratch memory resource allocate their temporary buffers from it if it is not
+null, pass ScratchArena::resource() to reuse memory across a batch of meshes.
+*/
 struct TP_MATH_UTILS_EXPORT Geometry3D
 {
   std::vector<std::string> comments;
@@ -91,6 +156,28 @@ struct TP_MATH_UTILS_EXPORT Geometry3D
 
   Material material;
 
+  //################################################################################################
+  //! Check indexes, positions and parts, algorithms skip bounds checking while this holds.
+  /*!
+  Geometry is valid if all indexes are in range, all positions are finite, all parts have a known
+  type and the number of indexes in each part is consistent with its type.
+  */
+  bool validate();
+
+  //################################################################################################
+  //! True if validate() passed and the parts and indexes are still valid.
+  /*!
+  Operations on Geometry3D keep this up to date. The parts and index values are checked again on
+  each call so that direct edits to them can never lead to out of range reads, this is one linear
+  pass over the indexes. Positions are only checked by validate(), adding verts is detected but
+  direct edits that make positions non-finite must be followed by invalidate() or validate().
+  */
+  bool validated() const;
+
+  //################################################################################################
+  //! Drop the validated state, call this after modifying verts or indexes directly.
+  void invalidate();
+
   //################################################################################################
   void add(const Geometry3D& other);
 
@@ -116,80 +203,65 @@ struct TP_MATH_UTILS_EXPORT Geometry3D
 
   //################################################################################################
   //! Convert strips and fans into triangles.
-  void convertToTriangles();
+  void convertToTriangles(std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
   //! Loop for each triangle
   template<typename Closure>
   void forEachTriangle(Closure&& closure) const
   {
-    for(const auto& indexes : indexes)
-    {
-      auto calcVMax = [&](size_t sub)
-      {
-        return (sub>indexes.indexes.size())?0:indexes.indexes.size()-sub;
-      };
+    if(validated())
+      forEachTriangleImpl<false>(closure);
+    else
+      forEachTriangleImpl<true>(closure);
+  }
 
-      if(indexes.type == triangleFan)
-      {
-        const auto& firstIndex = indexes.indexes.front();
-
-        size_t vMax = calcVMax(1);
-        for(size_t v=1; v<vMax; v++)
-        {
-          const glm::vec3& v0 = verts.at(firstIndex).vert;
-          const glm::vec3& v1 = verts.at(indexes.indexes.at(v)).vert;
-          const glm::vec3& v2 = verts.at(indexes.indexes.at(v+1)).vert;
-
-          closure(v0,v1,v2);
-        }
-      }
-      else if(indexes.type == triangleStrip)
-      {
-        size_t vMax = calcVMax(2);
-
-        for(size_t v=0; v<vMax; v++)
-        {
-          const glm::vec3& v0 = verts.at(indexes.indexes.at(v)).vert;
-          const glm::vec3& v1 = verts.at(indexes.indexes.at(v+1)).vert;
-          const glm::vec3& v2 = verts.at(indexes.indexes.at(v+2)).vert;
-
-          closure(v0,v1,v2);
-        }
-      }
-      else if(indexes.type == triangles)
+  //################################################################################################
+  //! Loop for each triangle, with or without bounds checking.
+  template<bool Checked, typename Closure>
+  void forEachTriangleImpl(Closure&& closure) const
+  {
+    for(const auto& part : indexes)
+    {
+      forEachPartTriangle<false>(part.type, part.indexes.data(), part.indexes.size(), triangleFan, triangleStrip, triangles, [&](int i0, int i1, int i2)
       {
-        size_t vMax = calcVMax(2);
-        for(size_t v=0; v<vMax; v+=3)
-        {
-          const glm::vec3& v0 = verts.at(indexes.indexes.at(v)).vert;
-          const glm::vec3& v1 = verts.at(indexes.indexes.at(v+1)).vert;
-          const glm::vec3& v2 = verts.at(indexes.indexes.at(v+2)).vert;
-
-          closure(v0,v1,v2);
-        }
-      }
+        closure(checkedAt<Checked>(verts, size_t(i0)).vert,
+                checkedAt<Checked>(verts, size_t(i1)).vert,
+                checkedAt<Checked>(verts, size_t(i2)).vert);
+      });
     }
   }
 
+  //################################################################################################
+  //! Loop for each triangle passing the vertex indexes, odd strip triangles are flipped.
+  /*!
+  This uses the same winding as the normal calculation, the indexes are not range checked.
+  */
+  template<typename Closure>
+  void forEachTriangleIndexes(Closure&& closure) const
+  {
+    for(const auto& part : indexes)
+      forEachPartTriangle<true>(part.type, part.indexes.data(), part.indexes.size(), triangleFan, triangleStrip, triangles, closure);
+  }
+
   //################################################################################################
   //! Convert to triangles and duplicate verts. (nVerts = nFaces*3)
-  void breakApartTriangles();
+  void breakApartTriangles(std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
-  void calculateNormals(NormalCalculationMode mode, float minDot=0.9f);
+  void calculateNormals(NormalCalculationMode mode, float minDot=0.9f, std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
-  void calculateVertexNormals();
+  void calculateVertexNormals(std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
-  void calculateFaceNormals();
+  void calculateFaceNormals(std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
-  void calculateAdaptiveNormals(float minDot=0.9f);
+  void calculateAdaptiveNormals(float minDot=0.9f, std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
-  void combineSimilarVerts();
+  void combineSimilarVerts(std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
   void transform(const glm::mat4& m);
@@ -199,7 +271,7 @@ struct TP_MATH_UTILS_EXPORT Geometry3D
 
   //################################################################################################
   //! Duplicate and reverse geometry to render back faces.
-  void addBackFaces();
+  void addBackFaces(std::pmr::memory_resource* scratch=nullptr);
 
   //################################################################################################
   tp_utils::StringID getName() const;
@@ -225,11 +297,182 @@ struct TP_MATH_UTILS_EXPORT Geometry3D
   //! This can be used to compare the results of creating a Geometry3D array from different inputs,
   //! for instance OBJ and JSON formats
   static bool printDataToFile(const std::vector<Geometry3D>& geometry, const std::string& filename);
+
+private:
+  friend struct FlatGeometry3D;
+  friend struct Geometry3DTopology;
+
+  //################################################################################################
+  //! Record the validated state along with the vert count that validated() checks against.
+  void setValidated(bool validated);
+
+  //################################################################################################
+  //! Combine verts, idxLookup is set to the new index of each of the old verts.
+  void combineSimilarVerts(std::pmr::vector<size_t>& idxLookup);
+
+  bool m_validated{false};
+  size_t m_validatedVerts{0};
 };
 
 //##################################################################################################
 typedef std::vector<Geometry3D> Geometry3DList;
 
+//##################################################################################################
+//! A part of a FlatIndexes3D, a range of its index buffer.
+struct TP_MATH_UTILS_EXPORT IndexPart3D
+{
+  int type{0};
+  size_t offset{0};
+  size_t count{0};
+
+  //################################################################################################
+  bool operator==(const IndexPart3D& other) const
+  {
+    return
+        type == other.type &&
+        offset == other.offset &&
+        count == other.count;
+  };
+};
+
+//##################################################################################################
+//! All of the indexes of a mesh in a single buffer, with a table of parts that index into it.
+/*!
+This avoids an allocation per part for meshes made of lots of small strips, and keeps the indexes
+together in memory for algorithms that loop over all of them.
+*/
+struct TP_MATH_UTILS_EXPORT FlatIndexes3D
+{
+  Vertex3DIndexList indexes;
+  std::vector<IndexPart3D> parts;
+
+  //################################################################################################
+  void addPart(int type, const int* partIndexes, size_t count);
+
+  //################################################################################################
+  void clear();
+
+  //################################################################################################
+  static FlatIndexes3D fromIndexes(const Indexes3DList& indexes);
+
+  //################################################################################################
+  Indexes3DList toIndexes() const;
+
+  //################################################################################################
+  //! Call closure(type, indexes, count) for each part, parts are clipped to the index buffer.
+  template<typename Closure>
+  void forEachPart(Closure&& closure) const
+  {
+    for(const auto& part : parts)
+    {
+      if(part.offset>=indexes.size())
+        continue;
+
+      closure(part.type, indexes.data()+part.offset, tpMin(part.count, indexes.size()-part.offset));
+    }
+  }
+
+  //################################################################################################
+  bool operator==(const FlatIndexes3D& other) const
+  {
+    return
+        indexes == other.indexes &&
+        parts == other.parts;
+  };
+};
+
+//##################################################################################################
+//! Geometry3D with flattened index storage, see FlatIndexes3D.
+struct TP_MATH_UTILS_EXPORT FlatGeometry3D
+{
+  std::vector<std::string> comments;
+  Vertex3DList verts;
+  FlatIndexes3D indexes;
+
+  int triangleFan  {TP_TRIANGLE_FAN  };
+  int triangleStrip{TP_TRIANGLE_STRIP};
+  int triangles    {TP_TRIANGLES     };
+
+  Material material;
+
+  //################################################################################################
+  static FlatGeometry3D fromGeometry3D(const Geometry3D& geometry);
+
+  //################################################################################################
+  Geometry3D toGeometry3D() const;
+
+  //################################################################################################
+  //! See Geometry3D::validate(), this also checks that parts lie inside the index buffer.
+  bool validate();
+
+  //################################################################################################
+  //! See Geometry3D::validated(), this also checks the part table on each call.
+  bool validated() const;
+
+  //################################################################################################
+  void invalidate();
+
+  //################################################################################################
+  void stats(size_t& vertCount, size_t& indexCount, size_t& triangleCount) const;
+
+  //################################################################################################
+  std::string stats() const;
+
+  //################################################################################################
+  //! Convert strips and fans into a single triangles part.
+  void convertToTriangles(std::pmr::memory_resource* scratch=nullptr);
+
+  //################################################################################################
+  void calculateVertexNormals(std::pmr::memory_resource* scratch=nullptr);
+
+  //################################################################################################
+  void buildTangentVectors(std::vector<glm::vec3>& tangent) const;
+
+  //################################################################################################
+  //! Loop for each triangle, see Geometry3D::forEachTriangle.
+  template<typename Closure>
+  void forEachTriangle(Closure&& closure) const
+  {
+    if(validated())
+      forEachTriangleImpl<false>(closure);
+    else
+      forEachTriangleImpl<true>(closure);
+  }
+
+  //################################################################################################
+  template<bool Checked, typename Closure>
+  void forEachTriangleImpl(Closure&& closure) const
+  {
+    indexes.forEachPart([&](int type, const int* ii, size_t count)
+    {
+      forEachPartTriangle<false>(type, ii, count, triangleFan, triangleStrip, triangles, [&](int i0, int i1, int i2)
+      {
+        closure(checkedAt<Checked>(verts, size_t(i0)).vert,
+                checkedAt<Checked>(verts, size_t(i1)).vert,
+                checkedAt<Checked>(verts, size_t(i2)).vert);
+      });
+    });
+  }
+
+  //################################################################################################
+  //! Loop for each triangle passing the vertex indexes, see Geometry3D::forEachTriangleIndexes.
+  template<typename Closure>
+  void forEachTriangleIndexes(Closure&& closure) const
+  {
+    indexes.forEachPart([&](int type, const int* ii, size_t count)
+    {
+      forEachPartTriangle<true>(type, ii, count, triangleFan, triangleStrip, triangles, closure);
+    });
+  }
+
+private:
+  //################################################################################################
+  void setValidated(bool validated);
+
+  bool m_validated{false};
+  size_t m_validatedVerts{0};
+};
+
 //##################################################################################################
 struct TP_MATH_UTILS_EXPORT Geometry
 {
@@ -0,0 +1,81 @@
+#ifndef tp_math_utils_Geometry3DBatch_h
+#define tp_math_utils_Geometry3DBatch_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+#include "tp_utils/Progress.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! Call closure(mesh, index) for each mesh in parallel.
+/*!
+Threads take the next mesh from a shared queue that is sorted largest first, so a few big meshes
+start early and the small ones fill in around them. Nested parallel calls made by the closure run
+on the thread that called them, except for meshes that are larger than an even share of the work.
+Those are run one at a time before the rest and their parallel calls can use every thread.
+
+Progress is weighted by the size of each mesh and is only reported from the calling thread, which
+polls it while the workers run so that it stays up to date during big meshes. If the progress asks
+to stop, meshes that have not started are skipped.
+
+\param geometry The meshes to process.
+\param closure Called as closure(mesh, index), each mesh is only touched by one thread.
+\param progress Optional, receives the fraction of the work that is done.
+\return false if the progress asked to stop before all meshes were processed.
+*/
+bool TP_MATH_UTILS_EXPORT forEachGeometry3D(Geometry3DList& geometry,
+                                            const std::function<void(Geometry3D&, size_t)>& closure,
+                                            tp_utils::Progress* progress=nullptr);
+
+//##################################################################################################
+//! Like forEachGeometry3D() but large meshes are split into ranges that are run in parallel.
+/*!
+Use this for per vertex work where ranges of a mesh can be processed independently. If the progress
+asks to stop a mesh may be left partly processed.
+
+\param geometry The meshes to process.
+\param count Returns the number of items in a mesh, for example the number of verts.
+\param blockSize The max number of items in a range.
+\param closure Called as closure(mesh, index, begin, end), ranges of a mesh may run concurrently.
+\param progress Optional, receives the fraction of the work that is done.
+\return false if the progress asked to stop before all ranges were processed.
+*/
+bool TP_MATH_UTILS_EXPORT forEachGeometry3DRange(Geometry3DList& geometry,
+                                                 const std::function<size_t(const Geometry3D&)>& count,
+                                                 size_t blockSize,
+                                                 const std::function<void(Geometry3D&, size_t, size_t, size_t)>& closure,
+                                                 tp_utils::Progress* progress=nullptr);
+
+//##################################################################################################
+//! See Geometry3D::convertToTriangles(), meshes are processed in parallel using Geometry3DPipeline.
+bool TP_MATH_UTILS_EXPORT convertToTriangles(Geometry3DList& geometry,
+                                             tp_utils::Progress* progress=nullptr);
+
+//##################################################################################################
+//! See Geometry3D::combineSimilarVerts(), meshes are processed in parallel.
+bool TP_MATH_UTILS_EXPORT combineSimilarVerts(Geometry3DList& geometry,
+                                              tp_utils::Progress* progress=nullptr);
+
+//##################################################################################################
+//! See Geometry3D::calculateNormals(), meshes are processed in parallel using Geometry3DPipeline.
+bool TP_MATH_UTILS_EXPORT calculateNormals(Geometry3DList& geometry,
+                                           NormalCalculationMode mode,
+                                           float minDot=0.9f,
+                                           tp_utils::Progress* progress=nullptr);
+
+//##################################################################################################
+//! See Geometry3D::addBackFaces(), meshes are processed in parallel using Geometry3DPipeline.
+bool TP_MATH_UTILS_EXPORT addBackFaces(Geometry3DList& geometry,
+                                       tp_utils::Progress* progress=nullptr);
+
+//##################################################################################################
+//! See Geometry3D::transform(), large meshes are split into blocks of verts.
+bool TP_MATH_UTILS_EXPORT transform(Geometry3DList& geometry,
+                                    const glm::mat4& m,
+                                    tp_utils::Progress* progress=nullptr);
+
+}
+
+#endif
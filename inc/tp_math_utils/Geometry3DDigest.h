@@ -0,0 +1,115 @@
+#ifndef tp_math_utils_Geometry3DDigest_h
+#define tp_math_utils_Geometry3DDigest_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DDigestParams
+{
+  //! If greater than 0 floats are rounded to a multiple of this before hashing, values that are
+  //! close to half way between two steps can still round differently.
+  float tolerance{0.0f};
+
+  //! By default the digest covers the same things as Geometry3D::operator==.
+  bool includeMaterial{false};
+};
+
+//##################################################################################################
+//! A content hash of a Geometry3D, split up so that differences can be located.
+/*!
+The digest is deterministic across runs, machines and thread counts so it can be used as a cache
+key. Verts are hashed in blocks of vertBlockSize.
+*/
+struct TP_MATH_UTILS_EXPORT Geometry3DDigest
+{
+  static constexpr size_t vertBlockSize{4096};
+
+  uint64_t digest{0};                     //!< Combines all of the other digests.
+  uint64_t headerDigest{0};               //!< Counts, type codes and comments.
+  uint64_t materialDigest{0};             //!< Zero unless includeMaterial is set.
+  std::vector<uint64_t> vertBlockDigests; //!< One per block of verts.
+  std::vector<uint64_t> partDigests;      //!< One per part, including its type.
+
+  //################################################################################################
+  //! The digest as a 16 character hex string.
+  std::string toString() const;
+
+  //################################################################################################
+  bool operator==(const Geometry3DDigest& other) const
+  {
+    return digest == other.digest;
+  }
+
+  //################################################################################################
+  bool operator!=(const Geometry3DDigest& other) const
+  {
+    return digest != other.digest;
+  }
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DListDigest
+{
+  uint64_t digest{0};                    //!< Combines the mesh digests in order.
+  std::vector<Geometry3DDigest> meshes;
+
+  //################################################################################################
+  std::string toString() const;
+};
+
+//##################################################################################################
+//! Hash a mesh, vert blocks and parts are hashed in parallel.
+Geometry3DDigest TP_MATH_UTILS_EXPORT digestGeometry3D(const Geometry3D& geometry,
+                                                      const Geometry3DDigestParams& params=Geometry3DDigestParams());
+
+//##################################################################################################
+//! Hash a list of meshes, meshes are hashed in parallel.
+Geometry3DListDigest TP_MATH_UTILS_EXPORT digestGeometry3D(const Geometry3DList& geometry,
+                                                          const Geometry3DDigestParams& params=Geometry3DDigestParams());
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DMeshDiff
+{
+  size_t index{0};          //!< The index of the mesh in both lists.
+  bool onlyInA{false};      //!< The mesh is missing from b.
+  bool onlyInB{false};      //!< The mesh is missing from a.
+  bool header{false};       //!< The counts, type codes or comments differ.
+  bool material{false};     //!< The materials differ, only checked if includeMaterial is set.
+  std::vector<std::pair<size_t, size_t>> vertRanges; //!< [begin, end) ranges of verts that differ.
+  std::vector<size_t> parts;                           //!< Indexes of parts that differ.
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DDiff
+{
+  size_t meshCountA{0};
+  size_t meshCountB{0};
+  std::vector<Geometry3DMeshDiff> meshes; //!< Only meshes that differ.
+
+  //################################################################################################
+  bool empty() const;
+
+  //################################################################################################
+  std::string toString() const;
+
+  //################################################################################################
+  void saveState(nlohmann::json& j) const;
+};
+
+//##################################################################################################
+//! Compare two lists of meshes mesh by mesh.
+/*!
+Digests are compared first, only vert blocks that have different digests are compared vert by vert
+to find the exact ranges that differ. Verts are compared using the same rounding as the digest.
+Meshes are compared in parallel.
+*/
+Geometry3DDiff TP_MATH_UTILS_EXPORT diffGeometry3D(const Geometry3DList& a,
+                                                  const Geometry3DList& b,
+                                                  const Geometry3DDigestParams& params=Geometry3DDigestParams());
+
+}
+
+#endif
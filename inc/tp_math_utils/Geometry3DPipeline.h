@@ -0,0 +1,103 @@
+#ifndef tp_math_utils_Geometry3DPipeline_h
+#define tp_math_utils_Geometry3DPipeline_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+#include "tp_utils/Progress.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+enum class Geometry3DOperation
+{
+  ConvertToTriangles,
+  CombineSimilarVerts,
+  CalculateNormals,
+  BuildTangentVectors,
+  AddBackFaces
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DPipelineStep
+{
+  Geometry3DOperation operation{Geometry3DOperation::ConvertToTriangles};
+  NormalCalculationMode normalMode{NormalCalculationMode::None}; //!< Used by CalculateNormals.
+  float minDot{0.9f};                                            //!< Used by CalculateNormals.
+};
+
+//##################################################################################################
+//! A list of Geometry3D operations that are planned and then run together.
+/*!
+Steps are added in the order that they should run. Before running, steps whose work is redone by a
+later step are dropped, for example adaptive normals combine verts and build a new triangle list so
+an earlier convertToTriangles or combineSimilarVerts is not needed. The result is the same as
+calling the steps one by one.
+
+Each mesh is validated once, its faces and the corners around each vert are then built once in a
+Geometry3DTopology and shared by the steps, each step updates them rather than walking the parts
+again. Vertex normals and tangents straight after them are calculated in the same pass. Meshes that
+don't validate run the Geometry3D operations one by one instead.
+
+Each mesh runs all of its steps on one thread, sharing a scratch arena for the temporary buffers.
+Meshes are processed in parallel, largest first. A single mesh passed to run(), and meshes that are
+larger than an even share of a list, use the parallel passes across every thread.
+
+Tangents are calculated where the step is added. If verts are changed by a later step the tangents
+are recalculated at the end, back faces get the tangents of the verts that they were copied from.
+*/
+class TP_MATH_UTILS_EXPORT Geometry3DPipeline
+{
+public:
+  //################################################################################################
+  Geometry3DPipeline& convertToTriangles();
+
+  //################################################################################################
+  Geometry3DPipeline& combineSimilarVerts();
+
+  //################################################################################################
+  Geometry3DPipeline& calculateNormals(NormalCalculationMode mode, float minDot=0.9f);
+
+  //################################################################################################
+  Geometry3DPipeline& buildTangentVectors();
+
+  //################################################################################################
+  Geometry3DPipeline& addBackFaces();
+
+  //################################################################################################
+  const std::vector<Geometry3DPipelineStep>& steps() const;
+
+  //################################################################################################
+  //! The steps that will actually be run.
+  std::vector<Geometry3DPipelineStep> plan() const;
+
+  //################################################################################################
+  //! Run the pipeline on a single mesh.
+  /*!
+  \param geometry The mesh to modify.
+  \param tangents Populated if the pipeline builds tangents, can be null.
+  \param scratch Memory resource for temporary buffers, can be null.
+  */
+  void run(Geometry3D& geometry,
+           std::vector<glm::vec3>* tangents=nullptr,
+           std::pmr::memory_resource* scratch=nullptr) const;
+
+  //################################################################################################
+  //! Run the pipeline on each mesh in parallel, see forEachGeometry3D().
+  /*!
+  \param geometry The meshes to modify.
+  \param tangents Populated with one list per mesh if the pipeline builds tangents, can be null.
+  \param progress Optional, see forEachGeometry3D().
+  \return false if the progress asked to stop before all meshes were processed.
+  */
+  bool run(Geometry3DList& geometry,
+           std::vector<std::vector<glm::vec3>>* tangents=nullptr,
+           tp_utils::Progress* progress=nullptr) const;
+
+private:
+  std::vector<Geometry3DPipelineStep> m_steps;
+};
+
+}
+
+#endif
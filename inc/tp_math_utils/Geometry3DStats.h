@@ -0,0 +1,88 @@
+#ifndef tp_math_utils_Geometry3DStats_h
+#define tp_math_utils_Geometry3DStats_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DStatsParams
+{
+  size_t cacheSize{32};              //!< The FIFO post transform cache size used to calculate ACMR.
+  float zeroAreaThreshold{1e-12f};   //!< Triangles with an area below this are counted as zero area.
+};
+
+//##################################################################################################
+//! Quality and performance statistics for one or more meshes.
+/*!
+The triangle area histogram uses power of 2 buckets, bucket i counts triangles with an area in the
+range [2^(i+areaHistogramMinExponent), 2^(i+1+areaHistogramMinExponent)). Zero area and degenerate
+triangles are not included in the histogram or the area and edge length ranges.
+*/
+struct TP_MATH_UTILS_EXPORT Geometry3DStats
+{
+  static constexpr int areaHistogramMinExponent{-32};
+  static constexpr size_t areaHistogramBuckets{64};
+
+  size_t meshCount{0};
+  size_t partCount{0};
+  size_t vertCount{0};
+  size_t indexCount{0};
+  size_t triangleCount{0};
+
+  size_t invalidIndexes{0};       //!< Entries in the index lists that are negative or >= verts.size().
+  size_t degenerateTriangles{0};  //!< Triangles that use the same vertex index more than once.
+  size_t zeroAreaTriangles{0};    //!< Triangles with 3 different indexes but no area.
+  size_t duplicateVerts{0};       //!< Verts identical to an earlier vert in the same mesh.
+  size_t duplicatePositions{0};   //!< Verts at the same position as an earlier vert in the same mesh.
+  size_t unreferencedVerts{0};    //!< Verts not used by any triangle.
+
+  size_t edgeCount{0};            //!< Unique edges, by vertex index.
+  size_t boundaryEdges{0};        //!< Edges used by a single triangle.
+  size_t nonManifoldEdges{0};     //!< Edges used by more than 2 triangles.
+
+  size_t cacheSize{0};            //!< The cache size used to calculate cacheMisses.
+  size_t cacheMisses{0};          //!< FIFO cache misses, processing each part in index order.
+
+  double totalArea{0.0};
+  float minTriangleArea{0.0f};
+  float maxTriangleArea{0.0f};
+  float minEdgeLength{0.0f};
+  float maxEdgeLength{0.0f};
+
+  glm::vec3 min{0.0f, 0.0f, 0.0f}; //!< Bounding box of the verts.
+  glm::vec3 max{0.0f, 0.0f, 0.0f}; //!< Bounding box of the verts.
+
+  std::vector<size_t> areaHistogram;
+
+  //################################################################################################
+  //! Average cache miss ratio, misses per triangle.
+  float acmr() const;
+
+  //################################################################################################
+  float meanTriangleArea() const;
+
+  //################################################################################################
+  //! Combine the stats from another mesh into this.
+  void add(const Geometry3DStats& other);
+
+  //################################################################################################
+  std::string toString() const;
+
+  //################################################################################################
+  void saveState(nlohmann::json& j) const;
+
+  //################################################################################################
+  static Geometry3DStats calculate(const Geometry3D& geometry,
+                                   const Geometry3DStatsParams& params=Geometry3DStatsParams());
+
+  //################################################################################################
+  //! Calculate the stats for each mesh in parallel and combine them.
+  static Geometry3DStats calculate(const std::vector<Geometry3D>& geometry,
+                                   const Geometry3DStatsParams& params=Geometry3DStatsParams());
+};
+
+}
+
+#endif
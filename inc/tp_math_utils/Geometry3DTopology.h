@@ -0,0 +1,79 @@
+#ifndef tp_math_utils_Geometry3DTopology_h
+#define tp_math_utils_Geometry3DTopology_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+#include <array>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! The triangles of a mesh and the triangle corners around each vert.
+/*!
+This is built once and then shared and kept up to date by a sequence of operations, rather than
+each of them walking the parts of the mesh again, see Geometry3DPipeline.
+
+Faces have the same winding as Geometry3D::forEachTriangleIndexes(), odd strip triangles are flipped
+and flagged so that calculations that depend on the original order can undo it. Corner c is corner
+c%3 of face c/3, the corners around each vert are kept in face order. This is the order that the
+Geometry3D operations visit them in, so sums over them give the same results.
+
+Indexes are not range checked, only use this with validated geometry.
+*/
+struct TP_MATH_UTILS_EXPORT Geometry3DTopology
+{
+  std::pmr::vector<std::array<int, 3>> faces;
+  std::pmr::vector<uint8_t> flipped;       //!< 1 if the face is a flipped strip triangle.
+  std::pmr::vector<glm::vec3> faceNormals; //!< Empty until calculateFaceNormals() is called.
+  std::pmr::vector<size_t> cornerOffsets;  //!< Corners of vert v are corners[cornerOffsets[v]] to corners[cornerOffsets[v+1]-1].
+  std::pmr::vector<size_t> corners;        //!< Empty until calculateAdjacency() is called.
+
+  //################################################################################################
+  explicit Geometry3DTopology(std::pmr::memory_resource* scratch=nullptr);
+
+  //################################################################################################
+  //! Build the faces from the parts of a mesh, this clears the face normals and adjacency.
+  void calculateFaces(const Geometry3D& geometry);
+
+  //################################################################################################
+  //! The same normals as glm::triangleNormal(), calculated in parallel.
+  void calculateFaceNormals(const Vertex3DList& verts);
+
+  //################################################################################################
+  //! Sort the corners of the faces by vert.
+  void calculateAdjacency(size_t vertCount);
+
+  //################################################################################################
+  bool hasFaceNormals() const;
+
+  //################################################################################################
+  bool hasAdjacency(size_t vertCount) const;
+
+  //################################################################################################
+  //! Map the vert indexes of the faces through idxLookup, this clears the face normals and adjacency.
+  void remapVerts(const std::pmr::vector<size_t>& idxLookup);
+
+  //################################################################################################
+  //! Combine the verts of the geometry and then remap the faces to the combined verts.
+  void combineSimilarVerts(Geometry3D& geometry);
+
+  //################################################################################################
+  //! Write the faces to a single triangles part and clear the flipped flags.
+  void writeTriangles(Geometry3D& geometry);
+
+  //################################################################################################
+  //! Call closure(corner) for each corner around vert v.
+  template<typename Closure>
+  void forEachCorner(size_t v, Closure&& closure) const
+  {
+    const size_t* c = corners.data()+cornerOffsets[v];
+    const size_t* cMax = corners.data()+cornerOffsets[v+1];
+    for(; c<cMax; c++)
+      closure(*c);
+  }
+};
+
+}
+
+#endif
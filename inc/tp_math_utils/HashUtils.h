@@ -0,0 +1,30 @@
+#ifndef tp_math_utils_HashUtils_h
+#define tp_math_utils_HashUtils_h
+
+#include "tp_math_utils/Globals.h"
+
+#include <cstring>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! The bits of a float for hashing and exact comparison, -0 and +0 give the same bits.
+inline uint32_t floatBits(float f)
+{
+  // Adding 0 turns -0 into +0.
+  f += 0.0f;
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+//##################################################################################################
+inline size_t hashCombine(size_t seed, uint32_t v)
+{
+  return seed ^ (size_t(v) + 0x9e3779b97f4a7c15ull + (seed<<6) + (seed>>2));
+}
+
+}
+
+#endif
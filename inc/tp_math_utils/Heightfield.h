@@ -0,0 +1,122 @@
+#ifndef tp_math_utils_Heightfield_h
+#define tp_math_utils_Heightfield_h
+
+#include "tp_math_utils/Plane.h"
+
+#include <functional>
+#include <memory>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT HeightfieldParams
+{
+  size_t tileSize{32}; //!< Quads along each side of a tile at full detail, rounded down to a power of 2.
+  size_t tilesI{1};    //!< Tiles along the tangent of the plane.
+  size_t tilesJ{1};    //!< Tiles along the bitangent of the plane.
+  float scaleI{1.0f};  //!< The size of the whole heightfield along the tangent.
+  float scaleJ{1.0f};  //!< The size of the whole heightfield along the bitangent.
+  float scaleU{1.0f};  //!< Texture u across the whole heightfield.
+  float scaleV{1.0f};  //!< Texture v across the whole heightfield.
+};
+
+//##################################################################################################
+//! Triangle index buffers shared by all tiles of the same size.
+/*!
+There is a buffer for each level of detail and each combination of edges that meet a coarser
+neighbor. The indexes refer to the full detail verts of a tile, (tileSize+1)^2 verts in rows along
+the tangent, so a tile changes its level of detail by changing the buffer it is drawn with.
+*/
+struct TP_MATH_UTILS_EXPORT HeightfieldIndexBuffers
+{
+  size_t tileSize{0};
+  size_t lodCount{0};
+  std::vector<std::vector<int>> buffers; //!< Indexed by lod*16 + stitch.
+
+  //################################################################################################
+  const std::vector<int>& indexes(size_t lod, int stitch) const;
+
+  //################################################################################################
+  //! The shared buffers for a tile size, each size is only generated once, this is thread safe.
+  static std::shared_ptr<const HeightfieldIndexBuffers> get(size_t tileSize);
+};
+
+//##################################################################################################
+//! A chunked terrain on a Plane, tiles use geomipmapping to draw with less detail in the distance.
+/*!
+The heightfield covers scaleI by scaleJ from the point of the plane along its tangent and bitangent,
+heights are offsets along the plane normal. Heights are sampled once for the whole heightfield so
+neighboring tiles share the same verts along their edges, and normals are found from the sampled
+heights.
+
+Level of detail l draws every 2^l th vert. Levels of neighboring tiles must differ by at most 1, the
+finer tile stitches its edge to the coarser tile by skipping the verts the coarser tile does not
+have. Stitch bits are 1 for the edge at j=0, 2 for i=max, 4 for j=max and 8 for i=0.
+*/
+class TP_MATH_UTILS_EXPORT Heightfield
+{
+public:
+  //################################################################################################
+  //! Sample heights from a function, it is called in parallel with distances along the plane axes.
+  Heightfield(const Plane& plane,
+              const HeightfieldParams& params,
+              const std::function<float(float i, float j)>& height);
+
+  //################################################################################################
+  //! Bilinearly sample heights from a grid of width*height values that covers the heightfield.
+  Heightfield(const Plane& plane,
+              const HeightfieldParams& params,
+              const std::vector<float>& heights,
+              size_t width,
+              size_t height);
+
+  //################################################################################################
+  const HeightfieldParams& params() const;
+
+  //################################################################################################
+  size_t tileCount() const;
+
+  //################################################################################################
+  //! The full detail verts of a tile, tiles are in rows along the tangent.
+  const Vertex3DList& tileVerts(size_t tile) const;
+
+  //################################################################################################
+  const HeightfieldIndexBuffers& indexBuffers() const;
+
+  //################################################################################################
+  //! A level of detail for each tile from its distance to a viewer.
+  /*!
+  Each level doubles the length of the edges, a tile gets the coarsest level whose edges are no
+  longer than errorPerDistance times the distance from the viewer to the bounding box of the tile.
+  Levels are then reduced until neighbors differ by at most 1.
+  */
+  std::vector<size_t> selectLods(const glm::vec3& viewer, float errorPerDistance) const;
+
+  //################################################################################################
+  //! The edges of a tile that must be stitched to coarser neighbors.
+  int stitch(const std::vector<size_t>& lods, size_t tile) const;
+
+  //################################################################################################
+  //! The verts that a level of a tile uses along with a triangle list.
+  Geometry3D tileGeometry(size_t tile, size_t lod, int stitch) const;
+
+  //################################################################################################
+  //! All tiles at the given levels joined into a single mesh, tiles are built in parallel.
+  Geometry3D geometry(const std::vector<size_t>& lods) const;
+
+private:
+  //################################################################################################
+  //! Append the verts and indexes that a level of a tile uses.
+  void appendTile(size_t tile, size_t lod, int stitch, Vertex3D* verts, int* indexes, int offset) const;
+
+  Plane m_plane;
+  HeightfieldParams m_params;
+  std::shared_ptr<const HeightfieldIndexBuffers> m_indexBuffers;
+  std::vector<Vertex3DList> m_tileVerts;
+  std::vector<std::pair<glm::vec3, glm::vec3>> m_tileBounds;
+};
+
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef tp_math_utils_InstancedGeometry3D_h
+#define tp_math_utils_InstancedGeometry3D_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! A placement of a shared mesh.
+struct TP_MATH_UTILS_EXPORT Geometry3DInstance
+{
+  size_t geometryIndex{0};   //!< Index into InstancedGeometry3D::geometry.
+  glm::mat4 transform{1.0f}; //!< Transforms the shared mesh into place.
+  Material material;         //!< Replaces the material of the shared mesh.
+};
+
+//##################################################################################################
+//! A list of unique meshes and the instances that place them.
+struct TP_MATH_UTILS_EXPORT InstancedGeometry3D
+{
+  Geometry3DList geometry;
+  std::vector<Geometry3DInstance> instances;
+
+  //################################################################################################
+  //! Add a mesh as a new unique mesh with a single instance.
+  void add(const Geometry3D& geometry, const glm::mat4& transform=glm::mat4(1.0f));
+
+  //################################################################################################
+  //! Expand the instances back into one mesh per instance, in instance order.
+  Geometry3DList flatten() const;
+
+  //################################################################################################
+  //! Estimate the memory usage of the unique geometry and instances.
+  size_t sizeInBytes() const;
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT InstanceDetectionParams
+{
+  bool rigid{true};             //!< Match meshes that have been rotated and translated.
+  bool uniformScale{false};     //!< Also match meshes that have been uniformly scaled.
+  float tolerance{1e-4f};       //!< Max position error relative to the radius of the mesh.
+  float normalTolerance{1e-3f}; //!< Max error in the transformed normals.
+};
+
+//##################################################################################################
+//! Find copies of the same mesh and convert them into instances.
+/*!
+Meshes are grouped by a hash of the properties that do not change under a transform (index buffers,
+part types, vert count and texture coordinates) and candidates within a group are then checked vert
+by vert. With rigid matching the transform is found from a frame built on the centroid and two
+well spread verts, a candidate is only accepted if every vert and normal maps within tolerance.
+
+The first mesh in each set of duplicates is kept unchanged as the shared mesh, each input produces
+one instance in the same order as the input and the material of each input becomes the material of
+its instance. Comments are taken from the shared mesh. Hashing and matching run in parallel.
+*/
+InstancedGeometry3D TP_MATH_UTILS_EXPORT detectInstances(const Geometry3DList& geometry,
+                                                        const InstanceDetectionParams& params=InstanceDetectionParams());
+
+}
+
+#endif
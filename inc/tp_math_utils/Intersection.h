@@ -3,10 +3,14 @@
 
 #include "tp_math_utils/Globals.h"
 
+#include <limits>
+#include <vector>
+
 namespace tp_math_utils
 {
 class Plane;
 struct Ray;
+struct DRay;
 
 //##################################################################################################
 bool TP_MATH_UTILS_EXPORT rayPlaneIntersection(const Ray& ray, const Plane& plane, glm::vec3& intersection);
@@ -14,6 +18,67 @@ bool TP_MATH_UTILS_EXPORT rayPlaneIntersection(const Ray& ray, const Plane& plan
 //##################################################################################################
 bool TP_MATH_UTILS_EXPORT rayPlaneIntersection(const Ray& ray, const Plane& plane, glm::dvec3& intersection);
 
+//##################################################################################################
+//! The intersection is calculated in double precision.
+bool TP_MATH_UTILS_EXPORT rayPlaneIntersection(const DRay& ray, const Plane& plane, glm::dvec3& intersection);
+
+//##################################################################################################
+//! Rays stored as structure of arrays, points along ray i are origin[i] + t*direction[i].
+struct TP_MATH_UTILS_EXPORT RayArray
+{
+  std::vector<float> ox;
+  std::vector<float> oy;
+  std::vector<float> oz;
+  std::vector<float> dx;
+  std::vector<float> dy;
+  std::vector<float> dz;
+
+  //################################################################################################
+  size_t size() const;
+
+  //################################################################################################
+  void resize(size_t size);
+
+  //################################################################################################
+  void set(size_t i, const glm::vec3& origin, const glm::vec3& direction);
+
+  //################################################################################################
+  void set(size_t i, const Ray& ray);
+
+  //################################################################################################
+  //! One ray through the center of each pixel from the near plane (t=0) to the far plane (t=1).
+  /*!
+  Rays are in rows from the bottom of the viewport, matching OpenGL, so ray x+y*width is pixel
+  (x,y). Rows are generated in parallel.
+
+  \param inverseViewProjection inverse(ProjectionMatrix * ViewMatrix)
+  */
+  static RayArray fromCamera(const glm::mat4& inverseViewProjection, size_t width, size_t height);
+};
+
+//##################################################################################################
+//! The output of rayPlaneIntersections(), reuse it between calls to reuse its memory.
+struct TP_MATH_UTILS_EXPORT RayPlaneHits
+{
+  std::vector<glm::vec3> points; //!< The hit point of each ray, origin where hit is 0.
+  std::vector<float> t;          //!< The distance along each ray in units of its direction, or tMax.
+  std::vector<uint8_t> hit;      //!< 1 if the ray hit a plane.
+  std::vector<int> plane;        //!< The index of the closest plane that was hit or -1.
+};
+
+//##################################################################################################
+//! Find the closest plane that each ray hits with t in [tMin, tMax].
+/*!
+Rays are processed in parallel blocks and each block is tested against all planes in turn, the
+loops over rays are written so that the compiler can vectorize them. Rays that are parallel to a
+plane do not hit it.
+*/
+void TP_MATH_UTILS_EXPORT rayPlaneIntersections(const RayArray& rays,
+                                               const std::vector<Plane>& planes,
+                                               RayPlaneHits& hits,
+                                               float tMin=0.0f,
+                                               float tMax=std::numeric_limits<float>::max());
+
 }
 
 #endif
@@ -0,0 +1,98 @@
+#ifndef tp_math_utils_LoopSubdivision_h
+#define tp_math_utils_LoopSubdivision_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT LoopSubdivisionParams
+{
+  size_t levels{1}; //!< Each level splits every triangle into 4.
+
+  //! Edges between faces whose normals have a dot product less than this are kept sharp, boundary
+  //! edges and edges shared by more than 2 faces are always sharp.
+  float creaseMinDot{-1.0f};
+};
+
+//##################################################################################################
+//! A sparse matrix where each row is a weighted sum of the input values.
+struct TP_MATH_UTILS_EXPORT SubdivisionStencils
+{
+  size_t inputCount{0};        //!< The number of values that the columns index.
+  std::vector<size_t> offsets; //!< Row r uses columns and weights [offsets[r], offsets[r+1]).
+  std::vector<int> columns;
+  std::vector<float> weights;
+
+  //################################################################################################
+  size_t rows() const;
+
+  //################################################################################################
+  //! output[r] = sum(weights[i] * input[columns[i]]), rows are processed in parallel.
+  void apply(const glm::vec3* input, glm::vec3* output) const;
+
+  //################################################################################################
+  void apply(const glm::vec2* input, glm::vec2* output) const;
+};
+
+//##################################################################################################
+//! Uniform Loop subdivision of a triangle mesh.
+/*!
+The topology and stencils for all levels are built once by the constructor, apply() then evaluates
+the subdivided mesh with a sparse matrix multiply, so frames of an animated mesh with the same
+topology only pay for the multiply.
+
+Positions are subdivided on a mesh where verts with identical positions are merged so the surface
+stays closed across texture seams. Texture coordinates and normals are subdivided on the original
+verts, so seams act as boundaries for them, normals are normalized after subdividing.
+
+Boundaries and creases use the standard crease rules: crease edges are split at their midpoint,
+verts on two crease edges only follow the crease and verts on more are corners that stay put.
+*/
+class TP_MATH_UTILS_EXPORT LoopSubdivision
+{
+public:
+  //################################################################################################
+  LoopSubdivision(const Geometry3D& geometry, const LoopSubdivisionParams& params=LoopSubdivisionParams());
+
+  //################################################################################################
+  //! Subdivide geometry that has the same verts and indexes as the geometry passed to the constructor.
+  /*!
+  Only the verts of geometry are read, so this can be called with each frame of an animation.
+  \return false if geometry has a different number of verts.
+  */
+  bool apply(const Geometry3D& geometry, Geometry3D& output) const;
+
+  //################################################################################################
+  //! Rows are subdivided positions, columns are positions of the merged input verts.
+  const SubdivisionStencils& positionStencils() const;
+
+  //################################################################################################
+  //! Rows are subdivided verts, columns are input verts.
+  const SubdivisionStencils& vertStencils() const;
+
+  //################################################################################################
+  //! The row of positionStencils() for each subdivided vert.
+  const std::vector<int>& positionOfVert() const;
+
+  //################################################################################################
+  //! The triangles of the subdivided mesh.
+  const std::vector<int>& indexes() const;
+
+private:
+  SubdivisionStencils m_positionStencils;
+  SubdivisionStencils m_vertStencils;
+  std::vector<int> m_basePositionVert; //!< An input vert for each merged position.
+  std::vector<int> m_positionOfVert;
+  std::vector<int> m_indexes;
+};
+
+//##################################################################################################
+//! Convenience for subdividing a mesh once, use LoopSubdivision to reuse the stencils.
+Geometry3D TP_MATH_UTILS_EXPORT loopSubdivide(const Geometry3D& geometry,
+                                             const LoopSubdivisionParams& params=LoopSubdivisionParams());
+
+}
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef tp_math_utils_ParallelFor_h
+#define tp_math_utils_ParallelFor_h
+
+#include "tp_math_utils/Globals.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <exception>
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! True while the current thread is running part of a parallel job.
+/*!
+Nested parallel calls run on the calling thread, this stops per mesh operations that are already
+called in parallel over a list of meshes from splitting their work again.
+*/
+inline bool& parallelForActive()
+{
+  thread_local bool active{false};
+  return active;
+}
+
+//##################################################################################################
+//! Lets parallel calls made while this is in scope split their work even inside a parallel job.
+/*!
+Use this for a task that is known to have most of the work in a job to itself, for example a mesh
+that is much larger than the rest of a batch, so that it does not hold up the job on one thread.
+*/
+class NestedParallelScope
+{
+  TP_NONCOPYABLE(NestedParallelScope);
+public:
+  //################################################################################################
+  NestedParallelScope():
+    m_active(parallelForActive())
+  {
+    parallelForActive() = false;
+  }
+
+  //################################################################################################
+  ~NestedParallelScope()
+  {
+    parallelForActive() = m_active;
+  }
+
+private:
+  bool m_active;
+};
+
+//##################################################################################################
+//! Holds the first exception thrown by the workers of a parallel job.
+/*!
+Exceptions can't leave a worker thread, so each call is made through run() and the first exception
+is rethrown on the calling thread once the workers have been joined. After an exception the other
+workers stop taking new items.
+*/
+class ParallelException
+{
+public:
+  //################################################################################################
+  template<typename Closure>
+  void run(Closure&& closure)
+  {
+    if(m_stop)
+      return;
+
+    try
+    {
+      closure();
+    }
+    catch(...)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(!m_exception)
+        m_exception = std::current_exception();
+      m_stop = true;
+    }
+  }
+
+  //################################################################################################
+  bool stopped() const
+  {
+    return m_stop;
+  }
+
+  //################################################################################################
+  void rethrow()
+  {
+    if(m_exception)
+      std::rethrow_exception(m_exception);
+  }
+
+private:
+  std::mutex m_mutex;
+  std::exception_ptr m_exception;
+  std::atomic<bool> m_stop{false};
+};
+
+//##################################################################################################
+//! Worker threads shared by all of the parallel functions below.
+/*!
+The workers are started the first time the pool is used and run until the program exits, rather
+than starting and joining threads for every parallel call. There is one worker less than
+std::thread::hardware_concurrency() as the calling thread normally takes part in its own job. Calls
+made from several threads at once share the workers, jobs are started in the order they arrive.
+*/
+class TP_MATH_UTILS_EXPORT ParallelPool
+{
+  TP_NONCOPYABLE(ParallelPool);
+public:
+  //################################################################################################
+  //! The pool used by parallelFor(), parallelForBlocks() and parallelForPolled().
+  static ParallelPool& instance();
+
+  //################################################################################################
+  //! The number of worker threads, not counting the calling thread.
+  size_t workerCount() const;
+
+  //################################################################################################
+  //! Call task(i) for each i in [0,count) and wait for them all to finish.
+  /*!
+  The first exception thrown by a task is rethrown once all of the threads have finished with the
+  job, see ParallelException.
+
+  \param count The number of tasks.
+  \param maxThreads The max number of threads to use, including the calling thread.
+  \param task Called as task(index), the calling thread takes tasks as well unless poll is set.
+  \param poll If set, the calling thread only waits and calls poll() at regular intervals.
+  \param interval How long to wait between calls to poll().
+  */
+  void run(size_t count,
+           size_t maxThreads,
+           const std::function<void(size_t)>& task,
+           const std::function<void()>& poll=std::function<void()>(),
+           std::chrono::milliseconds interval=std::chrono::milliseconds(50));
+
+private:
+  //################################################################################################
+  ParallelPool();
+
+  //################################################################################################
+  ~ParallelPool();
+
+  struct Job;
+
+  //################################################################################################
+  void workerLoop();
+
+  //################################################################################################
+  void work(Job& job);
+
+  //################################################################################################
+  //! Take part in a job, call with m_mutex locked.
+  void join(Job& job);
+
+  //################################################################################################
+  //! Stop taking part in a job once all of its tasks have been taken, call with m_mutex locked.
+  void leave(Job& job);
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::deque<Job*> m_jobs;
+  bool m_stop{false};
+  std::vector<std::thread> m_workers;
+};
+
+//##################################################################################################
+//! Returns the number of threads to use for a job of count items.
+/*!
+\param count The number of items in the job.
+\param minPerThread The minimum number of items worth handing to a thread.
+\return A value between 1 and std::thread::hardware_concurrency().
+*/
+inline size_t parallelThreadCount(size_t count, size_t minPerThread)
+{
+  if(parallelForActive())
+    return 1;
+
+  size_t nThreads = tpMax(size_t(std::thread::hardware_concurrency()), size_t(1));
+  size_t nUseful = count / tpMax(minPerThread, size_t(1));
+  return tpMin(tpMax(nUseful, size_t(1)), nThreads);
+}
+
+//##################################################################################################
+//! Split [0,count) into one contiguous block per thread and process the blocks in parallel.
+/*!
+The split is deterministic for a given count and thread count, this allows per thread results to
+be combined in a reproducible order.
+
+\param count The number of items to process.
+\param minPerThread The minimum block size, small jobs are run on the calling thread.
+\param closure Called as closure(begin, end, block) for each block.
+\return The number of blocks used, block indexes will be in the range [0,blocks).
+*/
+template<typename Closure>
+size_t parallelForBlocks(size_t count, size_t minPerThread, Closure&& closure)
+{
+  size_t nBlocks = parallelThreadCount(count, minPerThread);
+
+  if(nBlocks<2)
+  {
+    closure(size_t(0), count, size_t(0));
+    return 1;
+  }
+
+  ParallelPool::instance().run(nBlocks, nBlocks, [&](size_t b)
+  {
+    size_t begin = (count*b)/nBlocks;
+    size_t end   = (count*(b+1))/nBlocks;
+    closure(begin, end, b);
+  });
+
+  return nBlocks;
+}
+
+//##################################################################################################
+//! Process items in parallel, each thread takes the next item from a shared counter.
+/*!
+Use this when the cost of each item varies a lot, for uniform work parallelForBlocks() has less
+overhead.
+
+\param count The number of items to process.
+\param closure Called as closure(index) once for each index in [0,count).
+\param maxThreads Limit the number of threads, 0 means use std::thread::hardware_concurrency().
+*/
+template<typename Closure>
+void parallelFor(size_t count, Closure&& closure, size_t maxThreads=0)
+{
+  size_t nThreads = parallelThreadCount(count, 1);
+  if(maxThreads)
+    nThreads = tpMin(nThreads, maxThreads);
+
+  if(nThreads<2)
+  {
+    for(size_t i=0; i<count; i++)
+      closure(i);
+    return;
+  }
+
+  ParallelPool::instance().run(count, nThreads, [&](size_t i)
+  {
+    closure(i);
+  });
+}
+
+//##################################################################################################
+//! Process items in parallel while the calling thread waits and calls poll() at regular intervals.
+/*!
+This is the same as parallelFor() except that the calling thread does not process items, this
+keeps it free to report progress or ask the workers to stop even while a long item is running, a
+single item is still handed to a worker. If there are no workers or this is called from inside a
+parallel job, the items are processed on the calling thread and poll() is called after each item.
+
+\param count The number of items to process.
+\param closure Called as closure(index) once for each index in [0,count).
+\param poll Called on the calling thread while the items are processed.
+\param interval How long to wait between calls to poll().
+*/
+template<typename Closure, typename Poll>
+void parallelForPolled(size_t count,
+                       Closure&& closure,
+                       Poll&& poll,
+                       std::chrono::milliseconds interval=std::chrono::milliseconds(50))
+{
+  if(parallelForActive() || ParallelPool::instance().workerCount()==0)
+  {
+    for(size_t i=0; i<count; i++)
+    {
+      closure(i);
+      poll();
+    }
+    return;
+  }
+
+  ParallelPool::instance().run(count, parallelThreadCount(count, 1), [&](size_t i)
+  {
+    closure(i);
+  }, poll, interval);
+}
+
+}
+
+#endif
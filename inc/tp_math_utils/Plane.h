@@ -9,6 +9,12 @@ namespace tp_math_utils
 {
 
 //##################################################################################################
+//! An infinite plane.
+/*!
+Everything is calculated by the constructors and a Plane is never modified after that, so planes
+can be shared between threads. The batch functions take a byte stride so that they can read the
+positions straight out of arrays of structs such as Geometry3D::verts.
+*/
 class TP_MATH_UTILS_EXPORT Plane
 {
 public:
@@ -28,8 +34,8 @@ public:
   //################################################################################################
   //! Return the plane as an array with a point and a normal
   /*!
-  This will retuns the plane described as an origin point and a normal, it will calculate these
-  values if they have not yet been set.
+  This will retuns the plane described as an origin point and a normal, the normal is as it was
+  passed to the constructor and may not be normalized.
 
   \return An array with two elements in it
   */
@@ -39,6 +45,50 @@ public:
   //! Define a plane using three points on the surface of the plane
   const glm::vec3* threePoints() const;
 
+  //################################################################################################
+  //! The unit normal, this is zero if the plane was defined with a zero normal or colinear points.
+  const glm::vec3& normal() const;
+
+  //################################################################################################
+  //! The plane equation is dot(normal(), p) + d() = 0.
+  float d() const;
+
+  //################################################################################################
+  //! A unit vector in the plane, tangent(), bitangent() and normal() form a right handed basis.
+  const glm::vec3& tangent() const;
+
+  //################################################################################################
+  const glm::vec3& bitangent() const;
+
+  //################################################################################################
+  //! Positive on the side that the normal points to.
+  float signedDistance(const glm::vec3& point) const
+  {
+    return glm::dot(m_normal, point) + m_d;
+  }
+
+  //################################################################################################
+  //! Calculate the signed distance of each point, large batches are split across threads.
+  /*!
+  Distances are measured from the point in pointAndNormal() rather than with d(), this keeps their
+  precision far from the origin and gives exactly zero for points at the plane's point. The results
+  can differ from signedDistance() in the last bits, classify() and project() work the same way.
+
+  \param points The first point.
+  \param count The number of points.
+  \param stride The number of bytes from one point to the next.
+  \param distances Output for count distances.
+  */
+  void signedDistances(const glm::vec3* points, size_t count, size_t stride, float* distances) const;
+
+  //################################################################################################
+  //! Classify points as 1 in front, -1 behind or 0 if they are within epsilon of the plane.
+  void classify(const glm::vec3* points, size_t count, size_t stride, float epsilon, int8_t* sides) const;
+
+  //################################################################################################
+  //! Project points onto the plane, projected is packed and may be the same as packed points.
+  void project(const glm::vec3* points, size_t count, size_t stride, glm::vec3* projected) const;
+
   //################################################################################################
   static Plane planeFromPoints(const std::vector<glm::vec3>& points);
 
@@ -46,11 +96,19 @@ public:
   Geometry3D geometry(float scaleI, float scaleJ, float scaleU, float scaleV, size_t tilesI=1, size_t tilesJ=1) const;
 
 private:
-  mutable std::array<glm::vec3, 2> m_pointAndNormal{};
-  mutable bool m_pointAndNormalValid;
+  //################################################################################################
+  void calculateThreePoints();
+
+  //################################################################################################
+  void calculateEquation();
+
+  std::array<glm::vec3, 2> m_pointAndNormal{};
+  std::array<glm::vec3, 3> m_threePoints{};
 
-  mutable std::array<glm::vec3, 3> m_threePoints{};
-  mutable bool m_threePointsValid;
+  glm::vec3 m_normal{0.0f, 0.0f, 1.0f};
+  float m_d{0.0f};
+  glm::vec3 m_tangent{1.0f, 0.0f, 0.0f};
+  glm::vec3 m_bitangent{0.0f, 1.0f, 0.0f};
 };
 
 }
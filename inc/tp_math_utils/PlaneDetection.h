@@ -0,0 +1,49 @@
+#ifndef tp_math_utils_PlaneDetection_h
+#define tp_math_utils_PlaneDetection_h
+
+#include "tp_math_utils/Plane.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT PlaneDetectionParams
+{
+  float distanceThreshold{0.01f}; //!< Max distance from a point to a plane for it to be an inlier.
+  float connectivity{0.0f};       //!< Max gap between connected inliers, 0 uses 4*distanceThreshold.
+  float samplingRadius{0.0f};     //!< Hypotheses use points this close together, 0 uses 16*connectivity.
+  size_t minInliers{100};         //!< Smaller planes are rejected.
+  size_t maxPlanes{0};            //!< Stop after this many planes, 0 for no limit.
+  size_t hypotheses{256};         //!< Hypotheses scored for each plane.
+  size_t scoreSampleSize{16384};  //!< Hypotheses are scored against this many of the remaining points.
+  size_t refineIterations{3};     //!< Rounds of least squares fitting and regrowing for each plane.
+  size_t maxFailures{3};          //!< Stop after this many rounds in a row that find no plane.
+  uint64_t seed{1};
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT DetectedPlane
+{
+  Plane plane;
+  std::vector<size_t> inliers; //!< Indexes into the points, in ascending order.
+};
+
+//##################################################################################################
+//! Find the planes in a point cloud with RANSAC and region growing.
+/*!
+Each round builds hypotheses from triples of nearby points that have not yet been assigned to a
+plane and scores them in parallel against a random sample of the remaining points. The points within
+distanceThreshold of the best hypothesis are found and the largest connected region of them is
+grown through a voxel grid, the plane is then refined with Plane::planeFromPoints() and regrown.
+Regions smaller than minInliers are rejected, otherwise their points are removed and the next round
+starts.
+
+Random numbers are generated per hypothesis from the seed so the result does not depend on the
+number of threads. Planes are returned in the order they are found, largest first as a rule.
+*/
+std::vector<DetectedPlane> TP_MATH_UTILS_EXPORT detectPlanes(const std::vector<glm::vec3>& points,
+                                                             const PlaneDetectionParams& params=PlaneDetectionParams());
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef tp_math_utils_Primitives_h
+#define tp_math_utils_Primitives_h
+
+#include "tp_math_utils/Geometry3D.h"
+#include "tp_math_utils/Cone.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! The shapes that Primitives can generate, and what PrimitiveInstance::size means for each.
+enum class PrimitiveType
+{
+  Cone,     //!< size = {r0, r1, length}, along +Z from the origin, r0 at z=0.
+  Cylinder, //!< size = {radius, -, length}, along +Z from the origin.
+  Capsule,  //!< size = {radius, -, length}, the straight part runs along +Z from the origin.
+  Box,      //!< size = {x, y, z}, centered on the origin.
+  Torus     //!< size = {majorRadius, minorRadius, -}, around +Z centered on the origin.
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT PrimitiveTessellation
+{
+  size_t segments{32}; //!< Divisions around the axis of round primitives.
+  size_t stacks{1};    //!< Divisions along the length of cones, cylinders and capsules.
+  size_t rings{8};     //!< Divisions from the equator to the pole of each capsule end.
+  size_t sides{16};    //!< Divisions around the tube of a torus.
+};
+
+//##################################################################################################
+//! A primitive placed in a batch.
+struct TP_MATH_UTILS_EXPORT PrimitiveInstance
+{
+  PrimitiveType type{PrimitiveType::Box};
+  glm::vec3 size{1.0f, 1.0f, 1.0f}; //!< See PrimitiveType.
+  glm::mat4 transform{1.0f};        //!< Transforms the primitive into place.
+};
+
+//##################################################################################################
+//! Indexed primitive meshes with normals and texture coordinates.
+/*!
+The topology of each primitive only depends on its type and tessellation. It is built once into a
+shared template that holds the index buffers and the unit circle values for each vert, generating
+a primitive then only evaluates the verts for its size. Templates are cached and this is thread
+safe.
+
+The sides of round primitives are emitted as one triangle strip per row and caps as triangle fans,
+the verts along texture seams and at poles are duplicated so that each has its own texture
+coordinates and normal. Texture u goes around the axis and v goes along it. Cone caps are left out
+when their radius is 0. Triangles are wound counter clockwise when viewed from outside.
+*/
+struct TP_MATH_UTILS_EXPORT Primitives
+{
+  //################################################################################################
+  //! Generate a single primitive using strips and fans, the transform is applied to the result.
+  static Geometry3D generate(const PrimitiveInstance& instance,
+                             const PrimitiveTessellation& tessellation,
+                             int triangleFan,
+                             int triangleStrip,
+                             int triangles);
+
+  //################################################################################################
+  //! Generate a batch of primitives into a single mesh with a single triangle list part.
+  /*!
+  Instances are written in parallel straight into the output, the verts of each instance follow
+  those of the previous instance. Normals are transformed by the inverse transpose of each
+  transform so non uniform scales keep the normals correct.
+  */
+  static Geometry3D batch(const std::vector<PrimitiveInstance>& instances,
+                          const PrimitiveTessellation& tessellation,
+                          int triangleFan,
+                          int triangleStrip,
+                          int triangles);
+
+  //################################################################################################
+  //! An instance that places a cone along the line segment of a Cone.
+  static PrimitiveInstance coneInstance(const Cone& cone);
+
+  //################################################################################################
+  static Geometry3D cone(const Cone& cone,
+                         const PrimitiveTessellation& tessellation,
+                         int triangleFan,
+                         int triangleStrip,
+                         int triangles);
+
+  //################################################################################################
+  static Geometry3D cylinder(float radius,
+                             float length,
+                             const PrimitiveTessellation& tessellation,
+                             int triangleFan,
+                             int triangleStrip,
+                             int triangles);
+
+  //################################################################################################
+  static Geometry3D capsule(float radius,
+                            float length,
+                            const PrimitiveTessellation& tessellation,
+                            int triangleFan,
+                            int triangleStrip,
+                            int triangles);
+
+  //################################################################################################
+  static Geometry3D box(const glm::vec3& size,
+                        int triangleFan,
+                        int triangleStrip,
+                        int triangles);
+
+  //################################################################################################
+  static Geometry3D torus(float majorRadius,
+                          float minorRadius,
+                          const PrimitiveTessellation& tessellation,
+                          int triangleFan,
+                          int triangleStrip,
+                          int triangles);
+};
+
+}
+
+#endif
@@ -0,0 +1,497 @@
+#ifndef tp_math_utils_RayKernels_h
+#define tp_math_utils_RayKernels_h
+
+#include "tp_math_utils/Ray.h"
+#include "tp_math_utils/Cone.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! A ray with the values that the intersection kernels need worked out once.
+/*!
+Points along the ray are origin + t*direction, so for a Ray t=0 is at p0 and t=1 is at p1.
+*/
+template<typename T>
+struct PreparedRay
+{
+  glm::vec<3,T> origin;
+  glm::vec<3,T> direction;
+  glm::vec<3,T> invDirection; //!< 1/direction, inf for zero components.
+
+  int kx{0}; //!< Watertight triangle test, the axes of the shear with kz the largest direction.
+  int ky{1};
+  int kz{2};
+  T sx{0};   //!< Watertight triangle test, the shear constants.
+  T sy{0};
+  T sz{1};
+
+  //################################################################################################
+  PreparedRay(const glm::vec<3,T>& origin_, const glm::vec<3,T>& direction_):
+    origin(origin_),
+    direction(direction_),
+    invDirection(T(1)/direction_.x, T(1)/direction_.y, T(1)/direction_.z)
+  {
+    glm::vec<3,T> a = glm::abs(direction);
+    kz = (a.x>a.y)?((a.x>a.z)?0:2):((a.y>a.z)?1:2);
+    kx = (kz+1)%3;
+    ky = (kx+1)%3;
+    if(direction[kz]<T(0))
+      std::swap(kx, ky);
+
+    sx = direction[kx] / direction[kz];
+    sy = direction[ky] / direction[kz];
+    sz = T(1) / direction[kz];
+  }
+};
+
+//##################################################################################################
+inline PreparedRay<float> prepareRay(const Ray& ray)
+{
+  return PreparedRay<float>(ray.p0, ray.p1-ray.p0);
+}
+
+//##################################################################################################
+inline PreparedRay<double> prepareRay(const DRay& ray)
+{
+  return PreparedRay<double>(ray.p0, ray.p1-ray.p0);
+}
+
+//##################################################################################################
+//! Solve a*t^2 + b*t + c = 0 avoiding cancellation, returns the roots in ascending order.
+template<typename T>
+bool solveQuadratic(T a, T b, T c, T& t0, T& t1)
+{
+  if(a==T(0))
+  {
+    if(b==T(0))
+      return false;
+    t0 = t1 = -c/b;
+    return true;
+  }
+
+  T discriminant = b*b - T(4)*a*c;
+  if(discriminant<T(0))
+    return false;
+
+  T q = T(-0.5) * (b + std::copysign(std::sqrt(discriminant), b));
+  t0 = q / a;
+  t1 = (q!=T(0))?(c / q):t0;
+  if(t0>t1)
+    std::swap(t0, t1);
+  return true;
+}
+
+//##################################################################################################
+//! Slab test against an axis aligned box, tNear is where the ray enters the box or tMin.
+/*!
+Rays that lie in the plane of a slab give NaNs that are ignored by the comparisons, so they count
+as inside that slab.
+*/
+template<typename T>
+bool rayBoxIntersection(const PreparedRay<T>& ray,
+                        const glm::vec<3,T>& min,
+                        const glm::vec<3,T>& max,
+                        T tMin,
+                        T tMax,
+                        T& tNear)
+{
+  for(int a=0; a<3; a++)
+  {
+    T t0 = (min[a] - ray.origin[a]) * ray.invDirection[a];
+    T t1 = (max[a] - ray.origin[a]) * ray.invDirection[a];
+    if(t0>t1)
+      std::swap(t0, t1);
+    tMin = (t0>tMin)?t0:tMin;
+    tMax = (t1<tMax)?t1:tMax;
+  }
+
+  tNear = tMin;
+  return tMin<=tMax;
+}
+
+//##################################################################################################
+//! Möller–Trumbore ray triangle test, hits from both sides are reported.
+/*!
+\param t The distance along the ray in units of the direction.
+\param u The barycentric weight of v1.
+\param v The barycentric weight of v2.
+*/
+template<typename T>
+bool rayTriangleIntersection(const PreparedRay<T>& ray,
+                             const glm::vec<3,T>& v0,
+                             const glm::vec<3,T>& v1,
+                             const glm::vec<3,T>& v2,
+                             T tMin,
+                             T tMax,
+                             T& t,
+                             T& u,
+                             T& v)
+{
+  glm::vec<3,T> e1 = v1 - v0;
+  glm::vec<3,T> e2 = v2 - v0;
+  glm::vec<3,T> p = glm::cross(ray.direction, e2);
+  T det = glm::dot(e1, p);
+  if(det==T(0))
+    return false;
+
+  T invDet = T(1) / det;
+  glm::vec<3,T> s = ray.origin - v0;
+  u = glm::dot(s, p) * invDet;
+  if(u<T(0) || u>T(1))
+    return false;
+
+  glm::vec<3,T> q = glm::cross(s, e1);
+  v = glm::dot(ray.direction, q) * invDet;
+  if(v<T(0) || u+v>T(1))
+    return false;
+
+  t = glm::dot(e2, q) * invDet;
+  return t>=tMin && t<=tMax;
+}
+
+//##################################################################################################
+//! Watertight ray triangle test (Woop, Benthin and Wald 2013).
+/*!
+Rays that pass through a shared edge or vertex hit at least one of the triangles that share it, the
+float version falls back to double for the edge tests when they land exactly on an edge. The
+results are the same as rayTriangleIntersection().
+*/
+template<typename T>
+bool rayTriangleIntersectionWatertight(const PreparedRay<T>& ray,
+                                       const glm::vec<3,T>& v0,
+                                       const glm::vec<3,T>& v1,
+                                       const glm::vec<3,T>& v2,
+                                       T tMin,
+                                       T tMax,
+                                       T& t,
+                                       T& u,
+                                       T& v)
+{
+  glm::vec<3,T> a = v0 - ray.origin;
+  glm::vec<3,T> b = v1 - ray.origin;
+  glm::vec<3,T> c = v2 - ray.origin;
+
+  T ax = a[ray.kx] - ray.sx*a[ray.kz];
+  T ay = a[ray.ky] - ray.sy*a[ray.kz];
+  T bx = b[ray.kx] - ray.sx*b[ray.kz];
+  T by = b[ray.ky] - ray.sy*b[ray.kz];
+  T cx = c[ray.kx] - ray.sx*c[ray.kz];
+  T cy = c[ray.ky] - ray.sy*c[ray.kz];
+
+  T eu = cx*by - cy*bx;
+  T ev = ax*cy - ay*cx;
+  T ew = bx*ay - by*ax;
+
+  if constexpr(std::is_same_v<T, float>)
+  {
+    if(eu==0.0f || ev==0.0f || ew==0.0f)
+    {
+      eu = float(double(cx)*double(by) - double(cy)*double(bx));
+      ev = float(double(ax)*double(cy) - double(ay)*double(cx));
+      ew = float(double(bx)*double(ay) - double(by)*double(ax));
+    }
+  }
+
+  if((eu<T(0) || ev<T(0) || ew<T(0)) && (eu>T(0) || ev>T(0) || ew>T(0)))
+    return false;
+
+  T det = eu + ev + ew;
+  if(det==T(0))
+    return false;
+
+  T az = ray.sz*a[ray.kz];
+  T bz = ray.sz*b[ray.kz];
+  T cz = ray.sz*c[ray.kz];
+
+  T invDet = T(1) / det;
+  t = (eu*az + ev*bz + ew*cz) * invDet;
+  if(!(t>=tMin && t<=tMax))
+    return false;
+
+  u = ev * invDet;
+  v = ew * invDet;
+  return true;
+}
+
+//##################################################################################################
+//! The first hit on a sphere in [tMin, tMax], rays that start inside hit the far side.
+template<typename T>
+bool raySphereIntersection(const PreparedRay<T>& ray,
+                           const glm::vec<3,T>& center,
+                           T radius,
+                           T tMin,
+                           T tMax,
+                           T& t)
+{
+  glm::vec<3,T> oc = ray.origin - center;
+  T t0{0};
+  T t1{0};
+  if(!solveQuadratic(glm::dot(ray.direction, ray.direction),
+                     T(2)*glm::dot(oc, ray.direction),
+                     glm::dot(oc, oc) - radius*radius,
+                     t0,
+                     t1))
+    return false;
+
+  t = (t0>=tMin)?t0:t1;
+  return t>=tMin && t<=tMax;
+}
+
+//##################################################################################################
+//! The first hit on a capped cone in [tMin, tMax], this works with both Cone and DCone.
+/*!
+The side is the surface between the two end radii, caps with a radius of 0 are points and are
+never hit. Cones with p0==p1 are never hit.
+*/
+template<typename T, typename ConeType>
+bool rayConeIntersection(const PreparedRay<T>& ray,
+                         const ConeType& cone,
+                         T tMin,
+                         T tMax,
+                         T& t)
+{
+  glm::vec<3,T> p0(cone.p0);
+  glm::vec<3,T> axis = glm::vec<3,T>(cone.p1) - p0;
+  T length = glm::length(axis);
+  if(!(length>T(0)))
+    return false;
+  axis /= length;
+
+  T r0 = T(cone.r0);
+  T slope = (T(cone.r1) - r0) / length;
+
+  // Split the origin and direction into along the axis and across it.
+  glm::vec<3,T> q = ray.origin - p0;
+  T hq = glm::dot(q, axis);
+  T hd = glm::dot(ray.direction, axis);
+  glm::vec<3,T> w0 = q - axis*hq;
+  glm::vec<3,T> wd = ray.direction - axis*hd;
+  T rq = r0 + slope*hq;
+  T rd = slope*hd;
+
+  bool found=false;
+  auto consider = [&](T candidate)
+  {
+    if(candidate>=tMin && candidate<=tMax && (!found || candidate<t))
+    {
+      t = candidate;
+      found = true;
+    }
+  };
+
+  T t0{0};
+  T t1{0};
+  if(solveQuadratic(glm::dot(wd, wd) - rd*rd,
+                    T(2)*(glm::dot(w0, wd) - rq*rd),
+                    glm::dot(w0, w0) - rq*rq,
+                    t0,
+                    t1))
+  {
+    for(T c : {t0, t1})
+    {
+      T h = hq + c*hd;
+      if(h>=T(0) && h<=length && rq+c*rd>=T(0))
+        consider(c);
+    }
+  }
+
+  if(hd!=T(0))
+  {
+    for(const auto& [h, r] : {std::pair<T, T>(T(0), r0), std::pair<T, T>(length, T(cone.r1))})
+    {
+      T c = (h - hq) / hd;
+      glm::vec<3,T> w = w0 + wd*c;
+      if(r>T(0) && glm::dot(w, w)<=r*r)
+        consider(c);
+    }
+  }
+
+  return found;
+}
+
+//##################################################################################################
+//! N rays stored as structure of arrays so each kernel processes all lanes in one vectorizable loop.
+/*!
+Use 4 or 8 lanes for float and 2 or 4 for double to match the common vector register widths. N must
+be a power of two.
+*/
+template<typename T, size_t N>
+struct RayPacket
+{
+  static_assert(N>0 && N<=32 && (N&(N-1))==0, "Lanes are aligned to the packet width so N must be a power of two, the hit mask holds up to 32 lanes.");
+
+  alignas(sizeof(T)*N) T ox[N];
+  alignas(sizeof(T)*N) T oy[N];
+  alignas(sizeof(T)*N) T oz[N];
+  alignas(sizeof(T)*N) T dx[N];
+  alignas(sizeof(T)*N) T dy[N];
+  alignas(sizeof(T)*N) T dz[N];
+  alignas(sizeof(T)*N) T ix[N];
+  alignas(sizeof(T)*N) T iy[N];
+  alignas(sizeof(T)*N) T iz[N];
+
+  //################################################################################################
+  void set(size_t lane, const glm::vec<3,T>& origin, const glm::vec<3,T>& direction)
+  {
+    ox[lane] = origin.x;
+    oy[lane] = origin.y;
+    oz[lane] = origin.z;
+    dx[lane] = direction.x;
+    dy[lane] = direction.y;
+    dz[lane] = direction.z;
+    ix[lane] = T(1)/direction.x;
+    iy[lane] = T(1)/direction.y;
+    iz[lane] = T(1)/direction.z;
+  }
+};
+
+typedef RayPacket<float, 4> RayPacket4f;
+typedef RayPacket<float, 8> RayPacket8f;
+typedef RayPacket<double, 4> RayPacket4d;
+
+//##################################################################################################
+//! Build a mask with a bit set for each lane that hit.
+template<size_t N>
+uint32_t hitMask(const bool* hit)
+{
+  uint32_t mask=0;
+  for(size_t i=0; i<N; i++)
+    mask |= uint32_t(hit[i])<<i;
+  return mask;
+}
+
+//##################################################################################################
+//! Slab test for each lane of a packet.
+/*!
+Each lane gives the same result as the single ray test, including rays that lie in a slab.
+\param tMax The far limit of each lane, for example the closest hit so far.
+\param tNear Set to the entry distance of each lane.
+\return A bit for each lane that hits the box.
+*/
+template<typename T, size_t N>
+uint32_t rayBoxIntersection(const RayPacket<T, N>& rays,
+                            const glm::vec<3,T>& min,
+                            const glm::vec<3,T>& max,
+                            const T* tMax,
+                            T* tNear)
+{
+  bool hit[N];
+  for(size_t i=0; i<N; i++)
+  {
+    T x0 = (min.x - rays.ox[i]) * rays.ix[i];
+    T x1 = (max.x - rays.ox[i]) * rays.ix[i];
+    T y0 = (min.y - rays.oy[i]) * rays.iy[i];
+    T y1 = (max.y - rays.oy[i]) * rays.iy[i];
+    T z0 = (min.z - rays.oz[i]) * rays.iz[i];
+    T z1 = (max.z - rays.oz[i]) * rays.iz[i];
+
+    // The same comparisons as the single ray test so that NaNs are ignored in the same way.
+    T lo = T(0);
+    T hi = tMax[i];
+    auto slab = [&](T t0, T t1)
+    {
+      T n = (t0>t1)?t1:t0;
+      T f = (t0>t1)?t0:t1;
+      lo = (n>lo)?n:lo;
+      hi = (f<hi)?f:hi;
+    };
+    slab(x0, x1);
+    slab(y0, y1);
+    slab(z0, z1);
+
+    tNear[i] = lo;
+    hit[i] = lo<=hi;
+  }
+  return hitMask<N>(hit);
+}
+
+//##################################################################################################
+//! Möller–Trumbore test of one triangle against each lane of a packet.
+/*!
+Lanes that hit closer than t[i] update t, u and v, lanes that miss are left unchanged so a packet
+can be tested against a list of triangles to find the closest hits.
+\return A bit for each lane that hit this triangle closer than before.
+*/
+template<typename T, size_t N>
+uint32_t rayTriangleIntersection(const RayPacket<T, N>& rays,
+                                 const glm::vec<3,T>& v0,
+                                 const glm::vec<3,T>& v1,
+                                 const glm::vec<3,T>& v2,
+                                 T* t,
+                                 T* u,
+                                 T* v)
+{
+  glm::vec<3,T> e1 = v1 - v0;
+  glm::vec<3,T> e2 = v2 - v0;
+
+  bool hit[N];
+  for(size_t i=0; i<N; i++)
+  {
+    // p = d x e2
+    T px = rays.dy[i]*e2.z - rays.dz[i]*e2.y;
+    T py = rays.dz[i]*e2.x - rays.dx[i]*e2.z;
+    T pz = rays.dx[i]*e2.y - rays.dy[i]*e2.x;
+    T det = e1.x*px + e1.y*py + e1.z*pz;
+    T invDet = T(1) / det;
+
+    T sx = rays.ox[i] - v0.x;
+    T sy = rays.oy[i] - v0.y;
+    T sz = rays.oz[i] - v0.z;
+    T uu = (sx*px + sy*py + sz*pz) * invDet;
+
+    // q = s x e1
+    T qx = sy*e1.z - sz*e1.y;
+    T qy = sz*e1.x - sx*e1.z;
+    T qz = sx*e1.y - sy*e1.x;
+    T vv = (rays.dx[i]*qx + rays.dy[i]*qy + rays.dz[i]*qz) * invDet;
+    T tt = (e2.x*qx + e2.y*qy + e2.z*qz) * invDet;
+
+    bool h = (det!=T(0)) & (uu>=T(0)) & (vv>=T(0)) & (uu+vv<=T(1)) & (tt>=T(0)) & (tt<t[i]);
+    t[i] = h?tt:t[i];
+    u[i] = h?uu:u[i];
+    v[i] = h?vv:v[i];
+    hit[i] = h;
+  }
+  return hitMask<N>(hit);
+}
+
+//##################################################################################################
+//! The first hit on a sphere for each lane of a packet, with the same update rules as triangles.
+template<typename T, size_t N>
+uint32_t raySphereIntersection(const RayPacket<T, N>& rays,
+                               const glm::vec<3,T>& center,
+                               T radius,
+                               T* t)
+{
+  bool hit[N];
+  for(size_t i=0; i<N; i++)
+  {
+    T ocx = rays.ox[i] - center.x;
+    T ocy = rays.oy[i] - center.y;
+    T ocz = rays.oz[i] - center.z;
+    T a = rays.dx[i]*rays.dx[i] + rays.dy[i]*rays.dy[i] + rays.dz[i]*rays.dz[i];
+    T b = ocx*rays.dx[i] + ocy*rays.dy[i] + ocz*rays.dz[i];
+    T c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+    T discriminant = b*b - a*c;
+    T root = std::sqrt(tpMax(discriminant, T(0)));
+    T t0 = (-b - root) / a;
+    T t1 = (-b + root) / a;
+    T tt = (t0>=T(0))?t0:t1;
+
+    bool h = (discriminant>=T(0)) & (a>T(0)) & (tt>=T(0)) & (tt<t[i]);
+    t[i] = h?tt:t[i];
+    hit[i] = h;
+  }
+  return hitMask<N>(hit);
+}
+
+}
+
+#endif
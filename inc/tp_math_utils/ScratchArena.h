@@ -0,0 +1,106 @@
+#ifndef tp_math_utils_ScratchArena_h
+#define tp_math_utils_ScratchArena_h
+
+#include "tp_math_utils/Globals.h"
+
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! Returns scratch or the default memory resource if scratch is null.
+inline std::pmr::memory_resource* scratchResource(std::pmr::memory_resource* scratch)
+{
+  return scratch?scratch:std::pmr::get_default_resource();
+}
+
+//##################################################################################################
+//! A reusable arena for the temporary buffers used while processing geometry.
+/*!
+Allocations are taken from a single buffer and only released by reset(), so a pipeline of
+operations can share one arena that is reset between meshes. If a batch of work overflows the
+buffer the extra is allocated from the heap and the buffer is grown to fit on the next reset, up to
+maxSize. After a few meshes the arena stops allocating altogether.
+
+This is not thread safe, use one arena per thread.
+*/
+class TP_MATH_UTILS_EXPORT ScratchArena
+{
+  TP_NONCOPYABLE(ScratchArena);
+public:
+  //################################################################################################
+  ScratchArena(size_t initialSize=1024*1024, size_t maxSize=64*1024*1024);
+
+  //################################################################################################
+  ~ScratchArena();
+
+  //################################################################################################
+  //! The memory resource to pass to functions that accept scratch memory.
+  std::pmr::memory_resource* resource();
+
+  //################################################################################################
+  //! Release everything allocated from the arena, growing the buffer if it overflowed.
+  void reset();
+
+  //################################################################################################
+  //! Release everything allocated from the arena and shrink the buffer back to its initial size.
+  void release();
+
+  //################################################################################################
+  //! The size of the buffer, excluding overflow.
+  size_t capacity() const;
+
+  //################################################################################################
+  //! Bytes allocated from the heap since the last reset because the buffer was full.
+  size_t overflow() const;
+
+  //################################################################################################
+  //! An arena for the current thread, worker threads keep theirs until they exit.
+  /*!
+  The workers of ParallelPool release their arenas at the end of each parallel call, so they are
+  only reused for the meshes that they process within one batch. Reuse across batches only helps
+  the calling thread, hold a ThreadLocalScope for the length of a batch so that the memory this
+  arena grows by is released once the batch is done.
+  */
+  static ScratchArena& threadLocal();
+
+  //################################################################################################
+  //! Marks a use of threadLocal(), the arena is released when the outermost scope on a thread ends.
+  class TP_MATH_UTILS_EXPORT ThreadLocalScope
+  {
+    TP_NONCOPYABLE(ThreadLocalScope);
+  public:
+    //##############################################################################################
+    ThreadLocalScope();
+
+    //##############################################################################################
+    ~ThreadLocalScope();
+  };
+
+private:
+  //################################################################################################
+  //! Counts the overflow allocations made by the monotonic resource.
+  class Upstream : public std::pmr::memory_resource
+  {
+  public:
+    size_t allocated{0};
+
+  protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+  };
+
+  Upstream m_upstream;
+  size_t m_initialSize;
+  size_t m_maxSize;
+  std::vector<std::byte> m_buffer;
+  std::optional<std::pmr::monotonic_buffer_resource> m_resource;
+};
+
+}
+
+#endif
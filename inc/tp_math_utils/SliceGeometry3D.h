@@ -0,0 +1,49 @@
+#ifndef tp_math_utils_SliceGeometry3D_h
+#define tp_math_utils_SliceGeometry3D_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+namespace tp_math_utils
+{
+class Plane;
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Polyline3D
+{
+  std::vector<glm::vec3> points;
+  bool closed{false}; //!< If true the last point connects back to the first.
+};
+
+//##################################################################################################
+//! Intersect geometry with a plane.
+/*!
+Each mesh edge that crosses the plane produces a single point that is shared by the triangles on
+either side of it, these are then linked into polylines. Verts at exactly the same position are
+treated as one, so duplicated verts at seams do not break the polylines. Verts exactly on the plane
+are treated as being on the positive side of it and are shared by all of the triangles around them.
+
+\param geometry The mesh to slice.
+\param plane The cutting plane.
+\return Closed loops and open polylines where the surface is not closed.
+*/
+std::vector<Polyline3D> TP_MATH_UTILS_EXPORT sliceGeometry3D(const Geometry3D& geometry,
+                                                            const Plane& plane);
+
+//##################################################################################################
+//! Intersect geometry with a batch of parallel planes.
+/*!
+Slice i is cut by plane moved offsets[i] along its normal. Each triangle is only tested against the
+slices that it spans and the slices are processed in parallel.
+
+\param geometry The mesh to slice.
+\param plane The plane that the offsets are relative to.
+\param offsets The distance of each slice along the normal of the plane.
+\return The polylines for each slice.
+*/
+std::vector<std::vector<Polyline3D>> TP_MATH_UTILS_EXPORT sliceGeometry3D(const Geometry3D& geometry,
+                                                                         const Plane& plane,
+                                                                         const std::vector<float>& offsets);
+
+}
+
+#endif
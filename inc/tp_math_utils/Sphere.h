@@ -3,18 +3,29 @@
 
 #include "tp_math_utils/Geometry3D.h"
 
+#include <memory>
+
 namespace tp_math_utils
 {
 
+//##################################################################################################
+//! The polyhedron that a sphere is built from.
+enum class SphereType
+{
+  Tetrahedral,
+  Octahedral,
+  Icosahedral
+};
+
 //##################################################################################################
 struct TP_MATH_UTILS_EXPORT Sphere
 {
   //################################################################################################
-  //static Geometry3D icosahedralClass1(float radius,
-  //                                    size_t division,
-  //                                    int triangleFan,
-  //                                    int triangleStrip,
-  //                                    int triangles);
+  static Geometry3D icosahedralClass1(float radius,
+                                      size_t division,
+                                      int triangleFan,
+                                      int triangleStrip,
+                                      int triangles);
 
   //################################################################################################
   static Geometry3D octahedralClass1(float radius,
@@ -30,6 +41,32 @@ struct TP_MATH_UTILS_EXPORT Sphere
                                       int triangleStrip,
                                       int triangles);
 
+  //################################################################################################
+  //! Build a class 1 geodesic sphere, each face of the polyhedron is split into division^2 triangles.
+  /*!
+  Verts are indexed as they are generated: the corners, then the verts along each edge and then the
+  verts inside each face, so verts on shared edges are only generated once. Normals point out from
+  the center and texture coordinates are the same as indexAndScale().
+  */
+  static Geometry3D class1(SphereType type,
+                           float radius,
+                           size_t division,
+                           int triangleFan,
+                           int triangleStrip,
+                           int triangles);
+
+  //################################################################################################
+  //! A shared unit sphere, each combination of parameters is only generated once.
+  /*!
+  This is thread safe. Scale or transform a copy of the result, or draw it instanced, rather than
+  generating a new sphere for each marker.
+  */
+  static std::shared_ptr<const Geometry3D> unitSphere(SphereType type,
+                                                      size_t division,
+                                                      int triangleFan,
+                                                      int triangleStrip,
+                                                      int triangles);
+
   //################################################################################################
   static void divideClass1(size_t division,
                            const glm::vec3& a,
@@ -38,6 +75,7 @@ struct TP_MATH_UTILS_EXPORT Sphere
                            std::vector<glm::vec3>& verts);
 
   //################################################################################################
+  //! Index a triangle list merging verts that are within 0.000001 of each other.
   static Geometry3D indexAndScale(float radius,
                                   int triangleFan,
                                   int triangleStrip,
@@ -0,0 +1,59 @@
+#ifndef tp_math_utils_SplitGeometry3D_h
+#define tp_math_utils_SplitGeometry3D_h
+
+#include "tp_math_utils/Geometry3D.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! Split geometry into its connected components.
+/*!
+Triangles are connected if they share a vertex index, if connectByPosition is true they are also
+connected if they have verts at exactly the same position, this keeps UV seams together. Each
+component is returned as a triangle list with the material and comments of the input. Triangles
+that reference verts out of range are dropped.
+
+\param geometry The mesh to split.
+\param connectByPosition Also connect triangles that share a position but not a vertex index.
+\return One Geometry3D per component in the order that they first appear in the input.
+*/
+std::vector<Geometry3D> TP_MATH_UTILS_EXPORT splitConnectedComponents(const Geometry3D& geometry,
+                                                                      bool connectByPosition=true);
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DChunkParams
+{
+  size_t maxTriangles{65536}; //!< Cells with more triangles than this are split in 8.
+  size_t maxDepth{16};        //!< Maximum number of times that a cell can be split.
+  bool shareBoundaryVerts{false}; //!< Populate Geometry3DChunk::sharedVerts.
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT Geometry3DChunk
+{
+  Geometry3D geometry;           //!< The triangles whose centroid is in this cell.
+  std::vector<int> vertexMap;    //!< The index in the source geometry of each vert in this chunk.
+  std::vector<int> sharedVerts;  //!< Local indexes of verts that are also used by other chunks.
+
+  size_t depth{0};               //!< The octree depth of the cell, cells are size/2^depth.
+  glm::ivec3 cell{0, 0, 0};      //!< The cell coordinate on the grid at this depth.
+  glm::vec3 min{0.0f, 0.0f, 0.0f}; //!< Bounds of the cell, triangles may extend past this.
+  glm::vec3 max{0.0f, 0.0f, 0.0f}; //!< Bounds of the cell, triangles may extend past this.
+};
+
+//##################################################################################################
+//! Cut a mesh into grid aligned chunks with a bounded number of triangles.
+/*!
+Triangles are assigned to cells by their centroid. The bounds of the mesh are placed in a cube that
+is recursively split into 8 until each cell has at most maxTriangles triangles, so every chunk is
+aligned to a regular grid at its depth. Verts used by triangles in more than one chunk are copied
+into each of them, with shareBoundaryVerts these are listed in sharedVerts so that per chunk
+results can be stitched back together using vertexMap. Chunks are built in parallel.
+*/
+std::vector<Geometry3DChunk> TP_MATH_UTILS_EXPORT chunkGeometry3D(const Geometry3D& geometry,
+                                                                  const Geometry3DChunkParams& params=Geometry3DChunkParams());
+
+}
+
+#endif
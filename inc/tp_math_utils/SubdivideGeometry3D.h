@@ -2,6 +2,7 @@
 #define tp_math_utils_SubdivideGeometry3D_h
 
 #include "tp_math_utils/Geometry3D.h"
+#include "tp_math_utils/ParallelFor.h"
 
 #include "tp_utils/DebugUtils.h"
 #include "tp_utils/TimeUtils.h"
@@ -15,6 +16,41 @@
 namespace tp_math_utils
 {
 
+//##################################################################################################
+//! Limits for a call to SubdivideGeometry3D::divideFor(), zero means no limit.
+struct SubdivideBudget
+{
+  int64_t timeMS{0};        //!< Stop once this much time has passed.
+  size_t maxTriangles{0};   //!< Stop once there are at least this many triangles.
+  float targetLength{0.0f}; //!< Stop once no edge is longer than this, it can't go below maxLength.
+  bool parallel{false};     //!< Use divideRound() rather than divideOnce(), rounds may overshoot.
+};
+
+//##################################################################################################
+enum class SubdivideStopReason
+{
+  Done,      //!< There are no more edges to divide.
+  Time,      //!< The time budget ran out.
+  Triangles, //!< The triangle budget was reached.
+  Length     //!< The longest edge is no longer than the target length.
+};
+
+//##################################################################################################
+//! The result of a call to SubdivideGeometry3D::divideFor().
+struct SubdivideProgress
+{
+  SubdivideStopReason stopReason{SubdivideStopReason::Done};
+  size_t trianglesAdded{0}; //!< Extra triangles generated by this call.
+  size_t triangleCount{0};  //!< Triangles in the result so far.
+  float longestEdge{0.0f};  //!< The longest edge still waiting to be divided.
+
+  //################################################################################################
+  bool done() const
+  {
+    return stopReason == SubdivideStopReason::Done;
+  }
+};
+
 //##################################################################################################
 template<typename TriangleVisible, typename EdgeLength>
 class SubdivideGeometry3D
@@ -25,6 +61,7 @@ class SubdivideGeometry3D
   enum class MIdx : size_t {}; //!< Index into the mesh array.      (m_geometry->indexes[MIdx])
 
   struct Edge_lt;
+  struct RoundSplit_lt;
 
   struct Triangle_lt
   {
@@ -42,8 +79,10 @@ class SubdivideGeometry3D
     std::vector<TIdx> iTs; //!< Indexes of triangles that share this edge.
     PIdx iPs[2];
     float length;
+    size_t order{0};       //!< Creation order, breaks ties between edges of the same length.
+    bool queued{false};    //!< True while the edge is waiting in the queue to be divided.
 
-    bool contains(PIdx iP)
+    bool contains(PIdx iP) const
     {
       return (iPs[0] == iP) || (iPs[1] == iP);
     }
@@ -54,41 +93,19 @@ public:
   SubdivideGeometry3D(Geometry3D* geometry,
                       TriangleVisible triangleVisible,
                       EdgeLength edgeLength,
-                      float maxLength):
+                      float maxLength,
+                      std::pmr::memory_resource* scratch=nullptr):
     m_geometry(geometry),
     m_triangleVisible(triangleVisible),
     m_edgeLength(edgeLength),
     m_maxLength(maxLength)
   {
-    geometry->convertToTriangles();
+    geometry->convertToTriangles(scratch);
 
-    // Add all of the verts
-    // We don't know how many verts we are actually going to generate so lets allocate a bit of
-    // extra space and hope for the best.
-    m_positionLookup.reserve(m_geometry->verts.size()*2);
-    m_positions.reserve(m_geometry->verts.size()*2);
-    for(size_t i=0; i<m_geometry->verts.size(); i++)
-    {
-      const auto& v = m_geometry->verts.at(i);
+    // Once the input has been validated all of the indexes that we generate will be in range.
+    m_checked = !(geometry->validated() || geometry->validate());
 
-      // Try to find an existing position that is similar or the same as this.
-      bool foundExisting=false;
-      for(size_t j=0; j<m_positions.size(); j++)
-      {
-        if(glm::distance2(m_positions.at(j), v.vert) < 0.000001f)
-        {
-          m_positionLookup.push_back(PIdx(j));
-          foundExisting = true;
-          break;
-        }
-      }
-
-      if(foundExisting)
-        continue;
-
-      m_positionLookup.push_back(PIdx(m_positions.size()));
-      m_positions.push_back(v.vert);
-    }
+    buildPositionLookup();
 
     // Add triangles and edges
     {
@@ -101,16 +118,16 @@ public:
 
       for(size_t iM=0; iM<geometry->indexes.size(); iM++)
       {
-        const auto& mesh = geometry->indexes.at(iM);
+        const auto& mesh = geometry->indexes[iM];
 
         for(size_t c=0; (c+2)<mesh.indexes.size(); c+=3)
         {
           Triangle_lt& triangle = m_triangles.emplace_back();
           triangle.iM = MIdx(iM);
 
-          VIdx i0 = VIdx(mesh.indexes.at(c));
-          VIdx i1 = VIdx(mesh.indexes.at(c+1));
-          VIdx i2 = VIdx(mesh.indexes.at(c+2));
+          VIdx i0 = VIdx(mesh.indexes[c]);
+          VIdx i1 = VIdx(mesh.indexes[c+1]);
+          VIdx i2 = VIdx(mesh.indexes[c+2]);
 
           const glm::vec3& v0 = vertex(i0).vert;
           const glm::vec3& v1 = vertex(i1).vert;
@@ -122,8 +139,8 @@ public:
 
           triangle.visible = m_triangleVisible(v0, v1, v2);
 
-          std::unordered_set<Edge_lt*> dirtyEdges;
-          linkLastTriangle(dirtyEdges);
+          linkLastTriangle(m_dirtyEdges);
+          m_dirtyEdges.clear();
         }
       }
     }
@@ -138,21 +155,18 @@ public:
   */
   size_t divideOnce()
   {
-    if(m_edges.empty())
+    if(m_edgeQueue.empty())
       return 0;
 
     size_t count=0;
 
-    std::unique_ptr<Edge_lt> edge = tpTakeLast(m_edges);
-
-    struct ExistingNewVerts
-    {
-      VIdx iVs[2];
-      VIdx iVNew;
-    };
+    Edge_lt* edge = takeLongestEdge();
 
-    std::vector<ExistingNewVerts> midVerts;
-    std::unordered_set<Edge_lt*> dirtyEdges;
+    // The scratch buffers are members so that they keep their capacity between calls.
+    auto& midVerts = m_midVerts;
+    auto& dirtyEdges = m_dirtyEdges;
+    midVerts.clear();
+    dirtyEdges.clear();
     {
       // Calculate the midpoint
       glm::vec3 p0 = position(edge->iPs[0]);
@@ -168,10 +182,11 @@ public:
           continue;
 
         t.exclude = true;
+        m_excludedCount++;
 
-        if(t.edges[0])dirtyEdges.insert(t.edges[0]);
-        if(t.edges[1])dirtyEdges.insert(t.edges[1]);
-        if(t.edges[2])dirtyEdges.insert(t.edges[2]);
+        if(t.edges[0])dirtyEdges.push_back(t.edges[0]);
+        if(t.edges[1])dirtyEdges.push_back(t.edges[1]);
+        if(t.edges[2])dirtyEdges.push_back(t.edges[2]);
 
         for(size_t a=0; a<3; a++)
         {
@@ -231,6 +246,189 @@ public:
 
     removeDeadEdges(dirtyEdges);
 
+    // The divided edge has been unlinked from all of its triangles and can now be reused.
+    unlinkEdge(edge);
+    m_freeEdges.push_back(edge);
+
+    return count;
+  }
+
+  //################################################################################################
+  //! Divide a set of the longest edges that don't share any triangles, in parallel.
+  /*!
+  Edges are taken from the queue longest first down to half the length of the longest edge, shorter
+  edges would be queued behind the halves of the edges split in this round anyway. Edges that share
+  a triangle with an edge that has already been picked are put back in the queue. The new verts and
+  triangles for each edge are calculated in parallel and then added in the order that the edges
+  were picked.
+
+  This calls TriangleVisible and EdgeLength from several threads so they must be thread safe.
+
+  \return The number of extra triangles generated.
+  */
+  size_t divideRound()
+  {
+    popDeadEdges();
+    if(m_edgeQueue.empty())
+      return 0;
+
+    // Pick edges that don't share triangles, so each triangle is split at most once per round.
+    auto& skipped = m_roundSkipped;
+    skipped.clear();
+    auto& used = m_roundTriangleUsed;
+    used.resize(m_triangles.size(), 0);
+    float minLength = m_edgeQueue.front().length*0.5f;
+    size_t nSplits=0;
+    while(!m_edgeQueue.empty() && m_edgeQueue.front().length>minLength)
+    {
+      QueueEntry_lt entry = m_edgeQueue.front();
+      std::pop_heap(m_edgeQueue.begin(), m_edgeQueue.end(), QueueEntry_lt::less);
+      m_edgeQueue.pop_back();
+
+      if(!entry.live())
+        continue;
+
+      Edge_lt* e = entry.edge;
+
+      bool independent=true;
+      for(TIdx iT : e->iTs)
+      {
+        if(!triangle(iT).exclude && used[size_t(iT)])
+        {
+          independent = false;
+          break;
+        }
+      }
+
+      if(!independent)
+      {
+        skipped.push_back(entry);
+        continue;
+      }
+
+      for(TIdx iT : e->iTs)
+        used[size_t(iT)] = 1;
+
+      if(nSplits == m_roundSplits.size())
+        m_roundSplits.emplace_back();
+      m_roundSplits[nSplits++].edge = e;
+
+      e->queued = false;
+      m_edgeLookup.erase({e->iPs[0], e->iPs[1], e->length});
+    }
+
+    for(const auto& entry : skipped)
+    {
+      m_edgeQueue.push_back(entry);
+      std::push_heap(m_edgeQueue.begin(), m_edgeQueue.end(), QueueEntry_lt::less);
+    }
+
+    // Only clear the flags that were set so that a round costs time in proportion to its splits.
+    for(size_t i=0; i<nSplits; i++)
+      for(TIdx iT : m_roundSplits[i].edge->iTs)
+        used[size_t(iT)] = 0;
+
+    parallelForBlocks(nSplits, 64, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t i=begin; i<end; i++)
+        calculateSplit(m_roundSplits[i]);
+    });
+
+    size_t count=0;
+    auto& dirtyEdges = m_dirtyEdges;
+    dirtyEdges.clear();
+    for(size_t i=0; i<nSplits; i++)
+    {
+      const auto& split = m_roundSplits[i];
+
+      PIdx iPNew = PIdx(m_positions.size());
+      m_positions.push_back(split.position);
+
+      size_t firstNewVert = m_geometry->verts.size();
+      for(const auto& newVert : split.newVerts)
+      {
+        m_positionLookup.push_back(iPNew);
+        m_geometry->verts.push_back(newVert);
+      }
+
+      for(const auto& child : split.children)
+      {
+        MIdx iM;
+        {
+          Triangle_lt& t = triangle(child.iT);
+          t.exclude = true;
+          m_excludedCount++;
+          iM = t.iM;
+
+          if(t.edges[0])dirtyEdges.push_back(t.edges[0]);
+          if(t.edges[1])dirtyEdges.push_back(t.edges[1]);
+          if(t.edges[2])dirtyEdges.push_back(t.edges[2]);
+        }
+
+        VIdx iVNew = VIdx(firstNewVert + child.newVert);
+        const VIdx iVs[2][3] =
+        {
+          {child.iVs[0], iVNew, child.iVs[2]},
+          {iVNew, child.iVs[1], child.iVs[2]}
+        };
+
+        for(size_t c=0; c<2; c++)
+        {
+          if(!child.valid[c])
+            continue;
+
+          Triangle_lt& newTriangle = m_triangles.emplace_back();
+          newTriangle.iM = iM;
+          newTriangle.iVs[0] = iVs[c][0];
+          newTriangle.iVs[1] = iVs[c][1];
+          newTriangle.iVs[2] = iVs[c][2];
+          newTriangle.visible = child.visible[c];
+          newTriangle.lengths[0] = child.lengths[c][0];
+          newTriangle.lengths[1] = child.lengths[c][1];
+          newTriangle.lengths[2] = child.lengths[c][2];
+          linkLastTriangleEdges(dirtyEdges);
+        }
+
+        count++;
+      }
+    }
+
+    removeDeadEdges(dirtyEdges);
+
+    for(size_t i=0; i<nSplits; i++)
+    {
+      Edge_lt* e = m_roundSplits[i].edge;
+      unlinkEdge(e);
+      m_freeEdges.push_back(e);
+    }
+
+    return count;
+  }
+
+  //################################################################################################
+  //! Call divideRound() until there are no edges left that are longer than the max length.
+  /*!
+  Split triangles are kept until reindex() is called, between rounds they are compacted once they
+  outnumber the live triangles. The result is not the same as calling divideOnce() in a loop, the
+  edges are split in a different order, but every edge ends up shorter than the max length.
+
+  \param maxRounds Stop after this many rounds, 0 means keep going until done.
+  \return The number of extra triangles generated.
+  */
+  size_t divideAll(size_t maxRounds=0)
+  {
+    size_t count=0;
+    for(size_t round=0; !maxRounds || round<maxRounds; round++)
+    {
+      size_t c = divideRound();
+      if(!c)
+        break;
+
+      count += c;
+
+      if(m_excludedCount*2 > m_triangles.size())
+        reindex(m_maxLength);
+    }
     return count;
   }
 
@@ -238,7 +436,7 @@ public:
   void reindex(float lengthF)
   {
     m_maxLength = lengthF;
-    m_edges.clear();
+    clearEdges();
 
     auto triangleExcluded = [&](const Triangle_lt& t)
     {
@@ -246,6 +444,7 @@ public:
     };
 
     m_triangles.erase(std::remove_if(m_triangles.begin(), m_triangles.end(), triangleExcluded), m_triangles.end());
+    m_excludedCount = 0;
 
     struct Positions
     {
@@ -273,7 +472,91 @@ public:
   //! Write the results back to the geometry.
   void finalize()
   {
-    for(auto& mesh : m_geometry->indexes)
+    writeIndexes(m_geometry->indexes);
+  }
+
+  //################################################################################################
+  //! Write the current state to a copy of the geometry, subdivision can carry on afterwards.
+  void finalize(Geometry3D& snapshot) const
+  {
+    snapshot.comments = m_geometry->comments;
+    snapshot.verts = m_geometry->verts;
+    snapshot.indexes.resize(m_geometry->indexes.size());
+    for(size_t m=0; m<snapshot.indexes.size(); m++)
+      snapshot.indexes[m].type = m_geometry->indexes[m].type;
+    snapshot.triangleFan = m_geometry->triangleFan;
+    snapshot.triangleStrip = m_geometry->triangleStrip;
+    snapshot.triangles = m_geometry->triangles;
+    snapshot.material = m_geometry->material;
+    writeIndexes(snapshot.indexes);
+  }
+
+  //################################################################################################
+  float longestEdge() const
+  {
+    return m_edgeQueue.empty()?0.0f:m_edgeQueue.front().length;
+  }
+
+  //################################################################################################
+  //! The number of triangles that finalize() would write.
+  size_t triangleCount() const
+  {
+    return m_triangles.size() - m_excludedCount;
+  }
+
+  //################################################################################################
+  //! Divide the longest edges until there is nothing left to do or the budget runs out.
+  /*!
+  State is kept between calls so this can be called repeatedly, for example once per frame, each
+  call carries on from where the last one stopped. Use finalize(Geometry3D&) to get the partial
+  result without ending the subdivision.
+  */
+  SubdivideProgress divideFor(const SubdivideBudget& budget)
+  {
+    SubdivideProgress progress;
+    const int64_t endTime = tp_utils::currentTimeMS() + budget.timeMS;
+
+    for(size_t i=0; ; i++)
+    {
+      if(m_edgeQueue.empty())
+      {
+        progress.stopReason = SubdivideStopReason::Done;
+        break;
+      }
+
+      if(budget.targetLength>0.0f && longestEdge()<=budget.targetLength)
+      {
+        progress.stopReason = SubdivideStopReason::Length;
+        break;
+      }
+
+      if(budget.maxTriangles && triangleCount()>=budget.maxTriangles)
+      {
+        progress.stopReason = SubdivideStopReason::Triangles;
+        break;
+      }
+
+      // Reading the clock costs more than a single split so only check it every few splits.
+      if(budget.timeMS>0 && (budget.parallel || (i%16)==0) && tp_utils::currentTimeMS()>=endTime)
+      {
+        progress.stopReason = SubdivideStopReason::Time;
+        break;
+      }
+
+      progress.trianglesAdded += budget.parallel?divideRound():divideOnce();
+    }
+
+    progress.triangleCount = triangleCount();
+    progress.longestEdge = longestEdge();
+    return progress;
+  }
+
+private:
+
+  //################################################################################################
+  void writeIndexes(Indexes3DList& indexes) const
+  {
+    for(auto& mesh : indexes)
       mesh.indexes.clear();
 
     {
@@ -282,8 +565,8 @@ public:
         if(!triangle.exclude)
           meshSize[size_t(triangle.iM)] += 3;
 
-      for(size_t m=0; m<m_geometry->indexes.size(); m++)
-        m_geometry->indexes.at(m).indexes.reserve(meshSize[m]);
+      for(size_t m=0; m<indexes.size(); m++)
+        indexes.at(m).indexes.reserve(meshSize[m]);
     }
 
     for(const auto& triangle : m_triangles)
@@ -291,7 +574,7 @@ public:
       if(triangle.exclude)
         continue;
 
-      auto& mesh = m_geometry->indexes.at(size_t(triangle.iM));
+      auto& mesh = indexes.at(size_t(triangle.iM));
 
       for(size_t i=0; i<3; i++)
         mesh.indexes.push_back(int(triangle.iVs[i]));
@@ -299,15 +582,222 @@ public:
   }
 
   //################################################################################################
-  float longestEdge() const
+  //! Merge verts that share a position, verts closer than 0.001 map to the first position found.
+  /*!
+  Positions are bucketed in a hash grid with cells slightly larger than the tolerance so only the
+  27 neighbouring cells need checking. Each vert takes the earliest position within the tolerance,
+  the same as comparing against every position in order.
+  */
+  void buildPositionLookup()
   {
-    return m_edges.empty()?0.0f:m_edges.back()->length;
+    const auto& verts = m_geometry->verts;
+
+    // We don't know how many verts we are actually going to generate so lets allocate a bit of
+    // extra space and hope for the best.
+    m_positionLookup.reserve(verts.size()*2);
+    m_positions.reserve(verts.size()*2);
+
+    constexpr double cellSize = 0.001001;
+    constexpr double cellLimit = 4.0e18;
+
+    struct Cell_lt
+    {
+      int64_t c[3];
+    };
+
+    auto cellHash = [](int64_t x, int64_t y, int64_t z)
+    {
+      uint64_t h = uint64_t(x) * 0x9E3779B97F4A7C15ull;
+      h ^= uint64_t(y) * 0xC2B2AE3D27D4EB4Full + (h<<6) + (h>>2);
+      h ^= uint64_t(z) * 0x165667B19E3779F9ull + (h<<6) + (h>>2);
+      return h;
+    };
+
+    // Work out the cell of each vert in parallel, the assignment below has to be done in order.
+    std::vector<Cell_lt> cells(verts.size());
+    std::vector<uint8_t> finite(verts.size());
+    parallelForBlocks(verts.size(), 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t i=begin; i<end; i++)
+      {
+        const glm::vec3& v = verts[i].vert;
+        finite[i] = std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+        if(!finite[i])
+          continue;
+
+        // Clamping merges far away cells, that only adds candidates that fail the distance test.
+        for(int a=0; a<3; a++)
+          cells[i].c[a] = int64_t(std::clamp(std::floor(double(v[a])/cellSize), -cellLimit, cellLimit));
+      }
+    });
+
+    // Each cell points at its first position, positions in a cell are chained in ascending order.
+    std::unordered_map<uint64_t, size_t> firstInCell;
+    std::vector<size_t> nextInCell;
+    firstInCell.reserve(verts.size());
+    nextInCell.reserve(verts.size());
+    constexpr size_t none = ~size_t(0);
+
+    for(size_t i=0; i<verts.size(); i++)
+    {
+      const glm::vec3& v = verts[i].vert;
+
+      // Positions that are not finite never compare as close to anything.
+      if(!finite[i])
+      {
+        m_positionLookup.push_back(PIdx(m_positions.size()));
+        m_positions.push_back(v);
+        nextInCell.push_back(none);
+        continue;
+      }
+
+      const auto& cell = cells[i];
+      size_t found = none;
+      for(int64_t x=-1; x<=1; x++)
+      {
+        for(int64_t y=-1; y<=1; y++)
+        {
+          for(int64_t z=-1; z<=1; z++)
+          {
+            auto c = firstInCell.find(cellHash(cell.c[0]+x, cell.c[1]+y, cell.c[2]+z));
+            if(c == firstInCell.end())
+              continue;
+
+            for(size_t j=c->second; j!=none && j<found; j=nextInCell[j])
+            {
+              if(glm::distance2(m_positions[j], v) < 0.000001f)
+              {
+                found = j;
+                break;
+              }
+            }
+          }
+        }
+      }
+
+      if(found != none)
+      {
+        m_positionLookup.push_back(PIdx(found));
+        continue;
+      }
+
+      size_t j = m_positions.size();
+      m_positionLookup.push_back(PIdx(j));
+      m_positions.push_back(v);
+      nextInCell.push_back(none);
+
+      auto h = cellHash(cell.c[0], cell.c[1], cell.c[2]);
+      if(auto c = firstInCell.find(h); c != firstInCell.end())
+      {
+        // Positions in a cell are at least the tolerance apart so chains are short.
+        size_t last = c->second;
+        while(nextInCell[last] != none)
+          last = nextInCell[last];
+        nextInCell[last] = j;
+      }
+      else
+        firstInCell.emplace(h, j);
+    }
   }
 
-private:
+  //################################################################################################
+  //! Calculate the verts and triangles generated by splitting an edge, this only reads state.
+  void calculateSplit(RoundSplit_lt& split)
+  {
+    split.newVerts.clear();
+    split.midVerts.clear();
+    split.children.clear();
+
+    const Edge_lt* edge = split.edge;
+    const glm::vec3 p0 = position(edge->iPs[0]);
+    const glm::vec3 p1 = position(edge->iPs[1]);
+    split.position = (p0 + p1) / 2.0f;
+
+    for(TIdx iT : edge->iTs)
+    {
+      const Triangle_lt& t = triangle(iT);
+      if(t.exclude)
+        continue;
+
+      // Rotate the corners until the edge is between the first two, the same as divideOnce.
+      VIdx iVs[3] = {t.iVs[0], t.iVs[1], t.iVs[2]};
+      for(size_t a=0; a<3; a++)
+      {
+        if(edge->contains(positionIndex(iVs[0])) && edge->contains(positionIndex(iVs[1])))
+        {
+          VIdx iV0 = iVs[0];
+          VIdx iV1 = iVs[1];
+          if(iV1<iV0)
+            std::swap(iV0, iV1);
+
+          auto& child = split.children.emplace_back();
+          child.iT = iT;
+          child.iVs[0] = iVs[0];
+          child.iVs[1] = iVs[1];
+          child.iVs[2] = iVs[2];
+
+          auto midVert = std::find_if(split.midVerts.begin(), split.midVerts.end(), [&](const auto& m)
+          {
+            return m.iVs[0] == iV0 && m.iVs[1] == iV1;
+          });
+
+          if(midVert != split.midVerts.end())
+            child.newVert = size_t(midVert->iVNew);
+          else
+          {
+            child.newVert = split.newVerts.size();
+            split.midVerts.push_back({{iV0, iV1}, VIdx(child.newVert)});
+
+            auto& newVert = split.newVerts.emplace_back();
+            newVert.vert    = split.position;
+            const auto& v0 = vertex(iV0);
+            const auto& v1 = vertex(iV1);
+            newVert.texture = (v0.texture + v1.texture) / 2.0f;
+            newVert.normal  = glm::normalize(v0.normal  + v1.normal);
+          }
+
+          const glm::vec3& pNew = split.position;
+          const glm::vec3& c0 = position(iVs[0]);
+          const glm::vec3& c1 = position(iVs[1]);
+          const glm::vec3& c2 = position(iVs[2]);
+          const glm::vec3* ps[2][3] =
+          {
+            {&c0, &pNew, &c2},
+            {&pNew, &c1, &c2}
+          };
+
+          // The same checks as linkLastTriangle, the corners are distinct as the parent was valid.
+          for(size_t c=0; c<2; c++)
+          {
+            const auto& a0 = *ps[c][0];
+            const auto& a1 = *ps[c][1];
+            const auto& a2 = *ps[c][2];
+            double area2 = triangleArea2(a0, a1, a2);
+            child.valid[c] = !(area2 < 0.00000000000000001);
+            if(!child.valid[c])
+              continue;
+
+            child.visible[c] = t.visible?m_triangleVisible(a0, a1, a2):false;
+            if(child.visible[c] && area2<0.000000000000001)
+              child.visible[c] = false;
+
+            child.lengths[c][0] = m_edgeLength(a0, a1);
+            child.lengths[c][1] = m_edgeLength(a1, a2);
+            child.lengths[c][2] = m_edgeLength(a2, a0);
+          }
+          break;
+        }
+
+        VIdx iV  = iVs[0];
+        iVs[0] = iVs[1];
+        iVs[1] = iVs[2];
+        iVs[2] = iV;
+      }
+    }
+  }
 
   //################################################################################################
-  void splitTriangle(const Triangle_lt t, VIdx iVNew, std::unordered_set<Edge_lt*>& dirtyEdges)
+  void splitTriangle(const Triangle_lt t, VIdx iVNew, std::vector<Edge_lt*>& dirtyEdges)
   {
     // We know that the edge that needs cutting is between t.verts[0] and t.verts[1] because the
     // triangle is rotated until this is true by divideOnce.
@@ -350,10 +840,12 @@ private:
   //################################################################################################
   double triangleArea2(const Triangle_lt& triangle)
   {
-    glm::dvec3 v0 = position(triangle.iVs[0]);
-    glm::dvec3 v1 = position(triangle.iVs[1]);
-    glm::dvec3 v2 = position(triangle.iVs[2]);
+    return triangleArea2(position(triangle.iVs[0]), position(triangle.iVs[1]), position(triangle.iVs[2]));
+  }
 
+  //################################################################################################
+  static double triangleArea2(const glm::dvec3& v0, const glm::dvec3& v1, const glm::dvec3& v2)
+  {
     glm::dvec3 e1 = v1-v0;
     glm::dvec3 e2 = v2-v0;
     glm::dvec3 e3 = glm::cross(e1, e2);
@@ -384,9 +876,8 @@ private:
   }
 
   //################################################################################################
-  void linkLastTriangle(std::unordered_set<Edge_lt*>& dirtyEdges)
+  void linkLastTriangle(std::vector<Edge_lt*>& dirtyEdges)
   {
-    TIdx iT = TIdx(m_triangles.size()-1);
     Triangle_lt& t = m_triangles.back();
 
     if(isTraingleValid(t))
@@ -394,18 +885,11 @@ private:
       if(t.visible && triangleArea2(t)<0.000000000000001)
         t.visible = false;
 
-      t.edges[0] = insertEdge(positionIndex(t.iVs[0]), positionIndex(t.iVs[1]), iT);
-      t.edges[1] = insertEdge(positionIndex(t.iVs[1]), positionIndex(t.iVs[2]), iT);
-      t.edges[2] = insertEdge(positionIndex(t.iVs[2]), positionIndex(t.iVs[0]), iT);
-
-      if(t.edges[0])dirtyEdges.insert(t.edges[0]);
-      if(t.edges[1])dirtyEdges.insert(t.edges[1]);
-      if(t.edges[2])dirtyEdges.insert(t.edges[2]);
-
       t.lengths[0] = m_edgeLength(position(t.iVs[0]), position(t.iVs[1]));
       t.lengths[1] = m_edgeLength(position(t.iVs[1]), position(t.iVs[2]));
       t.lengths[2] = m_edgeLength(position(t.iVs[2]), position(t.iVs[0]));
 
+      linkLastTriangleEdges(dirtyEdges);
     }
     else
     {
@@ -413,6 +897,22 @@ private:
     }
   }
 
+  //################################################################################################
+  //! Insert the edges of the last triangle using the lengths that it holds.
+  void linkLastTriangleEdges(std::vector<Edge_lt*>& dirtyEdges)
+  {
+    TIdx iT = TIdx(m_triangles.size()-1);
+    Triangle_lt& t = m_triangles.back();
+
+    t.edges[0] = insertEdge(positionIndex(t.iVs[0]), positionIndex(t.iVs[1]), iT, t.lengths[0]);
+    t.edges[1] = insertEdge(positionIndex(t.iVs[1]), positionIndex(t.iVs[2]), iT, t.lengths[1]);
+    t.edges[2] = insertEdge(positionIndex(t.iVs[2]), positionIndex(t.iVs[0]), iT, t.lengths[2]);
+
+    if(t.edges[0])dirtyEdges.push_back(t.edges[0]);
+    if(t.edges[1])dirtyEdges.push_back(t.edges[1]);
+    if(t.edges[2])dirtyEdges.push_back(t.edges[2]);
+  }
+
   //################################################################################################
   void debugCounts()
   {
@@ -434,7 +934,7 @@ private:
           notVisible++;
       }
 
-      tpWarning() << "Edges: " << m_edges.size() << " Visible: " << visible << " Not visible: " << notVisible;
+      tpWarning() << "Edges: " << m_edgeLookup.size() << " Visible: " << visible << " Not visible: " << notVisible;
     }
   }
   //################################################################################################
@@ -452,62 +952,116 @@ private:
     if(iP1<iP0)
       std::swap(iP0, iP1);
 
-    Edge_lt key;
-    key.length = length;
-    auto i = std::lower_bound(m_edges.begin(), m_edges.end(), &key, [&](const auto& a, const auto& b)
-    {
-      return a->length < b->length;
-    });
-
-    for(; i!=m_edges.end() && (*i)->length<=length; ++i)
+    Edge_lt*& e = m_edgeLookup[{iP0, iP1, length}];
+    if(!e)
     {
-      if((*i)->iPs[0] == iP0 && (*i)->iPs[1] == iP1)
+      if(m_freeEdges.empty())
+        e = &m_edgePool.emplace_back();
+      else
       {
-        (*i)->iTs.push_back(iT);
-        return (*i).get();
+        e = tpTakeLast(m_freeEdges);
+        e->iTs.clear();
       }
-    }
 
-    {
-      Edge_lt* e = new Edge_lt();
       e->iPs[0] = iP0;
       e->iPs[1] = iP1;
-      e->iTs.push_back(iT);
       e->length = length;
+      e->order = m_edgeOrder++;
+      e->queued = true;
 
-      m_edges.insert(i, std::unique_ptr<Edge_lt>(e));
-      return e;
+      m_edgeQueue.push_back({length, e->order, e});
+      std::push_heap(m_edgeQueue.begin(), m_edgeQueue.end(), QueueEntry_lt::less);
     }
+
+    e->iTs.push_back(iT);
+    return e;
+  }
+
+  //################################################################################################
+  //! Remove the longest edge from the queue, the queue must not be empty.
+  Edge_lt* takeLongestEdge()
+  {
+    Edge_lt* e = m_edgeQueue.front().edge;
+    std::pop_heap(m_edgeQueue.begin(), m_edgeQueue.end(), QueueEntry_lt::less);
+    m_edgeQueue.pop_back();
+
+    e->queued = false;
+    m_edgeLookup.erase({e->iPs[0], e->iPs[1], e->length});
+    popDeadEdges();
+    return e;
+  }
+
+  //################################################################################################
+  //! Remove an edge from the lookup and release it, its queue entry is dropped when it surfaces.
+  void killEdge(Edge_lt* e)
+  {
+    if(!e->queued)
+      return;
+
+    e->queued = false;
+    m_edgeLookup.erase({e->iPs[0], e->iPs[1], e->length});
+    m_freeEdges.push_back(e);
+  }
+
+  //################################################################################################
+  //! Drop dead entries from the top of the queue so that the front is always the longest live edge.
+  void popDeadEdges()
+  {
+    // If too much of the queue is dead rebuild it rather than letting it grow.
+    if(m_edgeQueue.size() > 1024 && m_edgeQueue.size() > m_edgeLookup.size()*4)
+    {
+      m_edgeQueue.erase(std::remove_if(m_edgeQueue.begin(), m_edgeQueue.end(), [](const auto& entry)
+      {
+        return !entry.live();
+      }), m_edgeQueue.end());
+      std::make_heap(m_edgeQueue.begin(), m_edgeQueue.end(), QueueEntry_lt::less);
+    }
+
+    while(!m_edgeQueue.empty() && !m_edgeQueue.front().live())
+    {
+      std::pop_heap(m_edgeQueue.begin(), m_edgeQueue.end(), QueueEntry_lt::less);
+      m_edgeQueue.pop_back();
+    }
+  }
+
+  //################################################################################################
+  void clearEdges()
+  {
+    m_edgeQueue.clear();
+    m_edgeLookup.clear();
+    m_freeEdges.clear();
+    m_edgePool.clear();
+    m_edgeOrder = 0;
   }
 
   //################################################################################################
   Vertex3D& vertex(VIdx idx)
   {
-    return m_geometry->verts.at(size_t(idx));
+    return m_checked?m_geometry->verts.at(size_t(idx)):m_geometry->verts.data()[size_t(idx)];
   }
 
   //################################################################################################
   PIdx positionIndex(VIdx idx)
   {
-    return m_positionLookup.at(size_t(idx));
+    return m_checked?m_positionLookup.at(size_t(idx)):m_positionLookup.data()[size_t(idx)];
   }
 
   //################################################################################################
   glm::vec3& position(VIdx idx)
   {
-    return m_positions.at(size_t(positionIndex(idx)));
+    return position(positionIndex(idx));
   }
 
   //################################################################################################
   glm::vec3& position(PIdx idx)
   {
-    return m_positions.at(size_t(idx));
+    return m_checked?m_positions.at(size_t(idx)):m_positions.data()[size_t(idx)];
   }
 
   //################################################################################################
   Triangle_lt& triangle(TIdx idx)
   {
-    return m_triangles.at(size_t(idx));
+    return m_checked?m_triangles.at(size_t(idx)):m_triangles.data()[size_t(idx)];
   }
 
   //################################################################################################
@@ -540,61 +1094,138 @@ private:
   //! If an edge is not connected to any visible triangles we don't need to care about it.
   void removeDeadEdges()
   {
-    auto edgeNotVisible = [&](const std::unique_ptr<Edge_lt>& e)
+    auto& deadEdges = m_deadEdges;
+    deadEdges.clear();
+    for(const auto& i : m_edgeLookup)
+      if(edgeNotVisible(i.second))
+        deadEdges.push_back(i.second);
+
+    for(auto e : deadEdges)
     {
-      bool r = this->edgeNotVisible(e.get());
-      if(r)
-        unlinkEdge(e.get());
-      return r;
-    };
+      unlinkEdge(e);
+      killEdge(e);
+    }
 
-    m_edges.erase(std::remove_if(m_edges.begin(), m_edges.end(), edgeNotVisible), m_edges.end());
+    popDeadEdges();
   }
 
   //################################################################################################
-  void removeDeadEdges(const std::unordered_set<Edge_lt*>& dirtyEdges)
+  //! dirtyEdges may contain duplicates, it is sorted and used as a set.
+  void removeDeadEdges(std::vector<Edge_lt*>& dirtyEdges)
   {
-    std::unordered_set<Edge_lt*> deadEdges;
-    for(auto dirtyEdge : dirtyEdges)
-      if(edgeNotVisible(dirtyEdge))
-        deadEdges.insert(dirtyEdge);
-
-    for(auto e : deadEdges)
-      unlinkEdge(e);
+    std::sort(dirtyEdges.begin(), dirtyEdges.end());
+    dirtyEdges.erase(std::unique(dirtyEdges.begin(), dirtyEdges.end()), dirtyEdges.end());
 
-    if(deadEdges.size() == 1)
+    for(auto dirtyEdge : dirtyEdges)
     {
-      auto e = *deadEdges.begin();
-      for(auto i=m_edges.rbegin(); i!=m_edges.rend(); ++i)
+      if(edgeNotVisible(dirtyEdge))
       {
-        if(i->get() == e)
-        {
-          m_edges.erase(--(i.base()));
-          break;
-        }
+        unlinkEdge(dirtyEdge);
+        killEdge(dirtyEdge);
       }
     }
-    else
-    {
-      auto edgeNotVisible = [&](const std::unique_ptr<Edge_lt>& e)
-      {
-        return tpContains(deadEdges, e.get());
-      };
 
-      m_edges.erase(std::remove_if(m_edges.begin(), m_edges.end(), edgeNotVisible), m_edges.end());
-    }
+    popDeadEdges();
   }
 
   Geometry3D* m_geometry;
   TriangleVisible m_triangleVisible;
   EdgeLength m_edgeLength;
   float m_maxLength;
+  bool m_checked{true}; //!< False once the geometry has been validated, skips bounds checking.
 
   std::vector<glm::vec3>   m_positions;
   std::vector<PIdx>        m_positionLookup;
   std::vector<Triangle_lt> m_triangles;
 
-  std::vector<std::unique_ptr<Edge_lt>> m_edges;
+  //################################################################################################
+  //! Entries for edges that have died stay in the queue until they reach the front.
+  struct QueueEntry_lt
+  {
+    float length;
+    size_t order;
+    Edge_lt* edge;
+
+    //! Edges are reused so check that this entry still refers to the same edge.
+    bool live() const
+    {
+      return edge->queued && edge->order == order;
+    }
+
+    //! Longest first, the most recently created first for edges of the same length.
+    static bool less(const QueueEntry_lt& a, const QueueEntry_lt& b)
+    {
+      return (a.length<b.length) || (a.length==b.length && a.order<b.order);
+    }
+  };
+
+  //################################################################################################
+  //! The edge length can depend on direction so edges with different lengths are kept apart.
+  struct EdgeKey_lt
+  {
+    PIdx iP0;
+    PIdx iP1;
+    float length;
+
+    bool operator==(const EdgeKey_lt& other) const
+    {
+      return iP0==other.iP0 && iP1==other.iP1 && length==other.length;
+    }
+  };
+
+  //################################################################################################
+  struct EdgeKeyHash_lt
+  {
+    size_t operator()(const EdgeKey_lt& key) const
+    {
+      return (size_t(key.iP0) * 0x9E3779B97F4A7C15ull) ^ size_t(key.iP1) ^ (std::hash<float>()(key.length)<<1);
+    }
+  };
+
+  std::vector<QueueEntry_lt> m_edgeQueue; //!< A max heap of edges ordered by QueueEntry_lt::less.
+  std::unordered_map<EdgeKey_lt, Edge_lt*, EdgeKeyHash_lt> m_edgeLookup;
+  std::deque<Edge_lt> m_edgePool;         //!< Owns the edges, a deque so that pointers are stable.
+  std::vector<Edge_lt*> m_freeEdges;      //!< Edges in the pool that can be reused.
+  size_t m_edgeOrder{0};
+
+  struct ExistingNewVerts
+  {
+    VIdx iVs[2];
+    VIdx iVNew;
+  };
+
+  //################################################################################################
+  //! The result of splitting one edge in divideRound().
+  struct RoundSplit_lt
+  {
+    struct Child_lt
+    {
+      TIdx iT;            //!< The triangle being split.
+      VIdx iVs[3];        //!< Its corners rotated so that the edge is between the first two.
+      size_t newVert;     //!< Index into newVerts.
+      bool valid[2];      //!< The two new triangles, false if they are degenerate.
+      bool visible[2];
+      float lengths[2][3];
+    };
+
+    Edge_lt* edge{nullptr};
+    glm::vec3 position;
+    std::vector<ExistingNewVerts> midVerts;
+    std::vector<Vertex3D> newVerts;
+    std::vector<Child_lt> children;
+  };
+
+  size_t m_excludedCount{0}; //!< The number of split triangles waiting to be removed by reindex.
+
+  // Reused by divideRound, the splits keep the capacity of their vectors between rounds.
+  std::vector<QueueEntry_lt> m_roundSkipped;
+  std::vector<uint8_t> m_roundTriangleUsed;
+  std::vector<RoundSplit_lt> m_roundSplits;
+
+  // Reused by divideOnce to avoid allocating for each split.
+  std::vector<ExistingNewVerts> m_midVerts;
+  std::vector<Edge_lt*> m_dirtyEdges;
+  std::vector<Edge_lt*> m_deadEdges;
 };
 
 }
@@ -0,0 +1,156 @@
+#ifndef tp_math_utils_ViewDependentSubdivision_h
+#define tp_math_utils_ViewDependentSubdivision_h
+
+#include "tp_math_utils/Frustum.h"
+#include "tp_math_utils/SplitGeometry3D.h"
+
+#include <unordered_map>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+//! EdgeLength for SubdivideGeometry3D that measures edges in pixels on screen.
+/*!
+Edges are clipped to the near plane before they are projected, edges that are entirely behind the
+camera have a length of 0. This only reads its members so it can be called from several threads.
+*/
+struct TP_MATH_UTILS_EXPORT ScreenSpaceEdgeLength
+{
+  glm::mat4 vp;          //!< ProjectionMatrix * ViewMatrix
+  glm::vec2 viewportSize; //!< The size of the viewport in pixels.
+
+  //################################################################################################
+  ScreenSpaceEdgeLength(const glm::mat4& vp_, const glm::vec2& viewportSize_);
+
+  //################################################################################################
+  float operator()(const glm::vec3& a, const glm::vec3& b) const;
+
+  //################################################################################################
+  //! The max number of pixels that a unit of length covers in the part of a box in front of the
+  //! near plane, an estimate. Zero if the box is behind the near plane.
+  float pixelsPerUnit(const glm::vec3& min, const glm::vec3& max) const;
+};
+
+//##################################################################################################
+//! TriangleVisible for SubdivideGeometry3D that tests triangles against a view frustum.
+/*!
+A triangle is visible if its bounding box touches the frustum, optionally triangles that face away
+from the camera are culled. This only reads its members so it can be called from several threads.
+*/
+struct TP_MATH_UTILS_EXPORT FrustumTriangleVisible
+{
+  glm::mat4 vp;               //!< ProjectionMatrix * ViewMatrix
+  Frustum frustum;
+  bool cullBackFaces{false};  //!< Cull triangles that are wound clockwise on screen.
+
+  //################################################################################################
+  FrustumTriangleVisible(const glm::mat4& vp_, bool cullBackFaces_=false);
+
+  //################################################################################################
+  bool operator()(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) const;
+};
+
+//##################################################################################################
+struct TP_MATH_UTILS_EXPORT ViewDependentSubdivisionParams
+{
+  float pixelLength{8.0f}; //!< Edges are divided until they are shorter than this on screen.
+  size_t maxLevel{16};     //!< The finest level, edges are never divided below size/2^maxLevel.
+  size_t maxTriangles{0};  //!< Max triangles per chunk, 0 for no limit, limits can cause cracks.
+
+  //! How the input is cut into chunks, each chunk is rebuilt as a whole.
+  Geometry3DChunkParams chunkParams{4096, 16, false};
+};
+
+//##################################################################################################
+//! Tessellate a mesh for a camera, rebuilding only the chunks whose detail level changes.
+/*!
+The input is cut into chunks with chunkGeometry3D() and the octree cells of the chunks, along with
+the empty cells around them, form a level of detail field. For each camera every cell gets a level
+from the size of a pixel in it, target edge lengths are size/2^level so small camera moves rarely
+change the level of a cell. Cells outside the frustum are not divided at all.
+
+Each edge is measured against the coarser level of the cells that hold its two ends, so an edge
+that is shared by two chunks is divided in the same way by both and no cracks open between chunks.
+A chunk only depends on the cells that its triangles overlap, update() rebuilds a chunk from its
+source triangles only when one of those cells changes level, both to add and to remove detail.
+*/
+class TP_MATH_UTILS_EXPORT ViewDependentSubdivision
+{
+  TP_NONCOPYABLE(ViewDependentSubdivision);
+public:
+  //################################################################################################
+  ViewDependentSubdivision(const Geometry3D& geometry,
+                           const ViewDependentSubdivisionParams& params=ViewDependentSubdivisionParams());
+
+  //################################################################################################
+  //! Update the chunks for a new camera, chunks are rebuilt in parallel.
+  /*!
+  \param vp ProjectionMatrix * ViewMatrix
+  \param viewportSize The size of the viewport in pixels.
+  \return The number of chunks that were rebuilt, see changedChunks().
+  */
+  size_t update(const glm::mat4& vp, const glm::vec2& viewportSize);
+
+  //################################################################################################
+  size_t chunkCount() const;
+
+  //################################################################################################
+  //! The tessellated triangles of a chunk, this is empty until the first update().
+  const Geometry3D& chunkGeometry(size_t chunk) const;
+
+  //################################################################################################
+  //! The source chunk that chunkGeometry() is built from.
+  const Geometry3DChunk& sourceChunk(size_t chunk) const;
+
+  //################################################################################################
+  //! The chunks that were rebuilt by the last call to update(), for uploading to the GPU.
+  const std::vector<size_t>& changedChunks() const;
+
+  //################################################################################################
+  //! All of the chunks joined into a single mesh.
+  Geometry3D geometry() const;
+
+private:
+  //################################################################################################
+  //! The index into m_cells of the leaf cell that contains a point.
+  size_t cellAt(const glm::vec3& p) const;
+
+  //################################################################################################
+  //! The scale for lengths at a point, edges longer than 1 after scaling get divided.
+  float scaleAt(const glm::vec3& p) const;
+
+  //################################################################################################
+  void rebuild(size_t chunk);
+
+  struct Cell_lt
+  {
+    size_t depth{0};
+    glm::ivec3 cell{0, 0, 0};
+    glm::vec3 min{0.0f, 0.0f, 0.0f};
+    glm::vec3 max{0.0f, 0.0f, 0.0f};
+    int level{-2}; //!< -1 outside the frustum, -2 before the first update.
+    float scale{0.0f};
+  };
+
+  ViewDependentSubdivisionParams m_params;
+  Geometry3D m_header; //!< The input without its verts and indexes.
+
+  glm::vec3 m_rootMin{0.0f, 0.0f, 0.0f};
+  float m_rootSize{1.0f};
+  size_t m_maxDepth{0};
+  float m_margin{0.0f}; //!< The longest input edge, how far edges reach past a cell.
+
+  std::vector<Geometry3DChunk> m_chunks;
+  std::vector<Geometry3D> m_results;
+  std::vector<std::vector<size_t>> m_chunkCells; //!< The cells that each chunk depends on.
+
+  std::vector<Cell_lt> m_cells;
+  std::unordered_map<uint64_t, size_t> m_cellLookup;
+
+  std::vector<size_t> m_changedChunks;
+};
+
+}
+
+#endif
@@ -0,0 +1,142 @@
+#include "tp_math_utils/ConeProximity.h"
+#include "tp_math_utils/DistanceBetweenCones.h"
+#include "tp_math_utils/Cone.h"
+#include "tp_math_utils/ParallelFor.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+struct Bounds_lt
+{
+  glm::dvec3 min;
+  glm::dvec3 max;
+};
+}
+
+//##################################################################################################
+std::vector<ConeProximityPair> conesWithinDistance(const std::vector<DCone>& cones, double threshold)
+{
+  std::vector<ConeProximityPair> results;
+  size_t count = cones.size();
+  if(count<2)
+    return results;
+
+  double margin = tpMax(threshold, 0.0);
+
+  //================================================================================================
+  // Bounds are expanded by the threshold so that candidate pairs are those that overlap.
+  std::vector<Bounds_lt> bounds(count);
+  parallelForBlocks(count, 4096, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t i=begin; i<end; i++)
+    {
+      const auto& c = cones[i];
+      glm::dvec3 r(tpMax(std::fabs(c.r0), std::fabs(c.r1)) + margin);
+      bounds[i].min = glm::min(c.p0, c.p1) - r;
+      bounds[i].max = glm::max(c.p0, c.p1) + r;
+    }
+  });
+
+  //================================================================================================
+  // Sweep along the axis with the most variance in the bounds centers, this keeps the number of
+  // boxes that overlap along the sweep axis low.
+  size_t axis=0;
+  {
+    glm::dvec3 sum(0.0);
+    glm::dvec3 sumSq(0.0);
+    for(const auto& b : bounds)
+    {
+      glm::dvec3 c = (b.min+b.max)*0.5;
+      sum += c;
+      sumSq += c*c;
+    }
+    glm::dvec3 variance = sumSq - (sum*sum)/double(count);
+    if(variance.y>variance[axis])
+      axis = 1;
+    if(variance.z>variance[axis])
+      axis = 2;
+  }
+
+  std::vector<size_t> order(count);
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+  {
+    return bounds[a].min[axis] < bounds[b].min[axis];
+  });
+
+  //================================================================================================
+  // The amount of work per box depends on how many boxes follow it in the sweep, so work is taken
+  // in chunks from a shared counter and each chunk collects its own candidates.
+  constexpr size_t chunkSize = 256;
+  size_t nChunks = (count+chunkSize-1) / chunkSize;
+  std::vector<std::vector<ConeProximityPair>> chunkCandidates(nChunks);
+
+  parallelFor(nChunks, [&](size_t chunk)
+  {
+    auto& candidates = chunkCandidates[chunk];
+    size_t begin = chunk*chunkSize;
+    size_t end = tpMin(begin+chunkSize, count);
+    for(size_t a=begin; a<end; a++)
+    {
+      size_t ia = order[a];
+      const auto& ba = bounds[ia];
+      for(size_t b=a+1; b<count; b++)
+      {
+        size_t ib = order[b];
+        const auto& bb = bounds[ib];
+        if(bb.min[axis]>ba.max[axis])
+          break;
+
+        if(bb.min.x>ba.max.x || bb.min.y>ba.max.y || bb.min.z>ba.max.z ||
+           ba.min.x>bb.max.x || ba.min.y>bb.max.y || ba.min.z>bb.max.z)
+          continue;
+
+        candidates.push_back({tpMin(ia, ib), tpMax(ia, ib), 0.0});
+      }
+    }
+  });
+
+  std::vector<ConeProximityPair> candidates;
+  {
+    size_t total=0;
+    for(const auto& c : chunkCandidates)
+      total += c.size();
+    candidates.reserve(total);
+    for(auto& c : chunkCandidates)
+    {
+      candidates.insert(candidates.end(), c.begin(), c.end());
+      c = std::vector<ConeProximityPair>();
+    }
+  }
+
+  //================================================================================================
+  parallelForBlocks(candidates.size(), 256, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t i=begin; i<end; i++)
+    {
+      auto& candidate = candidates[i];
+      candidate.distance = distanceBetweenCones(cones[candidate.first], cones[candidate.second]);
+    }
+  });
+
+  //================================================================================================
+  results.reserve(candidates.size());
+  for(const auto& candidate : candidates)
+    if(candidate.distance<=threshold)
+      results.push_back(candidate);
+
+  std::sort(results.begin(), results.end(), [](const auto& a, const auto& b)
+  {
+    return (a.first<b.first) || (a.first==b.first && a.second<b.second);
+  });
+
+  return results;
+}
+
+}
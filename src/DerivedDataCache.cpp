@@ -0,0 +1,496 @@
+#include "tp_math_utils/DerivedDataCache.h"
+#include "tp_math_utils/Geometry3DDigest.h"
+
+#include "tp_utils/FileUtils.h"
+#include "tp_utils/DebugUtils.h"
+
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <filesystem>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+constexpr char geometryMagic[8] = {'T','P','G','E','O','M','0','1'};
+constexpr char fileMagic[8] = {'T','P','D','D','C','0','0','1'};
+
+static_assert(sizeof(Vertex3D) == sizeof(float)*8, "Vertex3D is written as 8 floats.");
+
+//##################################################################################################
+struct Writer_lt
+{
+  std::string& data;
+
+  //################################################################################################
+  void bytes(const void* p, size_t size)
+  {
+    data.append(static_cast<const char*>(p), size);
+  }
+
+  //################################################################################################
+  template<typename T>
+  void pod(const T& value)
+  {
+    bytes(&value, sizeof(T));
+  }
+
+  //################################################################################################
+  void string(const std::string& s)
+  {
+    pod(uint64_t(s.size()));
+    bytes(s.data(), s.size());
+  }
+};
+
+//##################################################################################################
+struct Reader_lt
+{
+  const std::string& data;
+  size_t pos{0};
+
+  //################################################################################################
+  bool bytes(void* p, size_t size)
+  {
+    if(size>(data.size()-pos))
+      return false;
+
+    std::memcpy(p, data.data()+pos, size);
+    pos += size;
+    return true;
+  }
+
+  //################################################################################################
+  template<typename T>
+  bool pod(T& value)
+  {
+    return bytes(&value, sizeof(T));
+  }
+
+  //################################################################################################
+  //! Read a count of items of itemSize, checking that they will fit in the remaining data.
+  bool count(size_t& value, size_t itemSize)
+  {
+    uint64_t c{0};
+    if(!pod(c) || (itemSize && c>(data.size()-pos)/itemSize))
+      return false;
+
+    value = size_t(c);
+    return true;
+  }
+
+  //################################################################################################
+  bool string(std::string& s)
+  {
+    size_t size{0};
+    if(!count(size, 1))
+      return false;
+
+    s.assign(data.data()+pos, size);
+    pos += size;
+    return true;
+  }
+};
+
+//##################################################################################################
+void writeKey(Writer_lt& writer, const DerivedDataKey& key)
+{
+  writer.pod(key.inputDigest);
+  writer.string(key.operation);
+  writer.string(key.parameters);
+}
+
+//##################################################################################################
+bool readKey(Reader_lt& reader, DerivedDataKey& key)
+{
+  return
+      reader.pod(key.inputDigest) &&
+      reader.string(key.operation) &&
+      reader.string(key.parameters);
+}
+
+//##################################################################################################
+//! Write to a uniquely named file next to path and then rename it over path.
+/*!
+Other threads or processes sharing the directory may be reading or writing the same key, the rename
+replaces the file in one step so they see either the old file or the new one.
+*/
+bool replaceFile(const std::string& path, const std::string& data)
+{
+  thread_local std::mt19937_64 rng{std::random_device{}()};
+
+  std::stringstream ss;
+  ss << path << '.' << std::hex << std::setw(16) << std::setfill('0') << rng() << ".tmp";
+  std::string tmpPath = ss.str();
+
+  std::error_code ec;
+  if(!tp_utils::writeBinaryFile(tmpPath, data))
+  {
+    std::filesystem::remove(tmpPath, ec);
+    return false;
+  }
+
+  std::filesystem::rename(tmpPath, path, ec);
+  if(ec)
+  {
+    std::filesystem::remove(tmpPath, ec);
+    return false;
+  }
+
+  return true;
+}
+
+//##################################################################################################
+uint64_t mix(uint64_t h, const std::string& s)
+{
+  // FNV-1a, the key hash only needs to spread the keys across file names.
+  for(char c : s)
+  {
+    h ^= uint8_t(c);
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+}
+
+//##################################################################################################
+uint64_t DerivedDataKey::hash() const
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  for(size_t i=0; i<8; i++)
+  {
+    h ^= (inputDigest>>(i*8)) & 0xFF;
+    h *= 0x100000001b3ull;
+  }
+  h = mix(h, operation);
+  h = mix(h, std::string(1, '\0'));
+  h = mix(h, parameters);
+  return h;
+}
+
+//##################################################################################################
+std::string DerivedDataKey::toString() const
+{
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash();
+  return ss.str();
+}
+
+//##################################################################################################
+DerivedDataCache::DerivedDataCache(size_t memoryBudget, const std::string& directory):
+  m_memoryBudget(memoryBudget),
+  m_directory(directory)
+{
+
+}
+
+//##################################################################################################
+size_t DerivedDataCache::memoryBudget() const
+{
+  TP_MUTEX_LOCKER(m_mutex);
+  return m_memoryBudget;
+}
+
+//##################################################################################################
+void DerivedDataCache::setMemoryBudget(size_t memoryBudget)
+{
+  TP_MUTEX_LOCKER(m_mutex);
+  m_memoryBudget = memoryBudget;
+  trim();
+}
+
+//##################################################################################################
+size_t DerivedDataCache::memoryUsage() const
+{
+  TP_MUTEX_LOCKER(m_mutex);
+  return m_memoryUsage;
+}
+
+//##################################################################################################
+const std::string& DerivedDataCache::directory() const
+{
+  return m_directory;
+}
+
+//##################################################################################################
+bool DerivedDataCache::find(const DerivedDataKey& key, std::string& data)
+{
+  uint64_t hash = key.hash();
+
+  {
+    TP_MUTEX_LOCKER(m_mutex);
+    if(auto i = m_lookup.find(hash); i!=m_lookup.end() && i->second->key == key)
+    {
+      m_entries.splice(m_entries.begin(), m_entries, i->second);
+      data = i->second->data;
+      return true;
+    }
+  }
+
+  if(m_directory.empty())
+    return false;
+
+  std::string file = tp_utils::readBinaryFile(filePath(key));
+  if(file.empty())
+    return false;
+
+  Reader_lt reader{file};
+  char magic[8];
+  DerivedDataKey fileKey;
+  if(!reader.bytes(magic, 8) || std::memcmp(magic, fileMagic, 8) || !readKey(reader, fileKey) || !(fileKey == key))
+    return false;
+
+  data = file.substr(reader.pos);
+
+  {
+    TP_MUTEX_LOCKER(m_mutex);
+    if(m_lookup.find(hash) == m_lookup.end())
+    {
+      m_entries.push_front({key, data});
+      m_lookup[hash] = m_entries.begin();
+      m_memoryUsage += data.size();
+      trim();
+    }
+  }
+
+  return true;
+}
+
+//##################################################################################################
+void DerivedDataCache::insert(const DerivedDataKey& key, const std::string& data)
+{
+  uint64_t hash = key.hash();
+
+  {
+    TP_MUTEX_LOCKER(m_mutex);
+    if(auto i = m_lookup.find(hash); i!=m_lookup.end())
+    {
+      m_memoryUsage -= i->second->data.size();
+      m_entries.erase(i->second);
+      m_lookup.erase(i);
+    }
+
+    m_entries.push_front({key, data});
+    m_lookup[hash] = m_entries.begin();
+    m_memoryUsage += data.size();
+    trim();
+  }
+
+  if(m_directory.empty())
+    return;
+
+  std::string file;
+  file.reserve(data.size() + key.operation.size() + key.parameters.size() + 64);
+  Writer_lt writer{file};
+  writer.bytes(fileMagic, 8);
+  writeKey(writer, key);
+  writer.bytes(data.data(), data.size());
+
+  if(!replaceFile(filePath(key), file))
+    tpWarning() << "Failed to write derived data cache file: " << filePath(key);
+}
+
+//##################################################################################################
+void DerivedDataCache::clearMemory()
+{
+  TP_MUTEX_LOCKER(m_mutex);
+  m_entries.clear();
+  m_lookup.clear();
+  m_memoryUsage = 0;
+}
+
+//##################################################################################################
+Geometry3DList DerivedDataCache::geometry(const Geometry3DList& input,
+                                          const std::string& operation,
+                                          const nlohmann::json& parameters,
+                                          const std::function<Geometry3DList(const Geometry3DList&)>& compute)
+{
+  // The material is included because it is carried through to the output.
+  Geometry3DDigestParams digestParams;
+  digestParams.includeMaterial = true;
+
+  DerivedDataKey key;
+  key.inputDigest = digestGeometry3D(input, digestParams).digest;
+  key.operation = operation;
+  key.parameters = parameters.dump();
+
+  Geometry3DList result;
+  if(std::string data; find(key, data) && deserializeGeometry3DList(data, result))
+    return result;
+
+  result = compute(input);
+
+  std::string data;
+  serializeGeometry3DList(result, data);
+  insert(key, data);
+  return result;
+}
+
+//##################################################################################################
+std::vector<glm::vec3> DerivedDataCache::vectors(const Geometry3D& input,
+                                                 const std::string& operation,
+                                                 const nlohmann::json& parameters,
+                                                 const std::function<std::vector<glm::vec3>(const Geometry3D&)>& compute)
+{
+  DerivedDataKey key;
+  key.inputDigest = digestGeometry3D(input).digest;
+  key.operation = operation;
+  key.parameters = parameters.dump();
+
+  std::vector<glm::vec3> result;
+  if(std::string data; find(key, data))
+  {
+    Reader_lt reader{data};
+    size_t count{0};
+    if(reader.count(count, sizeof(glm::vec3)))
+    {
+      result.resize(count);
+      if(reader.bytes(result.data(), count*sizeof(glm::vec3)))
+        return result;
+    }
+  }
+
+  result = compute(input);
+
+  std::string data;
+  Writer_lt writer{data};
+  writer.pod(uint64_t(result.size()));
+  writer.bytes(result.data(), result.size()*sizeof(glm::vec3));
+  insert(key, data);
+  return result;
+}
+
+//##################################################################################################
+void DerivedDataCache::trim()
+{
+  while(m_memoryUsage>m_memoryBudget && !m_entries.empty())
+  {
+    const auto& entry = m_entries.back();
+    m_memoryUsage -= entry.data.size();
+    m_lookup.erase(entry.key.hash());
+    m_entries.pop_back();
+  }
+}
+
+//##################################################################################################
+std::string DerivedDataCache::filePath(const DerivedDataKey& key) const
+{
+  return m_directory + '/' + key.toString() + ".bin";
+}
+
+//##################################################################################################
+void serializeGeometry3DList(const Geometry3DList& geometry, std::string& data)
+{
+  data.clear();
+  Writer_lt writer{data};
+  writer.bytes(geometryMagic, 8);
+  writer.pod(uint64_t(geometry.size()));
+
+  for(const auto& mesh : geometry)
+  {
+    writer.pod(uint64_t(mesh.comments.size()));
+    for(const auto& comment : mesh.comments)
+      writer.string(comment);
+
+    writer.pod(uint64_t(mesh.verts.size()));
+    writer.bytes(mesh.verts.data(), mesh.verts.size()*sizeof(Vertex3D));
+
+    writer.pod(uint64_t(mesh.indexes.size()));
+    for(const auto& part : mesh.indexes)
+    {
+      writer.pod(int32_t(part.type));
+      writer.pod(uint64_t(part.indexes.size()));
+      writer.bytes(part.indexes.data(), part.indexes.size()*sizeof(int));
+    }
+
+    writer.pod(int32_t(mesh.triangleFan));
+    writer.pod(int32_t(mesh.triangleStrip));
+    writer.pod(int32_t(mesh.triangles));
+    writer.pod(uint8_t(mesh.validated()?1:0));
+
+    nlohmann::json j;
+    mesh.material.saveState(j);
+    writer.string(j.dump());
+  }
+}
+
+//##################################################################################################
+bool deserializeGeometry3DList(const std::string& data, Geometry3DList& geometry)
+{
+  geometry.clear();
+
+  Reader_lt reader{data};
+  char magic[8];
+  if(!reader.bytes(magic, 8) || std::memcmp(magic, geometryMagic, 8))
+    return false;
+
+  size_t meshCount{0};
+  if(!reader.count(meshCount, 1))
+    return false;
+
+  geometry.resize(meshCount);
+  for(auto& mesh : geometry)
+  {
+    size_t count{0};
+    if(!reader.count(count, sizeof(uint64_t)))
+      return false;
+    mesh.comments.resize(count);
+    for(auto& comment : mesh.comments)
+      if(!reader.string(comment))
+        return false;
+
+    if(!reader.count(count, sizeof(Vertex3D)))
+      return false;
+    mesh.verts.resize(count);
+    if(!reader.bytes(mesh.verts.data(), count*sizeof(Vertex3D)))
+      return false;
+
+    if(!reader.count(count, sizeof(int32_t)+sizeof(uint64_t)))
+      return false;
+    mesh.indexes.resize(count);
+    for(auto& part : mesh.indexes)
+    {
+      int32_t type{0};
+      if(!reader.pod(type) || !reader.count(count, sizeof(int)))
+        return false;
+      part.type = type;
+      part.indexes.resize(count);
+      if(!reader.bytes(part.indexes.data(), count*sizeof(int)))
+        return false;
+    }
+
+    int32_t triangleFan{0};
+    int32_t triangleStrip{0};
+    int32_t triangles{0};
+    uint8_t validated{0};
+    if(!reader.pod(triangleFan) || !reader.pod(triangleStrip) || !reader.pod(triangles) || !reader.pod(validated))
+      return false;
+    mesh.triangleFan = triangleFan;
+    mesh.triangleStrip = triangleStrip;
+    mesh.triangles = triangles;
+
+    // Don't trust the flag from disk, validation is cheap compared to the operations being cached.
+    if(validated)
+      mesh.validate();
+
+    std::string material;
+    if(!reader.string(material))
+      return false;
+
+    try
+    {
+      mesh.material.loadState(nlohmann::json::parse(material));
+    }
+    catch(...)
+    {
+      return false;
+    }
+  }
+
+  return reader.pos == data.size();
+}
+
+}
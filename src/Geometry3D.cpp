@@ -1,5 +1,7 @@
 #include "tp_math_utils/Geometry3D.h"
 #include "tp_math_utils/JSONUtils.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/ScratchArena.h"
 
 #include "tp_utils/FileUtils.h"
 #include "tp_utils/DebugUtils.h"
@@ -24,157 +26,81 @@ struct Face_lt
 };
 
 //##################################################################################################
-std::vector<Face_lt> calculateFaces(const Geometry3D& geometry, bool calculateNormals)
+//! Call closure(type, indexes, count) for each part, this adapts the different index layouts.
+template<typename Closure>
+void forEachPart(const Geometry3D& geometry, Closure&& closure)
 {
-  std::vector<Face_lt> faces;
+  for(const auto& part : geometry.indexes)
+    closure(part.type, part.indexes.data(), part.indexes.size());
+}
+
+//##################################################################################################
+template<typename Closure>
+void forEachPart(const FlatGeometry3D& geometry, Closure&& closure)
+{
+  geometry.indexes.forEachPart(closure);
+}
+
+//##################################################################################################
+template<bool Checked, typename G>
+std::pmr::vector<Face_lt> calculateFacesImpl(const G& geometry, bool calculateNormals, std::pmr::memory_resource* scratch)
+{
+  std::pmr::vector<Face_lt> faces(scratchResource(scratch));
 
   size_t count=0;
-  for(const auto& indexes : geometry.indexes)
+  forEachPart(geometry, [&](int type, const int*, size_t size)
   {
-    if(indexes.indexes.size()<3)
-      continue;
+    if(size<3)
+      return;
 
-    if(indexes.type == geometry.triangleFan)
-      count+=indexes.indexes.size()-2;
-    else if(indexes.type == geometry.triangleStrip)
-      count+=indexes.indexes.size()-2;
-    else if(indexes.type == geometry.triangles)
-      count+=indexes.indexes.size()/3;
-  }
+    if(type == geometry.triangleFan)
+      count+=size-2;
+    else if(type == geometry.triangleStrip)
+      count+=size-2;
+    else if(type == geometry.triangles)
+      count+=size/3;
+  });
 
   faces.reserve(count);
 
-  for(const auto& indexes : geometry.indexes)
+  geometry.forEachTriangleIndexes([&](int i0, int i1, int i2)
   {
-    auto calcVMax = [&](size_t sub)
-    {
-      return (sub>indexes.indexes.size())?0:indexes.indexes.size()-sub;
-    };
-
-    if(indexes.type == geometry.triangleFan)
-    {
-      const auto& f = indexes.indexes.front();
-
-      size_t vMax = calcVMax(1);
-      for(size_t v=1; v<vMax; v++)
-      {
-        Face_lt& face = faces.emplace_back();
-        face.indexes[0] = f;
-        face.indexes[1] = indexes.indexes.at(v);
-        face.indexes[2] = indexes.indexes.at(v+1);
-      }
-    }
-    else if(indexes.type == geometry.triangleStrip)
-    {
-      size_t vMax = calcVMax(2);
-      for(size_t v=0; v<vMax; v++)
-      {
-        Face_lt& face = faces.emplace_back();
-        if(v&1)
-        {
-          face.indexes[0] = indexes.indexes.at(v);
-          face.indexes[1] = indexes.indexes.at(v+2);
-          face.indexes[2] = indexes.indexes.at(v+1);
-        }
-        else
-        {
-          face.indexes[0] = indexes.indexes.at(v);
-          face.indexes[1] = indexes.indexes.at(v+1);
-          face.indexes[2] = indexes.indexes.at(v+2);
-        }
-      }
-    }
-    else if(indexes.type == geometry.triangles)
-    {
-      size_t vMax = calcVMax(2);
-      for(size_t v=0; v<vMax; v+=3)
-      {
-        Face_lt& face = faces.emplace_back();
-        face.indexes[0] = indexes.indexes.at(v);
-        face.indexes[1] = indexes.indexes.at(v+1);
-        face.indexes[2] = indexes.indexes.at(v+2);
-      }
-    }
-  }
+    Face_lt& face = faces.emplace_back();
+    face.indexes[0] = i0;
+    face.indexes[1] = i1;
+    face.indexes[2] = i2;
+  });
 
   if(calculateNormals)
     for(auto& face : faces)
-      face.normal = glm::triangleNormal(geometry.verts.at(size_t(face.indexes[0])).vert,
-          geometry.verts.at(size_t(face.indexes[1])).vert,
-          geometry.verts.at(size_t(face.indexes[2])).vert);
+      face.normal = glm::triangleNormal(checkedAt<Checked>(geometry.verts, size_t(face.indexes[0])).vert,
+          checkedAt<Checked>(geometry.verts, size_t(face.indexes[1])).vert,
+          checkedAt<Checked>(geometry.verts, size_t(face.indexes[2])).vert);
 
   return faces;
 }
 
-//################################################################################################
-void accumulateTangentForTriangle(const Vertex3DList& verts, const Indexes3D& part, size_t i1, size_t i2, size_t i3, std::vector<glm::vec3>& tangent)
-{
-  auto idx1 = size_t(part.indexes.at(i1));
-  auto idx2 = size_t(part.indexes.at(i2));
-  auto idx3 = size_t(part.indexes.at(i3));
-  if(idx1<verts.size() && idx2<verts.size() && idx3<verts.size())
-  {
-    const auto& v1 = verts.at(idx1);
-    const auto& v2 = verts.at(idx2);
-    const auto& v3 = verts.at(idx3);
-    auto posdiff21 = v2.vert-v1.vert;
-    auto posdiff31 = v3.vert-v1.vert;
-    auto posdiff32 = v3.vert-v2.vert;
-    auto texdiff21 = v2.texture-v1.texture;
-    auto texdiff31 = v3.texture-v1.texture;
-    auto texdiff32 = v3.texture-v2.texture;
-    glm::vec3 t = {0,0,0};
-    const float smallVal = 1.e-4f;
-    const float verySmallVal = 1.e-6f;
-    if(verySmallVal > glm::abs(texdiff21.y) && smallVal < glm::abs(texdiff21.x))
-      // use points 1 and 2
-      t = (texdiff31.x < 0.f) ? -posdiff21 : posdiff21;
-    else if(verySmallVal > glm::abs(texdiff31.y) && smallVal < glm::abs(texdiff31.x))
-      // use points 1 and 3
-      t = (texdiff31.x < 0.f) ? -posdiff31 : posdiff31;
-    else if(verySmallVal > glm::abs(texdiff32.y) && smallVal < glm::abs(texdiff32.x))
-      // use points 2 and 3
-      t = (texdiff32.x < 0.f) ? -posdiff32 : posdiff32;
-    else if(smallVal < glm::abs(texdiff32.y) || smallVal < glm::abs(texdiff31.y) || smallVal < glm::abs(texdiff21.y))
-    {
-      if(glm::abs(texdiff32.y) > glm::abs(texdiff31.y) && glm::abs(texdiff32.y) > glm::abs(texdiff21.y))
-      {
-        // interpolate relative to point 1
-        float alpha = texdiff31.y/texdiff32.y;
-        float ud = alpha*texdiff21.x + (1.f-alpha)*texdiff31.x;
-        if(smallVal < glm::abs(ud))
-        {
-          t = alpha*posdiff21 + (1.f-alpha)*posdiff31;
-          if (ud < 0.f) t = -t;
-        }
-      }
-      else if(glm::abs(texdiff31.y) > glm::abs(texdiff21.y))
-      {
-        // interpolate relative to point 2
-        float alpha = texdiff21.y/texdiff31.y;
-        float ud = alpha*texdiff32.x - (1.f-alpha)*texdiff21.x;
-        if(smallVal < glm::abs(ud))
-        {
-          t = alpha*posdiff32 - (1.f-alpha)*posdiff21;
-          if (ud < 0.f) t = -t;
-        }
-      }
-      else
-      {
-        // interpolate relative to point 3
-        float alpha = -texdiff32.y/texdiff21.y;
-        float ud = -alpha*texdiff31.x - (1.f-alpha)*texdiff32.x;
-        if(smallVal < glm::abs(ud))
-        {
-          t = -alpha*posdiff31 - (1.f-alpha)*posdiff32;
-          if (ud < 0.f) t = -t;
-        }
-      }
-    }
+//##################################################################################################
+template<typename G>
+std::pmr::vector<Face_lt> calculateFaces(const G& geometry, bool calculateNormals, std::pmr::memory_resource* scratch=nullptr)
+{
+  return geometry.validated()?
+        calculateFacesImpl<false>(geometry, calculateNormals, scratch):
+        calculateFacesImpl<true>(geometry, calculateNormals, scratch);
+}
 
-    if(glm::length2(t) > 1.e-10f)
+//################################################################################################
+template<bool Checked>
+void accumulateTangentForTriangle(const Vertex3DList& verts, const int* ii, size_t i1, size_t i2, size_t i3, std::vector<glm::vec3>& tangent)
+{
+  auto idx1 = size_t(ii[i1]);
+  auto idx2 = size_t(ii[i2]);
+  auto idx3 = size_t(ii[i3]);
+  if(!Checked || (idx1<verts.size() && idx2<verts.size() && idx3<verts.size()))
+  {
+    glm::vec3 t;
+    if(triangleTangent(verts[idx1], verts[idx2], verts[idx3], t))
     {
-      t = glm::normalize(t);
       tangent[idx1] += t;
       tangent[idx2] += t;
       tangent[idx3] += t;
@@ -183,20 +109,170 @@ void accumulateTangentForTriangle(const Vertex3DList& verts, const Indexes3D& pa
 }
 
 //################################################################################################
-void accumulateTangents(const Geometry3D& geometry,
-                        const Indexes3D& part,
+template<bool Checked, typename G>
+void accumulateTangents(const G& geometry,
+                        int type,
+                        const int* ii,
+                        size_t count,
                         std::vector<glm::vec3>& tangent)
 {
-  if(part.type == geometry.triangleFan)
-    for(size_t n=2; n<part.indexes.size(); ++n)
-      accumulateTangentForTriangle(geometry.verts, part, 0, n-1, n, tangent);
-  else if(part.type == geometry.triangleStrip)
-    for(size_t n=2; n<part.indexes.size(); ++n)
-      accumulateTangentForTriangle(geometry.verts, part, n-2, n-1, n, tangent);
-  else if(part.type == geometry.triangles)
+  if(type == geometry.triangleFan)
+    for(size_t n=2; n<count; ++n)
+      accumulateTangentForTriangle<Checked>(geometry.verts, ii, 0, n-1, n, tangent);
+  else if(type == geometry.triangleStrip)
+    for(size_t n=2; n<count; ++n)
+      accumulateTangentForTriangle<Checked>(geometry.verts, ii, n-2, n-1, n, tangent);
+  else if(type == geometry.triangles)
     // process each triplet of consecutive vertices
-    for(size_t n=0; n<part.indexes.size(); n+=3)
-      accumulateTangentForTriangle(geometry.verts, part, n, n+1, n+2, tangent);
+    for(size_t n=0; (n+2)<count; n+=3)
+      accumulateTangentForTriangle<Checked>(geometry.verts, ii, n, n+1, n+2, tangent);
+}
+
+//################################################################################################
+template<typename G>
+void buildTangentVectorsImpl(const G& geometry, std::vector<glm::vec3>& tangent)
+{
+  const auto& verts = geometry.verts;
+
+  // start with non-zero in case no valid tangents are found - there will still be a valid result
+  tangent.assign(verts.size(), {1.e-6f,0,0});
+  bool validated = geometry.validated();
+  forEachPart(geometry, [&](int type, const int* ii, size_t count)
+  {
+    if(validated)
+      accumulateTangents<false>(geometry, type, ii, count, tangent);
+    else
+      accumulateTangents<true>(geometry, type, ii, count, tangent);
+  });
+
+  normalizeTangents(verts, tangent);
+}
+
+//##################################################################################################
+//! Check the part types and sizes and that every index is in range, the unchecked kernels rely on this.
+template<typename G>
+bool indexesValid(const G& geometry)
+{
+  bool partsValid=true;
+  forEachPart(geometry, [&](int type, const int*, size_t size)
+  {
+    if(type == geometry.triangleFan || type == geometry.triangleStrip)
+    {
+      if(size!=0 && size<3)
+        partsValid = false;
+    }
+    else if(type == geometry.triangles)
+    {
+      if(size%3)
+        partsValid = false;
+    }
+    else
+      partsValid = false;
+  });
+
+  if(!partsValid)
+    return false;
+
+  std::atomic<bool> valid{true};
+  const int nVerts = int(geometry.verts.size());
+  forEachPart(geometry, [&](int, const int* ii, size_t size)
+  {
+    if(!valid)
+      return;
+
+    parallelForBlocks(size, 100000, [&](size_t begin, size_t end, size_t)
+    {
+      const int* i = ii+begin;
+      const int* iMax = ii+end;
+      bool ok=true;
+      for(; i<iMax; i++)
+        ok &= (*i>=0) & (*i<nVerts);
+      if(!ok)
+        valid = false;
+    });
+  });
+
+  return valid;
+}
+
+//##################################################################################################
+//! Check that each part of a FlatGeometry3D lies inside its index buffer.
+bool partTableValid(const FlatGeometry3D& geometry)
+{
+  for(const auto& part : geometry.indexes.parts)
+    if(part.offset>geometry.indexes.indexes.size() || part.count>(geometry.indexes.indexes.size()-part.offset))
+      return false;
+  return true;
+}
+
+//##################################################################################################
+template<typename G>
+bool validateImpl(const G& geometry)
+{
+  if(!indexesValid(geometry))
+    return false;
+
+  std::atomic<bool> valid{true};
+
+  const auto& verts = geometry.verts;
+  parallelForBlocks(verts.size(), 100000, [&](size_t begin, size_t end, size_t)
+  {
+    bool ok=true;
+    for(size_t i=begin; i<end; i++)
+    {
+      const glm::vec3& v = verts[i].vert;
+      ok &= std::isfinite(v.x) & std::isfinite(v.y) & std::isfinite(v.z);
+    }
+    if(!ok)
+      valid = false;
+  });
+
+  return valid;
+}
+
+//##################################################################################################
+template<typename G>
+void calculateVertexNormalsImpl(G& geometry, std::pmr::memory_resource* scratch)
+{
+  auto& verts = geometry.verts;
+  const size_t vMax = verts.size();
+
+  std::pmr::vector<int> normalCounts(vMax, 0, scratchResource(scratch));
+
+  for(auto& vert : verts)
+    vert.normal = {0.0f, 0.0f, 0.0f};
+
+  std::pmr::vector<Face_lt> faces = calculateFaces(geometry, true, scratch);
+  {
+    auto const* face = faces.data();
+    auto faceMax = face + faces.size();
+    for(; face<faceMax; face++)
+    {
+      if(std::isnan(face->normal.x) || std::isnan(face->normal.y) || std::isnan(face->normal.z) ||
+         std::isinf(face->normal.x) || std::isinf(face->normal.y) || std::isinf(face->normal.z))
+        continue;
+
+      for(const auto& i : face->indexes)
+      {
+        auto ii = size_t(i);
+        normalCounts[ii]++;
+        verts[ii].normal += face->normal;
+      }
+    }
+  }
+
+  {
+    auto vert  = verts.data();
+    auto vertMax = vert+vMax;
+    auto count = normalCounts.data();
+    for(; vert<vertMax; vert++, count++)
+    {
+      if(*count && glm::length2(vert->normal)>0.000001f)
+        vert->normal = glm::normalize(vert->normal);
+      else
+        vert->normal = {0.0f, 0.0f, 1.0f};
+    }
+  }
 }
 
 }
@@ -262,6 +338,119 @@ Vertex3D Vertex3D::interpolate(float u, float v, const Vertex3D& v0, const Verte
   return result;
 }
 
+//##################################################################################################
+bool triangleTangent(const Vertex3D& v1, const Vertex3D& v2, const Vertex3D& v3, glm::vec3& tangent)
+{
+  auto posdiff21 = v2.vert-v1.vert;
+  auto posdiff31 = v3.vert-v1.vert;
+  auto posdiff32 = v3.vert-v2.vert;
+  auto texdiff21 = v2.texture-v1.texture;
+  auto texdiff31 = v3.texture-v1.texture;
+  auto texdiff32 = v3.texture-v2.texture;
+  glm::vec3 t = {0,0,0};
+  const float smallVal = 1.e-4f;
+  const float verySmallVal = 1.e-6f;
+  if(verySmallVal > glm::abs(texdiff21.y) && smallVal < glm::abs(texdiff21.x))
+    // use points 1 and 2
+    t = (texdiff31.x < 0.f) ? -posdiff21 : posdiff21;
+  else if(verySmallVal > glm::abs(texdiff31.y) && smallVal < glm::abs(texdiff31.x))
+    // use points 1 and 3
+    t = (texdiff31.x < 0.f) ? -posdiff31 : posdiff31;
+  else if(verySmallVal > glm::abs(texdiff32.y) && smallVal < glm::abs(texdiff32.x))
+    // use points 2 and 3
+    t = (texdiff32.x < 0.f) ? -posdiff32 : posdiff32;
+  else if(smallVal < glm::abs(texdiff32.y) || smallVal < glm::abs(texdiff31.y) || smallVal < glm::abs(texdiff21.y))
+  {
+    if(glm::abs(texdiff32.y) > glm::abs(texdiff31.y) && glm::abs(texdiff32.y) > glm::abs(texdiff21.y))
+    {
+      // interpolate relative to point 1
+      float alpha = texdiff31.y/texdiff32.y;
+      float ud = alpha*texdiff21.x + (1.f-alpha)*texdiff31.x;
+      if(smallVal < glm::abs(ud))
+      {
+        t = alpha*posdiff21 + (1.f-alpha)*posdiff31;
+        if (ud < 0.f) t = -t;
+      }
+    }
+    else if(glm::abs(texdiff31.y) > glm::abs(texdiff21.y))
+    {
+      // interpolate relative to point 2
+      float alpha = texdiff21.y/texdiff31.y;
+      float ud = alpha*texdiff32.x - (1.f-alpha)*texdiff21.x;
+      if(smallVal < glm::abs(ud))
+      {
+        t = alpha*posdiff32 - (1.f-alpha)*posdiff21;
+        if (ud < 0.f) t = -t;
+      }
+    }
+    else
+    {
+      // interpolate relative to point 3
+      float alpha = -texdiff32.y/texdiff21.y;
+      float ud = -alpha*texdiff31.x - (1.f-alpha)*texdiff32.x;
+      if(smallVal < glm::abs(ud))
+      {
+        t = -alpha*posdiff31 - (1.f-alpha)*posdiff32;
+        if (ud < 0.f) t = -t;
+      }
+    }
+  }
+
+
+  if(glm::length2(t) > 1.e-10f)
+  {
+    tangent = glm::normalize(t);
+    return true;
+  }
+
+  return false;
+}
+
+//##################################################################################################
+void normalizeTangents(const Vertex3DList& verts, std::vector<glm::vec3>& tangent)
+{
+  // normalize each tangent vector to unit length
+  for(auto& t : tangent)
+    t = glm::normalize(t);
+
+  // when tangent and normal are nearly parallel we have to select a different tangent
+  for(size_t idx=0; idx<tangent.size(); ++idx)
+    if(glm::abs(glm::dot(verts[idx].normal, tangent[idx])) > 0.999f)
+    {
+      glm::vec3 t1 = glm::cross(glm::vec3(1,0,0), verts[idx].normal);
+      glm::vec3 t2 = glm::cross(glm::vec3(0,1,0), verts[idx].normal);
+      tangent[idx] = glm::normalize((glm::dot(t1, t1)>glm::dot(t2,t2))?t1:t2);
+    }
+}
+
+//##################################################################################################
+bool Geometry3D::validate()
+{
+  setValidated(validateImpl(*this));
+  return m_validated;
+}
+
+//##################################################################################################
+bool Geometry3D::validated() const
+{
+  // Index values can be edited in place so they are checked every time, this is a single pass that
+  // is much cheaper than checking each access. Positions are only checked by validate().
+  return m_validated && verts.size()==m_validatedVerts && indexesValid(*this);
+}
+
+//##################################################################################################
+void Geometry3D::invalidate()
+{
+  setValidated(false);
+}
+
+//##################################################################################################
+void Geometry3D::setValidated(bool validated)
+{
+  m_validated = validated;
+  m_validatedVerts = verts.size();
+}
+
 //##################################################################################################
 void Geometry3D::add(const Geometry3D& other)
 {
@@ -274,6 +463,8 @@ void Geometry3D::add(const Geometry3D& other)
   for(const auto& index : other.indexes)
     for(auto& i : indexes.emplace_back(index).indexes)
       i+=int(offset);
+
+  invalidate();
 }
 
 //##################################################################################################
@@ -282,6 +473,7 @@ void Geometry3D::clear()
   comments.clear();
   verts.clear();
   indexes.clear();
+  setValidated(true);
 }
 
 //##################################################################################################
@@ -370,9 +562,10 @@ void Geometry3D::getMinMax(const std::vector<tp_math_utils::Geometry3D>& geometr
 }
 
 //##################################################################################################
-void Geometry3D::convertToTriangles()
+void Geometry3D::convertToTriangles(std::pmr::memory_resource* scratch)
 {
-  std::vector<Face_lt> faces = calculateFaces(*this, false);
+  bool valid = validated();
+  std::pmr::vector<Face_lt> faces = calculateFaces(*this, false, scratch);
 
   indexes.clear();
   Indexes3D& newIndexes = indexes.emplace_back();
@@ -382,12 +575,15 @@ void Geometry3D::convertToTriangles()
   for(const auto& face : faces)
     for(const auto& i : face.indexes)
       newIndexes.indexes.push_back(i);
+
+  setValidated(valid);
 }
 
 //##################################################################################################
-void Geometry3D::breakApartTriangles()
+void Geometry3D::breakApartTriangles(std::pmr::memory_resource* scratch)
 {
-  std::vector<Face_lt> faces = calculateFaces(*this, false);
+  bool valid = validated();
+  std::pmr::vector<Face_lt> faces = calculateFaces(*this, false, scratch);
 
   indexes.clear();
   Indexes3D& newIndexes = indexes.emplace_back();
@@ -408,10 +604,11 @@ void Geometry3D::breakApartTriangles()
   }
 
   verts.swap(newVerts);
+  setValidated(valid);
 }
 
 //##################################################################################################
-void Geometry3D::calculateNormals(NormalCalculationMode mode, float minDot)
+void Geometry3D::calculateNormals(NormalCalculationMode mode, float minDot, std::pmr::memory_resource* scratch)
 {
   switch(mode)
   {
@@ -419,66 +616,30 @@ void Geometry3D::calculateNormals(NormalCalculationMode mode, float minDot)
     break;
 
     case NormalCalculationMode::CalculateFaceNormals:
-    calculateFaceNormals();
+    calculateFaceNormals(scratch);
     break;
 
     case NormalCalculationMode::CalculateVertexNormals:
-    calculateVertexNormals();
+    calculateVertexNormals(scratch);
     break;
 
     case NormalCalculationMode::CalculateAdaptiveNormals:
-    calculateAdaptiveNormals(minDot);
+    calculateAdaptiveNormals(minDot, scratch);
     break;
   }
 }
 
 //##################################################################################################
-void Geometry3D::calculateVertexNormals()
+void Geometry3D::calculateVertexNormals(std::pmr::memory_resource* scratch)
 {
-  const size_t vMax = verts.size();
-
-  std::vector<int> normalCounts(vMax, 0);
-
-  for(auto& vert : verts)
-    vert.normal = {0.0f, 0.0f, 0.0f};
-
-  std::vector<Face_lt> faces = calculateFaces(*this, true);
-  {
-    auto const* face = faces.data();
-    auto faceMax = face + faces.size();
-    for(; face<faceMax; face++)
-    {
-      if(std::isnan(face->normal.x) || std::isnan(face->normal.y) || std::isnan(face->normal.z) ||
-         std::isinf(face->normal.x) || std::isinf(face->normal.y) || std::isinf(face->normal.z))
-        continue;
-
-      for(const auto& i : face->indexes)
-      {
-        auto ii = size_t(i);
-        normalCounts[ii]++;
-        verts[ii].normal += face->normal;
-      }
-    }
-  }
-
-  {
-    auto vert  = verts.data();
-    auto vertMax = vert+vMax;
-    auto count = normalCounts.data();
-    for(; vert<vertMax; vert++, count++)
-    {
-      if(*count && glm::length2(vert->normal)>0.000001f)
-        vert->normal = glm::normalize(vert->normal);
-      else
-        vert->normal = {0.0f, 0.0f, 1.0f};
-    }
-  }
+  calculateVertexNormalsImpl(*this, scratch);
 }
 
 //##################################################################################################
-void Geometry3D::calculateFaceNormals()
+void Geometry3D::calculateFaceNormals(std::pmr::memory_resource* scratch)
 {
-  std::vector<Face_lt> faces = calculateFaces(*this, true);
+  bool valid = validated();
+  std::pmr::vector<Face_lt> faces = calculateFaces(*this, true, scratch);
 
   indexes.clear();
   Indexes3D& newIndexes = indexes.emplace_back();
@@ -500,6 +661,7 @@ void Geometry3D::calculateFaceNormals()
   }
 
   verts = std::move(newVerts);
+  setValidated(valid);
 }
 
 namespace
@@ -527,10 +689,17 @@ struct VertCloud
 }
 
 //##################################################################################################
-void Geometry3D::combineSimilarVerts()
+void Geometry3D::combineSimilarVerts(std::pmr::memory_resource* scratch)
 {
+  std::pmr::vector<size_t> idxLookup(scratchResource(scratch));
+  combineSimilarVerts(idxLookup);
+}
+
+//##################################################################################################
+void Geometry3D::combineSimilarVerts(std::pmr::vector<size_t>& idxLookup)
+{
+  bool valid = validated();
   size_t insertPos=0;
-  std::vector<size_t> idxLookup;
   idxLookup.resize(verts.size());
 
   typedef nanoflann::KDTreeSingleIndexDynamicAdaptor<nanoflann::L2_Simple_Adaptor<float, VertCloud>, VertCloud, 5> KDTree;
@@ -581,12 +750,15 @@ void Geometry3D::combineSimilarVerts()
       i = int(idxLookup[j]);
     }
   }
+
+  setValidated(valid);
 }
 
 //##################################################################################################
-void Geometry3D::calculateAdaptiveNormals(float minDot)
+void Geometry3D::calculateAdaptiveNormals(float minDot, std::pmr::memory_resource* scratch)
 {
-  combineSimilarVerts();
+  bool valid = validated();
+  combineSimilarVerts(scratch);
 
   const size_t vMax = verts.size();
 
@@ -599,32 +771,48 @@ void Geometry3D::calculateAdaptiveNormals(float minDot)
     int newVertIndex{0};
   };
 
+  // Most verts only have a few clusters, the allocator is passed down to the inner vectors.
   struct VertDetails_lt
   {
-    std::vector<VertCluster_lt> clusters;
+    using allocator_type = std::pmr::polymorphic_allocator<VertCluster_lt>;
+
+    VertDetails_lt(const allocator_type& alloc):
+      clusters(alloc)
+    {
+
+    }
+
+    VertDetails_lt(const VertDetails_lt& other, const allocator_type& alloc):
+      clusters(other.clusters, alloc)
+    {
+
+    }
+
+    std::pmr::vector<VertCluster_lt> clusters;
   };
 
-  std::vector<VertDetails_lt> clusters(vMax);
+  std::pmr::vector<VertDetails_lt> clusters(vMax, scratchResource(scratch));
 
-  std::vector<Face_lt> faces = calculateFaces(*this, true);
-  std::vector<std::array<int, 3>> faceClusters(faces.size());
+  std::pmr::vector<Face_lt> faces = calculateFaces(*this, true, scratch);
+  std::pmr::vector<std::array<int, 3>> faceClusters(faces.size(), scratchResource(scratch));
 
+  // The face indexes have been range checked by calculateFaces when it calculated the normals.
   size_t newVertsCount=0;
   for(size_t f=0; f<faces.size(); f++)
   {
-    const auto& face = faces.at(f);
+    const auto& face = faces[f];
 
     for(size_t i=0; i<3; i++)
     {
-      auto& vertClusters = clusters.at(face.indexes.at(i));
+      auto& vertClusters = clusters[size_t(face.indexes[i])];
 
       bool done=false;
       for(size_t c=0; c<vertClusters.clusters.size(); c++)
       {
-        auto& cluster = vertClusters.clusters.at(c);
+        auto& cluster = vertClusters.clusters[c];
         if(glm::dot(glm::normalize(cluster.normal), face.normal)>minDot)
         {
-          faceClusters.at(f).at(i) = int(c);
+          faceClusters[f][i] = int(c);
           cluster.normal += face.normal;
           done=true;
           break;
@@ -634,7 +822,7 @@ void Geometry3D::calculateAdaptiveNormals(float minDot)
       if(!done)
       {
         newVertsCount++;
-        faceClusters.at(f).at(i) = int(vertClusters.clusters.size());
+        faceClusters[f][i] = int(vertClusters.clusters.size());
         auto& cluster = vertClusters.clusters.emplace_back();
         cluster.normal = face.normal;
       }
@@ -646,12 +834,12 @@ void Geometry3D::calculateAdaptiveNormals(float minDot)
     newVerts.reserve(newVertsCount);
     for(size_t c=0; c<clusters.size(); c++)
     {
-      auto& vertClusters = clusters.at(c);
+      auto& vertClusters = clusters[c];
       for(auto& cluster : vertClusters.clusters)
       {
         cluster.newVertIndex = int(newVerts.size());
         auto& newVert = newVerts.emplace_back();
-        newVert = verts.at(c);
+        newVert = verts[c];
         newVert.normal = glm::normalize(cluster.normal);
       }
     }
@@ -666,32 +854,41 @@ void Geometry3D::calculateAdaptiveNormals(float minDot)
 
   for(size_t f=0; f<faceClusters.size(); f++)
   {
-    const auto& face = faces.at(f);
-    const auto& faceCluster = faceClusters.at(f);
+    const auto& face = faces[f];
+    const auto& faceCluster = faceClusters[f];
 
     for(size_t i=0; i<3; i++)
     {
-      const auto& vertClusters = clusters.at(face.indexes.at(i));
-      newIndexes.indexes.push_back(vertClusters.clusters.at(faceCluster.at(i)).newVertIndex);
+      const auto& vertClusters = clusters[size_t(face.indexes[i])];
+      newIndexes.indexes.push_back(vertClusters.clusters[size_t(faceCluster[i])].newVertIndex);
     }
   }
+
+  setValidated(valid);
 }
 
 //##################################################################################################
 void Geometry3D::transform(const glm::mat4& m)
 {
   glm::mat3 r(m);
+  bool finite=true;
   for(auto& vert : verts)
   {
     vert.vert = tpProj(m, vert.vert);
     vert.normal = r * vert.normal;
+    finite &= std::isfinite(vert.vert.x) & std::isfinite(vert.vert.y) & std::isfinite(vert.vert.z);
   }
+
+  // A projective transform can move points to infinity.
+  if(!finite)
+    invalidate();
 }
 
 //##################################################################################################
-void Geometry3D::addBackFaces()
+void Geometry3D::addBackFaces(std::pmr::memory_resource* scratch)
 {
-  std::vector<Face_lt> faces = calculateFaces(*this, false);
+  bool valid = validated();
+  std::pmr::vector<Face_lt> faces = calculateFaces(*this, false, scratch);
 
   size_t size = verts.size();
   verts.resize(size*2);
@@ -711,28 +908,14 @@ void Geometry3D::addBackFaces()
     newTriangles.indexes.push_back(face.indexes[1] + int(size));
     newTriangles.indexes.push_back(face.indexes[0] + int(size));
   }
+
+  setValidated(valid);
 }
 
 //################################################################################################
 void Geometry3D::buildTangentVectors(std::vector<glm::vec3>& tangent) const
 {
-  // start with non-zero in case no valid tangents are found - there will still be a valid result
-  tangent.assign(verts.size(), {1.e-6f,0,0});
-  for(const auto& part : indexes)
-    accumulateTangents(*this, part, tangent);
-
-  // normalize each tangent vector to unit length
-  for(auto& t : tangent)
-    t = glm::normalize(t);
-
-  // when tangent and normal are nearly parallel we have to select a different tangent
-  for(size_t idx=0; idx<tangent.size(); ++idx)
-    if(glm::abs(glm::dot(verts.at(idx).normal, tangent.at(idx))) > 0.999f)
-    {
-      glm::vec3 t1 = glm::cross(glm::vec3(1,0,0), verts.at(idx).normal);
-      glm::vec3 t2 = glm::cross(glm::vec3(0,1,0), verts.at(idx).normal);
-      tangent[idx] = glm::normalize((glm::dot(t1, t1)>glm::dot(t2,t2))?t1:t2);
-    }
+  buildTangentVectorsImpl(*this, tangent);
 }
 
 //##################################################################################################
@@ -809,6 +992,174 @@ bool Geometry3D::printDataToFile(const std::vector<Geometry3D>& geometry, const
   }
 }
 
+//##################################################################################################
+void FlatIndexes3D::addPart(int type, const int* partIndexes, size_t count)
+{
+  auto& part = parts.emplace_back();
+  part.type = type;
+  part.offset = indexes.size();
+  part.count = count;
+  indexes.insert(indexes.end(), partIndexes, partIndexes+count);
+}
+
+//##################################################################################################
+void FlatIndexes3D::clear()
+{
+  indexes.clear();
+  parts.clear();
+}
+
+//##################################################################################################
+FlatIndexes3D FlatIndexes3D::fromIndexes(const Indexes3DList& indexes)
+{
+  FlatIndexes3D flat;
+
+  size_t count=0;
+  for(const auto& part : indexes)
+    count += part.indexes.size();
+
+  flat.indexes.reserve(count);
+  flat.parts.reserve(indexes.size());
+  for(const auto& part : indexes)
+    flat.addPart(part.type, part.indexes.data(), part.indexes.size());
+
+  return flat;
+}
+
+//##################################################################################################
+Indexes3DList FlatIndexes3D::toIndexes() const
+{
+  Indexes3DList result;
+  result.reserve(parts.size());
+  forEachPart([&](int type, const int* ii, size_t count)
+  {
+    auto& part = result.emplace_back();
+    part.type = type;
+    part.indexes.assign(ii, ii+count);
+  });
+  return result;
+}
+
+//##################################################################################################
+FlatGeometry3D FlatGeometry3D::fromGeometry3D(const Geometry3D& geometry)
+{
+  FlatGeometry3D flat;
+  flat.comments      = geometry.comments;
+  flat.verts         = geometry.verts;
+  flat.indexes       = FlatIndexes3D::fromIndexes(geometry.indexes);
+  flat.triangleFan   = geometry.triangleFan;
+  flat.triangleStrip = geometry.triangleStrip;
+  flat.triangles     = geometry.triangles;
+  flat.material      = geometry.material;
+  flat.setValidated(geometry.validated());
+  return flat;
+}
+
+//##################################################################################################
+Geometry3D FlatGeometry3D::toGeometry3D() const
+{
+  Geometry3D geometry;
+  geometry.comments      = comments;
+  geometry.verts         = verts;
+  geometry.indexes       = indexes.toIndexes();
+  geometry.triangleFan   = triangleFan;
+  geometry.triangleStrip = triangleStrip;
+  geometry.triangles     = triangles;
+  geometry.material      = material;
+  geometry.setValidated(validated());
+  return geometry;
+}
+
+//##################################################################################################
+bool FlatGeometry3D::validate()
+{
+  setValidated(partTableValid(*this) && validateImpl(*this));
+  return m_validated;
+}
+
+//##################################################################################################
+bool FlatGeometry3D::validated() const
+{
+  // See Geometry3D::validated(), the part table is checked first as the index check walks it.
+  return m_validated && verts.size()==m_validatedVerts && partTableValid(*this) && indexesValid(*this);
+}
+
+//##################################################################################################
+void FlatGeometry3D::invalidate()
+{
+  setValidated(false);
+}
+
+//##################################################################################################
+void FlatGeometry3D::setValidated(bool validated)
+{
+  m_validated = validated;
+  m_validatedVerts = verts.size();
+}
+
+//##################################################################################################
+void FlatGeometry3D::stats(size_t& vertCount, size_t& indexCount, size_t& triangleCount) const
+{
+  vertCount += verts.size();
+  indexCount += indexes.indexes.size();
+
+  indexes.forEachPart([&](int type, const int*, size_t count)
+  {
+    if(count<3)
+      return;
+
+    if(type == triangleFan)
+      triangleCount+=count-2;
+    else if(type == triangleStrip)
+      triangleCount+=count-2;
+    else if(type == triangles)
+      triangleCount+=count/3;
+  });
+}
+
+//##################################################################################################
+std::string FlatGeometry3D::stats() const
+{
+  size_t vertCount{0};
+  size_t indexCount{0};
+  size_t triangleCount{0};
+
+  stats(vertCount, indexCount, triangleCount);
+
+  return Geometry3D::statsString(vertCount, indexCount, triangleCount);
+}
+
+//##################################################################################################
+void FlatGeometry3D::convertToTriangles(std::pmr::memory_resource* scratch)
+{
+  bool valid = validated();
+  std::pmr::vector<Face_lt> faces = calculateFaces(*this, false, scratch);
+
+  indexes.clear();
+  auto& part = indexes.parts.emplace_back();
+  part.type = triangles;
+  part.count = faces.size()*3;
+
+  indexes.indexes.reserve(part.count);
+  for(const auto& face : faces)
+    for(const auto& i : face.indexes)
+      indexes.indexes.push_back(i);
+
+  setValidated(valid);
+}
+
+//##################################################################################################
+void FlatGeometry3D::calculateVertexNormals(std::pmr::memory_resource* scratch)
+{
+  calculateVertexNormalsImpl(*this, scratch);
+}
+
+//##################################################################################################
+void FlatGeometry3D::buildTangentVectors(std::vector<glm::vec3>& tangent) const
+{
+  buildTangentVectorsImpl(*this, tangent);
+}
+
 //##################################################################################################
 void Geometry::saveState(nlohmann::json& j) const
 {
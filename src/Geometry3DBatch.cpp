@@ -0,0 +1,237 @@
+#include "tp_math_utils/Geometry3DBatch.h"
+#include "tp_math_utils/Geometry3DPipeline.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/ScratchArena.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+size_t meshSize(const Geometry3D& mesh)
+{
+  size_t size = mesh.verts.size();
+  for(const auto& part : mesh.indexes)
+    size += part.indexes.size();
+  return size;
+}
+
+//##################################################################################################
+//! Run closure(task) for each task in parallel, largest first, reporting progress by weight.
+template<typename Closure>
+bool runLargestFirst(const std::vector<size_t>& weights, tp_utils::Progress* progress, const Closure& closure)
+{
+  // Add one to each weight so that empty tasks still count towards progress.
+  size_t total = std::accumulate(weights.begin(), weights.end(), weights.size());
+
+  std::vector<size_t> order(weights.size());
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+  {
+    return weights[a] > weights[b];
+  });
+
+  // Progress may not be thread safe, so only the calling thread talks to it. It does not take any
+  // tasks so that it can keep reporting progress and stop the workers while a big task runs.
+  std::atomic<size_t> done{0};
+  std::atomic<bool> stop{false};
+
+  auto poll = [&]
+  {
+    if(stop)
+      return;
+
+    if(progress->shouldStop())
+      stop = true;
+    else
+      progress->setProgress(float(done) / float(total));
+  };
+
+  // Run the tasks order[begin] to order[end-1] in parallel.
+  auto runTasks = [&](size_t begin, size_t end, bool nested)
+  {
+    auto run = [&](size_t i)
+    {
+      if(stop)
+        return;
+
+      size_t t = order[begin+i];
+      if(nested)
+      {
+        NestedParallelScope scope;
+        closure(t);
+      }
+      else
+        closure(t);
+
+      done += weights[t]+1;
+    };
+
+    if(progress)
+      parallelForPolled(end-begin, run, poll);
+    else
+      parallelFor(end-begin, run);
+  };
+
+  // A task that is bigger than an even share of the work would keep one thread busy while the
+  // others sit idle. Run these one at a time first and let the parallel passes inside them split
+  // the work across every thread.
+  size_t share = total / parallelThreadCount(total, 1);
+  size_t large=0;
+  if(share<total)
+    while(large<order.size() && weights[order[large]]>share)
+      large++;
+
+  for(size_t i=0; i<large; i++)
+    runTasks(i, i+1, true);
+
+  runTasks(large, order.size(), false);
+
+  if(stop)
+    return false;
+
+  if(progress)
+    progress->setProgress(1.0f);
+
+  return true;
+}
+
+//##################################################################################################
+//! Run an operation on each mesh passing in the arena of the thread that runs it.
+template<typename Closure>
+bool forEachWithScratch(Geometry3DList& geometry, tp_utils::Progress* progress, const Closure& closure)
+{
+  ScratchArena::ThreadLocalScope scope;
+  return forEachGeometry3D(geometry, [&](Geometry3D& mesh, size_t)
+  {
+    auto& arena = ScratchArena::threadLocal();
+    closure(mesh, arena.resource());
+    arena.reset();
+  }, progress);
+}
+}
+
+//##################################################################################################
+bool forEachGeometry3D(Geometry3DList& geometry,
+                       const std::function<void(Geometry3D&, size_t)>& closure,
+                       tp_utils::Progress* progress)
+{
+  std::vector<size_t> weights(geometry.size());
+  for(size_t m=0; m<geometry.size(); m++)
+    weights[m] = meshSize(geometry[m]);
+
+  return runLargestFirst(weights, progress, [&](size_t m)
+  {
+    closure(geometry[m], m);
+  });
+}
+
+//##################################################################################################
+bool forEachGeometry3DRange(Geometry3DList& geometry,
+                            const std::function<size_t(const Geometry3D&)>& count,
+                            size_t blockSize,
+                            const std::function<void(Geometry3D&, size_t, size_t, size_t)>& closure,
+                            tp_utils::Progress* progress)
+{
+  blockSize = tpMax(blockSize, size_t(1));
+
+  struct Range_lt
+  {
+    size_t mesh;
+    size_t begin;
+    size_t end;
+  };
+
+  std::vector<Range_lt> ranges;
+  std::vector<size_t> weights;
+  for(size_t m=0; m<geometry.size(); m++)
+  {
+    size_t c = count(geometry[m]);
+    for(size_t begin=0; begin<c; begin+=blockSize)
+    {
+      size_t end = tpMin(begin+blockSize, c);
+      ranges.push_back({m, begin, end});
+      weights.push_back(end-begin);
+    }
+  }
+
+  return runLargestFirst(weights, progress, [&](size_t r)
+  {
+    const auto& range = ranges[r];
+    closure(geometry[range.mesh], range.mesh, range.begin, range.end);
+  });
+}
+
+//##################################################################################################
+bool convertToTriangles(Geometry3DList& geometry, tp_utils::Progress* progress)
+{
+  return Geometry3DPipeline().convertToTriangles().run(geometry, nullptr, progress);
+}
+
+//##################################################################################################
+bool combineSimilarVerts(Geometry3DList& geometry, tp_utils::Progress* progress)
+{
+  return forEachWithScratch(geometry, progress, [&](Geometry3D& mesh, std::pmr::memory_resource* scratch)
+  {
+    mesh.combineSimilarVerts(scratch);
+  });
+}
+
+//##################################################################################################
+bool calculateNormals(Geometry3DList& geometry,
+                      NormalCalculationMode mode,
+                      float minDot,
+                      tp_utils::Progress* progress)
+{
+  // The pipeline calculates normals in parallel passes that large meshes can split.
+  return Geometry3DPipeline().calculateNormals(mode, minDot).run(geometry, nullptr, progress);
+}
+
+//##################################################################################################
+bool addBackFaces(Geometry3DList& geometry, tp_utils::Progress* progress)
+{
+  return Geometry3DPipeline().addBackFaces().run(geometry, nullptr, progress);
+}
+
+//##################################################################################################
+bool transform(Geometry3DList& geometry, const glm::mat4& m, tp_utils::Progress* progress)
+{
+  glm::mat3 r(m);
+
+  // Several ranges of a mesh may clear its flag at the same time.
+  std::vector<std::atomic<bool>> finite(geometry.size());
+  for(auto& f : finite)
+    f = true;
+
+  bool complete = forEachGeometry3DRange(geometry, [](const Geometry3D& mesh)
+  {
+    return mesh.verts.size();
+  }, 65536, [&](Geometry3D& mesh, size_t index, size_t begin, size_t end)
+  {
+    // Same as Geometry3D::transform() for a range of verts.
+    bool ok=true;
+    auto vert = mesh.verts.data()+begin;
+    auto vertMax = mesh.verts.data()+end;
+    for(; vert<vertMax; vert++)
+    {
+      vert->vert = tpProj(m, vert->vert);
+      vert->normal = r * vert->normal;
+      ok &= std::isfinite(vert->vert.x) & std::isfinite(vert->vert.y) & std::isfinite(vert->vert.z);
+    }
+
+    if(!ok)
+      finite[index] = false;
+  }, progress);
+
+  for(size_t i=0; i<geometry.size(); i++)
+    if(!finite[i])
+      geometry[i].invalidate();
+
+  return complete;
+}
+
+}
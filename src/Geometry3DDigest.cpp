@@ -0,0 +1,364 @@
+#include "tp_math_utils/Geometry3DDigest.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/HashUtils.h"
+
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+uint64_t mix(uint64_t h, uint64_t v)
+{
+  h ^= v * 0x9E3779B97F4A7C15ull;
+  h = (h << 27) | (h >> 37);
+  return h * 0xC2B2AE3D27D4EB4Full + 0x165667B19E3779F9ull;
+}
+
+//##################################################################################################
+uint64_t finalize(uint64_t h)
+{
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBull;
+  h ^= h >> 31;
+  return h;
+}
+
+//##################################################################################################
+uint64_t hashString(uint64_t h, const std::string& s)
+{
+  h = mix(h, s.size());
+  size_t i=0;
+  for(; i+8<=s.size(); i+=8)
+  {
+    uint64_t v;
+    std::memcpy(&v, s.data()+i, 8);
+    h = mix(h, v);
+  }
+
+  uint64_t v=0;
+  std::memcpy(&v, s.data()+i, s.size()-i);
+  return mix(h, v);
+}
+
+//##################################################################################################
+//! Round a float to a multiple of tolerance, or take its bits if tolerance is 0.
+uint64_t quantize(float f, float tolerance)
+{
+  if(tolerance>0.0f && std::isfinite(f))
+  {
+    double q = std::round(double(f)/double(tolerance));
+    if(std::fabs(q)<9.0e18)
+      return uint64_t(int64_t(q));
+  }
+
+  return floatBits(f);
+}
+
+//##################################################################################################
+uint64_t hashVertex(uint64_t h, const Vertex3D& v, float tolerance)
+{
+  h = mix(h, quantize(v.vert.x, tolerance));
+  h = mix(h, quantize(v.vert.y, tolerance));
+  h = mix(h, quantize(v.vert.z, tolerance));
+  h = mix(h, quantize(v.texture.x, tolerance));
+  h = mix(h, quantize(v.texture.y, tolerance));
+  h = mix(h, quantize(v.normal.x, tolerance));
+  h = mix(h, quantize(v.normal.y, tolerance));
+  h = mix(h, quantize(v.normal.z, tolerance));
+  return h;
+}
+
+//##################################################################################################
+bool sameVertex(const Vertex3D& a, const Vertex3D& b, float tolerance)
+{
+  return
+      quantize(a.vert.x, tolerance) == quantize(b.vert.x, tolerance) &&
+      quantize(a.vert.y, tolerance) == quantize(b.vert.y, tolerance) &&
+      quantize(a.vert.z, tolerance) == quantize(b.vert.z, tolerance) &&
+      quantize(a.texture.x, tolerance) == quantize(b.texture.x, tolerance) &&
+      quantize(a.texture.y, tolerance) == quantize(b.texture.y, tolerance) &&
+      quantize(a.normal.x, tolerance) == quantize(b.normal.x, tolerance) &&
+      quantize(a.normal.y, tolerance) == quantize(b.normal.y, tolerance) &&
+      quantize(a.normal.z, tolerance) == quantize(b.normal.z, tolerance);
+}
+
+//##################################################################################################
+std::string toHex(uint64_t digest)
+{
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << digest;
+  return ss.str();
+}
+
+//##################################################################################################
+//! Blocks have a fixed size so that the result does not depend on the number of threads.
+template<typename HashRange>
+void hashBlocks(size_t count, size_t blockSize, std::vector<uint64_t>& digests, const HashRange& hashRange)
+{
+  digests.resize((count+blockSize-1)/blockSize);
+  parallelFor(digests.size(), [&](size_t b)
+  {
+    size_t begin = b*blockSize;
+    digests[b] = hashRange(begin, tpMin(begin+blockSize, count));
+  });
+}
+}
+
+//##################################################################################################
+std::string Geometry3DDigest::toString() const
+{
+  return toHex(digest);
+}
+
+//##################################################################################################
+std::string Geometry3DListDigest::toString() const
+{
+  return toHex(digest);
+}
+
+//##################################################################################################
+Geometry3DDigest digestGeometry3D(const Geometry3D& geometry, const Geometry3DDigestParams& params)
+{
+  Geometry3DDigest result;
+
+  {
+    uint64_t h = mix(0, geometry.verts.size());
+    h = mix(h, geometry.indexes.size());
+    h = mix(h, uint64_t(uint32_t(geometry.triangleFan)));
+    h = mix(h, uint64_t(uint32_t(geometry.triangleStrip)));
+    h = mix(h, uint64_t(uint32_t(geometry.triangles)));
+    h = mix(h, geometry.comments.size());
+    for(const auto& comment : geometry.comments)
+      h = hashString(h, comment);
+    result.headerDigest = finalize(h);
+  }
+
+  if(params.includeMaterial)
+  {
+    nlohmann::json j;
+    geometry.material.saveState(j);
+    result.materialDigest = finalize(hashString(0, j.dump()));
+  }
+
+  hashBlocks(geometry.verts.size(), Geometry3DDigest::vertBlockSize, result.vertBlockDigests, [&](size_t begin, size_t end)
+  {
+    uint64_t h = mix(0, begin);
+    for(size_t i=begin; i<end; i++)
+      h = hashVertex(h, geometry.verts[i], params.tolerance);
+    return finalize(h);
+  });
+
+  result.partDigests.resize(geometry.indexes.size());
+  parallelFor(geometry.indexes.size(), [&](size_t p)
+  {
+    const auto& part = geometry.indexes[p];
+
+    // Large parts are split into blocks as well, the part digest combines them.
+    std::vector<uint64_t> blockDigests;
+    hashBlocks(part.indexes.size(), Geometry3DDigest::vertBlockSize*4, blockDigests, [&](size_t begin, size_t end)
+    {
+      uint64_t h = mix(0, begin);
+      for(size_t i=begin; i<end; i++)
+        h = mix(h, uint64_t(uint32_t(part.indexes[i])));
+      return h;
+    });
+
+    uint64_t h = mix(0, uint64_t(uint32_t(part.type)));
+    h = mix(h, part.indexes.size());
+    for(auto d : blockDigests)
+      h = mix(h, d);
+    result.partDigests[p] = finalize(h);
+  });
+
+  uint64_t h = mix(0, result.headerDigest);
+  h = mix(h, result.materialDigest);
+  for(auto d : result.vertBlockDigests)
+    h = mix(h, d);
+  for(auto d : result.partDigests)
+    h = mix(h, d);
+  result.digest = finalize(h);
+
+  return result;
+}
+
+//##################################################################################################
+Geometry3DListDigest digestGeometry3D(const Geometry3DList& geometry, const Geometry3DDigestParams& params)
+{
+  Geometry3DListDigest result;
+  result.meshes.resize(geometry.size());
+  parallelFor(geometry.size(), [&](size_t m)
+  {
+    result.meshes[m] = digestGeometry3D(geometry[m], params);
+  });
+
+  uint64_t h = mix(0, geometry.size());
+  for(const auto& mesh : result.meshes)
+    h = mix(h, mesh.digest);
+  result.digest = finalize(h);
+
+  return result;
+}
+
+//##################################################################################################
+bool Geometry3DDiff::empty() const
+{
+  return meshCountA == meshCountB && meshes.empty();
+}
+
+//##################################################################################################
+std::string Geometry3DDiff::toString() const
+{
+  std::stringstream ss;
+  ss << "Meshes: " << meshCountA << " / " << meshCountB << " differences: " << meshes.size() << '\n';
+
+  for(const auto& mesh : meshes)
+  {
+    ss << "  Mesh " << mesh.index << ':';
+
+    if(mesh.onlyInA)
+      ss << " only in a";
+
+    if(mesh.onlyInB)
+      ss << " only in b";
+
+    if(mesh.header)
+      ss << " header";
+
+    if(mesh.material)
+      ss << " material";
+
+    if(!mesh.vertRanges.empty())
+    {
+      ss << " verts";
+      for(const auto& range : mesh.vertRanges)
+        ss << " [" << range.first << ", " << range.second << ')';
+    }
+
+    if(!mesh.parts.empty())
+    {
+      ss << " parts";
+      for(auto p : mesh.parts)
+        ss << ' ' << p;
+    }
+
+    ss << '\n';
+  }
+
+  return ss.str();
+}
+
+//##################################################################################################
+void Geometry3DDiff::saveState(nlohmann::json& j) const
+{
+  j["meshCountA"] = meshCountA;
+  j["meshCountB"] = meshCountB;
+  j["meshes"] = nlohmann::json::array();
+  for(const auto& mesh : meshes)
+  {
+    nlohmann::json& jj = j["meshes"].emplace_back();
+    jj["index"] = mesh.index;
+    jj["onlyInA"] = mesh.onlyInA;
+    jj["onlyInB"] = mesh.onlyInB;
+    jj["header"] = mesh.header;
+    jj["material"] = mesh.material;
+    jj["vertRanges"] = mesh.vertRanges;
+    jj["parts"] = mesh.parts;
+  }
+}
+
+//##################################################################################################
+Geometry3DDiff diffGeometry3D(const Geometry3DList& a,
+                              const Geometry3DList& b,
+                              const Geometry3DDigestParams& params)
+{
+  Geometry3DDiff result;
+  result.meshCountA = a.size();
+  result.meshCountB = b.size();
+
+  size_t count = tpMax(a.size(), b.size());
+  std::vector<Geometry3DMeshDiff> meshes(count);
+  std::vector<uint8_t> differs(count, 0); // Not vector<bool>, this is written to in parallel.
+
+  parallelFor(count, [&](size_t m)
+  {
+    auto& mesh = meshes[m];
+    mesh.index = m;
+
+    if(m>=b.size())
+    {
+      mesh.onlyInA = true;
+      differs[m] = 1;
+      return;
+    }
+
+    if(m>=a.size())
+    {
+      mesh.onlyInB = true;
+      differs[m] = 1;
+      return;
+    }
+
+    const auto& ga = a[m];
+    const auto& gb = b[m];
+    auto da = digestGeometry3D(ga, params);
+    auto db = digestGeometry3D(gb, params);
+    if(da == db)
+      return;
+
+    mesh.header = da.headerDigest != db.headerDigest;
+    mesh.material = da.materialDigest != db.materialDigest;
+
+    // Compare verts in the blocks that have different digests.
+    {
+      size_t nA = ga.verts.size();
+      size_t nB = gb.verts.size();
+      size_t nMin = tpMin(nA, nB);
+      size_t nMax = tpMax(nA, nB);
+      size_t blocks = tpMax(da.vertBlockDigests.size(), db.vertBlockDigests.size());
+      for(size_t block=0; block<blocks; block++)
+      {
+        if(block<da.vertBlockDigests.size() &&
+           block<db.vertBlockDigests.size() &&
+           da.vertBlockDigests[block] == db.vertBlockDigests[block])
+          continue;
+
+        size_t begin = block*Geometry3DDigest::vertBlockSize;
+        size_t end = tpMin(begin+Geometry3DDigest::vertBlockSize, nMax);
+        for(size_t i=begin; i<end; i++)
+        {
+          if(i<nMin && sameVertex(ga.verts[i], gb.verts[i], params.tolerance))
+            continue;
+
+          if(!mesh.vertRanges.empty() && mesh.vertRanges.back().second == i)
+            mesh.vertRanges.back().second++;
+          else
+            mesh.vertRanges.emplace_back(i, i+1);
+        }
+      }
+    }
+
+    {
+      size_t parts = tpMax(da.partDigests.size(), db.partDigests.size());
+      for(size_t p=0; p<parts; p++)
+        if(p>=da.partDigests.size() || p>=db.partDigests.size() || da.partDigests[p] != db.partDigests[p])
+          mesh.parts.push_back(p);
+    }
+
+    differs[m] = 1;
+  });
+
+  for(size_t m=0; m<count; m++)
+    if(differs[m])
+      result.meshes.push_back(std::move(meshes[m]));
+
+  return result;
+}
+
+}
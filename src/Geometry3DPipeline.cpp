@@ -0,0 +1,655 @@
+#include "tp_math_utils/Geometry3DPipeline.h"
+#include "tp_math_utils/Geometry3DBatch.h"
+#include "tp_math_utils/Geometry3DTopology.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/ScratchArena.h"
+
+#include "glm/gtx/norm.hpp" // IWYU pragma: keep
+
+#include <algorithm>
+#include <numeric>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+bool isNormals(const Geometry3DPipelineStep& step, NormalCalculationMode mode)
+{
+  return step.operation == Geometry3DOperation::CalculateNormals && step.normalMode == mode;
+}
+
+//##################################################################################################
+//! True if the step replaces the whole triangle list and only depends on the faces and positions.
+bool rebuildsTriangles(const Geometry3DPipelineStep& step)
+{
+  return
+      isNormals(step, NormalCalculationMode::CalculateFaceNormals) ||
+      isNormals(step, NormalCalculationMode::CalculateAdaptiveNormals);
+}
+
+//##################################################################################################
+//! Runs the steps one at a time using the Geometry3D operations, used for meshes that don't validate.
+void runSteps(const std::vector<Geometry3DPipelineStep>& plan,
+              Geometry3D& geometry,
+              std::vector<glm::vec3>* tangents,
+              std::pmr::memory_resource* scratch)
+{
+  bool haveTangents=false;
+  for(const auto& step : plan)
+  {
+    switch(step.operation)
+    {
+      case Geometry3DOperation::ConvertToTriangles:
+      geometry.convertToTriangles(scratch);
+      break;
+
+      case Geometry3DOperation::CombineSimilarVerts:
+      geometry.combineSimilarVerts(scratch);
+      break;
+
+      case Geometry3DOperation::CalculateNormals:
+      geometry.calculateNormals(step.normalMode, step.minDot, scratch);
+      break;
+
+      case Geometry3DOperation::BuildTangentVectors:
+      if(tangents)
+        geometry.buildTangentVectors(*tangents);
+      haveTangents = true;
+      break;
+
+      case Geometry3DOperation::AddBackFaces:
+      {
+        geometry.addBackFaces(scratch);
+
+        // The back faces are copies of the existing verts, give them the same tangents.
+        if(tangents && haveTangents)
+        {
+          size_t size = tangents->size();
+          tangents->resize(size*2);
+          std::copy(tangents->begin(), tangents->begin()+std::ptrdiff_t(size), tangents->begin()+std::ptrdiff_t(size));
+        }
+        break;
+      }
+    }
+  }
+
+  if(tangents && !haveTangents)
+    tangents->clear();
+}
+
+//##################################################################################################
+//! Runs the steps on a validated mesh, sharing the faces and adjacency between them.
+/*!
+Each step gives the same result as the matching Geometry3D operation. The faces are built once and
+then updated by each step, the face normals and adjacency are only rebuilt when a step changes the
+positions or connectivity in a way that can't be updated directly.
+*/
+struct TopologyRunner_lt
+{
+  Geometry3D& geometry;
+  std::vector<glm::vec3>* tangents;
+  std::pmr::memory_resource* scratch;
+  Geometry3DTopology topology;
+  bool haveFaces{false};
+
+  //################################################################################################
+  TopologyRunner_lt(Geometry3D& geometry_, std::vector<glm::vec3>* tangents_, std::pmr::memory_resource* scratch_):
+    geometry(geometry_),
+    tangents(tangents_),
+    scratch(scratchResource(scratch_)),
+    topology(scratch)
+  {
+
+  }
+
+  //################################################################################################
+  void ensureFaces()
+  {
+    if(!haveFaces)
+    {
+      topology.calculateFaces(geometry);
+      haveFaces = true;
+    }
+  }
+
+  //################################################################################################
+  void ensureFaceNormals()
+  {
+    ensureFaces();
+    if(!topology.hasFaceNormals())
+      topology.calculateFaceNormals(geometry.verts);
+  }
+
+  //################################################################################################
+  void ensureAdjacency()
+  {
+    ensureFaces();
+    if(!topology.hasAdjacency(geometry.verts.size()))
+      topology.calculateAdjacency(geometry.verts.size());
+  }
+
+  //################################################################################################
+  void convertToTriangles()
+  {
+    ensureFaces();
+    topology.writeTriangles(geometry);
+  }
+
+  //################################################################################################
+  void combineSimilarVerts()
+  {
+    // Combining can snap positions together so the face normals are recalculated when needed.
+    // Before the faces are built there are none to remap, they are built from the combined verts.
+    topology.combineSimilarVerts(geometry);
+  }
+
+  //################################################################################################
+  //! The tangent of each face, zero if it doesn't have one, adding zero leaves a sum unchanged.
+  void calculateFaceTangents(std::pmr::vector<glm::vec3>& faceTangents)
+  {
+    const auto& verts = geometry.verts;
+    faceTangents.resize(topology.faces.size());
+    parallelForBlocks(topology.faces.size(), 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t f=begin; f<end; f++)
+      {
+        const auto& face = topology.faces[f];
+
+        // Tangents depend on the order of the corners, undo the flip of odd strip triangles.
+        size_t a = size_t(face[0]);
+        size_t b = size_t(face[topology.flipped[f]?2:1]);
+        size_t c = size_t(face[topology.flipped[f]?1:2]);
+
+        if(!triangleTangent(verts[a], verts[b], verts[c], faceTangents[f]))
+          faceTangents[f] = {0.0f, 0.0f, 0.0f};
+      }
+    });
+  }
+
+  //################################################################################################
+  glm::vec3 gatherTangent(size_t v, const std::pmr::vector<glm::vec3>& faceTangents) const
+  {
+    glm::vec3 t{1.e-6f,0,0};
+    topology.forEachCorner(v, [&](size_t c)
+    {
+      t += faceTangents[c/3];
+    });
+    return t;
+  }
+
+  //################################################################################################
+  //! Vertex normals, if withTangents is true the tangents are calculated in the same pass.
+  void calculateVertexNormals(bool withTangents)
+  {
+    ensureFaceNormals();
+    ensureAdjacency();
+
+    std::pmr::vector<glm::vec3> faceTangents(scratch);
+    if(withTangents)
+    {
+      calculateFaceTangents(faceTangents);
+      tangents->resize(geometry.verts.size());
+    }
+
+    auto& verts = geometry.verts;
+    const auto& faceNormals = topology.faceNormals;
+    parallelForBlocks(verts.size(), 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t v=begin; v<end; v++)
+      {
+        glm::vec3 normal{0.0f, 0.0f, 0.0f};
+        bool found=false;
+        topology.forEachCorner(v, [&](size_t c)
+        {
+          const glm::vec3& n = faceNormals[c/3];
+          if(std::isfinite(n.x) && std::isfinite(n.y) && std::isfinite(n.z))
+          {
+            normal += n;
+            found = true;
+          }
+        });
+
+        if(found && glm::length2(normal)>0.000001f)
+          verts[v].normal = glm::normalize(normal);
+        else
+          verts[v].normal = {0.0f, 0.0f, 1.0f};
+
+        if(withTangents)
+          (*tangents)[v] = gatherTangent(v, faceTangents);
+      }
+    });
+
+    if(withTangents)
+      normalizeTangents(verts, *tangents);
+  }
+
+  //################################################################################################
+  void calculateFaceNormals()
+  {
+    ensureFaceNormals();
+
+    const size_t fMax = topology.faces.size();
+    std::vector<Vertex3D> newVerts(fMax*3);
+    parallelForBlocks(fMax, 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t f=begin; f<end; f++)
+      {
+        auto& face = topology.faces[f];
+        for(size_t i=0; i<3; i++)
+        {
+          auto& v = newVerts[f*3+i];
+          v = geometry.verts[size_t(face[i])];
+          v.normal = topology.faceNormals[f];
+          face[i] = int(f*3+i);
+        }
+      }
+    });
+
+    geometry.verts = std::move(newVerts);
+    topology.writeTriangles(geometry);
+
+    // Each vert now has a single corner and the positions have not changed.
+    topology.cornerOffsets.resize(fMax*3+1);
+    topology.corners.resize(fMax*3);
+    std::iota(topology.cornerOffsets.begin(), topology.cornerOffsets.end(), size_t(0));
+    std::iota(topology.corners.begin(), topology.corners.end(), size_t(0));
+  }
+
+  //################################################################################################
+  void calculateAdaptiveNormals(float minDot)
+  {
+    combineSimilarVerts();
+    ensureFaceNormals();
+    ensureAdjacency();
+
+    const auto& verts = geometry.verts;
+    const auto& faceNormals = topology.faceNormals;
+    const auto& cornerOffsets = topology.cornerOffsets;
+    const size_t vMax = verts.size();
+    const size_t cMax = topology.corners.size();
+
+    // Cluster the corners around each vert in face order, cluster k of vert v accumulates its
+    // normal in clusterNormals[cornerOffsets[v]+k] as a vert never has more clusters than corners.
+    std::pmr::vector<int> cornerClusters(cMax, scratch);
+    std::pmr::vector<glm::vec3> clusterNormals(cMax, scratch);
+    std::pmr::vector<size_t> newVertOffsets(vMax+1, 0, scratch);
+    parallelForBlocks(vMax, 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t v=begin; v<end; v++)
+      {
+        glm::vec3* normals = clusterNormals.data()+cornerOffsets[v];
+        size_t count=0;
+        for(size_t p=cornerOffsets[v]; p<cornerOffsets[v+1]; p++)
+        {
+          const glm::vec3& faceNormal = faceNormals[topology.corners[p]/3];
+
+          bool done=false;
+          for(size_t k=0; k<count; k++)
+          {
+            if(glm::dot(glm::normalize(normals[k]), faceNormal)>minDot)
+            {
+              cornerClusters[p] = int(k);
+              normals[k] += faceNormal;
+              done=true;
+              break;
+            }
+          }
+
+          if(!done)
+          {
+            cornerClusters[p] = int(count);
+            normals[count] = faceNormal;
+            count++;
+          }
+        }
+        newVertOffsets[v+1] = count;
+      }
+    });
+
+    for(size_t v=0; v<vMax; v++)
+      newVertOffsets[v+1] += newVertOffsets[v];
+
+    // New verts are numbered by vert and then cluster, the same as calculateAdaptiveNormals. The
+    // corners of each vert are regrouped by cluster keeping them in face order.
+    const size_t newVMax = newVertOffsets[vMax];
+    std::vector<Vertex3D> newVerts(newVMax);
+    std::pmr::vector<size_t> newCornerOffsets(newVMax+1, scratch);
+    std::pmr::vector<size_t> newCorners(cMax, scratch);
+    newCornerOffsets[newVMax] = cMax;
+    parallelForBlocks(vMax, 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t v=begin; v<end; v++)
+      {
+        size_t insert = cornerOffsets[v];
+        for(size_t k=0; k<newVertOffsets[v+1]-newVertOffsets[v]; k++)
+        {
+          size_t n = newVertOffsets[v]+k;
+          auto& newVert = newVerts[n];
+          newVert = verts[v];
+          newVert.normal = glm::normalize(clusterNormals[cornerOffsets[v]+k]);
+
+          newCornerOffsets[n] = insert;
+          for(size_t p=cornerOffsets[v]; p<cornerOffsets[v+1]; p++)
+          {
+            if(size_t(cornerClusters[p]) == k)
+            {
+              size_t c = topology.corners[p];
+              topology.faces[c/3][c%3] = int(n);
+              newCorners[insert++] = c;
+            }
+          }
+        }
+      }
+    });
+
+    geometry.verts = std::move(newVerts);
+    topology.writeTriangles(geometry);
+    topology.cornerOffsets = std::move(newCornerOffsets);
+    topology.corners = std::move(newCorners);
+  }
+
+  //################################################################################################
+  void buildTangentVectors()
+  {
+    ensureAdjacency();
+
+    std::pmr::vector<glm::vec3> faceTangents(scratch);
+    calculateFaceTangents(faceTangents);
+
+    tangents->resize(geometry.verts.size());
+    parallelForBlocks(geometry.verts.size(), 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t v=begin; v<end; v++)
+        (*tangents)[v] = gatherTangent(v, faceTangents);
+    });
+
+    normalizeTangents(geometry.verts, *tangents);
+  }
+
+  //################################################################################################
+  void addBackFaces()
+  {
+    ensureFaces();
+
+    auto& verts = geometry.verts;
+    const size_t size = verts.size();
+    verts.resize(size*2);
+    parallelForBlocks(size, 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t i=begin; i<end; i++)
+      {
+        auto& dst = verts[i+size];
+        dst = verts[i];
+        dst.normal = -dst.normal;
+      }
+    });
+
+    auto& faces = topology.faces;
+    const size_t fMax = faces.size();
+    faces.resize(fMax*2);
+    topology.flipped.resize(fMax*2, 0);
+
+    auto& newTriangles = geometry.indexes.emplace_back();
+    newTriangles.type = geometry.triangles;
+    newTriangles.indexes.resize(fMax*3);
+    parallelForBlocks(fMax, 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t f=begin; f<end; f++)
+      {
+        const auto& face = faces[f];
+        auto& back = faces[fMax+f];
+        back = {face[2] + int(size), face[1] + int(size), face[0] + int(size)};
+        std::copy(back.begin(), back.end(), newTriangles.indexes.begin()+std::ptrdiff_t(f*3));
+      }
+    });
+
+    // Back faces are rarely followed by other steps, rebuild these if they are needed.
+    topology.faceNormals.clear();
+    topology.cornerOffsets.clear();
+    topology.corners.clear();
+  }
+
+  //################################################################################################
+  void run(const std::vector<Geometry3DPipelineStep>& plan)
+  {
+    bool haveTangents=false;
+    for(size_t s=0; s<plan.size(); s++)
+    {
+      const auto& step = plan.at(s);
+      switch(step.operation)
+      {
+        case Geometry3DOperation::ConvertToTriangles:
+        convertToTriangles();
+        break;
+
+        case Geometry3DOperation::CombineSimilarVerts:
+        combineSimilarVerts();
+        break;
+
+        case Geometry3DOperation::CalculateNormals:
+        switch(step.normalMode)
+        {
+          case NormalCalculationMode::None:
+          break;
+
+          case NormalCalculationMode::CalculateFaceNormals:
+          calculateFaceNormals();
+          break;
+
+          case NormalCalculationMode::CalculateVertexNormals:
+          {
+            // Tangents straight after vertex normals use the same adjacency, do both in one pass.
+            bool withTangents = tangents && s+1<plan.size() && plan.at(s+1).operation == Geometry3DOperation::BuildTangentVectors;
+            calculateVertexNormals(withTangents);
+            if(withTangents)
+            {
+              haveTangents = true;
+              s++;
+            }
+            break;
+          }
+
+          case NormalCalculationMode::CalculateAdaptiveNormals:
+          calculateAdaptiveNormals(step.minDot);
+          break;
+        }
+        break;
+
+        case Geometry3DOperation::BuildTangentVectors:
+        if(tangents)
+          buildTangentVectors();
+        haveTangents = true;
+        break;
+
+        case Geometry3DOperation::AddBackFaces:
+        {
+          addBackFaces();
+
+          // The back faces are copies of the existing verts, give them the same tangents.
+          if(tangents && haveTangents)
+          {
+            size_t size = tangents->size();
+            tangents->resize(size*2);
+            std::copy(tangents->begin(), tangents->begin()+std::ptrdiff_t(size), tangents->begin()+std::ptrdiff_t(size));
+          }
+          break;
+        }
+      }
+    }
+
+    if(tangents && !haveTangents)
+      tangents->clear();
+  }
+};
+
+//##################################################################################################
+void runPlan(const std::vector<Geometry3DPipelineStep>& plan,
+             Geometry3D& geometry,
+             std::vector<glm::vec3>* tangents,
+             std::pmr::memory_resource* scratch)
+{
+  if(!geometry.validated() && !geometry.validate())
+  {
+    runSteps(plan, geometry, tangents, scratch);
+    return;
+  }
+
+  TopologyRunner_lt(geometry, tangents, scratch).run(plan);
+
+  // The runner edits the verts and indexes directly, everything it builds is in range.
+  geometry.validate();
+}
+}
+
+//##################################################################################################
+Geometry3DPipeline& Geometry3DPipeline::convertToTriangles()
+{
+  m_steps.push_back({Geometry3DOperation::ConvertToTriangles});
+  return *this;
+}
+
+//##################################################################################################
+Geometry3DPipeline& Geometry3DPipeline::combineSimilarVerts()
+{
+  m_steps.push_back({Geometry3DOperation::CombineSimilarVerts});
+  return *this;
+}
+
+//##################################################################################################
+Geometry3DPipeline& Geometry3DPipeline::calculateNormals(NormalCalculationMode mode, float minDot)
+{
+  m_steps.push_back({Geometry3DOperation::CalculateNormals, mode, minDot});
+  return *this;
+}
+
+//##################################################################################################
+Geometry3DPipeline& Geometry3DPipeline::buildTangentVectors()
+{
+  m_steps.push_back({Geometry3DOperation::BuildTangentVectors});
+  return *this;
+}
+
+//##################################################################################################
+Geometry3DPipeline& Geometry3DPipeline::addBackFaces()
+{
+  m_steps.push_back({Geometry3DOperation::AddBackFaces});
+  return *this;
+}
+
+//##################################################################################################
+const std::vector<Geometry3DPipelineStep>& Geometry3DPipeline::steps() const
+{
+  return m_steps;
+}
+
+//##################################################################################################
+std::vector<Geometry3DPipelineStep> Geometry3DPipeline::plan() const
+{
+  std::vector<Geometry3DPipelineStep> steps;
+  steps.reserve(m_steps.size());
+
+  // Only the last set of tangents is returned. If the verts are modified after it they would be
+  // out of date so the tangents are built at the end instead, converting to triangles leaves the
+  // verts alone and back faces copy the tangents.
+  bool tangents=false;
+  bool tangentsAtEnd=false;
+  for(const auto& step : m_steps)
+  {
+    if(step.operation == Geometry3DOperation::BuildTangentVectors)
+    {
+      tangents = true;
+      tangentsAtEnd = false;
+    }
+    else if(tangents &&
+            step.operation != Geometry3DOperation::ConvertToTriangles &&
+            step.operation != Geometry3DOperation::AddBackFaces &&
+            !isNormals(step, NormalCalculationMode::None))
+      tangentsAtEnd = true;
+  }
+
+  // Work backwards so that each step can see the next step that will actually run.
+  for(auto s=m_steps.rbegin(); s!=m_steps.rend(); ++s)
+  {
+    const auto& step = *s;
+    const Geometry3DPipelineStep* next = steps.empty()?nullptr:&steps.back();
+
+    switch(step.operation)
+    {
+      case Geometry3DOperation::ConvertToTriangles:
+      // Converting twice gives the same triangles, face and adaptive normals build the same
+      // triangle list from the original parts.
+      if(next && (next->operation == Geometry3DOperation::ConvertToTriangles || rebuildsTriangles(*next)))
+        continue;
+      break;
+
+      case Geometry3DOperation::CombineSimilarVerts:
+      // Combining is idempotent and adaptive normals combine verts first. Face normals still need
+      // it as combining also snaps together verts that are nearly but not exactly equal.
+      if(next && (next->operation == Geometry3DOperation::CombineSimilarVerts ||
+                  isNormals(*next, NormalCalculationMode::CalculateAdaptiveNormals)))
+        continue;
+      break;
+
+      case Geometry3DOperation::CalculateNormals:
+      if(step.normalMode == NormalCalculationMode::None)
+        continue;
+
+      // Vertex normals only write normals which any of the other modes overwrite.
+      if(step.normalMode == NormalCalculationMode::CalculateVertexNormals &&
+         next && next->operation == Geometry3DOperation::CalculateNormals)
+        continue;
+      break;
+
+      case Geometry3DOperation::BuildTangentVectors:
+      if(tangentsAtEnd || std::any_of(s.base(), m_steps.end(), [](const auto& later)
+      {
+        return later.operation == Geometry3DOperation::BuildTangentVectors;
+      }))
+        continue;
+      break;
+
+      case Geometry3DOperation::AddBackFaces:
+      break;
+    }
+
+    steps.push_back(step);
+  }
+
+  std::reverse(steps.begin(), steps.end());
+
+  if(tangentsAtEnd)
+    steps.push_back({Geometry3DOperation::BuildTangentVectors});
+
+  return steps;
+}
+
+//##################################################################################################
+void Geometry3DPipeline::run(Geometry3D& geometry,
+                             std::vector<glm::vec3>* tangents,
+                             std::pmr::memory_resource* scratch) const
+{
+  runPlan(plan(), geometry, tangents, scratch);
+}
+
+//##################################################################################################
+bool Geometry3DPipeline::run(Geometry3DList& geometry,
+                             std::vector<std::vector<glm::vec3>>* tangents,
+                             tp_utils::Progress* progress) const
+{
+  auto steps = plan();
+
+  if(tangents)
+    tangents->resize(geometry.size());
+
+  ScratchArena::ThreadLocalScope scope;
+  return forEachGeometry3D(geometry, [&](Geometry3D& mesh, size_t m)
+  {
+    auto& arena = ScratchArena::threadLocal();
+    runPlan(steps, mesh, tangents?&(*tangents)[m]:nullptr, arena.resource());
+    arena.reset();
+  }, progress);
+}
+
+}
@@ -0,0 +1,486 @@
+#include "tp_math_utils/Geometry3DStats.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/HashUtils.h"
+#include "tp_math_utils/JSONUtils.h"
+
+#include "glm/gtx/norm.hpp" // IWYU pragma: keep
+
+#include <array>
+#include <sstream>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+struct FaceStats_lt
+{
+  size_t degenerateTriangles{0};
+  size_t zeroAreaTriangles{0};
+
+  double totalArea{0.0};
+  float minTriangleArea{std::numeric_limits<float>::max()};
+  float maxTriangleArea{0.0f};
+  float minEdgeLength{std::numeric_limits<float>::max()};
+  float maxEdgeLength{0.0f};
+
+  std::array<size_t, Geometry3DStats::areaHistogramBuckets> areaHistogram{};
+};
+
+//##################################################################################################
+size_t areaBucket(float area)
+{
+  int e=0;
+  std::frexp(area, &e);
+  int bucket = (e-1) - Geometry3DStats::areaHistogramMinExponent;
+  return size_t(tpMin(tpMax(bucket, 0), int(Geometry3DStats::areaHistogramBuckets)-1));
+}
+
+//##################################################################################################
+template<typename Hash, typename Equal>
+size_t countDuplicates(size_t count, const Hash& hash, const Equal& equal)
+{
+  std::vector<std::pair<size_t, size_t>> hashes(count);
+  parallelForBlocks(count, 10000, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t i=begin; i<end; i++)
+      hashes[i] = {hash(i), i};
+  });
+
+  std::sort(hashes.begin(), hashes.end());
+
+  size_t duplicates=0;
+  for(size_t r=0; r<hashes.size();)
+  {
+    size_t rEnd=r+1;
+    while(rEnd<hashes.size() && hashes[rEnd].first == hashes[r].first)
+      rEnd++;
+
+    for(size_t i=r+1; i<rEnd; i++)
+    {
+      for(size_t j=r; j<i; j++)
+      {
+        if(equal(hashes[i].second, hashes[j].second))
+        {
+          duplicates++;
+          break;
+        }
+      }
+    }
+
+    r = rEnd;
+  }
+
+  return duplicates;
+}
+}
+
+//##################################################################################################
+float Geometry3DStats::acmr() const
+{
+  return triangleCount?float(double(cacheMisses)/double(triangleCount)):0.0f;
+}
+
+//##################################################################################################
+float Geometry3DStats::meanTriangleArea() const
+{
+  size_t count = triangleCount - (tpMin(triangleCount, degenerateTriangles + zeroAreaTriangles));
+  return count?float(totalArea/double(count)):0.0f;
+}
+
+//##################################################################################################
+void Geometry3DStats::add(const Geometry3DStats& other)
+{
+  bool hadTriangles = (triangleCount - tpMin(triangleCount, degenerateTriangles + zeroAreaTriangles))>0;
+  bool otherHasTriangles = (other.triangleCount - tpMin(other.triangleCount, other.degenerateTriangles + other.zeroAreaTriangles))>0;
+
+  if(otherHasTriangles)
+  {
+    if(hadTriangles)
+    {
+      minTriangleArea = tpMin(minTriangleArea, other.minTriangleArea);
+      maxTriangleArea = tpMax(maxTriangleArea, other.maxTriangleArea);
+      minEdgeLength   = tpMin(minEdgeLength  , other.minEdgeLength  );
+      maxEdgeLength   = tpMax(maxEdgeLength  , other.maxEdgeLength  );
+    }
+    else
+    {
+      minTriangleArea = other.minTriangleArea;
+      maxTriangleArea = other.maxTriangleArea;
+      minEdgeLength   = other.minEdgeLength  ;
+      maxEdgeLength   = other.maxEdgeLength  ;
+    }
+  }
+
+  if(other.vertCount)
+  {
+    if(vertCount)
+    {
+      min = glm::min(min, other.min);
+      max = glm::max(max, other.max);
+    }
+    else
+    {
+      min = other.min;
+      max = other.max;
+    }
+  }
+
+  meshCount           += other.meshCount;
+  partCount           += other.partCount;
+  vertCount           += other.vertCount;
+  indexCount          += other.indexCount;
+  triangleCount       += other.triangleCount;
+  invalidIndexes      += other.invalidIndexes;
+  degenerateTriangles += other.degenerateTriangles;
+  zeroAreaTriangles   += other.zeroAreaTriangles;
+  duplicateVerts      += other.duplicateVerts;
+  duplicatePositions  += other.duplicatePositions;
+  unreferencedVerts   += other.unreferencedVerts;
+  edgeCount           += other.edgeCount;
+  boundaryEdges       += other.boundaryEdges;
+  nonManifoldEdges    += other.nonManifoldEdges;
+  cacheSize            = other.cacheSize;
+  cacheMisses         += other.cacheMisses;
+  totalArea           += other.totalArea;
+
+  areaHistogram.resize(areaHistogramBuckets, 0);
+  for(size_t i=0; i<other.areaHistogram.size() && i<areaHistogramBuckets; i++)
+    areaHistogram[i] += other.areaHistogram[i];
+}
+
+//##################################################################################################
+std::string Geometry3DStats::toString() const
+{
+  std::stringstream ss;
+  ss << Geometry3D::statsString(vertCount, indexCount, triangleCount);
+  ss << " invalid indexes: "       << invalidIndexes;
+  ss << " degenerate triangles: "  << degenerateTriangles;
+  ss << " zero area triangles: "   << zeroAreaTriangles;
+  ss << " duplicate verts: "       << duplicateVerts;
+  ss << " duplicate positions: "   << duplicatePositions;
+  ss << " unreferenced verts: "    << unreferencedVerts;
+  ss << " boundary edges: "        << boundaryEdges;
+  ss << " non-manifold edges: "    << nonManifoldEdges;
+  ss << " ACMR(" << cacheSize << "): " << acmr();
+  return ss.str();
+}
+
+//##################################################################################################
+void Geometry3DStats::saveState(nlohmann::json& j) const
+{
+  j["meshCount"]           = meshCount;
+  j["partCount"]           = partCount;
+  j["vertCount"]           = vertCount;
+  j["indexCount"]          = indexCount;
+  j["triangleCount"]       = triangleCount;
+
+  j["invalidIndexes"]      = invalidIndexes;
+  j["degenerateTriangles"] = degenerateTriangles;
+  j["zeroAreaTriangles"]   = zeroAreaTriangles;
+  j["duplicateVerts"]      = duplicateVerts;
+  j["duplicatePositions"]  = duplicatePositions;
+  j["unreferencedVerts"]   = unreferencedVerts;
+
+  j["edgeCount"]           = edgeCount;
+  j["boundaryEdges"]       = boundaryEdges;
+  j["nonManifoldEdges"]    = nonManifoldEdges;
+
+  j["cacheSize"]           = cacheSize;
+  j["cacheMisses"]         = cacheMisses;
+  j["acmr"]                = acmr();
+
+  j["totalArea"]           = totalArea;
+  j["meanTriangleArea"]    = meanTriangleArea();
+  j["minTriangleArea"]     = minTriangleArea;
+  j["maxTriangleArea"]     = maxTriangleArea;
+  j["minEdgeLength"]       = minEdgeLength;
+  j["maxEdgeLength"]       = maxEdgeLength;
+
+  j["min"] = vec3ToJSON(min);
+  j["max"] = vec3ToJSON(max);
+
+  // Only write the populated range of the histogram.
+  {
+    size_t first=0;
+    size_t last=areaHistogram.size();
+    while(first<last && areaHistogram[first]==0)first++;
+    while(last>first && areaHistogram[last-1]==0)last--;
+
+    nlohmann::json& jj = j["areaHistogram"];
+    jj["minExponent"] = areaHistogramMinExponent + int(first);
+    jj["counts"] = nlohmann::json::array();
+    for(size_t i=first; i<last; i++)
+      jj["counts"].push_back(areaHistogram[i]);
+  }
+}
+
+//##################################################################################################
+Geometry3DStats Geometry3DStats::calculate(const Geometry3D& geometry, const Geometry3DStatsParams& params)
+{
+  Geometry3DStats stats;
+  stats.meshCount = 1;
+  stats.partCount = geometry.indexes.size();
+  stats.vertCount = geometry.verts.size();
+  stats.cacheSize = params.cacheSize;
+  stats.areaHistogram.resize(areaHistogramBuckets, 0);
+
+  const int nVerts = int(geometry.verts.size());
+  auto validIndex = [&](int i)
+  {
+    return i>=0 && i<nVerts;
+  };
+
+  // Count the entries in the index lists, an index shared by several triangles is counted once.
+  for(const auto& part : geometry.indexes)
+  {
+    stats.indexCount += part.indexes.size();
+    for(int i : part.indexes)
+      if(!validIndex(i))
+        stats.invalidIndexes++;
+  }
+
+  std::vector<std::array<int, 3>> faces;
+  geometry.forEachTriangleIndexes([&](int i0, int i1, int i2)
+  {
+    faces.push_back({i0, i1, i2});
+  });
+  stats.triangleCount = faces.size();
+
+  auto validFace = [&](const std::array<int, 3>& face)
+  {
+    return validIndex(face[0]) && validIndex(face[1]) && validIndex(face[2]);
+  };
+
+  auto degenerateFace = [&](const std::array<int, 3>& face)
+  {
+    return face[0]==face[1] || face[0]==face[2] || face[1]==face[2];
+  };
+
+  //-- Per triangle stats --------------------------------------------------------------------------
+  {
+    std::vector<FaceStats_lt> blockStats(parallelThreadCount(faces.size(), 10000));
+    size_t nBlocks = parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t b)
+    {
+      FaceStats_lt& s = blockStats[b];
+      for(size_t f=begin; f<end; f++)
+      {
+        const auto& face = faces[f];
+        if(!validFace(face))
+          continue;
+
+        if(degenerateFace(face))
+        {
+          s.degenerateTriangles++;
+          continue;
+        }
+
+        const glm::vec3& v0 = geometry.verts[size_t(face[0])].vert;
+        const glm::vec3& v1 = geometry.verts[size_t(face[1])].vert;
+        const glm::vec3& v2 = geometry.verts[size_t(face[2])].vert;
+
+        float area = glm::length(glm::cross(v1-v0, v2-v0)) * 0.5f;
+        if(!(area>=params.zeroAreaThreshold))
+        {
+          s.zeroAreaTriangles++;
+          continue;
+        }
+
+        s.totalArea += double(area);
+        s.minTriangleArea = tpMin(s.minTriangleArea, area);
+        s.maxTriangleArea = tpMax(s.maxTriangleArea, area);
+        s.areaHistogram[areaBucket(area)]++;
+
+        for(float l : {glm::distance(v0, v1), glm::distance(v1, v2), glm::distance(v2, v0)})
+        {
+          s.minEdgeLength = tpMin(s.minEdgeLength, l);
+          s.maxEdgeLength = tpMax(s.maxEdgeLength, l);
+        }
+      }
+    });
+
+    FaceStats_lt total;
+    for(size_t b=0; b<nBlocks; b++)
+    {
+      const FaceStats_lt& s = blockStats[b];
+      total.degenerateTriangles += s.degenerateTriangles;
+      total.zeroAreaTriangles   += s.zeroAreaTriangles;
+      total.totalArea           += s.totalArea;
+      total.minTriangleArea      = tpMin(total.minTriangleArea, s.minTriangleArea);
+      total.maxTriangleArea      = tpMax(total.maxTriangleArea, s.maxTriangleArea);
+      total.minEdgeLength        = tpMin(total.minEdgeLength, s.minEdgeLength);
+      total.maxEdgeLength        = tpMax(total.maxEdgeLength, s.maxEdgeLength);
+      for(size_t i=0; i<areaHistogramBuckets; i++)
+        stats.areaHistogram[i] += s.areaHistogram[i];
+    }
+
+    stats.degenerateTriangles = total.degenerateTriangles;
+    stats.zeroAreaTriangles   = total.zeroAreaTriangles;
+    stats.totalArea           = total.totalArea;
+
+    if(total.maxTriangleArea>0.0f)
+    {
+      stats.minTriangleArea = total.minTriangleArea;
+      stats.maxTriangleArea = total.maxTriangleArea;
+      stats.minEdgeLength   = total.minEdgeLength;
+      stats.maxEdgeLength   = total.maxEdgeLength;
+    }
+  }
+
+  //-- Bounding box --------------------------------------------------------------------------------
+  if(!geometry.verts.empty())
+  {
+    std::vector<std::pair<glm::vec3, glm::vec3>> blockMinMax(parallelThreadCount(geometry.verts.size(), 10000));
+    size_t nBlocks = parallelForBlocks(geometry.verts.size(), 10000, [&](size_t begin, size_t end, size_t b)
+    {
+      glm::vec3 min = geometry.verts[begin].vert;
+      glm::vec3 max = min;
+      for(size_t i=begin+1; i<end; i++)
+      {
+        min = glm::min(min, geometry.verts[i].vert);
+        max = glm::max(max, geometry.verts[i].vert);
+      }
+      blockMinMax[b] = {min, max};
+    });
+
+    stats.min = blockMinMax[0].first;
+    stats.max = blockMinMax[0].second;
+    for(size_t b=1; b<nBlocks; b++)
+    {
+      stats.min = glm::min(stats.min, blockMinMax[b].first);
+      stats.max = glm::max(stats.max, blockMinMax[b].second);
+    }
+  }
+
+  //-- Unreferenced verts and ACMR -----------------------------------------------------------------
+  {
+    // FIFO cache simulation, a vert is in the cache if it was added less than cacheSize misses ago.
+    std::vector<size_t> cacheTime(geometry.verts.size(), 0);
+    size_t misses=0;
+    for(const auto& face : faces)
+    {
+      if(!validFace(face))
+        continue;
+
+      for(int i : face)
+      {
+        size_t& t = cacheTime[size_t(i)];
+        if(t==0 || (misses+1-t)>params.cacheSize)
+        {
+          misses++;
+          t = misses;
+        }
+      }
+    }
+
+    stats.cacheMisses = misses;
+
+    for(size_t t : cacheTime)
+      if(t==0)
+        stats.unreferencedVerts++;
+  }
+
+  //-- Edges ---------------------------------------------------------------------------------------
+  {
+    const uint64_t invalidEdge = std::numeric_limits<uint64_t>::max();
+    std::vector<uint64_t> edges(faces.size()*3);
+    parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t f=begin; f<end; f++)
+      {
+        const auto& face = faces[f];
+        uint64_t* e = edges.data() + f*3;
+        if(!validFace(face) || degenerateFace(face))
+        {
+          e[0] = e[1] = e[2] = invalidEdge;
+          continue;
+        }
+
+        for(size_t i=0; i<3; i++)
+        {
+          auto a = uint64_t(face[i]);
+          auto b = uint64_t(face[(i+1)%3]);
+          e[i] = (a<b)?((a<<32) | b):((b<<32) | a);
+        }
+      }
+    });
+
+    std::sort(edges.begin(), edges.end());
+
+    for(size_t r=0; r<edges.size() && edges[r]!=invalidEdge;)
+    {
+      size_t rEnd=r+1;
+      while(rEnd<edges.size() && edges[rEnd]==edges[r])
+        rEnd++;
+
+      size_t count = rEnd-r;
+      stats.edgeCount++;
+      if(count==1)
+        stats.boundaryEdges++;
+      else if(count>2)
+        stats.nonManifoldEdges++;
+
+      r = rEnd;
+    }
+  }
+
+  //-- Duplicate verts -----------------------------------------------------------------------------
+  {
+    const auto& verts = geometry.verts;
+
+    auto hashPosition = [&](size_t i)
+    {
+      const auto& v = verts[i].vert;
+      size_t h=0;
+      h = hashCombine(h, floatBits(v.x));
+      h = hashCombine(h, floatBits(v.y));
+      h = hashCombine(h, floatBits(v.z));
+      return h;
+    };
+
+    auto hashVertex = [&](size_t i)
+    {
+      const auto& v = verts[i];
+      size_t h = hashPosition(i);
+      h = hashCombine(h, floatBits(v.texture.x));
+      h = hashCombine(h, floatBits(v.texture.y));
+      h = hashCombine(h, floatBits(v.normal.x));
+      h = hashCombine(h, floatBits(v.normal.y));
+      h = hashCombine(h, floatBits(v.normal.z));
+      return h;
+    };
+
+    stats.duplicatePositions = countDuplicates(verts.size(), hashPosition, [&](size_t a, size_t b)
+    {
+      return verts[a].vert == verts[b].vert;
+    });
+
+    stats.duplicateVerts = countDuplicates(verts.size(), hashVertex, [&](size_t a, size_t b)
+    {
+      return verts[a] == verts[b];
+    });
+  }
+
+  return stats;
+}
+
+//##################################################################################################
+Geometry3DStats Geometry3DStats::calculate(const std::vector<Geometry3D>& geometry, const Geometry3DStatsParams& params)
+{
+  std::vector<Geometry3DStats> meshStats(geometry.size());
+  parallelFor(geometry.size(), [&](size_t i)
+  {
+    meshStats[i] = calculate(geometry[i], params);
+  });
+
+  Geometry3DStats stats;
+  stats.cacheSize = params.cacheSize;
+  stats.areaHistogram.resize(areaHistogramBuckets, 0);
+  for(const auto& s : meshStats)
+    stats.add(s);
+
+  return stats;
+}
+
+}
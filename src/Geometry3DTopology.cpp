@@ -0,0 +1,147 @@
+#include "tp_math_utils/Geometry3DTopology.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/ScratchArena.h"
+
+#include "glm/gtx/normal.hpp" // IWYU pragma: keep
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+Geometry3DTopology::Geometry3DTopology(std::pmr::memory_resource* scratch):
+  faces(scratchResource(scratch)),
+  flipped(scratchResource(scratch)),
+  faceNormals(scratchResource(scratch)),
+  cornerOffsets(scratchResource(scratch)),
+  corners(scratchResource(scratch))
+{
+
+}
+
+//##################################################################################################
+void Geometry3DTopology::calculateFaces(const Geometry3D& geometry)
+{
+  size_t count=0;
+  for(const auto& part : geometry.indexes)
+  {
+    size_t size = part.indexes.size();
+    if(size<3)
+      continue;
+
+    if(part.type == geometry.triangleFan || part.type == geometry.triangleStrip)
+      count+=size-2;
+    else if(part.type == geometry.triangles)
+      count+=size/3;
+  }
+
+  faces.clear();
+  flipped.clear();
+  faceNormals.clear();
+  cornerOffsets.clear();
+  corners.clear();
+
+  faces.reserve(count);
+  flipped.reserve(count);
+
+  for(const auto& part : geometry.indexes)
+  {
+    uint8_t odd = 0;
+    uint8_t strip = (part.type == geometry.triangleStrip)?1:0;
+    forEachPartTriangle<true>(part.type, part.indexes.data(), part.indexes.size(), geometry.triangleFan, geometry.triangleStrip, geometry.triangles, [&](int i0, int i1, int i2)
+    {
+      faces.push_back({i0, i1, i2});
+      flipped.push_back(odd & strip);
+      odd ^= 1;
+    });
+  }
+}
+
+//##################################################################################################
+void Geometry3DTopology::calculateFaceNormals(const Vertex3DList& verts)
+{
+  faceNormals.resize(faces.size());
+  parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t f=begin; f<end; f++)
+    {
+      const auto& face = faces[f];
+      faceNormals[f] = glm::triangleNormal(verts[size_t(face[0])].vert,
+                                           verts[size_t(face[1])].vert,
+                                           verts[size_t(face[2])].vert);
+    }
+  });
+}
+
+//##################################################################################################
+void Geometry3DTopology::calculateAdjacency(size_t vertCount)
+{
+  // Counting sort, filling in face order keeps the corners of each vert in face order.
+  cornerOffsets.assign(vertCount+1, 0);
+  for(const auto& face : faces)
+    for(int i : face)
+      cornerOffsets[size_t(i)+1]++;
+
+  for(size_t v=0; v<vertCount; v++)
+    cornerOffsets[v+1] += cornerOffsets[v];
+
+  corners.resize(faces.size()*3);
+  std::pmr::vector<size_t> insert(cornerOffsets.begin(), cornerOffsets.end()-1, cornerOffsets.get_allocator());
+  for(size_t f=0; f<faces.size(); f++)
+    for(size_t i=0; i<3; i++)
+      corners[insert[size_t(faces[f][i])]++] = f*3+i;
+}
+
+//##################################################################################################
+bool Geometry3DTopology::hasFaceNormals() const
+{
+  return faceNormals.size() == faces.size();
+}
+
+//##################################################################################################
+bool Geometry3DTopology::hasAdjacency(size_t vertCount) const
+{
+  return cornerOffsets.size() == vertCount+1;
+}
+
+//##################################################################################################
+void Geometry3DTopology::remapVerts(const std::pmr::vector<size_t>& idxLookup)
+{
+  parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t f=begin; f<end; f++)
+      for(auto& i : faces[f])
+        i = int(idxLookup[size_t(i)]);
+  });
+
+  faceNormals.clear();
+  cornerOffsets.clear();
+  corners.clear();
+}
+
+//##################################################################################################
+void Geometry3DTopology::combineSimilarVerts(Geometry3D& geometry)
+{
+  std::pmr::vector<size_t> idxLookup(faces.get_allocator().resource());
+  geometry.combineSimilarVerts(idxLookup);
+  remapVerts(idxLookup);
+}
+
+//##################################################################################################
+void Geometry3DTopology::writeTriangles(Geometry3D& geometry)
+{
+  geometry.indexes.clear();
+  Indexes3D& part = geometry.indexes.emplace_back();
+  part.type = geometry.triangles;
+  part.indexes.resize(faces.size()*3);
+  parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t)
+  {
+    int* ii = part.indexes.data()+begin*3;
+    for(size_t f=begin; f<end; f++)
+      for(int i : faces[f])
+        *(ii++) = i;
+  });
+
+  std::fill(flipped.begin(), flipped.end(), uint8_t(0));
+}
+
+}
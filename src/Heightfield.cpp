@@ -0,0 +1,359 @@
+#include "tp_math_utils/Heightfield.h"
+#include "tp_math_utils/ParallelFor.h"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+//! Round down to a power of 2, at least 2 so every tile has at least one level of detail.
+size_t validTileSize(size_t tileSize)
+{
+  size_t size=2;
+  while(size*2<=tileSize)
+    size*=2;
+  return size;
+}
+
+//##################################################################################################
+//! The tiles next to a tile in the order of the stitch bits, or SIZE_MAX at the border.
+std::array<size_t, 4> neighbors(const HeightfieldParams& params, size_t tile)
+{
+  size_t i = tile % params.tilesI;
+  size_t j = tile / params.tilesI;
+  return
+  {
+    (j>0)?(tile-params.tilesI):SIZE_MAX,
+    (i+1<params.tilesI)?(tile+1):SIZE_MAX,
+    (j+1<params.tilesJ)?(tile+params.tilesI):SIZE_MAX,
+    (i>0)?(tile-1):SIZE_MAX
+  };
+}
+}
+
+//##################################################################################################
+const std::vector<int>& HeightfieldIndexBuffers::indexes(size_t lod, int stitch) const
+{
+  return buffers.at(lod*16 + size_t(stitch&15));
+}
+
+//##################################################################################################
+std::shared_ptr<const HeightfieldIndexBuffers> HeightfieldIndexBuffers::get(size_t tileSize)
+{
+  static std::mutex mutex;
+  static std::map<size_t, std::shared_ptr<const HeightfieldIndexBuffers>> cache;
+
+  tileSize = validTileSize(tileSize);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(auto i = cache.find(tileSize); i!=cache.end())
+      return i->second;
+  }
+
+  // Generate without holding the lock, if two threads race the first result is kept.
+  auto result = std::make_shared<HeightfieldIndexBuffers>();
+  result->tileSize = tileSize;
+  for(size_t n=tileSize; n>=2; n/=2)
+    result->lodCount++;
+
+  // The ring of verts around the center of a 2x2 block of quads, counter clockwise.
+  const int ring[8][2] = {{-1,-1}, {0,-1}, {1,-1}, {1,0}, {1,1}, {0,1}, {-1,1}, {-1,0}};
+
+  int row = int(tileSize)+1;
+  result->buffers.resize(result->lodCount*16);
+  for(size_t lod=0; lod<result->lodCount; lod++)
+  {
+    int n = int(tileSize>>lod);
+    int step = 1<<lod;
+    for(int stitch=0; stitch<16; stitch++)
+    {
+      auto& buffer = result->buffers[lod*16+size_t(stitch)];
+      buffer.reserve(size_t(n*n)*6);
+
+      // Each block is a fan around its center, edge midpoints that a coarser neighbor does not
+      // have are left out of the fan.
+      for(int b=1; b<n; b+=2)
+      {
+        for(int a=1; a<n; a+=2)
+        {
+          int fan[8];
+          int count=0;
+          for(const auto& r : ring)
+          {
+            if((r[0]==0 && r[1]==-1 && b==1   && (stitch&1)) ||
+               (r[0]==1 && r[1]==0  && a==n-1 && (stitch&2)) ||
+               (r[0]==0 && r[1]==1  && b==n-1 && (stitch&4)) ||
+               (r[0]==-1 && r[1]==0 && a==1   && (stitch&8)))
+              continue;
+            fan[count++] = ((b+r[1])*row + (a+r[0]))*step;
+          }
+
+          int center = (b*row + a)*step;
+          for(int i=0; i<count; i++)
+            buffer.insert(buffer.end(), {center, fan[i], fan[(i+1)%count]});
+        }
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return cache.emplace(tileSize, result).first->second;
+}
+
+//##################################################################################################
+Heightfield::Heightfield(const Plane& plane,
+                         const HeightfieldParams& params,
+                         const std::function<float(float i, float j)>& height):
+  m_plane(plane),
+  m_params(params)
+{
+  m_params.tileSize = validTileSize(params.tileSize);
+  m_params.tilesI = tpMax(params.tilesI, size_t(1));
+  m_params.tilesJ = tpMax(params.tilesJ, size_t(1));
+  m_indexBuffers = HeightfieldIndexBuffers::get(m_params.tileSize);
+
+  size_t tileSize = m_params.tileSize;
+  size_t quadsI = m_params.tilesI*tileSize;
+  size_t quadsJ = m_params.tilesJ*tileSize;
+  size_t row = quadsI+1;
+  float dx = m_params.scaleI / float(quadsI);
+  float dy = m_params.scaleJ / float(quadsJ);
+
+  //-- Sample the heights once for the whole heightfield -------------------------------------------
+  std::vector<float> heights(row*(quadsJ+1));
+  parallelFor(quadsJ+1, [&](size_t j)
+  {
+    for(size_t i=0; i<row; i++)
+      heights[j*row+i] = height(float(i)*dx, float(j)*dy);
+  });
+
+  //-- Cut the samples into tiles ------------------------------------------------------------------
+  const glm::vec3& origin = m_plane.pointAndNormal()[0];
+  const glm::vec3& t = m_plane.tangent();
+  const glm::vec3& b = m_plane.bitangent();
+  const glm::vec3& n = m_plane.normal();
+
+  auto h = [&](size_t i, size_t j){return heights[j*row+i];};
+
+  m_tileVerts.resize(m_params.tilesI*m_params.tilesJ);
+  m_tileBounds.resize(m_tileVerts.size());
+  parallelFor(m_tileVerts.size(), [&](size_t tile)
+  {
+    size_t i0 = (tile % m_params.tilesI)*tileSize;
+    size_t j0 = (tile / m_params.tilesI)*tileSize;
+
+    auto& verts = m_tileVerts[tile];
+    verts.resize((tileSize+1)*(tileSize+1));
+    auto& bounds = m_tileBounds[tile];
+    auto v = verts.data();
+    for(size_t j=j0; j<=j0+tileSize; j++)
+    {
+      for(size_t i=i0; i<=i0+tileSize; i++, v++)
+      {
+        float x = float(i)*dx;
+        float y = float(j)*dy;
+        v->vert = origin + t*x + b*y + n*h(i, j);
+        v->texture = {m_params.scaleU*float(i)/float(quadsI), m_params.scaleV*float(j)/float(quadsJ)};
+
+        // Central differences, one sided at the border of the heightfield.
+        size_t il = (i>0)?(i-1):i;
+        size_t ih = (i<quadsI)?(i+1):i;
+        size_t jl = (j>0)?(j-1):j;
+        size_t jh = (j<quadsJ)?(j+1):j;
+        float hx = (h(ih, j) - h(il, j)) / (float(ih-il)*dx);
+        float hy = (h(i, jh) - h(i, jl)) / (float(jh-jl)*dy);
+        glm::vec3 normal = n - t*hx - b*hy;
+        float length = glm::length(normal);
+        v->normal = (length>0.0f && std::isfinite(length))?(normal/length):n;
+
+        if(v==verts.data())
+          bounds = {v->vert, v->vert};
+        bounds.first = glm::min(bounds.first, v->vert);
+        bounds.second = glm::max(bounds.second, v->vert);
+      }
+    }
+  });
+}
+
+//##################################################################################################
+Heightfield::Heightfield(const Plane& plane,
+                         const HeightfieldParams& params,
+                         const std::vector<float>& heights,
+                         size_t width,
+                         size_t height):
+  Heightfield(plane, params, [&](float i, float j)
+  {
+    if(width==0 || height==0 || heights.size()<width*height)
+      return 0.0f;
+
+    float x = (params.scaleI!=0.0f && width>1)?tpMin(tpMax(i/params.scaleI, 0.0f), 1.0f)*float(width-1):0.0f;
+    float y = (params.scaleJ!=0.0f && height>1)?tpMin(tpMax(j/params.scaleJ, 0.0f), 1.0f)*float(height-1):0.0f;
+    size_t x0 = tpMin(size_t(x), width-1);
+    size_t y0 = tpMin(size_t(y), height-1);
+    size_t x1 = tpMin(x0+1, width-1);
+    size_t y1 = tpMin(y0+1, height-1);
+    float fx = x - float(x0);
+    float fy = y - float(y0);
+
+    float h0 = heights[y0*width+x0] + (heights[y0*width+x1] - heights[y0*width+x0])*fx;
+    float h1 = heights[y1*width+x0] + (heights[y1*width+x1] - heights[y1*width+x0])*fx;
+    return h0 + (h1-h0)*fy;
+  })
+{
+
+}
+
+//##################################################################################################
+const HeightfieldParams& Heightfield::params() const
+{
+  return m_params;
+}
+
+//##################################################################################################
+size_t Heightfield::tileCount() const
+{
+  return m_tileVerts.size();
+}
+
+//##################################################################################################
+const Vertex3DList& Heightfield::tileVerts(size_t tile) const
+{
+  return m_tileVerts.at(tile);
+}
+
+//##################################################################################################
+const HeightfieldIndexBuffers& Heightfield::indexBuffers() const
+{
+  return *m_indexBuffers;
+}
+
+//##################################################################################################
+std::vector<size_t> Heightfield::selectLods(const glm::vec3& viewer, float errorPerDistance) const
+{
+  size_t maxLod = m_indexBuffers->lodCount-1;
+  float edge = tpMax(std::fabs(m_params.scaleI)/float(m_params.tilesI*m_params.tileSize),
+                     std::fabs(m_params.scaleJ)/float(m_params.tilesJ*m_params.tileSize));
+
+  std::vector<size_t> lods(m_tileVerts.size(), 0);
+  for(size_t tile=0; tile<lods.size(); tile++)
+  {
+    const auto& bounds = m_tileBounds[tile];
+    float distance = glm::distance(viewer, glm::min(glm::max(viewer, bounds.first), bounds.second));
+    float maxEdge = errorPerDistance*distance;
+    size_t& lod = lods[tile];
+    while(lod<maxLod && edge*float(size_t(2)<<lod)<=maxEdge)
+      lod++;
+  }
+
+  // Only ever lowers levels so this converges, each pass fixes at least one more level.
+  for(bool changed=true; changed;)
+  {
+    changed = false;
+    for(size_t tile=0; tile<lods.size(); tile++)
+    {
+      for(size_t neighbor : neighbors(m_params, tile))
+      {
+        if(neighbor!=SIZE_MAX && lods[tile]>lods[neighbor]+1)
+        {
+          lods[tile] = lods[neighbor]+1;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  return lods;
+}
+
+//##################################################################################################
+int Heightfield::stitch(const std::vector<size_t>& lods, size_t tile) const
+{
+  int result=0;
+  auto n = neighbors(m_params, tile);
+  for(size_t e=0; e<4; e++)
+    if(n[e]!=SIZE_MAX && lods.at(n[e])>lods.at(tile))
+      result |= 1<<e;
+  return result;
+}
+
+//##################################################################################################
+Geometry3D Heightfield::tileGeometry(size_t tile, size_t lod, int stitch) const
+{
+  lod = tpMin(lod, m_indexBuffers->lodCount-1);
+  size_t n = (m_params.tileSize>>lod)+1;
+
+  Geometry3D geometry;
+  geometry.verts.resize(n*n);
+  auto& part = geometry.indexes.emplace_back();
+  part.type = geometry.triangles;
+  part.indexes.resize(m_indexBuffers->indexes(lod, stitch).size());
+  appendTile(tile, lod, stitch, geometry.verts.data(), part.indexes.data(), 0);
+  geometry.validate();
+  return geometry;
+}
+
+//##################################################################################################
+Geometry3D Heightfield::geometry(const std::vector<size_t>& lods) const
+{
+  Geometry3D geometry;
+  auto& part = geometry.indexes.emplace_back();
+  part.type = geometry.triangles;
+
+  size_t maxLod = m_indexBuffers->lodCount-1;
+  std::vector<size_t> vertOffsets(m_tileVerts.size()+1, 0);
+  std::vector<size_t> indexOffsets(m_tileVerts.size()+1, 0);
+  std::vector<int> stitches(m_tileVerts.size());
+  for(size_t tile=0; tile<m_tileVerts.size(); tile++)
+  {
+    size_t lod = tpMin(lods.at(tile), maxLod);
+    size_t n = (m_params.tileSize>>lod)+1;
+    stitches[tile] = stitch(lods, tile);
+    vertOffsets[tile+1] = vertOffsets[tile] + n*n;
+    indexOffsets[tile+1] = indexOffsets[tile] + m_indexBuffers->indexes(lod, stitches[tile]).size();
+  }
+
+  geometry.verts.resize(vertOffsets.back());
+  part.indexes.resize(indexOffsets.back());
+
+  parallelFor(m_tileVerts.size(), [&](size_t tile)
+  {
+    appendTile(tile,
+               tpMin(lods[tile], maxLod),
+               stitches[tile],
+               geometry.verts.data()+vertOffsets[tile],
+               part.indexes.data()+indexOffsets[tile],
+               int(vertOffsets[tile]));
+  });
+
+  geometry.validate();
+  return geometry;
+}
+
+//##################################################################################################
+void Heightfield::appendTile(size_t tile, size_t lod, int stitch, Vertex3D* verts, int* indexes, int offset) const
+{
+  size_t row = m_params.tileSize+1;
+  size_t step = size_t(1)<<lod;
+  size_t n = (m_params.tileSize>>lod)+1;
+
+  const auto& src = m_tileVerts.at(tile);
+  for(size_t j=0; j<n; j++)
+    for(size_t i=0; i<n; i++)
+      *(verts++) = src[(j*row + i)*step];
+
+  // Map from full detail verts to the verts of this level.
+  for(int index : m_indexBuffers->indexes(lod, stitch))
+  {
+    size_t i = (size_t(index)%row)/step;
+    size_t j = (size_t(index)/row)/step;
+    *(indexes++) = int(j*n + i) + offset;
+  }
+}
+
+}
@@ -0,0 +1,269 @@
+#include "tp_math_utils/InstancedGeometry3D.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/HashUtils.h"
+
+#include "glm/gtx/norm.hpp" // IWYU pragma: keep
+
+#include <map>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+//! Hash the parts of a mesh that are not changed by transforming it.
+size_t transformInvariantHash(const Geometry3D& geometry)
+{
+  size_t h = hashCombine(0, uint32_t(geometry.verts.size()));
+  for(const auto& vert : geometry.verts)
+  {
+    h = hashCombine(h, floatBits(vert.texture.x));
+    h = hashCombine(h, floatBits(vert.texture.y));
+  }
+
+  h = hashCombine(h, uint32_t(geometry.indexes.size()));
+  for(const auto& part : geometry.indexes)
+  {
+    h = hashCombine(h, uint32_t(part.type));
+    h = hashCombine(h, uint32_t(part.indexes.size()));
+    for(auto i : part.indexes)
+      h = hashCombine(h, uint32_t(i));
+  }
+
+  return h;
+}
+
+//##################################################################################################
+bool sameTopology(const Geometry3D& a, const Geometry3D& b)
+{
+  if(a.verts.size() != b.verts.size() || !(a.indexes == b.indexes))
+    return false;
+
+  for(size_t i=0; i<a.verts.size(); i++)
+    if(a.verts[i].texture != b.verts[i].texture)
+      return false;
+
+  return true;
+}
+
+//##################################################################################################
+//! The centroid and two well spread verts of a mesh that transforms are calculated from.
+struct Frame_lt
+{
+  glm::vec3 centroid{0.0f, 0.0f, 0.0f};
+  size_t i0{0};
+  size_t i1{0};
+  float radius{0.0f};
+  bool collinear{true}; //!< All verts lie on a line, rotation about it can't be found.
+};
+
+//##################################################################################################
+Frame_lt calculateFrame(const Geometry3D& geometry)
+{
+  Frame_lt frame;
+  if(geometry.verts.empty())
+    return frame;
+
+  glm::dvec3 sum{0.0, 0.0, 0.0};
+  for(const auto& vert : geometry.verts)
+    sum += glm::dvec3(vert.vert);
+  frame.centroid = glm::vec3(sum / double(geometry.verts.size()));
+
+  float best=-1.0f;
+  for(size_t i=0; i<geometry.verts.size(); i++)
+  {
+    float d = glm::length2(geometry.verts[i].vert - frame.centroid);
+    if(d>best)
+    {
+      best = d;
+      frame.i0 = i;
+    }
+  }
+  frame.radius = std::sqrt(best);
+
+  glm::vec3 a = geometry.verts[frame.i0].vert - frame.centroid;
+  best=0.0f;
+  for(size_t i=0; i<geometry.verts.size(); i++)
+  {
+    float d = glm::length2(glm::cross(a, geometry.verts[i].vert - frame.centroid));
+    if(d>best)
+    {
+      best = d;
+      frame.i1 = i;
+    }
+  }
+
+  frame.collinear = best <= (frame.radius*frame.radius*frame.radius*frame.radius*1e-6f);
+  return frame;
+}
+
+//##################################################################################################
+glm::mat3 frameAxes(const Geometry3D& geometry, const Frame_lt& frame)
+{
+  glm::vec3 e0 = glm::normalize(geometry.verts[frame.i0].vert - frame.centroid);
+  glm::vec3 e1 = glm::normalize(glm::cross(e0, geometry.verts[frame.i1].vert - frame.centroid));
+  return glm::mat3(e0, e1, glm::cross(e0, e1));
+}
+
+//##################################################################################################
+//! Try to find m such that b = m*a, for meshes with the same topology.
+bool findTransform(const Geometry3D& a,
+                   const Frame_lt& frameA,
+                   const Geometry3D& b,
+                   const InstanceDetectionParams& params,
+                   glm::mat4& m)
+{
+  if(a.verts == b.verts)
+  {
+    m = glm::mat4(1.0f);
+    return true;
+  }
+
+  if(!params.rigid || a.verts.empty())
+    return false;
+
+  Frame_lt frameB = calculateFrame(b);
+
+  float scale=1.0f;
+  if(frameA.radius>0.0f)
+  {
+    scale = glm::length(b.verts[frameA.i0].vert - frameB.centroid) / frameA.radius;
+    if(!params.uniformScale)
+      scale = 1.0f;
+  }
+
+  glm::mat3 r(1.0f);
+  if(!frameA.collinear)
+    r = frameAxes(b, {frameB.centroid, frameA.i0, frameA.i1, 0.0f, false}) * glm::transpose(frameAxes(a, frameA));
+
+  glm::vec3 t = frameB.centroid - r*(frameA.centroid*scale);
+
+  float maxError = params.tolerance * tpMax(frameA.radius*tpMax(scale, 1.0f), 1e-6f);
+  float maxError2 = maxError*maxError;
+  float maxNormalError2 = params.normalTolerance*params.normalTolerance;
+  for(size_t i=0; i<a.verts.size(); i++)
+  {
+    const auto& va = a.verts[i];
+    const auto& vb = b.verts[i];
+
+    if(glm::length2(r*(va.vert*scale) + t - vb.vert) > maxError2)
+      return false;
+
+    if(glm::length2(r*va.normal - vb.normal) > maxNormalError2)
+      return false;
+  }
+
+  m = glm::mat4(r*scale);
+  m[3] = glm::vec4(t, 1.0f);
+  return true;
+}
+}
+
+//##################################################################################################
+void InstancedGeometry3D::add(const Geometry3D& geometry_, const glm::mat4& transform)
+{
+  auto& instance = instances.emplace_back();
+  instance.geometryIndex = geometry.size();
+  instance.transform = transform;
+  instance.material = geometry_.material;
+  geometry.push_back(geometry_);
+}
+
+//##################################################################################################
+Geometry3DList InstancedGeometry3D::flatten() const
+{
+  Geometry3DList result(instances.size());
+  parallelFor(instances.size(), [&](size_t i)
+  {
+    const auto& instance = instances.at(i);
+    auto& g = result[i];
+    g = geometry.at(instance.geometryIndex);
+    if(instance.transform != glm::mat4(1.0f))
+    {
+      g.transform(instance.transform);
+
+      // Scaled instances would otherwise get scaled normals.
+      if(std::fabs(glm::length2(glm::vec3(instance.transform[0])) - 1.0f) > 1e-5f)
+        for(auto& vert : g.verts)
+          vert.normal = glm::normalize(vert.normal);
+    }
+    g.material = instance.material;
+  });
+  return result;
+}
+
+//##################################################################################################
+size_t InstancedGeometry3D::sizeInBytes() const
+{
+  return Geometry3D::sizeInBytes(geometry) + instances.size()*sizeof(Geometry3DInstance);
+}
+
+//##################################################################################################
+InstancedGeometry3D detectInstances(const Geometry3DList& geometry, const InstanceDetectionParams& params)
+{
+  InstancedGeometry3D result;
+
+  std::vector<size_t> hashes(geometry.size());
+  parallelFor(geometry.size(), [&](size_t i)
+  {
+    hashes[i] = transformInvariantHash(geometry[i]);
+  });
+
+  // Group by hash, keeping each group in input order.
+  std::vector<std::vector<size_t>> groups;
+  {
+    std::map<size_t, size_t> groupIndexes;
+    for(size_t i=0; i<geometry.size(); i++)
+    {
+      auto j = groupIndexes.try_emplace(hashes[i], groups.size());
+      if(j.second)
+        groups.emplace_back();
+      groups[j.first->second].push_back(i);
+    }
+  }
+
+  // For each mesh, the mesh that it is an instance of and the transform to get there.
+  std::vector<size_t> sources(geometry.size());
+  std::vector<glm::mat4> transforms(geometry.size(), glm::mat4(1.0f));
+  parallelFor(groups.size(), [&](size_t g)
+  {
+    std::vector<std::pair<size_t, Frame_lt>> shared;
+    for(size_t i : groups[g])
+    {
+      const auto& mesh = geometry[i];
+      sources[i] = i;
+      for(const auto& [s, frame] : shared)
+      {
+        if(sameTopology(geometry[s], mesh) && findTransform(geometry[s], frame, mesh, params, transforms[i]))
+        {
+          sources[i] = s;
+          break;
+        }
+      }
+
+      if(sources[i] == i)
+        shared.emplace_back(i, calculateFrame(mesh));
+    }
+  });
+
+  std::vector<size_t> geometryIndexes(geometry.size());
+  result.instances.resize(geometry.size());
+  for(size_t i=0; i<geometry.size(); i++)
+  {
+    if(sources[i] == i)
+    {
+      geometryIndexes[i] = result.geometry.size();
+      result.geometry.push_back(geometry[i]);
+    }
+
+    auto& instance = result.instances[i];
+    instance.geometryIndex = geometryIndexes[sources[i]];
+    instance.transform = transforms[i];
+    instance.material = geometry[i].material;
+  }
+
+  return result;
+}
+
+}
@@ -1,8 +1,7 @@
-#ifndef tp_math_utils_Intersection_h
-#define tp_math_utils_Intersection_h
-
+#include "tp_math_utils/Intersection.h"
 #include "tp_math_utils/Plane.h"
 #include "tp_math_utils/Ray.h"
+#include "tp_math_utils/ParallelFor.h"
 
 namespace tp_math_utils
 {
@@ -13,11 +12,12 @@ Return false if ray is parallel to the plane (including ray belongs to the plane
 true otherwise with intersection parameter filled.
 */
 
-template<typename FLOAT_TYPE>
-bool rayPlaneIntersectionImpl(const Ray& ray, const Plane& plane, glm::vec<3,FLOAT_TYPE>& intersection)
+template<typename RayType, typename FLOAT_TYPE>
+bool rayPlaneIntersectionImpl(const RayType& ray, const Plane& plane, glm::vec<3,FLOAT_TYPE>& intersection)
 {
-  const auto& Po = plane.pointAndNormal()[0];
-  const auto& Pn = plane.pointAndNormal()[1];
+  using Vec = decltype(ray.p0);
+  const Vec Po(plane.pointAndNormal()[0]);
+  const Vec Pn(plane.pointAndNormal()[1]);
   const auto& Ro = ray.p0;
   const auto  Rd = ray.p1-ray.p0;
 
@@ -56,6 +56,158 @@ bool rayPlaneIntersection(const Ray& ray, const Plane& plane, glm::dvec3& inters
   return rayPlaneIntersectionImpl(ray, plane, intersection);
 }
 
+//##################################################################################################
+bool rayPlaneIntersection(const DRay& ray, const Plane& plane, glm::dvec3& intersection)
+{
+  return rayPlaneIntersectionImpl(ray, plane, intersection);
 }
 
-#endif
+//##################################################################################################
+size_t RayArray::size() const
+{
+  return ox.size();
+}
+
+//##################################################################################################
+void RayArray::resize(size_t size)
+{
+  ox.resize(size);
+  oy.resize(size);
+  oz.resize(size);
+  dx.resize(size);
+  dy.resize(size);
+  dz.resize(size);
+}
+
+//##################################################################################################
+void RayArray::set(size_t i, const glm::vec3& origin, const glm::vec3& direction)
+{
+  ox[i] = origin.x;
+  oy[i] = origin.y;
+  oz[i] = origin.z;
+  dx[i] = direction.x;
+  dy[i] = direction.y;
+  dz[i] = direction.z;
+}
+
+//##################################################################################################
+void RayArray::set(size_t i, const Ray& ray)
+{
+  set(i, ray.p0, ray.p1-ray.p0);
+}
+
+//##################################################################################################
+RayArray RayArray::fromCamera(const glm::mat4& inverseViewProjection, size_t width, size_t height)
+{
+  RayArray rays;
+  rays.resize(width*height);
+  if(rays.size()==0)
+    return rays;
+
+  // Homogeneous points are linear along a row, so each row is a start plus a step per pixel.
+  glm::vec4 stepX = inverseViewProjection[0] * (2.0f/float(width));
+
+  parallelForBlocks(height, 16, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t y=begin; y<end; y++)
+    {
+      float ndcX = (1.0f/float(width)) - 1.0f;
+      float ndcY = (float(y)+0.5f)*(2.0f/float(height)) - 1.0f;
+      glm::vec4 nearStart = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+      glm::vec4 farStart  = inverseViewProjection * glm::vec4(ndcX, ndcY,  1.0f, 1.0f);
+
+      size_t row = y*width;
+      float* ox = rays.ox.data()+row;
+      float* oy = rays.oy.data()+row;
+      float* oz = rays.oz.data()+row;
+      float* dx = rays.dx.data()+row;
+      float* dy = rays.dy.data()+row;
+      float* dz = rays.dz.data()+row;
+      for(size_t x=0; x<width; x++)
+      {
+        float fx = float(x);
+        glm::vec4 n = nearStart + stepX*fx;
+        glm::vec4 f = farStart + stepX*fx;
+        float nw = 1.0f/n.w;
+        float fw = 1.0f/f.w;
+        ox[x] = n.x*nw;
+        oy[x] = n.y*nw;
+        oz[x] = n.z*nw;
+        dx[x] = f.x*fw - ox[x];
+        dy[x] = f.y*fw - oy[x];
+        dz[x] = f.z*fw - oz[x];
+      }
+    }
+  });
+
+  return rays;
+}
+
+//##################################################################################################
+void rayPlaneIntersections(const RayArray& rays,
+                           const std::vector<Plane>& planes,
+                           RayPlaneHits& hits,
+                           float tMin,
+                           float tMax)
+{
+  size_t count = rays.size();
+  hits.points.resize(count);
+  hits.t.resize(count);
+  hits.hit.resize(count);
+  hits.plane.resize(count);
+
+  // Blocks that fit in cache are tested against every plane before moving on.
+  constexpr size_t chunk = 1024;
+
+  parallelForBlocks(count, 65536, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t c=begin; c<end; c+=chunk)
+    {
+      size_t n = tpMin(chunk, end-c);
+      const float* ox = rays.ox.data()+c;
+      const float* oy = rays.oy.data()+c;
+      const float* oz = rays.oz.data()+c;
+      const float* dx = rays.dx.data()+c;
+      const float* dy = rays.dy.data()+c;
+      const float* dz = rays.dz.data()+c;
+      float* t = hits.t.data()+c;
+      int* plane = hits.plane.data()+c;
+
+      for(size_t i=0; i<n; i++)
+      {
+        t[i] = tMax;
+        plane[i] = -1;
+      }
+
+      for(size_t p=0; p<planes.size(); p++)
+      {
+        const glm::vec3& normal = planes[p].normal();
+        float d = planes[p].d();
+        int index = int(p);
+        for(size_t i=0; i<n; i++)
+        {
+          float distance = normal.x*ox[i] + normal.y*oy[i] + normal.z*oz[i] + d;
+          float speed    = normal.x*dx[i] + normal.y*dy[i] + normal.z*dz[i];
+          float tt = -distance / speed;
+
+          // Parallel rays give inf or NaN which fail the comparisons.
+          bool closer = (tt>=tMin) & (tt<=t[i]) & (speed!=0.0f);
+          t[i] = closer?tt:t[i];
+          plane[i] = closer?index:plane[i];
+        }
+      }
+
+      glm::vec3* points = hits.points.data()+c;
+      uint8_t* hit = hits.hit.data()+c;
+      for(size_t i=0; i<n; i++)
+      {
+        bool h = plane[i]>=0;
+        float tt = h?t[i]:0.0f;
+        hit[i] = h?1:0;
+        points[i] = glm::vec3(ox[i] + dx[i]*tt, oy[i] + dy[i]*tt, oz[i] + dz[i]*tt);
+      }
+    }
+  });
+}
+
+}
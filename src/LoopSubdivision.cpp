@@ -0,0 +1,594 @@
+#include "tp_math_utils/LoopSubdivision.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/HashUtils.h"
+
+#include "tp_utils/DebugUtils.h"
+
+#include "glm/gtx/norm.hpp" // IWYU pragma: keep
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <unordered_map>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+typedef std::array<int, 3> Face_lt;
+
+//##################################################################################################
+uint64_t edgeKey(int a, int b)
+{
+  if(b<a)
+    std::swap(a, b);
+  return (uint64_t(uint32_t(a))<<32) | uint64_t(uint32_t(b));
+}
+
+//##################################################################################################
+//! The unique edges of a list of triangles.
+struct Edges_lt
+{
+  std::vector<uint64_t> keys;               //!< Sorted, see edgeKey().
+  std::vector<int> faceCount;
+  std::vector<std::array<int, 2>> faces;    //!< The first two faces that share the edge.
+  std::vector<std::array<int, 2>> opposite; //!< The corner opposite the edge in each of those faces.
+
+  //################################################################################################
+  size_t size() const
+  {
+    return keys.size();
+  }
+
+  //################################################################################################
+  int a(size_t e) const
+  {
+    return int(keys[e]>>32);
+  }
+
+  //################################################################################################
+  int b(size_t e) const
+  {
+    return int(keys[e] & 0xFFFFFFFFull);
+  }
+
+  //################################################################################################
+  int find(int a, int b) const
+  {
+    uint64_t key = edgeKey(a, b);
+    auto i = std::lower_bound(keys.begin(), keys.end(), key);
+    return (i!=keys.end() && *i==key)?int(i-keys.begin()):-1;
+  }
+};
+
+//##################################################################################################
+Edges_lt buildEdges(const std::vector<Face_lt>& faces)
+{
+  // Sorting the corners by edge groups the faces that share each edge.
+  std::vector<std::pair<uint64_t, int>> corners;
+  corners.reserve(faces.size()*3);
+  for(size_t f=0; f<faces.size(); f++)
+    for(size_t k=0; k<3; k++)
+      corners.emplace_back(edgeKey(faces[f][k], faces[f][(k+1)%3]), int(f*3+k));
+  std::sort(corners.begin(), corners.end());
+
+  Edges_lt edges;
+  edges.keys.reserve(corners.size()/2+1);
+  edges.faceCount.reserve(corners.size()/2+1);
+  edges.faces.reserve(corners.size()/2+1);
+  edges.opposite.reserve(corners.size()/2+1);
+
+  for(size_t i=0; i<corners.size(); )
+  {
+    size_t j=i+1;
+    while(j<corners.size() && corners[j].first == corners[i].first)
+      j++;
+
+    auto corner = [&](size_t c, int& face, int& opposite)
+    {
+      face = corners[c].second/3;
+      opposite = faces[size_t(face)][size_t((corners[c].second%3+2)%3)];
+    };
+
+    std::array<int, 2> f{-1, -1};
+    std::array<int, 2> o{-1, -1};
+    corner(i, f[0], o[0]);
+    if(j-i>1)
+      corner(i+1, f[1], o[1]);
+
+    edges.keys.push_back(corners[i].first);
+    edges.faceCount.push_back(int(j-i));
+    edges.faces.push_back(f);
+    edges.opposite.push_back(o);
+    i=j;
+  }
+
+  return edges;
+}
+
+//##################################################################################################
+//! Split each triangle into 4, edge points are numbered after the existing points.
+std::vector<Face_lt> refineFaces(const std::vector<Face_lt>& faces, size_t points, const Edges_lt& edges)
+{
+  std::vector<Face_lt> result(faces.size()*4);
+  parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t f=begin; f<end; f++)
+    {
+      const auto& face = faces[f];
+      int ab = int(points) + edges.find(face[0], face[1]);
+      int bc = int(points) + edges.find(face[1], face[2]);
+      int ca = int(points) + edges.find(face[2], face[0]);
+
+      result[f*4  ] = {face[0], ab, ca};
+      result[f*4+1] = {ab, face[1], bc};
+      result[f*4+2] = {ca, bc, face[2]};
+      result[f*4+3] = {ab, bc, ca};
+    }
+  });
+  return result;
+}
+
+//##################################################################################################
+float loopBeta(size_t n)
+{
+  double c = 0.375 + 0.25*std::cos(2.0*M_PI/double(n));
+  return float((0.625 - c*c) / double(n));
+}
+
+//##################################################################################################
+//! The stencils for one level, the rows are the existing points followed by one point per edge.
+SubdivisionStencils levelStencils(size_t points, const Edges_lt& edges, const std::vector<uint8_t>& crease)
+{
+  std::vector<size_t> adjacentOffsets(points+1, 0);
+  for(size_t e=0; e<edges.size(); e++)
+  {
+    adjacentOffsets[size_t(edges.a(e))+1]++;
+    adjacentOffsets[size_t(edges.b(e))+1]++;
+  }
+
+  for(size_t p=0; p<points; p++)
+    adjacentOffsets[p+1] += adjacentOffsets[p];
+
+  std::vector<int> adjacentEdges(adjacentOffsets.back());
+  {
+    std::vector<size_t> fill(adjacentOffsets.begin(), adjacentOffsets.end()-1);
+    for(size_t e=0; e<edges.size(); e++)
+    {
+      adjacentEdges[fill[size_t(edges.a(e))]++] = int(e);
+      adjacentEdges[fill[size_t(edges.b(e))]++] = int(e);
+    }
+  }
+
+  SubdivisionStencils stencils;
+  stencils.inputCount = points;
+  stencils.offsets.reserve(points+edges.size()+1);
+  stencils.columns.reserve(adjacentEdges.size()+points+edges.size()*4);
+  stencils.weights.reserve(stencils.columns.capacity());
+  stencils.offsets.push_back(0);
+
+  auto add = [&](int column, float weight)
+  {
+    stencils.columns.push_back(column);
+    stencils.weights.push_back(weight);
+  };
+
+  for(size_t p=0; p<points; p++)
+  {
+    size_t begin = adjacentOffsets[p];
+    size_t end = adjacentOffsets[p+1];
+    size_t n = end-begin;
+
+    auto other = [&](int e)
+    {
+      int a = edges.a(size_t(e));
+      return (a==int(p))?edges.b(size_t(e)):a;
+    };
+
+    int creaseNeighbours[2]{-1, -1};
+    size_t creaseCount=0;
+    for(size_t i=begin; i<end; i++)
+    {
+      if(crease[size_t(adjacentEdges[i])])
+      {
+        if(creaseCount<2)
+          creaseNeighbours[creaseCount] = other(adjacentEdges[i]);
+        creaseCount++;
+      }
+    }
+
+    if(n==0 || creaseCount>2)
+    {
+      // Isolated points and corners stay where they are.
+      add(int(p), 1.0f);
+    }
+    else if(creaseCount==2)
+    {
+      // Points on a crease only follow the crease.
+      add(int(p), 0.75f);
+      add(creaseNeighbours[0], 0.125f);
+      add(creaseNeighbours[1], 0.125f);
+    }
+    else
+    {
+      float beta = loopBeta(n);
+      add(int(p), 1.0f - float(n)*beta);
+      for(size_t i=begin; i<end; i++)
+        add(other(adjacentEdges[i]), beta);
+    }
+
+    stencils.offsets.push_back(stencils.columns.size());
+  }
+
+  for(size_t e=0; e<edges.size(); e++)
+  {
+    if(crease[e])
+    {
+      add(edges.a(e), 0.5f);
+      add(edges.b(e), 0.5f);
+    }
+    else
+    {
+      add(edges.a(e), 0.375f);
+      add(edges.b(e), 0.375f);
+      add(edges.opposite[e][0], 0.125f);
+      add(edges.opposite[e][1], 0.125f);
+    }
+
+    stencils.offsets.push_back(stencils.columns.size());
+  }
+
+  return stencils;
+}
+
+//##################################################################################################
+SubdivisionStencils identityStencils(size_t count)
+{
+  SubdivisionStencils stencils;
+  stencils.inputCount = count;
+  stencils.offsets.resize(count+1);
+  stencils.columns.resize(count);
+  stencils.weights.assign(count, 1.0f);
+  for(size_t i=0; i<count; i++)
+  {
+    stencils.offsets[i] = i;
+    stencils.columns[i] = int(i);
+  }
+  stencils.offsets[count] = count;
+  return stencils;
+}
+
+//##################################################################################################
+//! Returns the stencils for applying b then a.
+SubdivisionStencils multiply(const SubdivisionStencils& a, const SubdivisionStencils& b)
+{
+  struct Block_lt
+  {
+    std::vector<size_t> sizes;
+    std::vector<int> columns;
+    std::vector<float> weights;
+  };
+
+  // Each block builds its own rows, they are joined in order so the result is deterministic.
+  size_t rows = a.rows();
+  std::vector<Block_lt> blocks(parallelThreadCount(rows, 1024));
+  parallelForBlocks(rows, 1024, [&](size_t begin, size_t end, size_t block)
+  {
+    auto& out = blocks[block];
+    std::vector<float> sum(b.inputCount, 0.0f);
+    std::vector<uint8_t> used(b.inputCount, 0);
+    std::vector<int> touched;
+
+    for(size_t r=begin; r<end; r++)
+    {
+      for(size_t i=a.offsets[r]; i<a.offsets[r+1]; i++)
+      {
+        size_t j = size_t(a.columns[i]);
+        float w = a.weights[i];
+        for(size_t k=b.offsets[j]; k<b.offsets[j+1]; k++)
+        {
+          auto c = size_t(b.columns[k]);
+          if(!used[c])
+          {
+            used[c] = 1;
+            touched.push_back(int(c));
+          }
+          sum[c] += w * b.weights[k];
+        }
+      }
+
+      std::sort(touched.begin(), touched.end());
+      for(int c : touched)
+      {
+        out.columns.push_back(c);
+        out.weights.push_back(sum[size_t(c)]);
+        sum[size_t(c)] = 0.0f;
+        used[size_t(c)] = 0;
+      }
+      out.sizes.push_back(touched.size());
+      touched.clear();
+    }
+  });
+
+  SubdivisionStencils result;
+  result.inputCount = b.inputCount;
+  result.offsets.reserve(rows+1);
+  result.offsets.push_back(0);
+  for(const auto& block : blocks)
+  {
+    for(auto size : block.sizes)
+      result.offsets.push_back(result.offsets.back()+size);
+    result.columns.insert(result.columns.end(), block.columns.begin(), block.columns.end());
+    result.weights.insert(result.weights.end(), block.weights.begin(), block.weights.end());
+  }
+
+  return result;
+}
+
+//##################################################################################################
+template<typename T>
+void applyStencils(const SubdivisionStencils& stencils, const T* input, T* output)
+{
+  parallelForBlocks(stencils.rows(), 4096, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t r=begin; r<end; r++)
+    {
+      T value(0.0f);
+      for(size_t i=stencils.offsets[r]; i<stencils.offsets[r+1]; i++)
+        value += stencils.weights[i] * input[stencils.columns[i]];
+      output[r] = value;
+    }
+  });
+}
+
+//##################################################################################################
+struct PositionKey_lt
+{
+  uint32_t bits[3];
+
+  bool operator==(const PositionKey_lt& other) const
+  {
+    return bits[0]==other.bits[0] && bits[1]==other.bits[1] && bits[2]==other.bits[2];
+  }
+};
+
+//##################################################################################################
+struct PositionKeyHash_lt
+{
+  size_t operator()(const PositionKey_lt& key) const
+  {
+    uint64_t h = key.bits[0];
+    h = h*0x9E3779B97F4A7C15ull + key.bits[1];
+    h = h*0x9E3779B97F4A7C15ull + key.bits[2];
+    return size_t(h ^ (h>>29));
+  }
+};
+}
+
+//##################################################################################################
+size_t SubdivisionStencils::rows() const
+{
+  return offsets.empty()?0:offsets.size()-1;
+}
+
+//##################################################################################################
+void SubdivisionStencils::apply(const glm::vec3* input, glm::vec3* output) const
+{
+  applyStencils(*this, input, output);
+}
+
+//##################################################################################################
+void SubdivisionStencils::apply(const glm::vec2* input, glm::vec2* output) const
+{
+  applyStencils(*this, input, output);
+}
+
+//##################################################################################################
+LoopSubdivision::LoopSubdivision(const Geometry3D& geometry, const LoopSubdivisionParams& params)
+{
+  const auto& verts = geometry.verts;
+
+  // Merge verts with identical positions.
+  std::vector<int> positionOf(verts.size());
+  {
+    std::unordered_map<PositionKey_lt, int, PositionKeyHash_lt> lookup;
+    lookup.reserve(verts.size());
+    for(size_t i=0; i<verts.size(); i++)
+    {
+      PositionKey_lt key;
+      for(int a=0; a<3; a++)
+        key.bits[a] = floatBits(verts[i].vert[a]);
+
+      auto result = lookup.emplace(key, int(m_basePositionVert.size()));
+      if(result.second)
+        m_basePositionVert.push_back(int(i));
+      positionOf[i] = result.first->second;
+    }
+  }
+
+  // Faces that are out of range or have merged corners are dropped.
+  std::vector<Face_lt> vertFaces;
+  std::vector<Face_lt> positionFaces;
+  {
+    const int nVerts = int(verts.size());
+    geometry.forEachTriangleIndexes([&](int i0, int i1, int i2)
+    {
+      if(i0<0 || i1<0 || i2<0 || i0>=nVerts || i1>=nVerts || i2>=nVerts)
+        return;
+
+      Face_lt positionFace{positionOf[size_t(i0)], positionOf[size_t(i1)], positionOf[size_t(i2)]};
+      if(positionFace[0]==positionFace[1] || positionFace[1]==positionFace[2] || positionFace[2]==positionFace[0])
+        return;
+
+      vertFaces.push_back({i0, i1, i2});
+      positionFaces.push_back(positionFace);
+    });
+  }
+
+  // Sharp edges of the input, edges split from them stay sharp.
+  std::vector<uint64_t> creaseKeys;
+  if(params.creaseMinDot>-1.0f)
+  {
+    auto faceNormal = [&](int f)
+    {
+      const auto& face = positionFaces[size_t(f)];
+      const auto& p0 = verts[size_t(m_basePositionVert[size_t(face[0])])].vert;
+      const auto& p1 = verts[size_t(m_basePositionVert[size_t(face[1])])].vert;
+      const auto& p2 = verts[size_t(m_basePositionVert[size_t(face[2])])].vert;
+      return glm::normalize(glm::cross(p1-p0, p2-p0));
+    };
+
+    Edges_lt edges = buildEdges(positionFaces);
+    for(size_t e=0; e<edges.size(); e++)
+      if(edges.faceCount[e]==2 && glm::dot(faceNormal(edges.faces[e][0]), faceNormal(edges.faces[e][1]))<params.creaseMinDot)
+        creaseKeys.push_back(edges.keys[e]);
+  }
+
+  size_t nPositions = m_basePositionVert.size();
+  size_t nVerts = verts.size();
+  m_positionStencils = identityStencils(nPositions);
+  m_vertStencils = identityStencils(nVerts);
+
+  for(size_t level=0; level<params.levels; level++)
+  {
+    Edges_lt positionEdges = buildEdges(positionFaces);
+    std::vector<uint8_t> positionCrease(positionEdges.size());
+    for(size_t e=0; e<positionEdges.size(); e++)
+      positionCrease[e] = positionEdges.faceCount[e]!=2 || std::binary_search(creaseKeys.begin(), creaseKeys.end(), positionEdges.keys[e]);
+
+    // Texture seams are boundaries of the vert mesh, creases of the position mesh are also used so
+    // that the texture coordinates follow the shape of the surface.
+    Edges_lt vertEdges = buildEdges(vertFaces);
+    std::vector<uint8_t> vertCrease(vertEdges.size());
+    std::vector<int> vertEdgePosition(vertEdges.size());
+    for(size_t e=0; e<vertEdges.size(); e++)
+    {
+      int pe = positionEdges.find(positionOf[size_t(vertEdges.a(e))], positionOf[size_t(vertEdges.b(e))]);
+      vertEdgePosition[e] = pe;
+      vertCrease[e] = vertEdges.faceCount[e]!=2 || positionCrease[size_t(pe)];
+    }
+
+    m_positionStencils = multiply(levelStencils(nPositions, positionEdges, positionCrease), m_positionStencils);
+    m_vertStencils = multiply(levelStencils(nVerts, vertEdges, vertCrease), m_vertStencils);
+
+    positionFaces = refineFaces(positionFaces, nPositions, positionEdges);
+    vertFaces = refineFaces(vertFaces, nVerts, vertEdges);
+
+    positionOf.resize(nVerts+vertEdges.size());
+    for(size_t e=0; e<vertEdges.size(); e++)
+      positionOf[nVerts+e] = int(nPositions) + vertEdgePosition[e];
+
+    {
+      std::vector<uint64_t> childCreaseKeys;
+      childCreaseKeys.reserve(creaseKeys.size()*2);
+      for(auto key : creaseKeys)
+      {
+        int e = positionEdges.find(int(key>>32), int(key & 0xFFFFFFFFull));
+        int mid = int(nPositions) + e;
+        childCreaseKeys.push_back(edgeKey(positionEdges.a(size_t(e)), mid));
+        childCreaseKeys.push_back(edgeKey(mid, positionEdges.b(size_t(e))));
+      }
+      std::sort(childCreaseKeys.begin(), childCreaseKeys.end());
+      creaseKeys.swap(childCreaseKeys);
+    }
+
+    nPositions += positionEdges.size();
+    nVerts += vertEdges.size();
+  }
+
+  m_positionOfVert = std::move(positionOf);
+
+  m_indexes.reserve(vertFaces.size()*3);
+  for(const auto& face : vertFaces)
+    m_indexes.insert(m_indexes.end(), face.begin(), face.end());
+}
+
+//##################################################################################################
+bool LoopSubdivision::apply(const Geometry3D& geometry, Geometry3D& output) const
+{
+  if(geometry.verts.size() != m_vertStencils.inputCount)
+  {
+    tpWarning() << "LoopSubdivision::apply() expected " << m_vertStencils.inputCount << " verts got " << geometry.verts.size();
+    return false;
+  }
+
+  std::vector<glm::vec3> positions(m_positionStencils.rows());
+  std::vector<glm::vec2> textures(m_vertStencils.rows());
+  std::vector<glm::vec3> normals(m_vertStencils.rows());
+  {
+    std::vector<glm::vec3> basePositions(m_basePositionVert.size());
+    for(size_t p=0; p<basePositions.size(); p++)
+      basePositions[p] = geometry.verts[size_t(m_basePositionVert[p])].vert;
+
+    std::vector<glm::vec2> baseTextures(geometry.verts.size());
+    std::vector<glm::vec3> baseNormals(geometry.verts.size());
+    for(size_t v=0; v<geometry.verts.size(); v++)
+    {
+      baseTextures[v] = geometry.verts[v].texture;
+      baseNormals[v] = geometry.verts[v].normal;
+    }
+
+    m_positionStencils.apply(basePositions.data(), positions.data());
+    m_vertStencils.apply(baseTextures.data(), textures.data());
+    m_vertStencils.apply(baseNormals.data(), normals.data());
+  }
+
+  // Geometry and output may be the same object so only write to output once the input is read.
+  output.comments = geometry.comments;
+  output.triangleFan = geometry.triangleFan;
+  output.triangleStrip = geometry.triangleStrip;
+  output.triangles = geometry.triangles;
+  output.material = geometry.material;
+
+  output.verts.resize(m_vertStencils.rows());
+  parallelForBlocks(output.verts.size(), 10000, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t v=begin; v<end; v++)
+    {
+      auto& vert = output.verts[v];
+      vert.vert = positions[size_t(m_positionOfVert[v])];
+      vert.texture = textures[v];
+      vert.normal = (glm::length2(normals[v])>0.0f)?glm::normalize(normals[v]):normals[v];
+    }
+  });
+
+  output.indexes.resize(1);
+  output.indexes.front().type = geometry.triangles;
+  output.indexes.front().indexes = m_indexes;
+  return true;
+}
+
+//##################################################################################################
+const SubdivisionStencils& LoopSubdivision::positionStencils() const
+{
+  return m_positionStencils;
+}
+
+//##################################################################################################
+const SubdivisionStencils& LoopSubdivision::vertStencils() const
+{
+  return m_vertStencils;
+}
+
+//##################################################################################################
+const std::vector<int>& LoopSubdivision::positionOfVert() const
+{
+  return m_positionOfVert;
+}
+
+//##################################################################################################
+const std::vector<int>& LoopSubdivision::indexes() const
+{
+  return m_indexes;
+}
+
+//##################################################################################################
+Geometry3D loopSubdivide(const Geometry3D& geometry, const LoopSubdivisionParams& params)
+{
+  Geometry3D output;
+  LoopSubdivision(geometry, params).apply(geometry, output);
+  return output;
+}
+
+}
@@ -0,0 +1,170 @@
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/ScratchArena.h"
+
+#include <algorithm>
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+struct ParallelPool::Job
+{
+  const std::function<void(size_t)>* task{nullptr};
+  size_t count{0};
+  size_t maxThreads{0};
+  size_t threads{0}; //!< Threads that have joined the job, guarded by m_mutex.
+  size_t running{0}; //!< Threads that have not left the job yet, guarded by m_mutex.
+  std::atomic<size_t> next{0};
+  ParallelException exception;
+  std::condition_variable finished;
+};
+
+//##################################################################################################
+ParallelPool& ParallelPool::instance()
+{
+  static ParallelPool pool;
+  return pool;
+}
+
+//##################################################################################################
+size_t ParallelPool::workerCount() const
+{
+  return m_workers.size();
+}
+
+//##################################################################################################
+void ParallelPool::run(size_t count,
+                       size_t maxThreads,
+                       const std::function<void(size_t)>& task,
+                       const std::function<void()>& poll,
+                       std::chrono::milliseconds interval)
+{
+  if(m_workers.empty() || (!poll && maxThreads<2))
+  {
+    for(size_t i=0; i<count; i++)
+    {
+      task(i);
+      if(poll)
+        poll();
+    }
+    return;
+  }
+
+  Job job;
+  job.task = &task;
+  job.count = count;
+  job.maxThreads = maxThreads;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_jobs.push_back(&job);
+  if(!poll)
+    join(job);
+  lock.unlock();
+  m_wake.notify_all();
+
+  if(!poll)
+  {
+    bool& active = parallelForActive();
+    bool wasActive = active;
+    active = true;
+    work(job);
+    active = wasActive;
+
+    lock.lock();
+    leave(job);
+    job.finished.wait(lock, [&]{return job.running==0;});
+  }
+  else
+  {
+    // The job lives on this stack, so even if poll() throws keep waiting for the workers.
+    lock.lock();
+    while(!job.finished.wait_for(lock, interval, [&]{return job.running==0 && job.next>=count;}))
+    {
+      lock.unlock();
+      job.exception.run(poll);
+      lock.lock();
+    }
+  }
+
+  lock.unlock();
+  job.exception.rethrow();
+}
+
+//##################################################################################################
+ParallelPool::ParallelPool()
+{
+  size_t nWorkers = tpMax(size_t(std::thread::hardware_concurrency()), size_t(1)) - 1;
+  m_workers.reserve(nWorkers);
+  for(size_t w=0; w<nWorkers; w++)
+    m_workers.emplace_back([this]{workerLoop();});
+}
+
+//##################################################################################################
+ParallelPool::~ParallelPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+
+  for(auto& worker : m_workers)
+    worker.join();
+}
+
+//##################################################################################################
+void ParallelPool::workerLoop()
+{
+  // Nested parallel calls made by a task run on the worker that called them.
+  parallelForActive() = true;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for(;;)
+  {
+    m_wake.wait(lock, [&]{return m_stop || !m_jobs.empty();});
+    if(m_stop)
+      return;
+
+    Job& job = *m_jobs.front();
+    join(job);
+    lock.unlock();
+
+    {
+      // Worker arenas are released at the end of each job, see ScratchArena::threadLocal().
+      ScratchArena::ThreadLocalScope scope;
+      work(job);
+    }
+
+    lock.lock();
+    leave(job);
+  }
+}
+
+//##################################################################################################
+void ParallelPool::work(Job& job)
+{
+  for(size_t i=job.next++; i<job.count; i=job.next++)
+    job.exception.run([&]{(*job.task)(i);});
+}
+
+//##################################################################################################
+void ParallelPool::join(Job& job)
+{
+  job.threads++;
+  job.running++;
+
+  if(job.threads>=job.maxThreads)
+    m_jobs.erase(std::remove(m_jobs.begin(), m_jobs.end(), &job), m_jobs.end());
+}
+
+//##################################################################################################
+void ParallelPool::leave(Job& job)
+{
+  // All of the tasks have been taken so there is no point in other threads joining.
+  m_jobs.erase(std::remove(m_jobs.begin(), m_jobs.end(), &job), m_jobs.end());
+
+  if(--job.running==0)
+    job.finished.notify_all();
+}
+
+}
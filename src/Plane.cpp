@@ -1,12 +1,16 @@
 #include "tp_math_utils/Plane.h"
+#include "tp_math_utils/ParallelFor.h"
 
 namespace tp_math_utils
 {
 
+namespace
+{
+constexpr size_t minPointsPerThread = 65536;
+}
+
 //##################################################################################################
-Plane::Plane():
-  m_pointAndNormalValid(true),
-  m_threePointsValid(true)
+Plane::Plane()
 {
   m_pointAndNormal[0] = glm::vec3(0.0f, 0.0f, 0.0f);
   m_pointAndNormal[1] = glm::vec3(0.0f, 0.0f, 1.0f);
@@ -14,92 +18,174 @@ Plane::Plane():
   m_threePoints[0] = glm::vec3(0.0f, 0.0f, 0.0f);
   m_threePoints[1] = glm::vec3(1.0f, 0.0f, 0.0f);
   m_threePoints[2] = glm::vec3(0.0f, 1.0f, 0.0f);
+
+  calculateEquation();
 }
 
 //##################################################################################################
-Plane::Plane(const glm::vec3& point, const glm::vec3& normal):
-  m_pointAndNormalValid(true),
-  m_threePointsValid(false)
+Plane::Plane(const glm::vec3& point, const glm::vec3& normal)
 {
   m_pointAndNormal[0] = point;
   m_pointAndNormal[1] = normal;
 
-  m_threePoints[0] = glm::vec3(0.0f, 0.0f, 0.0f);
-  m_threePoints[1] = glm::vec3(0.0f, 0.0f, 0.0f);
-  m_threePoints[2] = glm::vec3(0.0f, 0.0f, 0.0f);
+  calculateThreePoints();
+  calculateEquation();
 }
 
 //##################################################################################################
-Plane::Plane(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3):
-  m_pointAndNormalValid(false),
-  m_threePointsValid(true)
+Plane::Plane(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3)
 {
-  m_pointAndNormal[0] = glm::vec3(0.0f, 0.0f, 0.0f);
-  m_pointAndNormal[1] = glm::vec3(0.0f, 0.0f, 0.0f);
-
   m_threePoints[0] = p1;
   m_threePoints[1] = p2;
   m_threePoints[2] = p3;
+
+  m_pointAndNormal[0] = p1;
+  m_pointAndNormal[1] = glm::normalize(glm::cross(p3 - p1, p2 - p1));
+
+  calculateEquation();
 }
 
 //##################################################################################################
 const glm::vec3* Plane::pointAndNormal() const
 {
-  if(!m_pointAndNormalValid)
-  {
-    m_pointAndNormal[0] = m_threePoints[0];
+  return m_pointAndNormal.data();
+}
+
+//##################################################################################################
+const glm::vec3* Plane::threePoints() const
+{
+  return m_threePoints.data();
+}
 
-    const glm::vec3& a = m_threePoints[0];
-    const glm::vec3& b = m_threePoints[1];
-    const glm::vec3& c = m_threePoints[2];
-    m_pointAndNormal[1] = glm::normalize(glm::cross(c - a, b - a));
+//##################################################################################################
+const glm::vec3& Plane::normal() const
+{
+  return m_normal;
+}
 
-    m_pointAndNormalValid = true;
-  }
+//##################################################################################################
+float Plane::d() const
+{
+  return m_d;
+}
 
-  return m_pointAndNormal.data();
+//##################################################################################################
+const glm::vec3& Plane::tangent() const
+{
+  return m_tangent;
 }
 
 //##################################################################################################
-const glm::vec3* Plane::threePoints() const
+const glm::vec3& Plane::bitangent() const
 {
-  if(!m_threePointsValid)
-  {
-    glm::vec3 normal = m_pointAndNormal[1];
-    normal.x = std::fabs(normal.x);
-    normal.y = std::fabs(normal.y);
-    normal.z = std::fabs(normal.z);
+  return m_bitangent;
+}
 
-    //This is used to give us a cross product
-    glm::vec3 cardinal;
+//##################################################################################################
+void Plane::signedDistances(const glm::vec3* points, size_t count, size_t stride, float* distances) const
+{
+  const glm::vec3 n = m_normal;
+  const glm::vec3 o = m_pointAndNormal[0];
+  parallelForBlocks(count, minPointsPerThread, [&](size_t begin, size_t end, size_t)
+  {
+    const auto* p = reinterpret_cast<const char*>(points) + begin*stride;
+    for(size_t i=begin; i<end; i++, p+=stride)
+    {
+      const auto* v = reinterpret_cast<const float*>(p);
+      distances[i] = n.x*(v[0]-o.x) + n.y*(v[1]-o.y) + n.z*(v[2]-o.z);
+    }
+  });
+}
 
-    //Find the shortest component
-    if(normal.x<normal.y)
+//##################################################################################################
+void Plane::classify(const glm::vec3* points, size_t count, size_t stride, float epsilon, int8_t* sides) const
+{
+  const glm::vec3 n = m_normal;
+  const glm::vec3 o = m_pointAndNormal[0];
+  parallelForBlocks(count, minPointsPerThread, [&](size_t begin, size_t end, size_t)
+  {
+    const auto* p = reinterpret_cast<const char*>(points) + begin*stride;
+    for(size_t i=begin; i<end; i++, p+=stride)
     {
-      if(normal.x<normal.z)
-        cardinal = glm::vec3(1.0f, 0.0f, 0.0f);
-      else
-        cardinal = glm::vec3(0.0f, 0.0f, 1.0f);
+      const auto* v = reinterpret_cast<const float*>(p);
+      float distance = n.x*(v[0]-o.x) + n.y*(v[1]-o.y) + n.z*(v[2]-o.z);
+      sides[i] = int8_t(int(distance>epsilon) - int(distance<-epsilon));
     }
-    else
+  });
+}
+
+//##################################################################################################
+void Plane::project(const glm::vec3* points, size_t count, size_t stride, glm::vec3* projected) const
+{
+  const glm::vec3 n = m_normal;
+  const glm::vec3 o = m_pointAndNormal[0];
+  parallelForBlocks(count, minPointsPerThread, [&](size_t begin, size_t end, size_t)
+  {
+    const auto* p = reinterpret_cast<const char*>(points) + begin*stride;
+    for(size_t i=begin; i<end; i++, p+=stride)
     {
-      if(normal.y<normal.z)
-        cardinal = glm::vec3(0.0f, 1.0f, 0.0f);
-      else
-        cardinal = glm::vec3(0.0f, 0.0f, 1.0f);
+      const auto* v = reinterpret_cast<const float*>(p);
+      float distance = n.x*(v[0]-o.x) + n.y*(v[1]-o.y) + n.z*(v[2]-o.z);
+      projected[i] = glm::vec3(v[0] - n.x*distance, v[1] - n.y*distance, v[2] - n.z*distance);
     }
+  });
+}
+
+//##################################################################################################
+void Plane::calculateThreePoints()
+{
+  glm::vec3 normal = m_pointAndNormal[1];
+  normal.x = std::fabs(normal.x);
+  normal.y = std::fabs(normal.y);
+  normal.z = std::fabs(normal.z);
 
-    m_threePoints[0] = m_pointAndNormal[0];
-    m_threePoints[1] = glm::cross(m_pointAndNormal[1], cardinal);
-    m_threePoints[2] = glm::cross(m_pointAndNormal[1], m_threePoints[1]);
-    m_threePoints[1] = glm::cross(m_pointAndNormal[1], m_threePoints[2]);
-    m_threePoints[1] += m_threePoints[0];
-    m_threePoints[2] += m_threePoints[0];
+  //This is used to give us a cross product
+  glm::vec3 cardinal;
 
-    m_threePointsValid = true;
+  //Find the shortest component
+  if(normal.x<normal.y)
+  {
+    if(normal.x<normal.z)
+      cardinal = glm::vec3(1.0f, 0.0f, 0.0f);
+    else
+      cardinal = glm::vec3(0.0f, 0.0f, 1.0f);
+  }
+  else
+  {
+    if(normal.y<normal.z)
+      cardinal = glm::vec3(0.0f, 1.0f, 0.0f);
+    else
+      cardinal = glm::vec3(0.0f, 0.0f, 1.0f);
   }
 
-  return m_threePoints.data();
+  m_threePoints[0] = m_pointAndNormal[0];
+  m_threePoints[1] = glm::cross(m_pointAndNormal[1], cardinal);
+  m_threePoints[2] = glm::cross(m_pointAndNormal[1], m_threePoints[1]);
+  m_threePoints[1] = glm::cross(m_pointAndNormal[1], m_threePoints[2]);
+  m_threePoints[1] += m_threePoints[0];
+  m_threePoints[2] += m_threePoints[0];
+}
+
+//##################################################################################################
+void Plane::calculateEquation()
+{
+  const glm::vec3& n = m_pointAndNormal[1];
+  float length = glm::length(n);
+  if(!(length>0.0f) || !std::isfinite(length))
+  {
+    m_normal = glm::vec3(0.0f, 0.0f, 0.0f);
+    m_d = 0.0f;
+    return;
+  }
+
+  m_normal = n / length;
+  m_d = -glm::dot(m_normal, m_pointAndNormal[0]);
+
+  // Start the tangent from the axis that is furthest from the normal.
+  glm::vec3 a = glm::abs(m_normal);
+  glm::vec3 cardinal = (a.x<=a.y && a.x<=a.z)?glm::vec3(1.0f, 0.0f, 0.0f):((a.y<=a.z)?glm::vec3(0.0f, 1.0f, 0.0f):glm::vec3(0.0f, 0.0f, 1.0f));
+  m_tangent = glm::normalize(cardinal - m_normal*glm::dot(m_normal, cardinal));
+  m_bitangent = glm::cross(m_normal, m_tangent);
 }
 
 //##################################################################################################
@@ -0,0 +1,396 @@
+#include "tp_math_utils/PlaneDetection.h"
+#include "tp_math_utils/ParallelFor.h"
+
+#include "glm/gtx/norm.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+uint64_t splitMix(uint64_t& state)
+{
+  uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+//##################################################################################################
+size_t randomIndex(uint64_t& state, size_t count)
+{
+  return size_t(splitMix(state) % uint64_t(count));
+}
+
+//##################################################################################################
+//! Point indexes sorted into cubic cells.
+/*!
+Cell coordinates are packed into 21 bits each, grids with more cells than that along an axis alias
+distant cells onto each other. That only adds candidates, callers still test the actual distance.
+*/
+struct VoxelGrid_lt
+{
+  float cellSize{1.0f};
+  glm::vec3 origin{0.0f, 0.0f, 0.0f};
+  std::vector<size_t> order;
+  std::unordered_map<uint64_t, std::pair<size_t, size_t>> cells;
+
+  //################################################################################################
+  VoxelGrid_lt(const std::vector<glm::vec3>& points, float cellSize_):
+    cellSize(cellSize_)
+  {
+    origin = points.front();
+    for(const auto& p : points)
+      origin = glm::min(origin, p);
+
+    std::vector<std::pair<uint64_t, size_t>> keys(points.size());
+    parallelForBlocks(points.size(), 4096, [&](size_t begin, size_t end, size_t)
+    {
+      for(size_t i=begin; i<end; i++)
+        keys[i] = {key(cellOf(points[i])), i};
+    });
+    std::sort(keys.begin(), keys.end());
+
+    order.resize(keys.size());
+    cells.reserve(keys.size()/4);
+    for(size_t i=0; i<keys.size(); i++)
+    {
+      order[i] = keys[i].second;
+      auto& range = cells.try_emplace(keys[i].first, i, i).first->second;
+      range.second = i+1;
+    }
+  }
+
+  //################################################################################################
+  glm::ivec3 cellOf(const glm::vec3& p) const
+  {
+    return glm::ivec3(glm::floor((p-origin) / cellSize));
+  }
+
+  //################################################################################################
+  static uint64_t key(const glm::ivec3& c)
+  {
+    return (uint64_t(uint32_t(c.x) & 0x1FFFFFu) << 42) |
+           (uint64_t(uint32_t(c.y) & 0x1FFFFFu) << 21) |
+           (uint64_t(uint32_t(c.z) & 0x1FFFFFu));
+  }
+
+  //################################################################################################
+  //! The points in a cell as a range of order, empty if the cell is empty.
+  std::pair<size_t, size_t> find(const glm::ivec3& c) const
+  {
+    auto i = cells.find(key(c));
+    return (i==cells.end())?std::pair<size_t, size_t>(0, 0):i->second;
+  }
+};
+
+//##################################################################################################
+//! Written as a flat loop over the coordinates so that the compiler can vectorize it.
+size_t countInliers(const glm::vec3* points, size_t count, const glm::vec4& plane, float threshold)
+{
+  const float* p = &points[0].x;
+  size_t n=0;
+  for(size_t i=0; i<count; i++, p+=3)
+    n += (std::fabs(plane.x*p[0] + plane.y*p[1] + plane.z*p[2] + plane.w)<=threshold)?1:0;
+  return n;
+}
+
+//##################################################################################################
+void markInliers(const glm::vec3* points, size_t count, const glm::vec4& plane, float threshold, uint8_t* inliers)
+{
+  const float* p = &points[0].x;
+  for(size_t i=0; i<count; i++, p+=3)
+    inliers[i] = (std::fabs(plane.x*p[0] + plane.y*p[1] + plane.z*p[2] + plane.w)<=threshold)?1:0;
+}
+
+//##################################################################################################
+struct Detector_lt
+{
+  const std::vector<glm::vec3>& points;
+  const PlaneDetectionParams& params;
+  float threshold;
+  float connectivity;
+
+  VoxelGrid_lt grid;   //!< Cells the size of connectivity, for growing regions.
+  VoxelGrid_lt coarse; //!< Cells the size of the sampling radius, for building hypotheses.
+
+  std::vector<size_t> remaining;         //!< Indexes of the points without a plane.
+  std::vector<glm::vec3> remainingPoints; //!< Packed copies of the remaining points.
+  std::vector<uint8_t> assigned;          //!< Per point, true once the point has a plane.
+  std::vector<uint8_t> inlier;            //!< Per point, true if within threshold of the current plane.
+  std::vector<uint8_t> mask;              //!< Per remaining point, inliers of the current plane.
+  std::vector<uint32_t> visited;          //!< Per point, the search that last visited it.
+  uint32_t search{0};
+
+  //################################################################################################
+  Detector_lt(const std::vector<glm::vec3>& points_,
+              const PlaneDetectionParams& params_,
+              float threshold_,
+              float connectivity_,
+              float samplingRadius):
+    points(points_),
+    params(params_),
+    threshold(threshold_),
+    connectivity(connectivity_),
+    grid(points_, connectivity_),
+    coarse(points_, samplingRadius),
+    remaining(points_.size()),
+    remainingPoints(points_),
+    assigned(points_.size(), 0),
+    inlier(points_.size(), 0),
+    mask(points_.size(), 0),
+    visited(points_.size(), 0)
+  {
+    std::iota(remaining.begin(), remaining.end(), size_t(0));
+  }
+
+  //################################################################################################
+  //! Build a plane from three unassigned points from the same coarse cell.
+  bool hypothesis(uint64_t& state, glm::vec4& plane) const
+  {
+    for(size_t attempt=0; attempt<8; attempt++)
+    {
+      const glm::vec3& a = points[remaining[randomIndex(state, remaining.size())]];
+      auto range = coarse.find(coarse.cellOf(a));
+      size_t count = range.second - range.first;
+      if(count<3)
+        continue;
+
+      const glm::vec3* bc[2]{nullptr, nullptr};
+      for(size_t i=0, tries=0; i<2 && tries<16; tries++)
+      {
+        size_t idx = coarse.order[range.first + randomIndex(state, count)];
+        if(!assigned[idx])
+          bc[i++] = &points[idx];
+      }
+
+      if(!bc[1])
+        continue;
+
+      glm::vec3 ab = *bc[0] - a;
+      glm::vec3 ac = *bc[1] - a;
+      glm::vec3 n = glm::cross(ab, ac);
+      float l2 = glm::length2(n);
+
+      // Reject triples that are close to a line.
+      if(!(l2 > 1e-6f * glm::length2(ab) * glm::length2(ac)) || l2<=0.0f)
+        continue;
+
+      n /= std::sqrt(l2);
+      plane = {n, -glm::dot(n, a)};
+      return true;
+    }
+
+    return false;
+  }
+
+  //################################################################################################
+  //! Update inlier and mask for a plane, only remaining points are updated.
+  void mark(const glm::vec4& plane)
+  {
+    parallelForBlocks(remaining.size(), 65536, [&](size_t begin, size_t end, size_t)
+    {
+      markInliers(remainingPoints.data()+begin, end-begin, plane, threshold, mask.data()+begin);
+      for(size_t i=begin; i<end; i++)
+        inlier[remaining[i]] = mask[i];
+    });
+  }
+
+  //################################################################################################
+  //! Flood fill through inliers that are within connectivity of each other.
+  void grow(std::vector<size_t>& region)
+  {
+    float c2 = connectivity*connectivity;
+    for(size_t r=0; r<region.size(); r++)
+    {
+      const glm::vec3& p = points[region[r]];
+      glm::ivec3 cell = grid.cellOf(p);
+      for(int z=-1; z<=1; z++)
+      {
+        for(int y=-1; y<=1; y++)
+        {
+          for(int x=-1; x<=1; x++)
+          {
+            auto range = grid.find(cell + glm::ivec3(x, y, z));
+            for(size_t i=range.first; i<range.second; i++)
+            {
+              size_t idx = grid.order[i];
+              if(inlier[idx] && visited[idx]!=search && glm::distance2(p, points[idx])<=c2)
+              {
+                visited[idx] = search;
+                region.push_back(idx);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  //################################################################################################
+  //! The largest connected region of the current inliers.
+  std::vector<size_t> largestRegion()
+  {
+    search++;
+    std::vector<size_t> best;
+    std::vector<size_t> region;
+    for(size_t i=0; i<remaining.size(); i++)
+    {
+      size_t idx = remaining[i];
+      if(!mask[i] || visited[idx]==search)
+        continue;
+
+      visited[idx] = search;
+      region.clear();
+      region.push_back(idx);
+      grow(region);
+      if(region.size()>best.size())
+        best.swap(region);
+    }
+    return best;
+  }
+
+  //################################################################################################
+  //! The current inliers that are connected to a previous region.
+  std::vector<size_t> regrow(const std::vector<size_t>& previous)
+  {
+    search++;
+    std::vector<size_t> region;
+    for(size_t idx : previous)
+    {
+      if(inlier[idx] && visited[idx]!=search)
+      {
+        visited[idx] = search;
+        region.push_back(idx);
+      }
+    }
+    grow(region);
+    return region;
+  }
+
+  //################################################################################################
+  //! Fit a plane to a region and grow it again, returns the region with the fitted plane.
+  std::vector<size_t> refine(glm::vec4 plane, Plane& fitted)
+  {
+    std::vector<size_t> region;
+    std::vector<glm::vec3> regionPoints;
+    for(size_t r=0; r<=params.refineIterations; r++)
+    {
+      mark(plane);
+      region = (r==0)?largestRegion():regrow(region);
+      if(region.size()<params.minInliers || region.size()<3)
+        break;
+
+      regionPoints.resize(region.size());
+      for(size_t i=0; i<region.size(); i++)
+        regionPoints[i] = points[region[i]];
+
+      fitted = Plane::planeFromPoints(regionPoints);
+      plane = {fitted.normal(), fitted.d()};
+    }
+    return region;
+  }
+
+  //################################################################################################
+  void remove(const std::vector<size_t>& region)
+  {
+    for(size_t idx : region)
+    {
+      assigned[idx] = 1;
+      inlier[idx] = 0;
+    }
+
+    size_t n=0;
+    for(size_t i=0; i<remaining.size(); i++)
+    {
+      if(!assigned[remaining[i]])
+      {
+        remaining[n] = remaining[i];
+        remainingPoints[n] = remainingPoints[i];
+        n++;
+      }
+    }
+    remaining.resize(n);
+    remainingPoints.resize(n);
+  }
+};
+}
+
+//##################################################################################################
+std::vector<DetectedPlane> detectPlanes(const std::vector<glm::vec3>& points, const PlaneDetectionParams& params)
+{
+  std::vector<DetectedPlane> result;
+
+  float threshold = params.distanceThreshold;
+  float connectivity = (params.connectivity>0.0f)?params.connectivity:(4.0f*threshold);
+  float samplingRadius = (params.samplingRadius>0.0f)?params.samplingRadius:(16.0f*connectivity);
+  size_t minInliers = tpMax(params.minInliers, size_t(3));
+
+  if(points.size()<minInliers || !(threshold>=0.0f) || !(connectivity>0.0f) || params.hypotheses==0)
+    return result;
+
+  Detector_lt detector(points, params, threshold, connectivity, samplingRadius);
+
+  std::vector<glm::vec4> hypotheses(params.hypotheses);
+  std::vector<size_t> scores(params.hypotheses);
+  std::vector<glm::vec3> sample;
+
+  size_t failures=0;
+  for(uint64_t round=0; ; round++)
+  {
+    if(params.maxPlanes && result.size()>=params.maxPlanes)
+      break;
+
+    if(detector.remaining.size()<minInliers || failures>=tpMax(params.maxFailures, size_t(1)))
+      break;
+
+    uint64_t roundState = params.seed + round*0xD1B54A32D192ED03ull;
+    const glm::vec3* scorePoints = detector.remainingPoints.data();
+    size_t scoreCount = detector.remainingPoints.size();
+    if(scoreCount>params.scoreSampleSize && params.scoreSampleSize>0)
+    {
+      sample.resize(params.scoreSampleSize);
+      for(auto& p : sample)
+        p = detector.remainingPoints[randomIndex(roundState, scoreCount)];
+      scorePoints = sample.data();
+      scoreCount = sample.size();
+    }
+
+    parallelFor(hypotheses.size(), [&](size_t h)
+    {
+      uint64_t state = roundState ^ (uint64_t(h+1) * 0x9E3779B97F4A7C15ull);
+      scores[h] = 0;
+      if(detector.hypothesis(state, hypotheses[h]))
+        scores[h] = countInliers(scorePoints, scoreCount, hypotheses[h], threshold);
+    });
+
+    size_t best = size_t(std::max_element(scores.begin(), scores.end()) - scores.begin());
+    if(scores[best]<3)
+    {
+      failures++;
+      continue;
+    }
+
+    DetectedPlane detected;
+    detected.inliers = detector.refine(hypotheses[best], detected.plane);
+    if(detected.inliers.size()<minInliers)
+    {
+      failures++;
+      continue;
+    }
+
+    failures=0;
+    detector.remove(detected.inliers);
+    std::sort(detected.inliers.begin(), detected.inliers.end());
+    result.push_back(std::move(detected));
+  }
+
+  return result;
+}
+
+}
@@ -0,0 +1,634 @@
+#include "tp_math_utils/Primitives.h"
+#include "tp_math_utils/ParallelFor.h"
+
+#include "glm/gtc/constants.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+//! How the verts of a template are evaluated for the size of a primitive.
+enum class VertKind_lt : uint8_t
+{
+  Side,       //!< a = {cos, sin, t}
+  BottomCap,  //!< a = {x, y} on the unit disc.
+  TopCap,     //!< a = {x, y} on the unit disc.
+  BottomDome, //!< a = {cos, sin, cos(lat), sin(lat)}, texture.y is the arc length from the pole.
+  Body,       //!< a = {cos, sin, t}
+  TopDome,    //!< a = {cos, sin, cos(lat), sin(lat)}, texture.y is the arc length from the equator.
+  Torus,      //!< a = {cos, sin, cos(tube), sin(tube)}
+  Box         //!< a = {x, y, z} on the unit box.
+};
+
+//##################################################################################################
+struct TemplateVert_lt
+{
+  glm::vec4 a{0.0f, 0.0f, 0.0f, 0.0f};
+  glm::vec3 normal{0.0f, 0.0f, 1.0f}; //!< Only used by caps and boxes.
+  glm::vec2 texture{0.0f, 0.0f};
+  VertKind_lt kind{VertKind_lt::Side};
+};
+
+//##################################################################################################
+//! A range of verts along with the parts that use them, cone caps are left out if they have no area.
+struct TemplateGroup_lt
+{
+  int cap{0}; //!< 0 always used, 1 only used if r0>0, 2 only used if r1>0.
+  size_t vertBegin{0};
+  size_t vertEnd{0};
+  Indexes3DList parts;         //!< Uses TP_TRIANGLE_* and indexes relative to vertBegin.
+  std::vector<int> triangles; //!< The same triangles as a list without the triangles at poles.
+};
+
+//##################################################################################################
+struct Template_lt
+{
+  std::vector<TemplateVert_lt> verts;
+  std::vector<TemplateGroup_lt> groups;
+};
+
+//##################################################################################################
+TemplateGroup_lt& beginGroup(Template_lt& t, int cap)
+{
+  auto& group = t.groups.emplace_back();
+  group.cap = cap;
+  group.vertBegin = t.verts.size();
+  return group;
+}
+
+//##################################################################################################
+//! Add a strip for each row of a grid of verts that has already been added to the group.
+void addGrid(Template_lt& t, TemplateGroup_lt& group, size_t columns, bool firstRowPole, bool lastRowPole)
+{
+  group.vertEnd = t.verts.size();
+  size_t rows = (group.vertEnd - group.vertBegin) / columns;
+
+  for(size_t r=0; r+1<rows; r++)
+  {
+    auto& part = group.parts.emplace_back();
+    part.type = TP_TRIANGLE_STRIP;
+    part.indexes.reserve(columns*2);
+
+    int lower = int(r*columns);
+    int upper = int((r+1)*columns);
+    for(size_t c=0; c<columns; c++)
+    {
+      part.indexes.push_back(upper+int(c));
+      part.indexes.push_back(lower+int(c));
+    }
+
+    bool skipUpper = lastRowPole && (r+2)==rows;
+    bool skipLower = firstRowPole && r==0;
+    for(size_t c=0; c+1<columns; c++)
+    {
+      int tl = upper+int(c);
+      int bl = lower+int(c);
+      if(!skipUpper)
+        group.triangles.insert(group.triangles.end(), {tl, bl, tl+1});
+      if(!skipLower)
+        group.triangles.insert(group.triangles.end(), {bl, bl+1, tl+1});
+    }
+  }
+}
+
+//##################################################################################################
+//! Add a disc cap as a fan around a center vert.
+void addCap(Template_lt& t, size_t segments, const std::vector<glm::vec2>& circle, bool top)
+{
+  auto& group = beginGroup(t, top?2:1);
+  VertKind_lt kind = top?VertKind_lt::TopCap:VertKind_lt::BottomCap;
+  glm::vec3 normal{0.0f, 0.0f, top?1.0f:-1.0f};
+  float flip = top?0.5f:-0.5f;
+
+  t.verts.push_back({{0.0f, 0.0f, 0.0f, 0.0f}, normal, {0.5f, 0.5f}, kind});
+  for(size_t c=0; c<segments; c++)
+  {
+    const auto& cs = circle[c];
+    t.verts.push_back({{cs.x, cs.y, 0.0f, 0.0f}, normal, {0.5f+0.5f*cs.x, 0.5f+flip*cs.y}, kind});
+  }
+  group.vertEnd = t.verts.size();
+
+  // Seen from outside the bottom cap goes around clockwise when viewed from above.
+  auto& part = group.parts.emplace_back();
+  part.type = TP_TRIANGLE_FAN;
+  part.indexes.reserve(segments+2);
+  part.indexes.push_back(0);
+  for(size_t c=0; c<=segments; c++)
+  {
+    size_t i = c%segments;
+    part.indexes.push_back(1+int(top?i:(segments-i)%segments));
+  }
+
+  for(size_t v=1; v+1<part.indexes.size(); v++)
+    group.triangles.insert(group.triangles.end(), {0, part.indexes[v], part.indexes[v+1]});
+}
+
+//##################################################################################################
+//! cos and sin around a circle, the last value repeats the first exactly to close seams.
+std::vector<glm::vec2> circle(size_t segments)
+{
+  std::vector<glm::vec2> result(segments+1);
+  for(size_t c=0; c<segments; c++)
+  {
+    double a = glm::two_pi<double>() * double(c) / double(segments);
+    result[c] = {float(std::cos(a)), float(std::sin(a))};
+  }
+  result[segments] = result[0];
+  return result;
+}
+
+//##################################################################################################
+Template_lt coneTemplate(size_t segments, size_t stacks)
+{
+  Template_lt t;
+  auto cs = circle(segments);
+
+  auto& side = beginGroup(t, 0);
+  for(size_t r=0; r<=stacks; r++)
+  {
+    float v = float(r) / float(stacks);
+    for(size_t c=0; c<=segments; c++)
+      t.verts.push_back({{cs[c].x, cs[c].y, v, 0.0f}, {}, {float(c)/float(segments), v}, VertKind_lt::Side});
+  }
+  addGrid(t, side, segments+1, false, false);
+
+  addCap(t, segments, cs, false);
+  addCap(t, segments, cs, true);
+  return t;
+}
+
+//##################################################################################################
+Template_lt capsuleTemplate(size_t segments, size_t stacks, size_t rings)
+{
+  Template_lt t;
+  auto cs = circle(segments);
+  float halfPi = glm::half_pi<float>();
+
+  auto addRow = [&](VertKind_lt kind, float p, float q, float arc)
+  {
+    for(size_t c=0; c<=segments; c++)
+      t.verts.push_back({{cs[c].x, cs[c].y, p, q}, {}, {float(c)/float(segments), arc}, kind});
+  };
+
+  auto latitude = [&](size_t i)
+  {
+    // Set the ends exactly so the pole and equator rows line up with the body.
+    double a = glm::half_pi<double>() * double(i) / double(rings);
+    return glm::vec2(i==rings?0.0f:float(std::cos(a)), i==0?0.0f:float(std::sin(a)));
+  };
+
+  auto& group = beginGroup(t, 0);
+
+  // From the bottom pole to the equator.
+  for(size_t i=0; i<=rings; i++)
+  {
+    auto l = latitude(rings-i);
+    addRow(VertKind_lt::BottomDome, l.x, -l.y, halfPi*float(i)/float(rings));
+  }
+
+  for(size_t j=1; j<stacks; j++)
+  {
+    float v = float(j) / float(stacks);
+    addRow(VertKind_lt::Body, v, 0.0f, v);
+  }
+
+  // From the equator to the top pole.
+  for(size_t i=0; i<=rings; i++)
+  {
+    auto l = latitude(i);
+    addRow(VertKind_lt::TopDome, l.x, l.y, halfPi*float(i)/float(rings));
+  }
+
+  addGrid(t, group, segments+1, true, true);
+  return t;
+}
+
+//##################################################################################################
+Template_lt torusTemplate(size_t segments, size_t sides)
+{
+  Template_lt t;
+  auto cs = circle(segments);
+  auto tube = circle(sides);
+
+  auto& group = beginGroup(t, 0);
+  for(size_t r=0; r<=sides; r++)
+  {
+    float v = float(r) / float(sides);
+    for(size_t c=0; c<=segments; c++)
+      t.verts.push_back({{cs[c].x, cs[c].y, tube[r].x, tube[r].y}, {}, {float(c)/float(segments), v}, VertKind_lt::Torus});
+  }
+  addGrid(t, group, segments+1, false, false);
+  return t;
+}
+
+//##################################################################################################
+Template_lt boxTemplate()
+{
+  Template_lt t;
+
+  // The normal and two axes across each face, u x v = normal.
+  const glm::vec3 faces[6][3] =
+  {
+    {{ 1, 0, 0}, { 0, 1, 0}, {0, 0, 1}},
+    {{-1, 0, 0}, { 0,-1, 0}, {0, 0, 1}},
+    {{ 0, 1, 0}, {-1, 0, 0}, {0, 0, 1}},
+    {{ 0,-1, 0}, { 1, 0, 0}, {0, 0, 1}},
+    {{ 0, 0, 1}, { 1, 0, 0}, {0, 1, 0}},
+    {{ 0, 0,-1}, { 1, 0, 0}, {0,-1, 0}}
+  };
+
+  for(const auto& face : faces)
+  {
+    auto& group = beginGroup(t, 0);
+    for(float v=0.0f; v<1.5f; v+=1.0f)
+    {
+      for(float u=0.0f; u<1.5f; u+=1.0f)
+      {
+        glm::vec3 p = 0.5f*face[0] + (u-0.5f)*face[1] + (v-0.5f)*face[2];
+        t.verts.push_back({{p, 0.0f}, face[0], {u, v}, VertKind_lt::Box});
+      }
+    }
+    addGrid(t, group, 2, false, false);
+  }
+
+  return t;
+}
+
+//##################################################################################################
+typedef std::tuple<PrimitiveType, size_t, size_t, size_t> TemplateKey_lt;
+
+//##################################################################################################
+//! Cylinders use the cone template and sizes are converted with primitiveSize().
+TemplateKey_lt templateKey(PrimitiveType type, const PrimitiveTessellation& tessellation)
+{
+  size_t segments = tpMax(tessellation.segments, size_t(3));
+  size_t stacks = tpMax(tessellation.stacks, size_t(1));
+  switch(type)
+  {
+    case PrimitiveType::Cone:
+    case PrimitiveType::Cylinder:
+    return {PrimitiveType::Cone, segments, stacks, 0};
+
+    case PrimitiveType::Capsule:
+    return {PrimitiveType::Capsule, segments, stacks, tpMax(tessellation.rings, size_t(1))};
+
+    case PrimitiveType::Box:
+    return {PrimitiveType::Box, 0, 0, 0};
+
+    case PrimitiveType::Torus:
+    return {PrimitiveType::Torus, segments, tpMax(tessellation.sides, size_t(3)), 0};
+  }
+
+  return {PrimitiveType::Box, 0, 0, 0};
+}
+
+//##################################################################################################
+std::shared_ptr<const Template_lt> primitiveTemplate(PrimitiveType type, const PrimitiveTessellation& tessellation)
+{
+  static std::mutex mutex;
+  static std::map<TemplateKey_lt, std::shared_ptr<const Template_lt>> cache;
+
+  TemplateKey_lt key = templateKey(type, tessellation);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(auto i = cache.find(key); i!=cache.end())
+      return i->second;
+  }
+
+  // Generate without holding the lock, if two threads race the first result is kept.
+  auto [t, a, b, c] = key;
+  std::shared_ptr<const Template_lt> result;
+  switch(t)
+  {
+    case PrimitiveType::Cone:
+    case PrimitiveType::Cylinder: result = std::make_shared<const Template_lt>(coneTemplate(a, b));       break;
+    case PrimitiveType::Capsule:  result = std::make_shared<const Template_lt>(capsuleTemplate(a, b, c)); break;
+    case PrimitiveType::Box:      result = std::make_shared<const Template_lt>(boxTemplate());            break;
+    case PrimitiveType::Torus:    result = std::make_shared<const Template_lt>(torusTemplate(a, b));      break;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return cache.emplace(key, result).first->second;
+}
+
+//##################################################################################################
+//! Cylinders are evaluated as cones and negative sizes are clamped.
+glm::vec3 primitiveSize(const PrimitiveInstance& instance)
+{
+  glm::vec3 s = glm::max(instance.size, glm::vec3(0.0f));
+  if(instance.type == PrimitiveType::Cylinder)
+    s.y = s.x;
+  return s;
+}
+
+//##################################################################################################
+bool groupUsed(const TemplateGroup_lt& group, const glm::vec3& size)
+{
+  return group.cap==0 || (group.cap==1 && size.x>0.0f) || (group.cap==2 && size.y>0.0f);
+}
+
+//##################################################################################################
+Vertex3D evaluate(const TemplateVert_lt& t, const glm::vec3& size)
+{
+  Vertex3D v;
+  v.texture = t.texture;
+  const auto& a = t.a;
+  switch(t.kind)
+  {
+    case VertKind_lt::Side:
+    {
+      float r = size.x + (size.y-size.x)*a.z;
+      v.vert = {a.x*r, a.y*r, a.z*size.z};
+      glm::vec3 n{a.x*size.z, a.y*size.z, size.x-size.y};
+      float l = glm::length(n);
+      v.normal = (l>0.0f)?(n/l):glm::vec3(a.x, a.y, 0.0f);
+      break;
+    }
+
+    case VertKind_lt::BottomCap:
+    v.vert = {a.x*size.x, a.y*size.x, 0.0f};
+    v.normal = t.normal;
+    break;
+
+    case VertKind_lt::TopCap:
+    v.vert = {a.x*size.y, a.y*size.y, size.z};
+    v.normal = t.normal;
+    break;
+
+    case VertKind_lt::BottomDome:
+    case VertKind_lt::Body:
+    case VertKind_lt::TopDome:
+    {
+      // v runs along the profile from pole to pole in proportion to its length.
+      float r = size.x;
+      float length = size.z;
+      float quarter = glm::half_pi<float>()*r;
+      float total = 2.0f*quarter + length;
+      float s = 0.0f;
+      if(t.kind == VertKind_lt::Body)
+      {
+        v.vert = {a.x*r, a.y*r, a.z*length};
+        v.normal = {a.x, a.y, 0.0f};
+        s = quarter + a.z*length;
+      }
+      else
+      {
+        float z = (t.kind == VertKind_lt::TopDome)?length:0.0f;
+        v.normal = {a.x*a.z, a.y*a.z, a.w};
+        v.vert = {v.normal.x*r, v.normal.y*r, z + a.w*r};
+        s = t.texture.y*r + ((t.kind == VertKind_lt::TopDome)?(quarter+length):0.0f);
+      }
+      v.texture.y = (total>0.0f)?(s/total):0.0f;
+      break;
+    }
+
+    case VertKind_lt::Torus:
+    {
+      float ring = size.x + size.y*a.z;
+      v.vert = {a.x*ring, a.y*ring, size.y*a.w};
+      v.normal = {a.x*a.z, a.y*a.z, a.w};
+      break;
+    }
+
+    case VertKind_lt::Box:
+    v.vert = glm::vec3(a)*size;
+    v.normal = t.normal;
+    break;
+  }
+  return v;
+}
+
+//##################################################################################################
+//! Positions with the transform and normals with its inverse transpose.
+struct Transform_lt
+{
+  glm::mat4 m;
+  glm::mat3 n;
+  bool identity;
+
+  Transform_lt(const glm::mat4& m_):
+    m(m_),
+    n(normalMatrix(glm::mat3(m_))),
+    identity(m_ == glm::mat4(1.0f))
+  {
+  }
+
+  static glm::mat3 normalMatrix(const glm::mat3& r)
+  {
+    // Flattened primitives keep their normals rather than getting NaNs.
+    return (std::fabs(glm::determinant(r))>0.0f)?glm::transpose(glm::inverse(r)):r;
+  }
+
+  void apply(Vertex3D& v) const
+  {
+    if(identity)
+      return;
+
+    v.vert = glm::vec3(m * glm::vec4(v.vert, 1.0f));
+    glm::vec3 normal = n * v.normal;
+    float l = glm::length(normal);
+    if(l>0.0f)
+      v.normal = normal / l;
+  }
+};
+}
+
+//##################################################################################################
+Geometry3D Primitives::generate(const PrimitiveInstance& instance,
+                                const PrimitiveTessellation& tessellation,
+                                int triangleFan,
+                                int triangleStrip,
+                                int triangles)
+{
+  Geometry3D geometry;
+  geometry.triangleFan   = triangleFan;
+  geometry.triangleStrip = triangleStrip;
+  geometry.triangles     = triangles;
+
+  auto t = primitiveTemplate(instance.type, tessellation);
+  glm::vec3 size = primitiveSize(instance);
+  Transform_lt transform(instance.transform);
+
+  for(const auto& group : t->groups)
+  {
+    if(!groupUsed(group, size))
+      continue;
+
+    int offset = int(geometry.verts.size());
+    for(size_t i=group.vertBegin; i<group.vertEnd; i++)
+    {
+      auto& v = geometry.verts.emplace_back(evaluate(t->verts[i], size));
+      transform.apply(v);
+    }
+
+    for(const auto& part : group.parts)
+    {
+      auto& p = geometry.indexes.emplace_back();
+      p.type = (part.type==TP_TRIANGLE_FAN)?triangleFan:triangleStrip;
+      p.indexes.reserve(part.indexes.size());
+      for(int i : part.indexes)
+        p.indexes.push_back(i+offset);
+    }
+  }
+
+  geometry.validate();
+  return geometry;
+}
+
+//##################################################################################################
+Geometry3D Primitives::batch(const std::vector<PrimitiveInstance>& instances,
+                             const PrimitiveTessellation& tessellation,
+                             int triangleFan,
+                             int triangleStrip,
+                             int triangles)
+{
+  Geometry3D geometry;
+  geometry.triangleFan   = triangleFan;
+  geometry.triangleStrip = triangleStrip;
+  geometry.triangles     = triangles;
+
+  // Fetch the templates up front, the cache is locked for each lookup.
+  std::map<TemplateKey_lt, std::shared_ptr<const Template_lt>> templates;
+  std::vector<const Template_lt*> instanceTemplates(instances.size());
+  std::vector<size_t> vertOffsets(instances.size()+1, 0);
+  std::vector<size_t> indexOffsets(instances.size()+1, 0);
+  for(size_t i=0; i<instances.size(); i++)
+  {
+    const auto& instance = instances[i];
+    auto& t = templates[templateKey(instance.type, tessellation)];
+    if(!t)
+      t = primitiveTemplate(instance.type, tessellation);
+    instanceTemplates[i] = t.get();
+
+    glm::vec3 size = primitiveSize(instance);
+    size_t verts=0;
+    size_t indexes=0;
+    for(const auto& group : t->groups)
+    {
+      if(groupUsed(group, size))
+      {
+        verts += group.vertEnd - group.vertBegin;
+        indexes += group.triangles.size();
+      }
+    }
+    vertOffsets[i+1] = vertOffsets[i] + verts;
+    indexOffsets[i+1] = indexOffsets[i] + indexes;
+  }
+
+  geometry.verts.resize(vertOffsets.back());
+  auto& part = geometry.indexes.emplace_back();
+  part.type = triangles;
+  part.indexes.resize(indexOffsets.back());
+
+  parallelForBlocks(instances.size(), 16, [&](size_t begin, size_t end, size_t)
+  {
+    for(size_t i=begin; i<end; i++)
+    {
+      const auto& instance = instances[i];
+      const auto& t = *instanceTemplates[i];
+      glm::vec3 size = primitiveSize(instance);
+      Transform_lt transform(instance.transform);
+
+      Vertex3D* v = geometry.verts.data() + vertOffsets[i];
+      int* ii = part.indexes.data() + indexOffsets[i];
+      int offset = int(vertOffsets[i]);
+
+      for(const auto& group : t.groups)
+      {
+        if(!groupUsed(group, size))
+          continue;
+
+        for(size_t j=group.vertBegin; j<group.vertEnd; j++, v++)
+        {
+          *v = evaluate(t.verts[j], size);
+          transform.apply(*v);
+        }
+
+        for(int index : group.triangles)
+          *(ii++) = index + offset;
+
+        offset += int(group.vertEnd - group.vertBegin);
+      }
+    }
+  });
+
+  geometry.validate();
+  return geometry;
+}
+
+//##################################################################################################
+PrimitiveInstance Primitives::coneInstance(const Cone& cone)
+{
+  glm::vec3 axis = cone.p1 - cone.p0;
+  float length = glm::length(axis);
+  glm::vec3 z = (length>0.0f)?(axis/length):glm::vec3(0.0f, 0.0f, 1.0f);
+  glm::vec3 x = glm::normalize(glm::cross((std::fabs(z.x)<0.9f)?glm::vec3(1.0f, 0.0f, 0.0f):glm::vec3(0.0f, 1.0f, 0.0f), z));
+  glm::vec3 y = glm::cross(z, x);
+
+  PrimitiveInstance instance;
+  instance.type = PrimitiveType::Cone;
+  instance.size = {cone.r0, cone.r1, length};
+  instance.transform = glm::mat4(glm::vec4(x, 0.0f), glm::vec4(y, 0.0f), glm::vec4(z, 0.0f), glm::vec4(cone.p0, 1.0f));
+  return instance;
+}
+
+//##################################################################################################
+Geometry3D Primitives::cone(const Cone& cone,
+                            const PrimitiveTessellation& tessellation,
+                            int triangleFan,
+                            int triangleStrip,
+                            int triangles)
+{
+  return generate(coneInstance(cone), tessellation, triangleFan, triangleStrip, triangles);
+}
+
+//##################################################################################################
+Geometry3D Primitives::cylinder(float radius,
+                                float length,
+                                const PrimitiveTessellation& tessellation,
+                                int triangleFan,
+                                int triangleStrip,
+                                int triangles)
+{
+  return generate({PrimitiveType::Cylinder, {radius, radius, length}, glm::mat4(1.0f)}, tessellation, triangleFan, triangleStrip, triangles);
+}
+
+//##################################################################################################
+Geometry3D Primitives::capsule(float radius,
+                               float length,
+                               const PrimitiveTessellation& tessellation,
+                               int triangleFan,
+                               int triangleStrip,
+                               int triangles)
+{
+  return generate({PrimitiveType::Capsule, {radius, radius, length}, glm::mat4(1.0f)}, tessellation, triangleFan, triangleStrip, triangles);
+}
+
+//##################################################################################################
+Geometry3D Primitives::box(const glm::vec3& size,
+                           int triangleFan,
+                           int triangleStrip,
+                           int triangles)
+{
+  return generate({PrimitiveType::Box, size, glm::mat4(1.0f)}, PrimitiveTessellation(), triangleFan, triangleStrip, triangles);
+}
+
+//##################################################################################################
+Geometry3D Primitives::torus(float majorRadius,
+                             float minorRadius,
+                             const PrimitiveTessellation& tessellation,
+                             int triangleFan,
+                             int triangleStrip,
+                             int triangles)
+{
+  return generate({PrimitiveType::Torus, {majorRadius, minorRadius, 0.0f}, glm::mat4(1.0f)}, tessellation, triangleFan, triangleStrip, triangles);
+}
+
+}
@@ -0,0 +1,116 @@
+#include "tp_math_utils/ScratchArena.h"
+
+namespace tp_math_utils
+{
+
+//##################################################################################################
+ScratchArena::ScratchArena(size_t initialSize, size_t maxSize):
+  m_initialSize(tpMax(initialSize, size_t(64))),
+  m_maxSize(tpMax(maxSize, m_initialSize)),
+  m_buffer(m_initialSize)
+{
+  m_resource.emplace(m_buffer.data(), m_buffer.size(), &m_upstream);
+}
+
+//##################################################################################################
+ScratchArena::~ScratchArena()
+{
+  m_resource.reset();
+}
+
+//##################################################################################################
+std::pmr::memory_resource* ScratchArena::resource()
+{
+  return &(*m_resource);
+}
+
+//##################################################################################################
+void ScratchArena::reset()
+{
+  size_t overflow = m_upstream.allocated;
+
+  // Destroying the resource releases the overflow, the address of the resource stays the same.
+  m_resource.reset();
+  m_upstream.allocated = 0;
+
+  size_t size = tpMin(m_buffer.size() + overflow, m_maxSize);
+  if(size>m_buffer.size())
+    m_buffer = std::vector<std::byte>(size);
+
+  m_resource.emplace(m_buffer.data(), m_buffer.size(), &m_upstream);
+}
+
+//##################################################################################################
+void ScratchArena::release()
+{
+  m_resource.reset();
+  m_upstream.allocated = 0;
+
+  if(m_buffer.size()!=m_initialSize)
+    m_buffer = std::vector<std::byte>(m_initialSize);
+
+  m_resource.emplace(m_buffer.data(), m_buffer.size(), &m_upstream);
+}
+
+//##################################################################################################
+size_t ScratchArena::capacity() const
+{
+  return m_buffer.size();
+}
+
+//##################################################################################################
+size_t ScratchArena::overflow() const
+{
+  return m_upstream.allocated;
+}
+
+//##################################################################################################
+ScratchArena& ScratchArena::threadLocal()
+{
+  thread_local ScratchArena arena;
+  return arena;
+}
+
+namespace
+{
+//##################################################################################################
+size_t& threadLocalScopeDepth()
+{
+  thread_local size_t depth{0};
+  return depth;
+}
+}
+
+//##################################################################################################
+ScratchArena::ThreadLocalScope::ThreadLocalScope()
+{
+  threadLocalScopeDepth()++;
+}
+
+//##################################################################################################
+ScratchArena::ThreadLocalScope::~ThreadLocalScope()
+{
+  if(--threadLocalScopeDepth() == 0)
+    threadLocal().release();
+}
+
+//##################################################################################################
+void* ScratchArena::Upstream::do_allocate(size_t bytes, size_t alignment)
+{
+  allocated += bytes;
+  return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+//##################################################################################################
+void ScratchArena::Upstream::do_deallocate(void* p, size_t bytes, size_t alignment)
+{
+  std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+//##################################################################################################
+bool ScratchArena::Upstream::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+  return this == &other;
+}
+
+}
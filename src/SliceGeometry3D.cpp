@@ -0,0 +1,280 @@
+#include "tp_math_utils/SliceGeometry3D.h"
+#include "tp_math_utils/Plane.h"
+#include "tp_math_utils/ParallelFor.h"
+#include "tp_math_utils/HashUtils.h"
+
+#include <array>
+#include <numeric>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+struct Segment_lt
+{
+  uint64_t keys[2];    //!< The edges or verts that the ends of the segment lie on.
+  glm::vec3 points[2];
+};
+
+//##################################################################################################
+//! Edges are keyed by both of their verts, a crossing that lies on vert a is keyed edgeKey(a, a).
+uint64_t edgeKey(int a, int b)
+{
+  return (a<b)?((uint64_t(a)<<32) | uint64_t(uint32_t(b))):((uint64_t(b)<<32) | uint64_t(uint32_t(a)));
+}
+
+//##################################################################################################
+//! Map each vert to the first vert with exactly the same position.
+/*!
+This joins up meshes with duplicated verts at UV and normal seams, or with no shared verts at all
+like the output of calculateFaceNormals(). Positions are compared by their bits so that the order is
+well defined even for non-finite values.
+*/
+std::vector<int> positionIds(const Geometry3D& geometry)
+{
+  const auto& verts = geometry.verts;
+  auto key = [&](int i)
+  {
+    const glm::vec3& v = verts[size_t(i)].vert;
+    return std::array<uint32_t, 3>{floatBits(v.x), floatBits(v.y), floatBits(v.z)};
+  };
+
+  std::vector<int> order(verts.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b){return key(a) < key(b);});
+
+  std::vector<int> ids(verts.size());
+  for(size_t i=0; i<order.size(); i++)
+  {
+    size_t v = size_t(order[i]);
+    ids[v] = (i>0 && key(order[i]) == key(order[i-1]))?ids[size_t(order[i-1])]:int(v);
+  }
+
+  return ids;
+}
+
+//##################################################################################################
+std::vector<Polyline3D> linkSegments(const std::vector<Segment_lt>& segments)
+{
+  std::vector<Polyline3D> polylines;
+
+  // Sorted (key, segment end) pairs give the segments that meet at each edge point.
+  std::vector<std::pair<uint64_t, size_t>> ends;
+  ends.reserve(segments.size()*2);
+  for(size_t s=0; s<segments.size(); s++)
+  {
+    ends.emplace_back(segments[s].keys[0], s*2);
+    ends.emplace_back(segments[s].keys[1], s*2+1);
+  }
+  std::sort(ends.begin(), ends.end());
+
+  auto range = [&](uint64_t key)
+  {
+    auto begin = std::lower_bound(ends.begin(), ends.end(), std::pair<uint64_t, size_t>(key, 0));
+    auto end = begin;
+    while(end!=ends.end() && end->first==key)
+      ++end;
+    return std::make_pair(begin, end);
+  };
+
+  std::vector<bool> visited(segments.size(), false);
+
+  // Follow segments from the end e of segment s until we hit a dead end or get back to the start.
+  auto walk = [&](size_t s, size_t e, Polyline3D& polyline)
+  {
+    const size_t start = s;
+    polyline.points.push_back(segments[s].points[1-e]);
+    for(;;)
+    {
+      visited[s] = true;
+      polyline.points.push_back(segments[s].points[e]);
+
+      auto r = range(segments[s].keys[e]);
+      if((r.second-r.first)!=2)
+        return;
+
+      size_t next = (r.first->second/2 == s)?(r.first+1)->second:r.first->second;
+      if(next/2 == start)
+      {
+        polyline.closed = true;
+        polyline.points.pop_back();
+        return;
+      }
+
+      if(visited[next/2])
+        return;
+
+      s = next/2;
+      e = 1-(next&1);
+    }
+  };
+
+  // Open polylines start at points that are not shared by exactly 2 segments.
+  for(size_t s=0; s<segments.size(); s++)
+  {
+    for(size_t e=0; e<2 && !visited[s]; e++)
+    {
+      auto r = range(segments[s].keys[e]);
+      if((r.second-r.first)!=2)
+        walk(s, 1-e, polylines.emplace_back());
+    }
+  }
+
+  // Everything left is part of a closed loop.
+  for(size_t s=0; s<segments.size(); s++)
+    if(!visited[s])
+      walk(s, 1, polylines.emplace_back());
+
+  // Remove any zero length steps.
+  for(auto& polyline : polylines)
+  {
+    auto& points = polyline.points;
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    if(polyline.closed && points.size()>1 && points.front() == points.back())
+      points.pop_back();
+  }
+
+  return polylines;
+}
+}
+
+//##################################################################################################
+std::vector<Polyline3D> sliceGeometry3D(const Geometry3D& geometry, const Plane& plane)
+{
+  return sliceGeometry3D(geometry, plane, {0.0f}).front();
+}
+
+//##################################################################################################
+std::vector<std::vector<Polyline3D>> sliceGeometry3D(const Geometry3D& geometry,
+                                                     const Plane& plane,
+                                                     const std::vector<float>& offsets)
+{
+  std::vector<std::vector<Polyline3D>> results(offsets.size());
+  if(offsets.empty() || geometry.verts.empty())
+    return results;
+
+  //-- Distance of each vert along the normal ------------------------------------------------------
+  std::vector<float> heights(geometry.verts.size());
+  plane.signedDistances(&geometry.verts.front().vert, heights.size(), sizeof(Vertex3D), heights.data());
+
+  // Faces index the first vert at each position so that triangles that touch link up.
+  std::vector<std::array<int, 3>> faces;
+  {
+    std::vector<int> ids = positionIds(geometry);
+    const int nVerts = int(geometry.verts.size());
+    const bool validated = geometry.validated();
+    geometry.forEachTriangleIndexes([&](int i0, int i1, int i2)
+    {
+      if(validated || (i0>=0 && i1>=0 && i2>=0 && i0<nVerts && i1<nVerts && i2<nVerts))
+        faces.push_back({ids[size_t(i0)], ids[size_t(i1)], ids[size_t(i2)]});
+    });
+  }
+
+  //-- Assign each face to the slices that it spans ------------------------------------------------
+  std::vector<size_t> sortedSlices(offsets.size());
+  std::iota(sortedSlices.begin(), sortedSlices.end(), 0);
+  std::sort(sortedSlices.begin(), sortedSlices.end(), [&](size_t a, size_t b){return offsets[a]<offsets[b];});
+
+  std::vector<float> sortedOffsets(offsets.size());
+  for(size_t i=0; i<sortedSlices.size(); i++)
+    sortedOffsets[i] = offsets[sortedSlices[i]];
+
+  // The range of sorted slices that each face spans.
+  std::vector<std::pair<size_t, size_t>> faceSpans(faces.size());
+  std::vector<size_t> sliceFaceCount(offsets.size()+1, 0);
+  for(size_t f=0; f<faces.size(); f++)
+  {
+    const auto& face = faces[f];
+    float h0 = heights[size_t(face[0])];
+    float h1 = heights[size_t(face[1])];
+    float h2 = heights[size_t(face[2])];
+    float hMin = tpMin(tpMin(h0, h1), h2);
+    float hMax = tpMax(tpMax(h0, h1), h2);
+
+    // A face crosses a slice if it has verts on both sides, on the plane counts as positive.
+    auto begin = size_t(std::upper_bound(sortedOffsets.begin(), sortedOffsets.end(), hMin) - sortedOffsets.begin());
+    auto end   = size_t(std::upper_bound(sortedOffsets.begin(), sortedOffsets.end(), hMax) - sortedOffsets.begin());
+    faceSpans[f] = {begin, end};
+    for(size_t s=begin; s<end; s++)
+      sliceFaceCount[s+1]++;
+  }
+
+  std::partial_sum(sliceFaceCount.begin(), sliceFaceCount.end(), sliceFaceCount.begin());
+  std::vector<size_t> sliceFaces(sliceFaceCount.back());
+  {
+    std::vector<size_t> insert(sliceFaceCount.begin(), sliceFaceCount.end()-1);
+    for(size_t f=0; f<faces.size(); f++)
+      for(size_t s=faceSpans[f].first; s<faceSpans[f].second; s++)
+        sliceFaces[insert[s]++] = f;
+  }
+
+  //-- Cut each slice ------------------------------------------------------------------------------
+  parallelFor(sortedSlices.size(), [&](size_t s)
+  {
+    const float offset = sortedOffsets[s];
+
+    // Calculate the point where an edge crosses the plane, ordering by index makes sure that both
+    // triangles that share an edge get exactly the same point. If the vert above the plane lies on
+    // it the crossing is that vert, so that all of the triangles around it share the same key.
+    auto crossing = [&](int below, int above, Segment_lt& segment, size_t e)
+    {
+      if(heights[size_t(above)] - offset == 0.0f)
+      {
+        segment.keys[e] = edgeKey(above, above);
+        segment.points[e] = geometry.verts[size_t(above)].vert;
+        return;
+      }
+
+      int a = tpMin(below, above);
+      int b = tpMax(below, above);
+      float ha = heights[size_t(a)] - offset;
+      float hb = heights[size_t(b)] - offset;
+      float t = ha / (ha-hb);
+      const glm::vec3& pa = geometry.verts[size_t(a)].vert;
+      const glm::vec3& pb = geometry.verts[size_t(b)].vert;
+      segment.keys[e] = edgeKey(a, b);
+      segment.points[e] = pa + (pb-pa)*t;
+    };
+
+    std::vector<Segment_lt> segments;
+    segments.reserve(sliceFaceCount[s+1]-sliceFaceCount[s]);
+    for(size_t i=sliceFaceCount[s]; i<sliceFaceCount[s+1]; i++)
+    {
+      const auto& face = faces[sliceFaces[i]];
+
+      bool above[3];
+      for(size_t c=0; c<3; c++)
+        above[c] = (heights[size_t(face[c])] - offset) >= 0.0f;
+
+      // Walk the edges in winding order, the segment goes from the edge where the surface goes
+      // down through the plane to the edge where it comes back up.
+      Segment_lt& segment = segments.emplace_back();
+      size_t crossings=0;
+      for(size_t c=0; c<3; c++)
+      {
+        size_t n = (c+1)%3;
+        if(above[c] == above[n])
+          continue;
+
+        if(above[c])
+          crossing(face[n], face[c], segment, 0);
+        else
+          crossing(face[c], face[n], segment, 1);
+        crossings++;
+      }
+
+      // Only happens with non-finite positions. Triangles that touch the plane at a single vert
+      // give a segment that starts and ends on that vert, these are dropped.
+      if(crossings!=2 || segment.keys[0] == segment.keys[1])
+        segments.pop_back();
+    }
+
+    results[sortedSlices[s]] = linkSegments(segments);
+  });
+
+  return results;
+}
+
+}
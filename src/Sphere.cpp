@@ -2,19 +2,88 @@
 
 #include "glm/gtx/compatibility.hpp"
 
+#include <array>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
 namespace tp_math_utils
 {
 
+namespace
+{
 //##################################################################################################
-//Geometry3D Sphere::icosahedralClass1(float radius,
-//                                     size_t division,
-//                                     int triangleFan,
-//                                     int triangleStrip,
-//                                     int triangles)
-//{
-//  std::vector<glm::vec3> verts;
-//  return indexAndScale(radius, triangleFan, triangleStrip, triangles, verts);
-//}
+struct Polyhedron_lt
+{
+  std::vector<glm::vec3> corners;
+  std::vector<std::array<int, 3>> faces; //!< Wound counter clockwise when viewed from outside.
+};
+
+//##################################################################################################
+Polyhedron_lt polyhedron(SphereType type)
+{
+  Polyhedron_lt p;
+  switch(type)
+  {
+    case SphereType::Tetrahedral:
+    p.corners = {{-1,-1,-1}, { 1,-1, 1}, {-1, 1, 1}, { 1, 1,-1}};
+    p.faces = {{0, 1, 2}, {0, 3, 1}, {0, 2, 3}, {1, 3, 2}};
+    break;
+
+    case SphereType::Octahedral:
+    p.corners = {{ 0,-1, 0}, { 1, 0, 0}, { 0, 0, 1}, {-1, 0, 0}, { 0, 1, 0}, { 0, 0,-1}};
+    p.faces = {{0, 1, 2}, {3, 0, 2}, {4, 3, 2}, {1, 4, 2},
+               {1, 0, 5}, {0, 3, 5}, {3, 4, 5}, {4, 1, 5}};
+    break;
+
+    case SphereType::Icosahedral:
+    {
+      float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+      p.corners = {{-1, t, 0}, { 1, t, 0}, {-1,-t, 0}, { 1,-t, 0},
+                   { 0,-1, t}, { 0, 1, t}, { 0,-1,-t}, { 0, 1,-t},
+                   { t, 0,-1}, { t, 0, 1}, {-t, 0,-1}, {-t, 0, 1}};
+      p.faces = {{0, 11,  5}, {0,  5,  1}, {0,  1,  7}, {0,  7, 10}, {0, 10, 11},
+                 {1,  5,  9}, {5, 11,  4}, {11, 10, 2}, {10, 7,  6}, {7,  1,  8},
+                 {3,  9,  4}, {3,  4,  2}, {3,  2,  6}, {3,  6,  8}, {3,  8,  9},
+                 {4,  9,  5}, {2,  4, 11}, {6,  2, 10}, {8,  6,  7}, {9,  8,  1}};
+      break;
+    }
+  }
+  return p;
+}
+
+//##################################################################################################
+Geometry3D emptySphere(int triangleFan, int triangleStrip, int triangles)
+{
+  Geometry3D geometry;
+  geometry.triangleFan   = triangleFan;
+  geometry.triangleStrip = triangleStrip;
+  geometry.triangles     = triangles;
+  geometry.indexes.emplace_back().type = geometry.triangles;
+  return geometry;
+}
+
+//##################################################################################################
+void projectToSphere(float radius, Geometry3D& geometry)
+{
+  for(auto& vert : geometry.verts)
+  {
+    vert.vert = glm::normalize(vert.vert);
+    vert.texture = {(vert.vert.x+1.0f)/2.0f, (-vert.vert.z+1.0f)/2.0f};
+    vert.vert *= radius;
+  }
+}
+}
+
+//##################################################################################################
+Geometry3D Sphere::icosahedralClass1(float radius,
+                                     size_t division,
+                                     int triangleFan,
+                                     int triangleStrip,
+                                     int triangles)
+{
+  return class1(SphereType::Icosahedral, radius, division, triangleFan, triangleStrip, triangles);
+}
 
 //##################################################################################################
 Geometry3D Sphere::octahedralClass1(float radius,
@@ -23,19 +92,7 @@ Geometry3D Sphere::octahedralClass1(float radius,
                                     int triangleStrip,
                                     int triangles)
 {
-  std::vector<glm::vec3> verts;
-
-  divideClass1(division, { 0,-1, 0}, { 1, 0, 0}, { 0, 0, 1}, verts);
-  divideClass1(division, {-1, 0, 0}, { 0,-1, 0}, { 0, 0, 1}, verts);
-  divideClass1(division, { 0, 1, 0}, {-1, 0, 0}, { 0, 0, 1}, verts);
-  divideClass1(division, { 1, 0, 0}, { 0, 1, 0}, { 0, 0, 1}, verts);
-
-  divideClass1(division, { 1, 0, 0}, { 0,-1, 0}, { 0, 0,-1}, verts);
-  divideClass1(division, { 0,-1, 0}, {-1, 0, 0}, { 0, 0,-1}, verts);
-  divideClass1(division, {-1, 0, 0}, { 0, 1, 0}, { 0, 0,-1}, verts);
-  divideClass1(division, { 0, 1, 0}, { 1, 0, 0}, { 0, 0,-1}, verts);
-
-  return indexAndScale(radius, triangleFan, triangleStrip, triangles, verts);
+  return class1(SphereType::Octahedral, radius, division, triangleFan, triangleStrip, triangles);
 }
 
 //##################################################################################################
@@ -45,14 +102,145 @@ Geometry3D Sphere::tetrahedralClass1(float radius,
                                      int triangleStrip,
                                      int triangles)
 {
-  std::vector<glm::vec3> verts;
+  return class1(SphereType::Tetrahedral, radius, division, triangleFan, triangleStrip, triangles);
+}
+
+//##################################################################################################
+Geometry3D Sphere::class1(SphereType type,
+                          float radius,
+                          size_t division,
+                          int triangleFan,
+                          int triangleStrip,
+                          int triangles)
+{
+  Geometry3D geometry = emptySphere(triangleFan, triangleStrip, triangles);
+  if(division==0)
+    return geometry;
+
+  const Polyhedron_lt p = polyhedron(type);
+  const size_t n = division;
+  const double step = 1.0 / double(n);
+
+  //-- Number the edges, each edge gets n-1 verts ordered from its lower corner --------------------
+  std::vector<std::pair<int, int>> edges;
+  for(const auto& face : p.faces)
+    for(size_t k=0; k<3; k++)
+      edges.emplace_back(tpMin(face[k], face[(k+1)%3]), tpMax(face[k], face[(k+1)%3]));
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  const size_t edgeBase = p.corners.size();
+  const size_t faceBase = edgeBase + edges.size()*(n-1);
+  const size_t faceInterior = (n>1)?((n-1)*(n-2)/2):0;
+
+  auto& verts = geometry.verts;
+  verts.resize(faceBase + p.faces.size()*faceInterior);
 
-  divideClass1(division, {-1,-1,-1}, { 1,-1, 1}, {-1, 1, 1}, verts);
-  divideClass1(division, {-1,-1,-1}, { 1, 1,-1}, { 1,-1, 1}, verts);
-  divideClass1(division, {-1,-1,-1}, {-1, 1, 1}, { 1, 1,-1}, verts);
-  divideClass1(division, { 1,-1, 1}, { 1, 1,-1}, {-1, 1, 1}, verts);
+  for(size_t c=0; c<p.corners.size(); c++)
+    verts[c].vert = p.corners[c];
 
-  return indexAndScale(radius, triangleFan, triangleStrip, triangles, verts);
+  for(size_t e=0; e<edges.size(); e++)
+  {
+    const auto& a = p.corners[size_t(edges[e].first)];
+    const auto& b = p.corners[size_t(edges[e].second)];
+    for(size_t k=1; k<n; k++)
+      verts[edgeBase + e*(n-1) + k-1].vert = glm::lerp(a, b, float(step*double(k)));
+  }
+
+  // The index of the k'th vert along the edge from u to v, k is in [0, n].
+  auto edgeVert = [&](int u, int v, size_t k)
+  {
+    if(k==0)
+      return int(u);
+    if(k==n)
+      return int(v);
+
+    size_t e = size_t(std::lower_bound(edges.begin(), edges.end(), std::make_pair(tpMin(u, v), tpMax(u, v))) - edges.begin());
+    return int(edgeBase + e*(n-1) + ((u<v)?k:(n-k)) - 1);
+  };
+
+  //-- Fill in each face, rows run from a towards bc in the same order as divideClass1 -------------
+  auto& indexes = geometry.indexes.front().indexes;
+  indexes.reserve(p.faces.size()*n*n*3);
+  std::vector<int> prev;
+  std::vector<int> next;
+  for(size_t f=0; f<p.faces.size(); f++)
+  {
+    const auto& face = p.faces[f];
+    const auto& a = p.corners[size_t(face[0])];
+    const auto& b = p.corners[size_t(face[1])];
+    const auto& c = p.corners[size_t(face[2])];
+    size_t interior = faceBase + f*faceInterior;
+
+    prev.assign(1, face[0]);
+    for(size_t i=1; i<=n; i++)
+    {
+      next.clear();
+      next.push_back(edgeVert(face[0], face[1], i));
+
+      if(i==n)
+      {
+        for(size_t j=1; j<n; j++)
+          next.push_back(edgeVert(face[1], face[2], j));
+      }
+      else
+      {
+        glm::vec3 bb = glm::lerp(a, b, float(step*double(i)));
+        glm::vec3 cc = glm::lerp(a, c, float(step*double(i)));
+        double stepJ = 1.0 / double(i);
+        for(size_t j=1; j<i; j++)
+        {
+          next.push_back(int(interior));
+          verts[interior++].vert = glm::lerp(bb, cc, float(stepJ*double(j)));
+        }
+      }
+
+      next.push_back(edgeVert(face[0], face[2], i));
+
+      for(size_t k=0; k<prev.size(); k++)
+        indexes.insert(indexes.end(), {prev[k], next[k], next[k+1]});
+
+      for(size_t k=1; k<prev.size(); k++)
+        indexes.insert(indexes.end(), {prev[k-1], next[k], prev[k]});
+
+      prev.swap(next);
+    }
+  }
+
+  // Take the normals from the unit positions, dividing by the radius would fail for a radius of 0.
+  projectToSphere(1.0f, geometry);
+  for(auto& vert : verts)
+  {
+    vert.normal = vert.vert;
+    vert.vert *= radius;
+  }
+
+  return geometry;
+}
+
+//##################################################################################################
+std::shared_ptr<const Geometry3D> Sphere::unitSphere(SphereType type,
+                                                     size_t division,
+                                                     int triangleFan,
+                                                     int triangleStrip,
+                                                     int triangles)
+{
+  typedef std::tuple<SphereType, size_t, int, int, int> Key;
+  static std::mutex mutex;
+  static std::map<Key, std::shared_ptr<const Geometry3D>> cache;
+
+  Key key{type, division, triangleFan, triangleStrip, triangles};
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(auto i = cache.find(key); i!=cache.end())
+      return i->second;
+  }
+
+  // Generate without holding the lock, if two threads race the first result is kept.
+  auto sphere = std::make_shared<const Geometry3D>(class1(type, 1.0f, division, triangleFan, triangleStrip, triangles));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return cache.emplace(key, sphere).first->second;
 }
 
 //##################################################################################################
@@ -110,29 +298,60 @@ Geometry3D Sphere::indexAndScale(float radius,
                                  int triangles,
                                  const std::vector<glm::vec3>& verts)
 {
-  Geometry3D geometry;
+  Geometry3D geometry = emptySphere(triangleFan, triangleStrip, triangles);
+  auto& indexes = geometry.indexes.back().indexes;
+  indexes.reserve(verts.size());
 
-  geometry.triangleFan   = triangleFan;
-  geometry.triangleStrip = triangleStrip;
-  geometry.triangles     = triangles;
+  // Verts are bucketed in a grid with cells the size of the tolerance so only the 27 neighbouring
+  // cells need to be searched. Each vert takes the earliest match, the same as a linear search.
+  const float e=0.000001f;
+  auto cellOf = [&](float v)
+  {
+    return int64_t(std::floor(double(v)/double(e)));
+  };
 
-  auto& indexes = geometry.indexes.emplace_back().indexes;
-  geometry.indexes.back().type = geometry.triangles;
+  auto cellHash = [](int64_t x, int64_t y, int64_t z)
+  {
+    uint64_t h = uint64_t(x) * 0x9E3779B97F4A7C15ull;
+    h ^= uint64_t(y) * 0xC2B2AE3D27D4EB4Full + (h<<6) + (h>>2);
+    h ^= uint64_t(z) * 0x165667B19E3779F9ull + (h<<6) + (h>>2);
+    return h;
+  };
 
-  float e=0.000001f;
+  std::unordered_map<uint64_t, std::vector<int>> cells;
+  cells.reserve(verts.size()/4);
   for(const auto& vert : verts)
   {
-    int index=-1;
+    int64_t x = cellOf(vert.x);
+    int64_t y = cellOf(vert.y);
+    int64_t z = cellOf(vert.z);
 
-    for(size_t i=0; i<geometry.verts.size(); i++)
+    int index=-1;
+    for(int64_t dx=-1; dx<=1; dx++)
     {
-      const auto& v = geometry.verts.at(i).vert;
-      if(std::fabs(v.x-vert.x)<e &&
-         std::fabs(v.y-vert.y)<e &&
-         std::fabs(v.z-vert.z)<e)
+      for(int64_t dy=-1; dy<=1; dy++)
       {
-        index = int(i);
-        break;
+        for(int64_t dz=-1; dz<=1; dz++)
+        {
+          auto c = cells.find(cellHash(x+dx, y+dy, z+dz));
+          if(c == cells.end())
+            continue;
+
+          for(int i : c->second)
+          {
+            if(index!=-1 && i>index)
+              break;
+
+            const auto& v = geometry.verts[size_t(i)].vert;
+            if(std::fabs(v.x-vert.x)<e &&
+               std::fabs(v.y-vert.y)<e &&
+               std::fabs(v.z-vert.z)<e)
+            {
+              index = i;
+              break;
+            }
+          }
+        }
       }
     }
 
@@ -140,18 +359,13 @@ Geometry3D Sphere::indexAndScale(float radius,
     {
       index = int(geometry.verts.size());
       geometry.verts.emplace_back().vert = vert;
+      cells[cellHash(x, y, z)].push_back(index);
     }
 
     indexes.push_back(index);
   }
 
-  for(auto& vert : geometry.verts)
-  {
-    vert.vert = glm::normalize(vert.vert);
-    vert.texture = {(vert.vert.x+1.0f)/2.0f, (-vert.vert.z+1.0f)/2.0f};
-    vert.vert *= radius;
-  }
-
+  projectToSphere(radius, geometry);
   return geometry;
 }
 
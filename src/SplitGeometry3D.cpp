@@ -0,0 +1,383 @@
+#include "tp_math_utils/SplitGeometry3D.h"
+#include "tp_math_utils/HashUtils.h"
+#include "tp_math_utils/ParallelFor.h"
+
+#include <array>
+#include <numeric>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+std::vector<std::array<int, 3>> validFaces(const Geometry3D& geometry)
+{
+  std::vector<std::array<int, 3>> faces;
+
+  const int nVerts = int(geometry.verts.size());
+  const bool validated = geometry.validated();
+  geometry.forEachTriangleIndexes([&](int i0, int i1, int i2)
+  {
+    if(validated || (i0>=0 && i1>=0 && i2>=0 && i0<nVerts && i1<nVerts && i2<nVerts))
+      faces.push_back({i0, i1, i2});
+  });
+
+  return faces;
+}
+
+//##################################################################################################
+Geometry3D emptyCopy(const Geometry3D& geometry)
+{
+  Geometry3D result;
+  result.comments      = geometry.comments;
+  result.triangleFan   = geometry.triangleFan;
+  result.triangleStrip = geometry.triangleStrip;
+  result.triangles     = geometry.triangles;
+  result.material      = geometry.material;
+  return result;
+}
+
+//##################################################################################################
+struct UnionFind_lt
+{
+  std::vector<int> parent;
+  std::vector<int> size;
+
+  //################################################################################################
+  UnionFind_lt(size_t n):
+    parent(n),
+    size(n, 1)
+  {
+    std::iota(parent.begin(), parent.end(), 0);
+  }
+
+  //################################################################################################
+  int find(int i)
+  {
+    while(parent[size_t(i)] != i)
+    {
+      int& p = parent[size_t(i)];
+      p = parent[size_t(p)];
+      i = p;
+    }
+    return i;
+  }
+
+  //################################################################################################
+  void join(int a, int b)
+  {
+    a = find(a);
+    b = find(b);
+    if(a==b)
+      return;
+
+    if(size[size_t(a)]<size[size_t(b)])
+      std::swap(a, b);
+
+    parent[size_t(b)] = a;
+    size[size_t(a)] += size[size_t(b)];
+  }
+};
+
+//##################################################################################################
+uint64_t spreadBits(uint64_t v)
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v <<  8) & 0x100f00f00f00f00full;
+  v = (v | v <<  4) & 0x10c30c30c30c30c3ull;
+  v = (v | v <<  2) & 0x1249249249249249ull;
+  return v;
+}
+
+//##################################################################################################
+uint64_t mortonCode(uint64_t x, uint64_t y, uint64_t z)
+{
+  return spreadBits(x) | (spreadBits(y)<<1) | (spreadBits(z)<<2);
+}
+
+//##################################################################################################
+struct Cell_lt
+{
+  size_t begin{0};
+  size_t end{0};
+  size_t depth{0};
+  uint64_t prefix{0};
+};
+}
+
+//##################################################################################################
+std::vector<Geometry3D> splitConnectedComponents(const Geometry3D& geometry, bool connectByPosition)
+{
+  std::vector<std::array<int, 3>> faces = validFaces(geometry);
+
+  UnionFind_lt unionFind(geometry.verts.size());
+
+  if(connectByPosition)
+  {
+    std::vector<int> order(geometry.verts.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    // Sort on the bits so that NaN positions still give a strict weak ordering, equal positions
+    // have equal keys. NaN positions are never equal so they are not joined.
+    auto key = [&](int i)
+    {
+      const glm::vec3& v = geometry.verts[size_t(i)].vert;
+      return std::array<uint32_t, 3>{floatBits(v.x), floatBits(v.y), floatBits(v.z)};
+    };
+
+    std::sort(order.begin(), order.end(), [&](int a, int b){return key(a) < key(b);});
+    for(size_t i=1; i<order.size(); i++)
+      if(geometry.verts[size_t(order[i])].vert == geometry.verts[size_t(order[i-1])].vert)
+        unionFind.join(order[i], order[i-1]);
+  }
+
+  for(const auto& face : faces)
+  {
+    unionFind.join(face[0], face[1]);
+    unionFind.join(face[0], face[2]);
+  }
+
+  // Number the components in the order that they are first used.
+  std::vector<int> componentOfRoot(geometry.verts.size(), -1);
+  std::vector<int> faceComponent(faces.size());
+  std::vector<size_t> componentFaceCount;
+  for(size_t f=0; f<faces.size(); f++)
+  {
+    int& c = componentOfRoot[size_t(unionFind.find(faces[f][0]))];
+    if(c<0)
+    {
+      c = int(componentFaceCount.size());
+      componentFaceCount.push_back(0);
+    }
+
+    faceComponent[f] = c;
+    componentFaceCount[size_t(c)]++;
+  }
+
+  // Bucket the faces by component.
+  std::vector<size_t> componentOffset(componentFaceCount.size()+1, 0);
+  for(size_t c=0; c<componentFaceCount.size(); c++)
+    componentOffset[c+1] = componentOffset[c] + componentFaceCount[c];
+
+  std::vector<size_t> sortedFaces(faces.size());
+  {
+    std::vector<size_t> insert(componentOffset.begin(), componentOffset.end()-1);
+    for(size_t f=0; f<faces.size(); f++)
+      sortedFaces[insert[size_t(faceComponent[f])]++] = f;
+  }
+
+  // Each vert belongs to exactly one component so the local index lookup can be shared.
+  std::vector<int> localIndex(geometry.verts.size(), -1);
+
+  std::vector<Geometry3D> results(componentFaceCount.size(), emptyCopy(geometry));
+  parallelFor(results.size(), [&](size_t c)
+  {
+    Geometry3D& result = results[c];
+    Indexes3D& part = result.indexes.emplace_back();
+    part.type = result.triangles;
+    part.indexes.reserve(componentFaceCount[c]*3);
+
+    for(size_t i=componentOffset[c]; i<componentOffset[c+1]; i++)
+    {
+      for(int v : faces[sortedFaces[i]])
+      {
+        int& l = localIndex[size_t(v)];
+        if(l<0)
+        {
+          l = int(result.verts.size());
+          result.verts.push_back(geometry.verts[size_t(v)]);
+        }
+        part.indexes.push_back(l);
+      }
+    }
+
+    result.validate();
+  });
+
+  return results;
+}
+
+//##################################################################################################
+std::vector<Geometry3DChunk> chunkGeometry3D(const Geometry3D& geometry, const Geometry3DChunkParams& params)
+{
+  std::vector<std::array<int, 3>> faces = validFaces(geometry);
+  if(faces.empty())
+    return {};
+
+  const size_t maxDepth = tpMin(params.maxDepth, size_t(21));
+  const size_t maxTriangles = tpMax(params.maxTriangles, size_t(1));
+
+  //-- Calculate the centroids and bounds ----------------------------------------------------------
+  std::vector<glm::vec3> centroids(faces.size());
+  glm::vec3 min;
+  float size=0.0f;
+  {
+    std::vector<std::pair<glm::vec3, glm::vec3>> blockMinMax(parallelThreadCount(faces.size(), 10000));
+    size_t nBlocks = parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t b)
+    {
+      glm::vec3 bMin{std::numeric_limits<float>::max()};
+      glm::vec3 bMax{-std::numeric_limits<float>::max()};
+      for(size_t f=begin; f<end; f++)
+      {
+        const auto& face = faces[f];
+        glm::vec3 c = (geometry.verts[size_t(face[0])].vert +
+                       geometry.verts[size_t(face[1])].vert +
+                       geometry.verts[size_t(face[2])].vert) / 3.0f;
+        centroids[f] = c;
+        bMin = glm::min(bMin, c);
+        bMax = glm::max(bMax, c);
+      }
+      blockMinMax[b] = {bMin, bMax};
+    });
+
+    min = blockMinMax[0].first;
+    glm::vec3 max = blockMinMax[0].second;
+    for(size_t b=1; b<nBlocks; b++)
+    {
+      min = glm::min(min, blockMinMax[b].first);
+      max = glm::max(max, blockMinMax[b].second);
+    }
+
+    glm::vec3 extent = max - min;
+    size = tpMax(tpMax(extent.x, extent.y), extent.z);
+    if(!(size>0.0f))
+      size = 1.0f;
+
+    // Make sure that max lands inside the last cell.
+    size *= 1.0001f;
+  }
+
+  //-- Sort the faces along a Morton curve ---------------------------------------------------------
+  const uint64_t gridSize = uint64_t(1)<<maxDepth;
+  std::vector<std::pair<uint64_t, size_t>> codes(faces.size());
+  parallelForBlocks(faces.size(), 10000, [&](size_t begin, size_t end, size_t)
+  {
+    float scale = float(gridSize) / size;
+    for(size_t f=begin; f<end; f++)
+    {
+      glm::vec3 p = (centroids[f] - min) * scale;
+      auto q = [&](float v){return uint64_t(tpMin(tpMax(v, 0.0f), float(gridSize-1)));};
+      codes[f] = {mortonCode(q(p.x), q(p.y), q(p.z)), f};
+    }
+  });
+
+  std::sort(codes.begin(), codes.end());
+
+  //-- Recursively split the cells that have too many triangles ------------------------------------
+  std::vector<Cell_lt> cells;
+  {
+    std::vector<Cell_lt> stack;
+    stack.push_back({0, codes.size(), 0, 0});
+    while(!stack.empty())
+    {
+      Cell_lt cell = tpTakeLast(stack);
+      if((cell.end-cell.begin)<=maxTriangles || cell.depth>=maxDepth)
+      {
+        cells.push_back(cell);
+        continue;
+      }
+
+      // The 3 bits that select the child at the next depth.
+      size_t shift = 3*(maxDepth-cell.depth-1);
+      size_t begin = cell.begin;
+      for(uint64_t child=0; child<8; child++)
+      {
+        uint64_t prefix = (cell.prefix<<3) | child;
+        uint64_t last = ((prefix+1)<<shift);
+        auto i = std::lower_bound(codes.begin()+std::ptrdiff_t(begin), codes.begin()+std::ptrdiff_t(cell.end), last, [](const auto& a, uint64_t b)
+        {
+          return a.first<b;
+        });
+
+        size_t end = size_t(i-codes.begin());
+        if(end>begin)
+          stack.push_back({begin, end, cell.depth+1, prefix});
+        begin = end;
+      }
+    }
+
+    std::sort(cells.begin(), cells.end(), [](const auto& a, const auto& b){return a.begin<b.begin;});
+  }
+
+  //-- Build the chunks ----------------------------------------------------------------------------
+  std::vector<Geometry3DChunk> chunks(cells.size());
+  const bool validated = geometry.validated();
+  parallelFor(chunks.size(), [&](size_t c)
+  {
+    const Cell_lt& cell = cells[c];
+    Geometry3DChunk& chunk = chunks[c];
+
+    chunk.depth = cell.depth;
+    {
+      uint64_t x=0, y=0, z=0;
+      for(size_t d=0; d<cell.depth; d++)
+      {
+        uint64_t bits = (cell.prefix >> (3*(cell.depth-d-1))) & 7;
+        x = (x<<1) | ( bits     & 1);
+        y = (y<<1) | ((bits>>1) & 1);
+        z = (z<<1) | ((bits>>2) & 1);
+      }
+      chunk.cell = glm::ivec3(int(x), int(y), int(z));
+
+      float cellSize = size / float(uint64_t(1)<<cell.depth);
+      chunk.min = min + glm::vec3(chunk.cell) * cellSize;
+      chunk.max = chunk.min + glm::vec3(cellSize);
+    }
+
+    chunk.vertexMap.reserve((cell.end-cell.begin)*3);
+    for(size_t i=cell.begin; i<cell.end; i++)
+      for(int v : faces[codes[i].second])
+        chunk.vertexMap.push_back(v);
+
+    std::sort(chunk.vertexMap.begin(), chunk.vertexMap.end());
+    chunk.vertexMap.erase(std::unique(chunk.vertexMap.begin(), chunk.vertexMap.end()), chunk.vertexMap.end());
+
+    chunk.geometry = emptyCopy(geometry);
+    chunk.geometry.verts.reserve(chunk.vertexMap.size());
+    for(int v : chunk.vertexMap)
+      chunk.geometry.verts.push_back(geometry.verts[size_t(v)]);
+
+    Indexes3D& part = chunk.geometry.indexes.emplace_back();
+    part.type = chunk.geometry.triangles;
+    part.indexes.reserve((cell.end-cell.begin)*3);
+
+    // Keep the triangles in their original order.
+    std::vector<size_t> cellFaces;
+    cellFaces.reserve(cell.end-cell.begin);
+    for(size_t i=cell.begin; i<cell.end; i++)
+      cellFaces.push_back(codes[i].second);
+    std::sort(cellFaces.begin(), cellFaces.end());
+
+    for(size_t f : cellFaces)
+      for(int v : faces[f])
+        part.indexes.push_back(int(std::lower_bound(chunk.vertexMap.begin(), chunk.vertexMap.end(), v) - chunk.vertexMap.begin()));
+
+    if(validated)
+      chunk.geometry.validate();
+  });
+
+  //-- Find verts used by more than one chunk ------------------------------------------------------
+  if(params.shareBoundaryVerts)
+  {
+    std::vector<uint8_t> useCount(geometry.verts.size(), 0);
+    for(const auto& chunk : chunks)
+      for(int v : chunk.vertexMap)
+        if(useCount[size_t(v)]<2)
+          useCount[size_t(v)]++;
+
+    parallelFor(chunks.size(), [&](size_t c)
+    {
+      Geometry3DChunk& chunk = chunks[c];
+      for(size_t i=0; i<chunk.vertexMap.size(); i++)
+        if(useCount[size_t(chunk.vertexMap[i])]>1)
+          chunk.sharedVerts.push_back(int(i));
+    });
+  }
+
+  return chunks;
+}
+
+}
@@ -0,0 +1,448 @@
+#include "tp_math_utils/ViewDependentSubdivision.h"
+#include "tp_math_utils/SubdivideGeometry3D.h"
+#include "tp_math_utils/ParallelFor.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tp_math_utils
+{
+
+namespace
+{
+//##################################################################################################
+//! A unique key for an octree cell, a leading 1 bit followed by the interleaved cell coordinates.
+uint64_t cellKey(size_t depth, const glm::ivec3& cell)
+{
+  uint64_t code=0;
+  for(size_t d=0; d<depth; d++)
+  {
+    size_t shift = depth-d-1;
+    code = (code<<3) |
+        ( uint64_t((cell.x>>shift) & 1)    ) |
+        ( uint64_t((cell.y>>shift) & 1)<<1 ) |
+        ( uint64_t((cell.z>>shift) & 1)<<2 );
+  }
+  return (uint64_t(1)<<(3*depth)) | code;
+}
+
+//##################################################################################################
+//! The cell that contains a cell, a number of levels up the tree.
+glm::ivec3 ancestorCell(const glm::ivec3& cell, size_t levels)
+{
+  int shift = int(levels);
+  return glm::ivec3(cell.x>>shift, cell.y>>shift, cell.z>>shift);
+}
+
+//##################################################################################################
+//! Convert a coordinate in the range [0, n) to a cell index, out of range values are clamped.
+int cellIndex(float f, int n)
+{
+  return (f>=0.0f)?int(tpMin(f, float(n-1))):0;
+}
+}
+
+//##################################################################################################
+ScreenSpaceEdgeLength::ScreenSpaceEdgeLength(const glm::mat4& vp_, const glm::vec2& viewportSize_):
+  vp(vp_),
+  viewportSize(viewportSize_)
+{
+
+}
+
+//##################################################################################################
+float ScreenSpaceEdgeLength::operator()(const glm::vec3& a, const glm::vec3& b) const
+{
+  glm::vec4 ca = vp * glm::vec4(a, 1.0f);
+  glm::vec4 cb = vp * glm::vec4(b, 1.0f);
+
+  // Clip against the near plane, the same plane that Frustum uses.
+  float da = ca.z + ca.w;
+  float db = cb.z + cb.w;
+  if(da<0.0f && db<0.0f)
+    return 0.0f;
+
+  if(da<0.0f)
+    ca = ca + (cb-ca)*(da/(da-db));
+  else if(db<0.0f)
+    cb = cb + (ca-cb)*(db/(db-da));
+
+  auto screen = [&](const glm::vec4& c)
+  {
+    return (glm::vec2(c) / tpMax(c.w, 0.000001f)) * 0.5f * viewportSize;
+  };
+
+  return glm::distance(screen(ca), screen(cb));
+}
+
+//##################################################################################################
+float ScreenSpaceEdgeLength::pixelsPerUnit(const glm::vec3& min, const glm::vec3& max) const
+{
+  glm::vec3 corners[8];
+  float distances[8];
+  for(int i=0; i<8; i++)
+  {
+    corners[i] = glm::vec3((i&1)?max.x:min.x, (i&2)?max.y:min.y, (i&4)?max.z:min.z);
+    glm::vec4 c = vp * glm::vec4(corners[i], 1.0f);
+    distances[i] = c.z + c.w;
+  }
+
+  float result=0.0f;
+  auto measure = [&](const glm::vec3& a, const glm::vec3& b)
+  {
+    float length = glm::distance(a, b);
+    if(length>0.0f)
+      result = tpMax(result, (*this)(a, b) / length);
+  };
+
+  // The projected size is largest along the edges nearest to the camera, measure all 12. Only the
+  // parts in front of the near plane are measured, the same as operator(), so that a box that
+  // reaches behind the camera is measured where it is cut by the near plane.
+  glm::vec3 crossings[12];
+  size_t nCrossings=0;
+  for(int i=0; i<8; i++)
+  {
+    for(int axis=1; axis<8; axis<<=1)
+    {
+      if(i&axis)
+        continue;
+
+      glm::vec3 a = corners[i];
+      glm::vec3 b = corners[i|axis];
+      float da = distances[i];
+      float db = distances[i|axis];
+      if(da<0.0f && db<0.0f)
+        continue;
+
+      if(da<0.0f)
+        crossings[nCrossings++] = a = a + (b-a)*(da/(da-db));
+      else if(db<0.0f)
+        crossings[nCrossings++] = b = b + (a-b)*(db/(db-da));
+
+      measure(a, b);
+    }
+  }
+
+  // Edges of the face where the near plane cuts the box.
+  for(size_t i=0; i<nCrossings; i++)
+    for(size_t j=i+1; j<nCrossings; j++)
+      measure(crossings[i], crossings[j]);
+
+  return result;
+}
+
+//##################################################################################################
+FrustumTriangleVisible::FrustumTriangleVisible(const glm::mat4& vp_, bool cullBackFaces_):
+  vp(vp_),
+  frustum(vp_),
+  cullBackFaces(cullBackFaces_)
+{
+
+}
+
+//##################################################################################################
+bool FrustumTriangleVisible::operator()(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) const
+{
+  if(!frustum.isBoxVisible(glm::min(glm::min(v0, v1), v2), glm::max(glm::max(v0, v1), v2)))
+    return false;
+
+  if(cullBackFaces)
+  {
+    glm::vec4 c0 = vp * glm::vec4(v0, 1.0f);
+    glm::vec4 c1 = vp * glm::vec4(v1, 1.0f);
+    glm::vec4 c2 = vp * glm::vec4(v2, 1.0f);
+
+    // Only cull triangles that are entirely in front of the camera, others can't be projected.
+    if(c0.w>0.0f && c1.w>0.0f && c2.w>0.0f)
+    {
+      glm::vec2 p0 = glm::vec2(c0) / c0.w;
+      glm::vec2 e1 = glm::vec2(c1) / c1.w - p0;
+      glm::vec2 e2 = glm::vec2(c2) / c2.w - p0;
+      if((e1.x*e2.y - e1.y*e2.x) < 0.0f)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+//##################################################################################################
+ViewDependentSubdivision::ViewDependentSubdivision(const Geometry3D& geometry,
+                                                   const ViewDependentSubdivisionParams& params):
+  m_params(params)
+{
+  m_header.comments      = geometry.comments;
+  m_header.triangleFan   = geometry.triangleFan;
+  m_header.triangleStrip = geometry.triangleStrip;
+  m_header.triangles     = geometry.triangles;
+  m_header.material      = geometry.material;
+
+  m_chunks = chunkGeometry3D(geometry, params.chunkParams);
+  m_results.resize(m_chunks.size(), m_header);
+  m_chunkCells.resize(m_chunks.size());
+  if(m_chunks.empty())
+    return;
+
+  //-- Recover the cube that the chunks were cut from ----------------------------------------------
+  {
+    const auto& chunk = m_chunks.front();
+    float cellSize = chunk.max.x - chunk.min.x;
+    m_rootSize = cellSize * float(uint64_t(1)<<chunk.depth);
+    m_rootMin = chunk.min - glm::vec3(chunk.cell)*cellSize;
+
+    for(const auto& c : m_chunks)
+      m_maxDepth = tpMax(m_maxDepth, c.depth);
+  }
+
+  //-- Find how far edges can reach outside of the cell that holds one of their ends ---------------
+  {
+    std::vector<float> longest(m_chunks.size(), 0.0f);
+    parallelFor(m_chunks.size(), [&](size_t c)
+    {
+      const auto& g = m_chunks[c].geometry;
+      float l2=0.0f;
+      g.forEachTriangleIndexes([&](int i0, int i1, int i2)
+      {
+        const auto& p0 = g.verts[size_t(i0)].vert;
+        const auto& p1 = g.verts[size_t(i1)].vert;
+        const auto& p2 = g.verts[size_t(i2)].vert;
+        l2 = tpMax(l2, tpMax(glm::distance2(p0, p1), tpMax(glm::distance2(p1, p2), glm::distance2(p2, p0))));
+      });
+      longest[c] = l2;
+    });
+
+    m_margin = std::sqrt(*std::max_element(longest.begin(), longest.end()));
+  }
+
+  //-- Build the leaf cells, the chunks plus the empty cells next to them --------------------------
+  {
+    auto addCell = [&](size_t depth, const glm::ivec3& cell)
+    {
+      float size = m_rootSize / float(uint64_t(1)<<depth);
+      auto& c = m_cells.emplace_back();
+      c.depth = depth;
+      c.cell = cell;
+      c.min = m_rootMin + glm::vec3(cell)*size;
+      c.max = c.min + glm::vec3(size);
+      m_cellLookup.emplace(cellKey(depth, cell), m_cells.size()-1);
+    };
+
+    std::vector<uint64_t> internal;
+    for(const auto& chunk : m_chunks)
+    {
+      addCell(chunk.depth, chunk.cell);
+      for(size_t d=0; d<chunk.depth; d++)
+        internal.push_back(cellKey(d, ancestorCell(chunk.cell, chunk.depth-d)));
+    }
+    std::sort(internal.begin(), internal.end());
+    internal.erase(std::unique(internal.begin(), internal.end()), internal.end());
+
+    auto isInternal = [&](uint64_t key)
+    {
+      return std::binary_search(internal.begin(), internal.end(), key);
+    };
+
+    // The siblings of every chunk and internal cell that are neither are empty leaves.
+    auto addSiblings = [&](size_t depth, const glm::ivec3& cell)
+    {
+      if(depth==0)
+        return;
+
+      glm::ivec3 parent = ancestorCell(cell, 1);
+      for(int i=0; i<8; i++)
+      {
+        glm::ivec3 sibling = parent*2 + glm::ivec3(i&1, (i>>1)&1, (i>>2)&1);
+        uint64_t key = cellKey(depth, sibling);
+        if(!isInternal(key) && m_cellLookup.find(key)==m_cellLookup.end())
+          addCell(depth, sibling);
+      }
+    };
+
+    for(const auto& chunk : m_chunks)
+      for(size_t d=1; d<=chunk.depth; d++)
+        addSiblings(d, ancestorCell(chunk.cell, chunk.depth-d));
+  }
+
+  //-- Find the cells that each chunk depends on ---------------------------------------------------
+  parallelFor(m_chunks.size(), [&](size_t c)
+  {
+    const auto& verts = m_chunks[c].geometry.verts;
+    if(verts.empty())
+      return;
+
+    // Points outside the cube are clamped into it, so clamping the bounds finds the same cells.
+    glm::vec3 min = verts.front().vert;
+    glm::vec3 max = min;
+    for(const auto& vert : verts)
+    {
+      min = glm::min(min, vert.vert);
+      max = glm::max(max, vert.vert);
+    }
+
+    glm::vec3 epsilon(m_rootSize*0.00001f);
+    glm::vec3 rootMax = m_rootMin + glm::vec3(m_rootSize);
+    min = glm::min(glm::max(min, m_rootMin), rootMax) - epsilon;
+    max = glm::min(glm::max(max, m_rootMin), rootMax) + epsilon;
+
+    auto& cells = m_chunkCells[c];
+    std::vector<std::pair<size_t, glm::ivec3>> stack;
+    stack.emplace_back(0, glm::ivec3(0, 0, 0));
+    while(!stack.empty())
+    {
+      auto [depth, cell] = tpTakeLast(stack);
+
+      float size = m_rootSize / float(uint64_t(1)<<depth);
+      glm::vec3 cellMin = m_rootMin + glm::vec3(cell)*size;
+      glm::vec3 cellMax = cellMin + glm::vec3(size);
+      if(cellMin.x>max.x || cellMin.y>max.y || cellMin.z>max.z ||
+         cellMax.x<min.x || cellMax.y<min.y || cellMax.z<min.z)
+        continue;
+
+      if(auto i = m_cellLookup.find(cellKey(depth, cell)); i!=m_cellLookup.end())
+      {
+        cells.push_back(i->second);
+        continue;
+      }
+
+      if(depth<m_maxDepth)
+        for(int i=0; i<8; i++)
+          stack.emplace_back(depth+1, cell*2 + glm::ivec3(i&1, (i>>1)&1, (i>>2)&1));
+    }
+  });
+}
+
+//##################################################################################################
+size_t ViewDependentSubdivision::update(const glm::mat4& vp, const glm::vec2& viewportSize)
+{
+  ScreenSpaceEdgeLength screen(vp, viewportSize);
+  Frustum frustum(vp);
+
+  std::vector<uint8_t> changed(m_cells.size(), 0);
+  parallelFor(m_cells.size(), [&](size_t i)
+  {
+    Cell_lt& cell = m_cells[i];
+
+    // Edges with an end in this cell can reach a margin outside of it.
+    glm::vec3 min = cell.min - glm::vec3(m_margin);
+    glm::vec3 max = cell.max + glm::vec3(m_margin);
+
+    int level=-1;
+    if(frustum.isBoxVisible(min, max))
+    {
+      float target = m_params.pixelLength / screen.pixelsPerUnit(min, max);
+      float l = std::ceil(std::log2(m_rootSize / target));
+      level = (l>=float(m_params.maxLevel) || std::isnan(l))?int(m_params.maxLevel):int(tpMax(l, 0.0f));
+    }
+
+    if(level != cell.level)
+    {
+      cell.level = level;
+      cell.scale = (level<0)?0.0f:std::ldexp(1.0f, level) / m_rootSize;
+      changed[i] = 1;
+    }
+  });
+
+  m_changedChunks.clear();
+  for(size_t c=0; c<m_chunks.size(); c++)
+  {
+    for(size_t cell : m_chunkCells[c])
+    {
+      if(changed[cell])
+      {
+        m_changedChunks.push_back(c);
+        break;
+      }
+    }
+  }
+
+  parallelFor(m_changedChunks.size(), [&](size_t i)
+  {
+    rebuild(m_changedChunks[i]);
+  });
+
+  return m_changedChunks.size();
+}
+
+//##################################################################################################
+size_t ViewDependentSubdivision::chunkCount() const
+{
+  return m_chunks.size();
+}
+
+//##################################################################################################
+const Geometry3D& ViewDependentSubdivision::chunkGeometry(size_t chunk) const
+{
+  return m_results.at(chunk);
+}
+
+//##################################################################################################
+const Geometry3DChunk& ViewDependentSubdivision::sourceChunk(size_t chunk) const
+{
+  return m_chunks.at(chunk);
+}
+
+//##################################################################################################
+const std::vector<size_t>& ViewDependentSubdivision::changedChunks() const
+{
+  return m_changedChunks;
+}
+
+//##################################################################################################
+Geometry3D ViewDependentSubdivision::geometry() const
+{
+  Geometry3D result = m_header;
+  for(const auto& chunk : m_results)
+    result.add(chunk);
+  return result;
+}
+
+//##################################################################################################
+size_t ViewDependentSubdivision::cellAt(const glm::vec3& p) const
+{
+  glm::vec3 q = (p - m_rootMin) / m_rootSize;
+  for(size_t d=0; d<=m_maxDepth; d++)
+  {
+    int n = int(uint64_t(1)<<d);
+    glm::ivec3 cell(cellIndex(q.x*float(n), n), cellIndex(q.y*float(n), n), cellIndex(q.z*float(n), n));
+    if(auto i = m_cellLookup.find(cellKey(d, cell)); i!=m_cellLookup.end())
+      return i->second;
+  }
+
+  // The leaves cover the whole cube so this should not happen.
+  return 0;
+}
+
+//##################################################################################################
+float ViewDependentSubdivision::scaleAt(const glm::vec3& p) const
+{
+  return m_cells[cellAt(p)].scale;
+}
+
+//##################################################################################################
+void ViewDependentSubdivision::rebuild(size_t chunk)
+{
+  Geometry3D& result = m_results[chunk];
+  result = m_chunks[chunk].geometry;
+
+  // Visibility is part of the cell levels so that both sides of a shared edge agree on it.
+  auto visible = [](const glm::vec3&, const glm::vec3&, const glm::vec3&)
+  {
+    return true;
+  };
+
+  // Using the coarser end keeps a thin triangle from being split forever through its edges in a
+  // finer cell, which would leave a shared edge that this chunk never splits.
+  auto length = [this](const glm::vec3& a, const glm::vec3& b)
+  {
+    return glm::distance(a, b) * tpMin(scaleAt(a), scaleAt(b));
+  };
+
+  SubdivideGeometry3D<decltype(visible), decltype(length)> subdivide(&result, visible, length, 1.0f);
+
+  SubdivideBudget budget;
+  budget.maxTriangles = m_params.maxTriangles;
+  subdivide.divideFor(budget);
+  subdivide.finalize();
+}
+
+}
@@ -6,6 +6,15 @@ DEFINES += TP_MATH_UTILS_LIBRARY
 SOURCES += src/Globals.cpp
 HEADERS += inc/tp_math_utils/Globals.h
 
+SOURCES += src/ScratchArena.cpp
+HEADERS += inc/tp_math_utils/ScratchArena.h
+
+SOURCES += src/ParallelFor.cpp
+HEADERS += inc/tp_math_utils/ParallelFor.h
+
+#SOURCES += src/HashUtils.cpp
+HEADERS += inc/tp_math_utils/HashUtils.h
+
 #SOURCES += src/JSONUtils.cpp
 HEADERS += inc/tp_math_utils/JSONUtils.h
 
@@ -15,6 +24,12 @@ HEADERS += inc/tp_math_utils/Plane.h
 SOURCES += src/DistanceToPlane.cpp
 HEADERS += inc/tp_math_utils/DistanceToPlane.h
 
+SOURCES += src/PlaneDetection.cpp
+HEADERS += inc/tp_math_utils/PlaneDetection.h
+
+SOURCES += src/Heightfield.cpp
+HEADERS += inc/tp_math_utils/Heightfield.h
+
 SOURCES += src/DistanceToRay.cpp
 HEADERS += inc/tp_math_utils/DistanceToRay.h
 
@@ -24,6 +39,9 @@ HEADERS += inc/tp_math_utils/DistanceBetweenLines.h
 SOURCES += src/DistanceBetweenCones.cpp
 HEADERS += inc/tp_math_utils/DistanceBetweenCones.h
 
+SOURCES += src/ConeProximity.cpp
+HEADERS += inc/tp_math_utils/ConeProximity.h
+
 #SOURCES += src/Ray.cpp
 HEADERS += inc/tp_math_utils/Ray.h
 
@@ -36,6 +54,9 @@ HEADERS += inc/tp_math_utils/Region.h
 SOURCES += src/Intersection.cpp
 HEADERS += inc/tp_math_utils/Intersection.h
 
+#SOURCES += src/RayKernels.cpp
+HEADERS += inc/tp_math_utils/RayKernels.h
+
 SOURCES += src/Transformation.cpp
 HEADERS += inc/tp_math_utils/Transformation.h
 
@@ -66,9 +87,42 @@ HEADERS += inc/tp_math_utils/LightAnimation.h
 SOURCES += src/Geometry3D.cpp
 HEADERS += inc/tp_math_utils/Geometry3D.h
 
+SOURCES += src/Geometry3DStats.cpp
+HEADERS += inc/tp_math_utils/Geometry3DStats.h
+
+SOURCES += src/Geometry3DDigest.cpp
+HEADERS += inc/tp_math_utils/Geometry3DDigest.h
+
+SOURCES += src/DerivedDataCache.cpp
+HEADERS += inc/tp_math_utils/DerivedDataCache.h
+
+SOURCES += src/Geometry3DTopology.cpp
+HEADERS += inc/tp_math_utils/Geometry3DTopology.h
+
+SOURCES += src/Geometry3DPipeline.cpp
+HEADERS += inc/tp_math_utils/Geometry3DPipeline.h
+
+SOURCES += src/Geometry3DBatch.cpp
+HEADERS += inc/tp_math_utils/Geometry3DBatch.h
+
+SOURCES += src/SplitGeometry3D.cpp
+HEADERS += inc/tp_math_utils/SplitGeometry3D.h
+
+SOURCES += src/SliceGeometry3D.cpp
+HEADERS += inc/tp_math_utils/SliceGeometry3D.h
+
+SOURCES += src/InstancedGeometry3D.cpp
+HEADERS += inc/tp_math_utils/InstancedGeometry3D.h
+
 #SOURCES += src/SubdivideGeometry3D.cpp
 HEADERS += inc/tp_math_utils/SubdivideGeometry3D.h
 
+SOURCES += src/LoopSubdivision.cpp
+HEADERS += inc/tp_math_utils/LoopSubdivision.h
+
+SOURCES += src/ViewDependentSubdivision.cpp
+HEADERS += inc/tp_math_utils/ViewDependentSubdivision.h
+
 SOURCES += src/ClosestPointsOnLines.cpp
 HEADERS += inc/tp_math_utils/ClosestPointsOnLines.h
 
@@ -90,6 +144,9 @@ HEADERS += inc/tp_math_utils/BoxPacker.h
 SOURCES += src/Sphere.cpp
 HEADERS += inc/tp_math_utils/Sphere.h
 
+SOURCES += src/Primitives.cpp
+HEADERS += inc/tp_math_utils/Primitives.h
+
 SOURCES += src/Frustum.cpp
 HEADERS += inc/tp_math_utils/Frustum.h
 